@@ -0,0 +1,1056 @@
+#ifndef LOOPBACK_SERVER_H
+#define LOOPBACK_SERVER_H
+
+/**
+ * A small HTTP/1.1 server on 127.0.0.1 for benchmarks, it never touches the network.
+ * Every connection is served by its own thread with blocking sockets, so this header requires a POSIX system.
+ *
+ * Request targets:
+ *  - `/`               Body of the default size
+ *  - `/chunked`        Body sent with `Transfer-Encoding: chunked`
+ *  - `/echo`           The request body is sent back as the response body
+ *  - `?size=N`         Body of N bytes
+ *  - `?delay=N`        Wait N milliseconds before responding
+ *  - `?close=1`        Close the connection after the response
+ *  - `?drop=N`         Close the connection once a body that starts before offset N reaches it, not chunked
+ *  - `?norange=1`      Ignore `Range` and answer with the whole body, `HEAD` still advertises ranges
+ *  - `?etag=N`         Send `ETag: "N"` and `X-Request` with the request count, answer `If-None-Match: "N"` with 304
+ *  - `?max_age=N`      Send `Cache-Control: max-age=N`
+ *  - `?deflate=1`      Send the whole body with `Content-Encoding: deflate` and `Vary: Accept-Encoding`, not chunked
+ *  - `?vary=1`         Send `Vary: Cookie`
+ *  - `?fail=N&id=K`    Answer the first N requests that carry the id K with 503 and the usual body
+ *
+ * Keep-alive is the default, single `Range: bytes=a-b` requests are answered with 206.
+ * Request bodies may be chunked, `Expect: 100-continue` is answered right away.
+ * The body byte at offset i is always `'a' + i % 26`, so ranges can be checked.
+ *
+ * Connections that start with the HTTP/2 preface, or send `Upgrade: h2c`, are served as h2c.
+ * The HTTP/2 request headers are not decoded, so every stream but the upgraded request gets
+ * the default body and latency. The streams of a connection are answered concurrently.
+ */
+
+#ifndef _INC_STDIO
+#include <stdio.h>
+#endif
+
+#ifndef _INC_STDLIB
+#include <stdlib.h>
+#endif
+
+#ifndef _INC_STRING
+#include <string.h>
+#endif
+
+#include <errno.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <strings.h>
+#include <time.h>
+#include <unistd.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <poll.h>
+#include <sys/socket.h>
+
+#define LOOPBACK_SERVER_REQUEST_SIZE 8192
+#define LOOPBACK_SERVER_CHUNK_SIZE 65536
+#define LOOPBACK_SERVER_PATTERN_PERIOD 26
+#define LOOPBACK_SERVER_DEFLATE_BLOCK_SIZE 65535
+#define LOOPBACK_SERVER_MAX_IDS 64
+
+#define LOOPBACK_SERVER_H2_PREFACE_SIZE 24
+#define LOOPBACK_SERVER_H2_FRAME_SIZE 16384
+#define LOOPBACK_SERVER_H2_WINDOW 65535
+#define LOOPBACK_SERVER_H2_MAX_STREAMS 1024
+
+/**
+ * Options for `loopback_server_start`, the query of a request overrides them.
+ */
+typedef struct LoopbackServerOptions {
+    size_t body_size; // Default body size in bytes
+    long latency_ms;  // Default delay before every response
+    int chunked;      // Send every body with chunked encoding
+} LoopbackServerOptions;
+
+typedef struct LoopbackServer {
+    int listen_fd;
+    unsigned short port;
+    pthread_t thread;
+    LoopbackServerOptions options;
+    atomic_size_t connections, requests;
+    atomic_size_t failures[LOOPBACK_SERVER_MAX_IDS]; // Requests answered with `?fail` per `id`
+} LoopbackServer;
+
+#pragma region Internals
+
+/**
+ * The body pattern, long enough to send a full chunk from any offset in the period.
+ */
+static char loopback_server_internal_pattern[LOOPBACK_SERVER_CHUNK_SIZE + LOOPBACK_SERVER_PATTERN_PERIOD];
+
+typedef struct LoopbackServerInternalConnection {
+    LoopbackServer *server;
+    int fd;
+} LoopbackServerInternalConnection;
+
+/**
+ * A parsed request.
+ */
+typedef struct LoopbackServerInternalRequest {
+    int head;                         // HEAD request, no body
+    int chunked;                      // Send the body chunked
+    int close;                        // Close the connection after the response
+    size_t size;                      // Body size
+    long delay_ms;                    // Delay before the response
+    int has_range;                    // A `Range` header was sent
+    long long range_start, range_end; // Inclusive, -1 = open
+    size_t content_length;            // Length of the request body
+    int chunked_body;                 // The request body is chunked
+    int expect_continue;              // `Expect: 100-continue`
+    int echo;                         // Send the request body back
+    char *body;                       // Received request body of `/echo`
+    size_t body_len;
+    int upgrade;                      // `Upgrade: h2c`, the connection switches to HTTP/2
+    long long drop;                   // Body offset at which the connection is closed, -1 = never
+    int norange;                      // Ignore the `Range` header
+    long long etag;                   // Entity tag, -1 = none
+    long long max_age;                // `Cache-Control: max-age`, -1 = none
+    int deflate;                      // Send the body zlib-wrapped in stored deflate blocks
+    int vary;                         // Send `Vary: Cookie`
+    int not_modified;                 // `If-None-Match` matched the entity tag
+    size_t number;                    // Count of the server's requests including this one
+    int fail;                         // Answer with 503
+} LoopbackServerInternalRequest;
+
+/**
+ * Send all of `data`.
+ * @return 0 on success, -1 if the connection is gone
+ */
+int loopback_server_internal_send(int fd, const char *data, size_t length) {
+    while (length > 0) {
+        ssize_t sent = send(fd, data, length, MSG_NOSIGNAL);
+        if (sent < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return -1;
+        }
+        data += sent;
+        length -= (size_t)sent;
+    }
+    return 0;
+}
+
+/**
+ * Send `length` bytes of the body pattern starting at body offset `offset`.
+ * @return 0 on success, -1 if the connection is gone
+ */
+int loopback_server_internal_send_body(int fd, size_t offset, size_t length, int chunked) {
+    char chunk_header[32];
+    while (length > 0) {
+        size_t n = length < LOOPBACK_SERVER_CHUNK_SIZE ? length : LOOPBACK_SERVER_CHUNK_SIZE;
+        const char *data = loopback_server_internal_pattern + offset % LOOPBACK_SERVER_PATTERN_PERIOD;
+        if (chunked) {
+            int header_length = snprintf(chunk_header, sizeof(chunk_header), "%zx\r\n", n);
+            if (loopback_server_internal_send(fd, chunk_header, (size_t)header_length) != 0
+                || loopback_server_internal_send(fd, data, n) != 0
+                || loopback_server_internal_send(fd, "\r\n", 2) != 0) {
+                return -1;
+            }
+        }
+        else if (loopback_server_internal_send(fd, data, n) != 0) {
+            return -1;
+        }
+        offset += n;
+        length -= n;
+    }
+    return chunked ? loopback_server_internal_send(fd, "0\r\n\r\n", 5) : 0;
+}
+
+/**
+ * Send the first `length` body bytes as a zlib stream of uncompressed deflate blocks.
+ * @return 0 on success, -1 if the connection is gone
+ */
+int loopback_server_internal_send_deflate(int fd, size_t length) {
+    uint32_t a = 1, b = 0;
+    size_t offset = 0;
+    if (loopback_server_internal_send(fd, "\x78\x01", 2) != 0) {
+        return -1;
+    }
+    do {
+        size_t n = length - offset < LOOPBACK_SERVER_DEFLATE_BLOCK_SIZE ? length - offset : LOOPBACK_SERVER_DEFLATE_BLOCK_SIZE;
+        const char *data = loopback_server_internal_pattern + offset % LOOPBACK_SERVER_PATTERN_PERIOD;
+        unsigned char block_header[5] = {offset + n == length, n & 0xff, n >> 8, ~n & 0xff, (~n >> 8) & 0xff};
+        if (loopback_server_internal_send(fd, (const char *)block_header, 5) != 0 || loopback_server_internal_send(fd, data, n) != 0) {
+            return -1;
+        }
+        for (size_t i = 0; i < n; i += 1) {
+            a = (a + (unsigned char)data[i]) % 65521;
+            b = (b + a) % 65521;
+        }
+        offset += n;
+    } while (offset < length);
+    uint32_t adler = b << 16 | a;
+    unsigned char trailer[4] = {adler >> 24, (adler >> 16) & 0xff, (adler >> 8) & 0xff, adler & 0xff};
+    return loopback_server_internal_send(fd, (const char *)trailer, 4);
+}
+
+/**
+ * Find a header in the request head, case-insensitive.
+ * @return Pointer to the value or `NULL`
+ */
+const char *loopback_server_internal_header(const char *head, const char *name) {
+    size_t length = strlen(name);
+    for (const char *line = strstr(head, "\r\n"); line != NULL; line = strstr(line + 2, "\r\n")) {
+        if (strncasecmp(line + 2, name, length) == 0 && line[2 + length] == ':') {
+            const char *value = line + 3 + length;
+            while (*value == ' ') {
+                value += 1;
+            }
+            return value;
+        }
+    }
+    return NULL;
+}
+
+/**
+ * Read a numeric query parameter from the request target.
+ * @return 1 if the parameter was found, else 0
+ */
+int loopback_server_internal_query(const char *target, const char *target_end, const char *name, long long *value) {
+    size_t length = strlen(name);
+    const char *c = memchr(target, '?', (size_t)(target_end - target));
+    while (c != NULL && c < target_end) {
+        c += 1;
+        if ((size_t)(target_end - c) > length && strncmp(c, name, length) == 0 && c[length] == '=') {
+            *value = strtoll(c + length + 1, NULL, 10);
+            return 1;
+        }
+        c = memchr(c, '&', (size_t)(target_end - c));
+    }
+    return 0;
+}
+
+/**
+ * Parse a request head, which ends with an empty line and is null terminated.
+ */
+void loopback_server_internal_parse(LoopbackServer *server, const char *head, LoopbackServerInternalRequest *request) {
+    *request = (LoopbackServerInternalRequest) {
+        .size = server->options.body_size,
+        .delay_ms = server->options.latency_ms,
+        .chunked = server->options.chunked,
+        .range_start = -1,
+        .range_end = -1,
+        .drop = -1,
+        .etag = -1,
+        .max_age = -1,
+    };
+    request->head = strncmp(head, "HEAD ", 5) == 0;
+    const char *target = strchr(head, ' ');
+    target = target != NULL ? target + 1 : head;
+    const char *target_end = strchr(target, ' ');
+    if (target_end == NULL) {
+        target_end = target + strlen(target);
+    }
+
+    long long value;
+    if (strncmp(target, "/chunked", 8) == 0) {
+        request->chunked = 1;
+    }
+    if (strncmp(target, "/echo", 5) == 0) {
+        request->echo = 1;
+    }
+    if (loopback_server_internal_query(target, target_end, "size", &value) && value >= 0) {
+        request->size = (size_t)value;
+    }
+    if (loopback_server_internal_query(target, target_end, "delay", &value) && value >= 0) {
+        request->delay_ms = (long)value;
+    }
+    if (loopback_server_internal_query(target, target_end, "close", &value)) {
+        request->close = value != 0;
+    }
+    if (loopback_server_internal_query(target, target_end, "drop", &value) && value >= 0) {
+        request->drop = value;
+        request->chunked = 0;
+    }
+    if (loopback_server_internal_query(target, target_end, "norange", &value)) {
+        request->norange = value != 0;
+    }
+    if (loopback_server_internal_query(target, target_end, "etag", &value) && value >= 0) {
+        request->etag = value;
+    }
+    if (loopback_server_internal_query(target, target_end, "max_age", &value) && value >= 0) {
+        request->max_age = value;
+    }
+    if (loopback_server_internal_query(target, target_end, "deflate", &value)) {
+        request->deflate = value != 0;
+        request->chunked = 0;
+    }
+    if (loopback_server_internal_query(target, target_end, "vary", &value)) {
+        request->vary = value != 0;
+    }
+    if (loopback_server_internal_query(target, target_end, "fail", &value) && value > 0) {
+        long long id = 0;
+        loopback_server_internal_query(target, target_end, "id", &id);
+        atomic_size_t *failures = &server->failures[(size_t)id % LOOPBACK_SERVER_MAX_IDS];
+        request->fail = atomic_fetch_add(failures, 1) < (size_t)value;
+    }
+
+    const char *header = loopback_server_internal_header(head, "Connection");
+    if (header != NULL && strncasecmp(header, "close", 5) == 0) {
+        request->close = 1;
+    }
+    if (strstr(head, "HTTP/1.0\r\n") != NULL && (header == NULL || strncasecmp(header, "keep-alive", 10) != 0)) {
+        request->close = 1;
+    }
+    header = loopback_server_internal_header(head, "Content-Length");
+    if (header != NULL) {
+        request->content_length = (size_t)strtoull(header, NULL, 10);
+    }
+    header = loopback_server_internal_header(head, "Transfer-Encoding");
+    if (header != NULL && strncasecmp(header, "chunked", 7) == 0) {
+        request->chunked_body = 1;
+    }
+    header = loopback_server_internal_header(head, "Expect");
+    if (header != NULL && strncasecmp(header, "100-continue", 12) == 0) {
+        request->expect_continue = 1;
+    }
+    header = loopback_server_internal_header(head, "Upgrade");
+    if (header != NULL && strncasecmp(header, "h2c", 3) == 0 && !request->head && request->content_length == 0 && !request->chunked_body) {
+        request->upgrade = 1;
+    }
+    header = loopback_server_internal_header(head, "If-None-Match");
+    if (header != NULL && request->etag >= 0) {
+        char etag[32];
+        int etag_length = snprintf(etag, sizeof(etag), "\"%lld\"", request->etag);
+        request->not_modified = strncmp(header, etag, (size_t)etag_length) == 0;
+    }
+    header = loopback_server_internal_header(head, "Range");
+    if (header != NULL && !request->norange && strncmp(header, "bytes=", 6) == 0 && memchr(header, ',', strcspn(header, "\r")) == NULL) {
+        const char *dash = strchr(header + 6, '-');
+        if (dash != NULL) {
+            request->has_range = 1;
+            if (dash != header + 6) {
+                request->range_start = strtoll(header + 6, NULL, 10);
+            }
+            if (dash[1] >= '0' && dash[1] <= '9') {
+                request->range_end = strtoll(dash + 1, NULL, 10);
+            }
+        }
+    }
+}
+
+/**
+ * Send the response of a parsed request.
+ * @return 0 on success, -1 if the connection is gone
+ */
+int loopback_server_internal_respond(int fd, LoopbackServerInternalRequest *request) {
+    char head[512];
+    size_t offset = 0, length = request->size;
+    const char *status = "200 OK";
+    char content_range[128] = "";
+    char caching[192] = "";
+
+    if (request->etag >= 0) {
+        snprintf(caching, sizeof(caching), "ETag: \"%lld\"\r\nX-Request: %zu\r\n", request->etag, request->number);
+    }
+    if (request->max_age >= 0) {
+        size_t caching_length = strlen(caching);
+        snprintf(caching + caching_length, sizeof(caching) - caching_length, "Cache-Control: max-age=%lld\r\n", request->max_age);
+    }
+    if (request->vary) {
+        size_t caching_length = strlen(caching);
+        snprintf(caching + caching_length, sizeof(caching) - caching_length, "Vary: Cookie\r\n");
+    }
+    if (request->not_modified) {
+        int head_length = snprintf(head, sizeof(head), "HTTP/1.1 304 Not Modified\r\n%s%s\r\n",
+            caching, request->close ? "Connection: close\r\n" : "");
+        return loopback_server_internal_send(fd, head, (size_t)head_length);
+    }
+
+    if (request->echo) {
+        int head_length = snprintf(head, sizeof(head),
+            "HTTP/1.1 200 OK\r\nContent-Type: application/octet-stream\r\nContent-Length: %zu\r\n%s\r\n",
+            request->body_len, request->close ? "Connection: close\r\n" : "");
+        if (loopback_server_internal_send(fd, head, (size_t)head_length) != 0) {
+            return -1;
+        }
+        return request->head ? 0 : loopback_server_internal_send(fd, request->body, request->body_len);
+    }
+    if (request->fail) {
+        status = "503 Service Unavailable";
+        request->has_range = 0;
+    }
+    if (request->deflate) {
+        // Stored blocks of up to 65535 bytes with a 5 byte header each, in a 2 byte zlib header and 4 byte checksum
+        size_t blocks = request->size == 0 ? 1 : (request->size + LOOPBACK_SERVER_DEFLATE_BLOCK_SIZE - 1) / LOOPBACK_SERVER_DEFLATE_BLOCK_SIZE;
+        int head_length = snprintf(head, sizeof(head),
+            "HTTP/1.1 %s\r\nContent-Type: application/octet-stream\r\nContent-Encoding: deflate\r\nVary: Accept-Encoding\r\n%sContent-Length: %zu\r\n%s\r\n",
+            status, caching, 2 + blocks * 5 + request->size + 4, request->close ? "Connection: close\r\n" : "");
+        if (loopback_server_internal_send(fd, head, (size_t)head_length) != 0) {
+            return -1;
+        }
+        return request->head ? 0 : loopback_server_internal_send_deflate(fd, request->size);
+    }
+    if (request->has_range) {
+        long long size = (long long)request->size;
+        long long start = request->range_start, end = request->range_end;
+        if (start < 0 && end >= 0) {
+            // Suffix range, the last `end` bytes
+            start = end < size ? size - end : 0;
+            end = size - 1;
+        }
+        else if (end < 0 || end >= size) {
+            end = size - 1;
+        }
+        if (start < 0 || start >= size || start > end) {
+            int head_length = snprintf(head, sizeof(head),
+                "HTTP/1.1 416 Range Not Satisfiable\r\nContent-Range: bytes */%zu\r\nContent-Length: 0\r\n%s\r\n",
+                request->size, request->close ? "Connection: close\r\n" : "");
+            return loopback_server_internal_send(fd, head, (size_t)head_length);
+        }
+        status = "206 Partial Content";
+        offset = (size_t)start;
+        length = (size_t)(end - start + 1);
+        snprintf(content_range, sizeof(content_range), "Content-Range: bytes %lld-%lld/%zu\r\n", start, end, request->size);
+        request->chunked = 0;
+    }
+
+    char framing[64];
+    if (request->chunked) {
+        snprintf(framing, sizeof(framing), "Transfer-Encoding: chunked\r\n");
+    }
+    else {
+        snprintf(framing, sizeof(framing), "Content-Length: %zu\r\n", length);
+    }
+    int head_length = snprintf(head, sizeof(head),
+        "HTTP/1.1 %s\r\nContent-Type: application/octet-stream\r\nAccept-Ranges: bytes\r\n%s%s%s%s\r\n",
+        status, caching, content_range, framing, request->close ? "Connection: close\r\n" : "");
+    if (loopback_server_internal_send(fd, head, (size_t)head_length) != 0) {
+        return -1;
+    }
+    if (request->head) {
+        return 0;
+    }
+    if (request->drop >= 0 && (size_t)request->drop > offset && (size_t)request->drop < offset + length) {
+        // The client sees the connection go away in the middle of the body
+        loopback_server_internal_send_body(fd, offset, (size_t)request->drop - offset, 0);
+        return -1;
+    }
+    return loopback_server_internal_send_body(fd, offset, length, request->chunked);
+}
+
+/**
+ * Take `n` bytes of the request body, the bytes already received in `buffer` first.
+ * @param buffer The receive buffer of the connection, what is taken is removed from it
+ * @param len Number of bytes in the receive buffer
+ * @param out Output for the bytes, `NULL` = discard them
+ * @return 0 on success, -1 if the connection is gone
+ */
+int loopback_server_internal_receive(int fd, char *buffer, size_t *len, char *out, size_t n) {
+    size_t done = n < *len ? n : *len;
+    if (out != NULL) {
+        memcpy(out, buffer, done);
+    }
+    memmove(buffer, buffer + done, *len - done);
+    *len -= done;
+    while (done < n) {
+        char discard[4096];
+        size_t wanted = n - done;
+        if (out == NULL && wanted > sizeof(discard)) {
+            wanted = sizeof(discard);
+        }
+        ssize_t received = recv(fd, out != NULL ? out + done : discard, wanted, 0);
+        if (received < 0 && errno == EINTR) {
+            continue;
+        }
+        if (received <= 0) {
+            return -1;
+        }
+        done += (size_t)received;
+    }
+    return 0;
+}
+
+/**
+ * Take a line of a chunked request body (a chunk size or a trailer) from the receive buffer.
+ * @param buffer The receive buffer of the connection, it holds up to `LOOPBACK_SERVER_REQUEST_SIZE` bytes
+ * @param len Number of bytes in the receive buffer
+ * @param line Output for the null terminated line without the line break
+ * @param line_size Size of the output, longer lines are cut
+ * @return 0 on success, -1 if the connection is gone or the line is too long
+ */
+int loopback_server_internal_receive_line(int fd, char *buffer, size_t *len, char *line, size_t line_size) {
+    size_t scanned = 0;
+    for (;;) {
+        while (scanned + 1 < *len && !(buffer[scanned] == '\r' && buffer[scanned + 1] == '\n')) {
+            scanned += 1;
+        }
+        if (scanned + 1 < *len) {
+            size_t length = scanned;
+            size_t copied = length < line_size - 1 ? length : line_size - 1;
+            memcpy(line, buffer, copied);
+            line[copied] = '\0';
+            return loopback_server_internal_receive(fd, buffer, len, NULL, length + 2);
+        }
+        if (*len == LOOPBACK_SERVER_REQUEST_SIZE) {
+            return -1;
+        }
+        ssize_t received = recv(fd, buffer + *len, LOOPBACK_SERVER_REQUEST_SIZE - *len, 0);
+        if (received < 0 && errno == EINTR) {
+            continue;
+        }
+        if (received <= 0) {
+            return -1;
+        }
+        *len += (size_t)received;
+    }
+}
+
+/**
+ * Receive the body of a request, keep it for `/echo` and discard it otherwise.
+ * @param buffer The receive buffer of the connection, the body starts at its beginning
+ * @param len Number of bytes in the receive buffer
+ * @return 0 on success, -1 if the connection is gone
+ */
+int loopback_server_internal_receive_body(int fd, char *buffer, size_t *len, LoopbackServerInternalRequest *request) {
+    static const char continue_response[] = "HTTP/1.1 100 Continue\r\n\r\n";
+    if (request->expect_continue && (request->chunked_body || request->content_length > 0)
+        && loopback_server_internal_send(fd, continue_response, sizeof(continue_response) - 1) != 0) {
+        return -1;
+    }
+    if (!request->chunked_body) {
+        if (request->echo) {
+            request->body = malloc(request->content_length > 0 ? request->content_length : 1);
+            if (request->body == NULL) {
+                return -1;
+            }
+            request->body_len = request->content_length;
+        }
+        return loopback_server_internal_receive(fd, buffer, len, request->body, request->content_length);
+    }
+    char line[128];
+    size_t body_cap = 0;
+    for (;;) {
+        if (loopback_server_internal_receive_line(fd, buffer, len, line, sizeof(line)) != 0) {
+            return -1;
+        }
+        size_t size = (size_t)strtoull(line, NULL, 16);
+        if (size == 0) {
+            break;
+        }
+        if (request->echo && request->body_len + size > body_cap) {
+            body_cap = (request->body_len + size) * 2;
+            char *body = realloc(request->body, body_cap);
+            if (body == NULL) {
+                return -1;
+            }
+            request->body = body;
+        }
+        char *out = request->echo ? request->body + request->body_len : NULL;
+        if (loopback_server_internal_receive(fd, buffer, len, out, size) != 0
+            || loopback_server_internal_receive(fd, buffer, len, NULL, 2) != 0) {
+            return -1;
+        }
+        request->body_len += request->echo ? size : 0;
+    }
+    // Trailers up to the empty line
+    do {
+        if (loopback_server_internal_receive_line(fd, buffer, len, line, sizeof(line)) != 0) {
+            return -1;
+        }
+    } while (line[0] != '\0');
+    return 0;
+}
+
+/**
+ * @return Monotonic clock in milliseconds
+ */
+int64_t loopback_server_internal_now_ms(void) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (int64_t)now.tv_sec * 1000 + now.tv_nsec / 1000000;
+}
+
+/**
+ * A stream of an h2c connection.
+ */
+typedef struct LoopbackServerInternalStream {
+    uint32_t id;
+    int request_done; // The request has ended, the response may start
+    int headers_sent;
+    int64_t due_ms;   // The response starts after the latency
+    size_t offset, remaining;
+    int64_t window;   // Send window of the stream
+} LoopbackServerInternalStream;
+
+typedef struct LoopbackServerInternalH2 {
+    LoopbackServer *server;
+    int fd;
+    int64_t window;         // Send window of the connection
+    int64_t initial_window; // Send window of new streams
+    size_t max_frame;
+    LoopbackServerInternalStream *streams;
+    size_t stream_count;
+} LoopbackServerInternalH2;
+
+/**
+ * Send a single HTTP/2 frame.
+ * @return 0 on success, -1 if the connection is gone
+ */
+int loopback_server_internal_h2_frame(int fd, int type, int flags, uint32_t stream, const void *payload, size_t length) {
+    unsigned char header[9] = {
+        (unsigned char)(length >> 16), (unsigned char)(length >> 8), (unsigned char)length,
+        (unsigned char)type, (unsigned char)flags,
+        (unsigned char)(stream >> 24 & 0x7F), (unsigned char)(stream >> 16), (unsigned char)(stream >> 8), (unsigned char)stream,
+    };
+    struct iovec parts[2] = {{.iov_base = header, .iov_len = 9}, {.iov_base = (void*)payload, .iov_len = length}};
+    struct iovec *part = parts;
+    int count = length > 0 ? 2 : 1;
+    while (count > 0) {
+        struct msghdr message = {.msg_iov = part, .msg_iovlen = (size_t)count};
+        ssize_t sent = sendmsg(fd, &message, MSG_NOSIGNAL);
+        if (sent < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return -1;
+        }
+        // Skip what was sent
+        while (count > 0 && (size_t)sent >= part->iov_len) {
+            sent -= (ssize_t)part->iov_len;
+            part += 1;
+            count -= 1;
+        }
+        if (count > 0) {
+            part->iov_base = (char*)part->iov_base + sent;
+            part->iov_len -= (size_t)sent;
+        }
+    }
+    return 0;
+}
+
+/**
+ * Send a window update for a stream, 0 = the connection.
+ */
+int loopback_server_internal_h2_window_update(int fd, uint32_t stream, uint32_t increment) {
+    unsigned char payload[4] = {(unsigned char)(increment >> 24 & 0x7F), (unsigned char)(increment >> 16), (unsigned char)(increment >> 8), (unsigned char)increment};
+    return loopback_server_internal_h2_frame(fd, 0x8, 0, stream, payload, 4);
+}
+
+LoopbackServerInternalStream *loopback_server_internal_h2_stream(LoopbackServerInternalH2 *h2, uint32_t id) {
+    for (size_t i = 0; i < h2->stream_count; i += 1) {
+        if (h2->streams[i].id == id) {
+            return &h2->streams[i];
+        }
+    }
+    return NULL;
+}
+
+void loopback_server_internal_h2_remove(LoopbackServerInternalH2 *h2, LoopbackServerInternalStream *stream) {
+    *stream = h2->streams[h2->stream_count - 1];
+    h2->stream_count -= 1;
+}
+
+/**
+ * Handle a received frame.
+ * @return 0 on success, -1 to close the connection
+ */
+int loopback_server_internal_h2_receive(LoopbackServerInternalH2 *h2, int type, int flags, uint32_t id, const unsigned char *payload, size_t length) {
+    LoopbackServerInternalStream *stream;
+    switch (type) {
+        case 0x0: // DATA, the request body is discarded but its window is given back
+            stream = loopback_server_internal_h2_stream(h2, id);
+            if (stream != NULL && (flags & 0x1)) {
+                stream->request_done = 1;
+            }
+            if (length > 0
+                && (loopback_server_internal_h2_window_update(h2->fd, 0, (uint32_t)length) != 0
+                    || (stream != NULL && !stream->request_done && loopback_server_internal_h2_window_update(h2->fd, id, (uint32_t)length) != 0))) {
+                return -1;
+            }
+            return 0;
+        case 0x1: // HEADERS, a new request
+            if (h2->stream_count == LOOPBACK_SERVER_H2_MAX_STREAMS) {
+                return -1;
+            }
+            atomic_fetch_add(&h2->server->requests, 1);
+            h2->streams[h2->stream_count] = (LoopbackServerInternalStream) {
+                .id = id,
+                .request_done = flags & 0x1,
+                .due_ms = loopback_server_internal_now_ms() + h2->server->options.latency_ms,
+                .remaining = h2->server->options.body_size,
+                .window = h2->initial_window,
+            };
+            h2->stream_count += 1;
+            return 0;
+        case 0x3: // RST_STREAM
+            stream = loopback_server_internal_h2_stream(h2, id);
+            if (stream != NULL) {
+                loopback_server_internal_h2_remove(h2, stream);
+            }
+            return 0;
+        case 0x4: // SETTINGS
+            if (flags & 0x1) {
+                return 0;
+            }
+            for (size_t i = 0; i + 6 <= length; i += 6) {
+                uint32_t value = (uint32_t)payload[i + 2] << 24 | (uint32_t)payload[i + 3] << 16 | (uint32_t)payload[i + 4] << 8 | payload[i + 5];
+                int setting = payload[i] << 8 | payload[i + 1];
+                if (setting == 0x4) {
+                    for (size_t j = 0; j < h2->stream_count; j += 1) {
+                        h2->streams[j].window += (int64_t)value - h2->initial_window;
+                    }
+                    h2->initial_window = value;
+                }
+                else if (setting == 0x5 && value < h2->max_frame) {
+                    h2->max_frame = value;
+                }
+            }
+            return loopback_server_internal_h2_frame(h2->fd, 0x4, 0x1, 0, NULL, 0);
+        case 0x6: // PING
+            return (flags & 0x1) ? 0 : loopback_server_internal_h2_frame(h2->fd, 0x6, 0x1, 0, payload, length);
+        case 0x7: // GOAWAY
+            return -1;
+        case 0x8: // WINDOW_UPDATE
+            if (length == 4) {
+                int64_t increment = (int64_t)((uint32_t)(payload[0] & 0x7F) << 24 | (uint32_t)payload[1] << 16 | (uint32_t)payload[2] << 8 | payload[3]);
+                if (id == 0) {
+                    h2->window += increment;
+                }
+                else if ((stream = loopback_server_internal_h2_stream(h2, id)) != NULL) {
+                    stream->window += increment;
+                }
+            }
+            return 0;
+        default: // PRIORITY, CONTINUATION and unknown frames
+            return 0;
+    }
+}
+
+/**
+ * Send the next frame of every stream that is due, round-robin.
+ * @param sent Set to 1 if anything was sent
+ * @return 0 on success, -1 if the connection is gone
+ */
+int loopback_server_internal_h2_send(LoopbackServerInternalH2 *h2, int *sent) {
+    int64_t now = loopback_server_internal_now_ms();
+    *sent = 0;
+    for (size_t i = 0; i < h2->stream_count;) {
+        LoopbackServerInternalStream *stream = &h2->streams[i];
+        if (!stream->request_done || stream->due_ms > now) {
+            i += 1;
+            continue;
+        }
+        if (!stream->headers_sent) {
+            // :status 200, then content-length as a literal with an indexed name
+            unsigned char block[32] = {0x88, 0x0F, 0x0D};
+            int digits = snprintf((char*)block + 4, sizeof(block) - 4, "%zu", stream->remaining);
+            block[3] = (unsigned char)digits;
+            if (loopback_server_internal_h2_frame(h2->fd, 0x1, 0x4 | (stream->remaining == 0 ? 0x1 : 0), stream->id, block, (size_t)(4 + digits)) != 0) {
+                return -1;
+            }
+            stream->headers_sent = 1;
+            *sent = 1;
+        }
+        else if (h2->window > 0 && stream->window > 0) {
+            size_t n = stream->remaining < h2->max_frame ? stream->remaining : h2->max_frame;
+            if ((int64_t)n > h2->window) {
+                n = (size_t)h2->window;
+            }
+            if ((int64_t)n > stream->window) {
+                n = (size_t)stream->window;
+            }
+            const char *data = loopback_server_internal_pattern + stream->offset % LOOPBACK_SERVER_PATTERN_PERIOD;
+            int end = n == stream->remaining;
+            if (loopback_server_internal_h2_frame(h2->fd, 0x0, end ? 0x1 : 0, stream->id, data, n) != 0) {
+                return -1;
+            }
+            stream->offset += n;
+            stream->remaining -= n;
+            stream->window -= (int64_t)n;
+            h2->window -= (int64_t)n;
+            *sent = 1;
+        }
+        if (stream->headers_sent && stream->remaining == 0) {
+            loopback_server_internal_h2_remove(h2, stream);
+            continue;
+        }
+        i += 1;
+    }
+    return 0;
+}
+
+/**
+ * Serve an h2c connection.
+ * @param server The server
+ * @param fd The connection
+ * @param received Bytes already received, starting with the preface
+ * @param received_len Number of bytes already received
+ * @param upgrade The HTTP/1.1 request that asked for the upgrade, it becomes stream 1, or `NULL` for prior knowledge
+ */
+void loopback_server_internal_h2(LoopbackServer *server, int fd, const char *received, size_t received_len, const LoopbackServerInternalRequest *upgrade) {
+    static const char switching[] = "HTTP/1.1 101 Switching Protocols\r\nConnection: Upgrade\r\nUpgrade: h2c\r\n\r\n";
+    LoopbackServerInternalH2 h2 = {
+        .server = server,
+        .fd = fd,
+        .window = LOOPBACK_SERVER_H2_WINDOW,
+        .initial_window = LOOPBACK_SERVER_H2_WINDOW,
+        .max_frame = LOOPBACK_SERVER_H2_FRAME_SIZE,
+        .streams = malloc(LOOPBACK_SERVER_H2_MAX_STREAMS * sizeof(LoopbackServerInternalStream)),
+    };
+    size_t capacity = LOOPBACK_SERVER_H2_FRAME_SIZE + 9 + LOOPBACK_SERVER_REQUEST_SIZE;
+    unsigned char *in = malloc(capacity);
+    size_t len = received_len < capacity ? received_len : capacity;
+    int preface_done = 0;
+    if (h2.streams == NULL || in == NULL
+        || (upgrade != NULL && loopback_server_internal_send(fd, switching, sizeof(switching) - 1) != 0)
+        || loopback_server_internal_h2_frame(fd, 0x4, 0, 0, NULL, 0) != 0) {
+        goto ConnectionClose;
+    }
+    memcpy(in, received, len);
+    if (upgrade != NULL) {
+        h2.streams[0] = (LoopbackServerInternalStream) {
+            .id = 1,
+            .request_done = 1,
+            .due_ms = loopback_server_internal_now_ms() + upgrade->delay_ms,
+            .remaining = upgrade->size,
+            .window = h2.initial_window,
+        };
+        h2.stream_count = 1;
+    }
+
+    for (;;) {
+        // Handle every complete frame
+        size_t position = 0;
+        if (!preface_done && len >= LOOPBACK_SERVER_H2_PREFACE_SIZE) {
+            position = LOOPBACK_SERVER_H2_PREFACE_SIZE;
+            preface_done = 1;
+        }
+        while (preface_done && len - position >= 9) {
+            size_t length = (size_t)in[position] << 16 | (size_t)in[position + 1] << 8 | in[position + 2];
+            if (length > LOOPBACK_SERVER_H2_FRAME_SIZE) {
+                goto ConnectionClose;
+            }
+            if (len - position < 9 + length) {
+                break;
+            }
+            uint32_t id = (uint32_t)(in[position + 5] & 0x7F) << 24 | (uint32_t)in[position + 6] << 16 | (uint32_t)in[position + 7] << 8 | in[position + 8];
+            if (loopback_server_internal_h2_receive(&h2, in[position + 3], in[position + 4], id, in + position + 9, length) != 0) {
+                goto ConnectionClose;
+            }
+            position += 9 + length;
+        }
+        memmove(in, in + position, len - position);
+        len -= position;
+
+        // Send until the due streams are blocked on flow control
+        int sent = 1;
+        while (sent) {
+            if (loopback_server_internal_h2_send(&h2, &sent) != 0) {
+                goto ConnectionClose;
+            }
+        }
+
+        // Wait for frames, or until the next stream is due
+        int timeout = -1;
+        int64_t now = loopback_server_internal_now_ms();
+        for (size_t i = 0; i < h2.stream_count; i += 1) {
+            if (h2.streams[i].request_done && !h2.streams[i].headers_sent) {
+                int64_t wait = h2.streams[i].due_ms > now ? h2.streams[i].due_ms - now : 0;
+                if (timeout < 0 || wait < timeout) {
+                    timeout = (int)wait;
+                }
+            }
+        }
+        struct pollfd pfd = {.fd = fd, .events = POLLIN};
+        int ready = poll(&pfd, 1, timeout);
+        if (ready < 0 && errno != EINTR) {
+            break;
+        }
+        if (ready > 0) {
+            ssize_t received_count = recv(fd, in + len, capacity - len, 0);
+            if (received_count <= 0 && !(received_count < 0 && errno == EINTR)) {
+                break;
+            }
+            if (received_count > 0) {
+                len += (size_t)received_count;
+            }
+        }
+    }
+
+ConnectionClose:
+    free(h2.streams);
+    free(in);
+}
+
+/**
+ * Serve the requests of a single connection until it is closed.
+ */
+void *loopback_server_internal_connection(void *argument) {
+    LoopbackServerInternalConnection *connection = argument;
+    LoopbackServer *server = connection->server;
+    int fd = connection->fd;
+    free(connection);
+
+    char *buffer = malloc(LOOPBACK_SERVER_REQUEST_SIZE + 1);
+    size_t len = 0;
+    while (buffer != NULL) {
+        buffer[len] = '\0';
+        char *end = strstr(buffer, "\r\n\r\n");
+        if (end == NULL) {
+            if (len == LOOPBACK_SERVER_REQUEST_SIZE) {
+                break; // Request head too large
+            }
+            ssize_t received = recv(fd, buffer + len, LOOPBACK_SERVER_REQUEST_SIZE - len, 0);
+            if (received < 0 && errno == EINTR) {
+                continue;
+            }
+            if (received <= 0) {
+                break;
+            }
+            len += (size_t)received;
+            continue;
+        }
+
+        // HTTP/2 with prior knowledge starts with the connection preface instead of a request
+        if (strncmp(buffer, "PRI * HTTP/2.0", 14) == 0) {
+            loopback_server_internal_h2(server, fd, buffer, len, NULL);
+            break;
+        }
+
+        // Pipelined requests stay in the buffer
+        end[2] = '\0';
+        size_t consumed = (size_t)(end + 4 - buffer);
+        LoopbackServerInternalRequest request;
+        loopback_server_internal_parse(server, buffer, &request);
+        request.number = atomic_fetch_add(&server->requests, 1) + 1;
+
+        memmove(buffer, buffer + consumed, len - consumed);
+        len -= consumed;
+        if (loopback_server_internal_receive_body(fd, buffer, &len, &request) != 0) {
+            free(request.body);
+            goto ConnectionClose;
+        }
+
+        if (request.upgrade) {
+            loopback_server_internal_h2(server, fd, buffer, len, &request);
+            break;
+        }
+        if (request.delay_ms > 0) {
+            struct timespec delay = {.tv_sec = request.delay_ms / 1000, .tv_nsec = (request.delay_ms % 1000) * 1000000L};
+            while (nanosleep(&delay, &delay) != 0 && errno == EINTR) {}
+        }
+        int sent = loopback_server_internal_respond(fd, &request);
+        free(request.body);
+        if (sent != 0 || request.close) {
+            break;
+        }
+    }
+
+ConnectionClose:
+    free(buffer);
+    close(fd);
+    return NULL;
+}
+
+/**
+ * Accept connections until the listening socket is shut down.
+ */
+void *loopback_server_internal_accept(void *argument) {
+    LoopbackServer *server = argument;
+    for (;;) {
+        int fd = accept(server->listen_fd, NULL, NULL);
+        if (fd < 0) {
+            if (errno == EINTR || errno == ECONNABORTED) {
+                continue;
+            }
+            break;
+        }
+        int one = 1;
+        setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one)); // Small responses must not wait for delayed ACKs
+        LoopbackServerInternalConnection *connection = malloc(sizeof(*connection));
+        pthread_t thread;
+        if (connection == NULL) {
+            close(fd);
+            continue;
+        }
+        connection->server = server;
+        connection->fd = fd;
+        if (pthread_create(&thread, NULL, loopback_server_internal_connection, connection) != 0) {
+            free(connection);
+            close(fd);
+            continue;
+        }
+        pthread_detach(thread);
+        atomic_fetch_add(&server->connections, 1);
+    }
+    return NULL;
+}
+
+#pragma endregion
+
+/**
+ * Start the server on a free port of 127.0.0.1.
+ * @param server Pointer to a `LoopbackServer` struct
+ * @param options Server options, or `NULL` for an empty body without delay
+ * @return 0 on success, -1 on failure
+ */
+int loopback_server_start(LoopbackServer *server, const LoopbackServerOptions *options) {
+    *server = (LoopbackServer) {.listen_fd = -1};
+    if (options != NULL) {
+        server->options = *options;
+    }
+    for (size_t i = 0; i < sizeof(loopback_server_internal_pattern); i += 1) {
+        loopback_server_internal_pattern[i] = (char)('a' + i % LOOPBACK_SERVER_PATTERN_PERIOD);
+    }
+
+    struct sockaddr_in address = {.sin_family = AF_INET, .sin_port = 0};
+    address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    socklen_t address_length = sizeof(address);
+    int one = 1;
+    server->listen_fd = socket(AF_INET, SOCK_STREAM, 0);
+    if (server->listen_fd < 0) {
+        return -1;
+    }
+    setsockopt(server->listen_fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+    if (bind(server->listen_fd, (struct sockaddr*)&address, sizeof(address)) != 0
+        || listen(server->listen_fd, SOMAXCONN) != 0
+        || getsockname(server->listen_fd, (struct sockaddr*)&address, &address_length) != 0
+        || pthread_create(&server->thread, NULL, loopback_server_internal_accept, server) != 0) {
+        close(server->listen_fd);
+        server->listen_fd = -1;
+        return -1;
+    }
+    server->port = ntohs(address.sin_port);
+    return 0;
+}
+
+/**
+ * Stop accepting connections and wait for the accept thread.
+ * Open connections are served until the client closes them.
+ * @param server Pointer to a started `LoopbackServer` struct
+ */
+void loopback_server_stop(LoopbackServer *server) {
+    if (server->listen_fd < 0) {
+        return;
+    }
+    shutdown(server->listen_fd, SHUT_RDWR);
+    pthread_join(server->thread, NULL);
+    close(server->listen_fd);
+    server->listen_fd = -1;
+}
+
+/**
+ * Build the URL of a path on the server.
+ * @param server Pointer to a started `LoopbackServer` struct
+ * @param path Path and query, e.g. "/chunked?size=1024"
+ * @param url Output buffer for the URL
+ * @param url_size Size of the output buffer
+ */
+void loopback_server_url(LoopbackServer *server, const char *path, char *url, size_t url_size) {
+    snprintf(url, url_size, "http://127.0.0.1:%u%s", server->port, path);
+}
+
+#endif
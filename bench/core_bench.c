@@ -0,0 +1,425 @@
+/**
+ * Micro-benchmarks of the core headers: Buffer, Json, String, Slice and Mime.
+ * Every case runs at several input sizes, the results are printed as JSON so runs of
+ * different commits can be compared.
+ *
+ * Build and run:
+ *   make bench
+ *   make bench_alloc   Also print the allocation counters of every call site to stderr
+ *
+ * Usage:
+ *   core_bench [-t min_time_ms] [-f filter]
+ */
+
+#ifndef _STDINT_H
+#include <stdint.h>
+#endif
+
+#include <getopt.h>
+#include <stdio.h>
+#include <time.h>
+
+#include "Buffer.h"
+#include "Json.h"
+#include "Mime.h"
+#include "Slice.h"
+#include "String.h"
+
+#ifndef BENCH_COMMIT
+#define BENCH_COMMIT "unknown"
+#endif
+
+#define BENCH_BATCH 64
+#define BENCH_BUFFER_LIMIT (1 << 20)
+
+/**
+ * A benchmark case, `run` performs `count` operations on an input of `size` bytes.
+ */
+typedef struct BenchCase {
+    const char *name;
+    void (*run)(size_t size, size_t count);
+} BenchCase;
+
+typedef struct BenchState {
+    long min_time_ms;
+    const char *filter;
+    int first;
+} BenchState;
+
+// Results are accumulated here so the compiler keeps the work
+static volatile size_t bench_sink;
+
+static const size_t bench_sizes[] = {16, 256, 4096, 65536};
+
+int64_t bench_now_ns(void) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (int64_t)now.tv_sec * 1000000000 + now.tv_nsec;
+}
+
+/**
+ * @return A string of `size` pattern bytes, the caller frees it
+ */
+char *bench_text(size_t size, char first) {
+    char *text = malloc(size + 1);
+    for (size_t i = 0; i < size; i += 1) {
+        text[i] = (char)(first + i % 26);
+    }
+    text[size] = '\0';
+    return text;
+}
+
+#pragma region Buffer
+
+void bench_buffer_write_byte(size_t size, size_t count) {
+    Buffer buffer = buffer_make(64);
+    for (size_t n = 0; n < count; n += 1) {
+        for (size_t i = 0; i < size; i += 1) {
+            buffer_write_byte(&buffer, (char)i);
+        }
+        buffer.len = 0;
+    }
+    bench_sink += buffer.cap;
+    buffer_release(&buffer);
+}
+
+void bench_buffer_write_bytes(size_t size, size_t count) {
+    char *text = bench_text(size, 'a');
+    Buffer buffer = buffer_make(64);
+    for (size_t n = 0; n < count; n += 1) {
+        buffer_write_bytes(&buffer, text, size);
+        if (buffer.len > BENCH_BUFFER_LIMIT) {
+            buffer.len = 0;
+        }
+    }
+    bench_sink += buffer.len;
+    buffer_release(&buffer);
+    free(text);
+}
+
+void bench_buffer_write_string(size_t size, size_t count) {
+    char *text = bench_text(size, 'a');
+    Buffer buffer = buffer_make(64);
+    for (size_t n = 0; n < count; n += 1) {
+        buffer_write_string(&buffer, text);
+        if (buffer.len > BENCH_BUFFER_LIMIT) {
+            buffer.len = 0;
+        }
+    }
+    bench_sink += buffer.len;
+    buffer_release(&buffer);
+    free(text);
+}
+
+void bench_buffer_write_format(size_t size, size_t count) {
+    char *text = bench_text(size, 'a');
+    Buffer buffer = buffer_make(64);
+    for (size_t n = 0; n < count; n += 1) {
+        buffer_write_format(&buffer, "%s=%d;%u\n", text, (int64_t)n - 1000, (uint64_t)n);
+        if (buffer.len > BENCH_BUFFER_LIMIT) {
+            buffer.len = 0;
+        }
+    }
+    bench_sink += buffer.len;
+    buffer_release(&buffer);
+    free(text);
+}
+
+#pragma endregion
+
+#pragma region Json
+
+void bench_json_write_string(size_t size, size_t count) {
+    char *text = bench_text(size, 'a');
+    Buffer buffer = buffer_make(64);
+    JsonWriter json = json_writer_make(&buffer);
+    for (size_t n = 0; n < count; n += 1) {
+        json_write_string_bytes(&json, text, size);
+        if (buffer.len > BENCH_BUFFER_LIMIT) {
+            buffer.len = 0;
+        }
+    }
+    bench_sink += buffer.len;
+    buffer_release(&buffer);
+    free(text);
+}
+
+/**
+ * A string with a quote or a newline every 32 bytes.
+ */
+void bench_json_write_string_escaped(size_t size, size_t count) {
+    char *text = bench_text(size, 'a');
+    for (size_t i = 31; i < size; i += 32) {
+        text[i] = i % 64 == 31 ? '"' : '\n';
+    }
+    Buffer buffer = buffer_make(64);
+    JsonWriter json = json_writer_make(&buffer);
+    for (size_t n = 0; n < count; n += 1) {
+        json_write_string_bytes(&json, text, size);
+        if (buffer.len > BENCH_BUFFER_LIMIT) {
+            buffer.len = 0;
+        }
+    }
+    bench_sink += buffer.len;
+    buffer_release(&buffer);
+    free(text);
+}
+
+/**
+ * A structured log line with a message of `size` bytes, the counterpart of `buffer_write_format`.
+ */
+void bench_json_log_line(size_t size, size_t count) {
+    char *text = bench_text(size, 'a');
+    Buffer buffer = buffer_make(64);
+    JsonWriter json = json_writer_make(&buffer);
+    for (size_t n = 0; n < count; n += 1) {
+        json_object_begin(&json);
+        json_write_key(&json, "ts");
+        json_write_uint(&json, 1700000000000 + n);
+        json_write_key(&json, "level");
+        json_write_string(&json, "info");
+        json_write_key(&json, "status");
+        json_write_int(&json, (int64_t)n - 1000);
+        json_write_key(&json, "latency_ms");
+        json_write_fixed(&json, (double)n * 0.137, 3);
+        json_write_key(&json, "msg");
+        json_write_string_bytes(&json, text, size);
+        json_object_end(&json);
+        if (buffer.len > BENCH_BUFFER_LIMIT) {
+            buffer.len = 0;
+        }
+    }
+    bench_sink += buffer.len;
+    buffer_release(&buffer);
+    free(text);
+}
+
+void bench_json_write_double(size_t size, size_t count) {
+    Buffer buffer = buffer_make(64);
+    JsonWriter json = json_writer_make(&buffer);
+    double value = 1.0 / (double)size;
+    for (size_t n = 0; n < count; n += 1) {
+        json_write_double(&json, value * (double)n);
+        if (buffer.len > BENCH_BUFFER_LIMIT) {
+            buffer.len = 0;
+        }
+    }
+    bench_sink += buffer.len;
+    buffer_release(&buffer);
+}
+
+#pragma endregion
+
+#pragma region String
+
+/**
+ * @return A `String` holding `size` pattern bytes
+ */
+String bench_string(size_t size) {
+    char *text = bench_text(size, 'a');
+    String string = string_make(size + 64);
+    string_append_string(&string, text);
+    free(text);
+    return string;
+}
+
+void bench_string_insert_remove_byte(size_t size, size_t count) {
+    String string = bench_string(size);
+    for (size_t n = 0; n < count; n += 1) {
+        string_insert_byte(&string, size / 2, '#');
+        string_remove_byte(&string, size / 2);
+    }
+    bench_sink += string.len;
+    string_release(&string);
+}
+
+void bench_string_insert_remove_string(size_t size, size_t count) {
+    String string = bench_string(size);
+    for (size_t n = 0; n < count; n += 1) {
+        string_insert_string(&string, size / 2, "<inserted>");
+        string_remove_string(&string, size / 2, 10);
+    }
+    bench_sink += string.len;
+    string_release(&string);
+}
+
+#pragma endregion
+
+#pragma region Slice
+
+void bench_slice_equals(size_t size, size_t count) {
+    char *a = bench_text(size, 'a'), *b = bench_text(size, 'a');
+    Slice s1 = {.ptr = a, .len = size}, s2 = {.ptr = b, .len = size};
+    size_t equal = 0;
+    for (size_t n = 0; n < count; n += 1) {
+        equal += (size_t)slice_equals(&s1, &s2);
+    }
+    bench_sink += equal;
+    free(a);
+    free(b);
+}
+
+void bench_slice_equals_string(size_t size, size_t count) {
+    char *a = bench_text(size, 'a'), *b = bench_text(size, 'a');
+    Slice slice = {.ptr = a, .len = size};
+    size_t equal = 0;
+    for (size_t n = 0; n < count; n += 1) {
+        equal += (size_t)slice_equals_string(&slice, b);
+    }
+    bench_sink += equal;
+    free(a);
+    free(b);
+}
+
+void bench_slice_has_prefix(size_t size, size_t count) {
+    char *a = bench_text(size, 'a'), *prefix = bench_text(size / 2, 'a');
+    Slice slice = {.ptr = a, .len = size};
+    size_t found = 0;
+    for (size_t n = 0; n < count; n += 1) {
+        found += (size_t)slice_has_prefix(&slice, prefix);
+    }
+    bench_sink += found;
+    free(a);
+    free(prefix);
+}
+
+void bench_slice_has_suffix(size_t size, size_t count) {
+    char *a = bench_text(size, 'a'), *suffix = bench_text(size / 2, (char)('a' + (size - size / 2) % 26));
+    Slice slice = {.ptr = a, .len = size};
+    size_t found = 0;
+    for (size_t n = 0; n < count; n += 1) {
+        found += (size_t)slice_has_suffix(&slice, suffix);
+    }
+    bench_sink += found;
+    free(a);
+    free(suffix);
+}
+
+void bench_slice_has_string(size_t size, size_t count) {
+    char *a = bench_text(size, 'a');
+    Slice slice = {.ptr = a, .len = size};
+    size_t found = 0;
+    for (size_t n = 0; n < count; n += 1) {
+        found += (size_t)slice_has_string(&slice, "xyzabc");
+    }
+    bench_sink += found;
+    free(a);
+}
+
+#pragma endregion
+
+#pragma region Mime
+
+/**
+ * The input size of the mime cases is the position in the table:
+ * 16 = first entry, 256 = a quarter, 4096 = the last entry, 65536 = no match.
+ */
+size_t bench_mime_index(size_t size) {
+    switch (size) {
+        case 16: return 0;
+        case 256: return MIME_INTERNAL_LENGTH / 4;
+        case 4096: return MIME_INTERNAL_LENGTH - 1;
+        default: return MIME_INTERNAL_LENGTH;
+    }
+}
+
+void bench_mime_resolve_type(size_t size, size_t count) {
+    size_t index = bench_mime_index(size);
+    const char *ext = index < MIME_INTERNAL_LENGTH ? MIMES[index].ext : ".nomatch";
+    size_t found = 0;
+    for (size_t n = 0; n < count; n += 1) {
+        found += mime_resolve_type(ext) != NULL;
+    }
+    bench_sink += found;
+}
+
+void bench_mime_resolve_ext(size_t size, size_t count) {
+    size_t index = bench_mime_index(size);
+    const char *type = index < MIME_INTERNAL_LENGTH ? MIMES[index].type : "application/x-nomatch";
+    size_t found = 0;
+    for (size_t n = 0; n < count; n += 1) {
+        found += mime_resolve_ext(type) != NULL;
+    }
+    bench_sink += found;
+}
+
+#pragma endregion
+
+/**
+ * Run a case with more and more operations until it takes at least the minimum time,
+ * then print it as a JSON object.
+ */
+void bench_run(BenchState *state, const BenchCase *bench, size_t size) {
+    size_t count = BENCH_BATCH;
+    int64_t elapsed;
+    while (1) {
+        int64_t start = bench_now_ns();
+        bench->run(size, count);
+        elapsed = bench_now_ns() - start;
+        if (elapsed >= state->min_time_ms * 1000000 || count >= ((size_t)1 << 40)) {
+            break;
+        }
+        // Aim a bit above the minimum time on the next attempt
+        double scale = elapsed > 0 ? (double)state->min_time_ms * 1.2e6 / (double)elapsed : 100;
+        count = (size_t)((double)count * (scale < 2 ? 2 : scale > 100 ? 100 : scale));
+    }
+    double ns_per_op = (double)elapsed / (double)count;
+    printf("%s\n    {\"name\": \"%s\", \"size\": %zu, \"iterations\": %zu, \"ns_per_op\": %.3f, \"ops_per_s\": %.0f, \"mb_per_s\": %.2f}",
+        state->first ? "" : ",",
+        bench->name,
+        size,
+        count,
+        ns_per_op,
+        1e9 / ns_per_op,
+        (double)size * 1e9 / ns_per_op / (1024 * 1024));
+    state->first = 0;
+    fflush(stdout);
+}
+
+int main(int argc, char **argv) {
+    static const BenchCase cases[] = {
+        {"buffer_write_byte", bench_buffer_write_byte},
+        {"buffer_write_bytes", bench_buffer_write_bytes},
+        {"buffer_write_string", bench_buffer_write_string},
+        {"buffer_write_format", bench_buffer_write_format},
+        {"json_write_string", bench_json_write_string},
+        {"json_write_string_escaped", bench_json_write_string_escaped},
+        {"json_log_line", bench_json_log_line},
+        {"json_write_double", bench_json_write_double},
+        {"string_insert_remove_byte", bench_string_insert_remove_byte},
+        {"string_insert_remove_string", bench_string_insert_remove_string},
+        {"slice_equals", bench_slice_equals},
+        {"slice_equals_string", bench_slice_equals_string},
+        {"slice_has_prefix", bench_slice_has_prefix},
+        {"slice_has_suffix", bench_slice_has_suffix},
+        {"slice_has_string", bench_slice_has_string},
+        {"mime_resolve_type", bench_mime_resolve_type},
+        {"mime_resolve_ext", bench_mime_resolve_ext},
+    };
+    BenchState state = {.min_time_ms = 100, .first = 1};
+    int option;
+    while ((option = getopt(argc, argv, "t:f:")) != -1) {
+        switch (option) {
+            case 't': state.min_time_ms = strtol(optarg, NULL, 10); break;
+            case 'f': state.filter = optarg; break;
+            default:
+                fprintf(stderr, "usage: %s [-t min_time_ms] [-f filter]\n", argv[0]);
+                return 2;
+        }
+    }
+
+    printf("{\n  \"commit\": \"%s\",\n  \"min_time_ms\": %ld,\n  \"results\": [", BENCH_COMMIT, state.min_time_ms);
+    for (size_t i = 0; i < sizeof(cases) / sizeof(*cases); i += 1) {
+        if (state.filter != NULL && strstr(cases[i].name, state.filter) == NULL) {
+            continue;
+        }
+        for (size_t j = 0; j < sizeof(bench_sizes) / sizeof(*bench_sizes); j += 1) {
+            bench_run(&state, &cases[i], bench_sizes[j]);
+        }
+    }
+    printf("\n  ]\n}\n");
+#ifdef ALLOC_STATS
+    alloc_stats_print(stderr);
+#endif
+    return 0;
+}
@@ -0,0 +1,268 @@
+/**
+ * Throughput and latency benchmark of the HTTP client against the loopback server.
+ * Everything runs on 127.0.0.1, no network access is needed.
+ *
+ * Build (POSIX, curl headers from the submodule, linked against the system libcurl):
+ *   gcc -O2 -I clib -I clib/Http -I bench bench/http_bench.c -o http_bench -lcurl -lpthread
+ *
+ * Usage:
+ *   http_bench [-m mode] [-n requests] [-c concurrency] [-s body_size] [-d latency_ms] [-k] [-2]
+ *
+ * Modes:
+ *   request  `http_request_get`, a new handle and connection for every request
+ *   client   `http_client_get`, pooled handles and keep-alive connections
+ *   batch    `http_batch_run` with `-c` transfers in flight
+ *   event    `HttpEventLoop` with `-c` transfers in flight
+ *   pool     `HttpPool` with `-c` worker threads, each with its own client
+ *   all      Every mode above (default)
+ *
+ * With -2 the pooled modes upgrade to HTTP/2 (h2c) and multiplex their transfers
+ * over as few connections as possible, the stream count per connection is reported.
+ */
+
+#ifndef _STDINT_H
+#include <stdint.h>
+#endif
+
+#include <getopt.h>
+
+#include "LoopbackServer.h"
+#include "Batch.h"
+#include "Event.h"
+#include "Metrics.h"
+#include "Pool.h"
+
+typedef struct BenchOptions {
+    const char *mode;
+    size_t requests;
+    size_t concurrency;
+    size_t body_size;
+    long latency_ms;
+    int chunked;
+    int http2;
+} BenchOptions;
+
+/**
+ * Results of a single mode.
+ */
+typedef struct BenchResult {
+    HttpHistogram latency; // Microseconds per request
+    HttpMetrics metrics;   // Connection reuse of the pooled modes
+    size_t failed;
+    uint64_t body_bytes;
+} BenchResult;
+
+/**
+ * State of the concurrent modes.
+ */
+typedef struct BenchRun {
+    BenchResult *result;
+    HttpEventLoop *loop;
+    HttpBatchRequest *requests;
+    size_t count, next;
+    pthread_mutex_t lock; // Guards `result` in the pool mode
+} BenchRun;
+
+int64_t bench_now_us(void) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (int64_t)now.tv_sec * 1000000 + now.tv_nsec / 1000;
+}
+
+/**
+ * Body write function that only counts the bytes.
+ */
+size_t bench_discard(char *chunk, size_t size, size_t count, void *user_data) {
+    (void)chunk;
+    (void)user_data;
+    return size * count;
+}
+
+void bench_record(BenchResult *result, HttpResponse *response, CURLcode error) {
+    if (error != CURLE_OK || response->code != HttpOk) {
+        result->failed += 1;
+        return;
+    }
+    http_histogram_record(&result->latency, (uint64_t)response->timings.total);
+    http_metrics_record(&result->metrics, response);
+    result->body_bytes += (uint64_t)response->body_bytes;
+}
+
+void bench_complete(HttpBatchRequest *request, HttpResponse *response, CURLcode error, void *batch_data) {
+    (void)request;
+    BenchRun *run = batch_data;
+    bench_record(run->result, response, error);
+    // Keep the event loop at the same number of transfers in flight
+    if (run->loop != NULL && run->next < run->count) {
+        run->next += 1;
+        http_event_loop_add(run->loop, &run->requests[run->next - 1]);
+    }
+}
+
+void bench_run_request(const char *url, const BenchOptions *options, BenchResult *result) {
+    for (size_t i = 0; i < options->requests; i += 1) {
+        HttpResponse response = http_request_get(url, bench_discard, NULL);
+        bench_record(result, &response, response.error);
+        http_response_release(&response);
+    }
+}
+
+void bench_run_client(HttpClient *client, const char *url, const BenchOptions *options, BenchResult *result) {
+    for (size_t i = 0; i < options->requests; i += 1) {
+        HttpResponse response = http_client_get(client, url, bench_discard, NULL);
+        bench_record(result, &response, response.error);
+        http_client_response_release(client, &response);
+    }
+}
+
+void bench_run_concurrent(HttpClient *client, const char *url, const BenchOptions *options, BenchResult *result, int event) {
+    BenchRun run = {.result = result, .count = options->requests};
+    run.requests = calloc(options->requests, sizeof(*run.requests));
+    if (run.requests == NULL) {
+        result->failed = options->requests;
+        return;
+    }
+    for (size_t i = 0; i < options->requests; i += 1) {
+        run.requests[i] = (HttpBatchRequest) {.url = url, .sink = {.body_write_function = bench_discard}};
+    }
+
+    if (!event) {
+        http_batch_run(client, run.requests, run.count, options->concurrency, bench_complete, &run);
+    }
+    else {
+        HttpEventLoop loop;
+        if (http_event_loop_init(&loop, client, bench_complete, &run) != CURLE_OK) {
+            result->failed = options->requests;
+            free(run.requests);
+            return;
+        }
+        run.loop = &loop;
+        while (run.next < run.count && run.next < options->concurrency) {
+            run.next += 1;
+            http_event_loop_add(&loop, &run.requests[run.next - 1]);
+        }
+        http_event_loop_run(&loop);
+        http_event_loop_release(&loop);
+    }
+    free(run.requests);
+}
+
+void bench_job_complete(HttpJob *job, HttpResponse *response, void *user_data) {
+    (void)job;
+    BenchRun *run = user_data;
+    pthread_mutex_lock(&run->lock);
+    bench_record(run->result, response, response->error);
+    pthread_mutex_unlock(&run->lock);
+}
+
+void bench_run_pool(const char *url, const BenchOptions *options, const HttpClientOptions *client_options, BenchResult *result) {
+    BenchRun run = {.result = result, .lock = PTHREAD_MUTEX_INITIALIZER};
+    HttpJob *jobs = calloc(options->requests, sizeof(*jobs));
+    HttpPool pool;
+    if (jobs == NULL || http_pool_init(&pool, options->concurrency, client_options) != CURLE_OK) {
+        result->failed = options->requests;
+        free(jobs);
+        return;
+    }
+    for (size_t i = 0; i < options->requests; i += 1) {
+        jobs[i] = (HttpJob) {.url = url, .sink = {.body_write_function = bench_discard}, .on_complete = bench_job_complete, .user_data = &run};
+        if (http_pool_submit(&pool, &jobs[i]) != 0) {
+            result->failed += 1;
+        }
+    }
+    http_pool_wait(&pool);
+    http_pool_release(&pool);
+    free(jobs);
+}
+
+void bench_report(const char *mode, BenchResult *result, double seconds) {
+    HttpHistogram *latency = &result->latency;
+    double per_connection = result->metrics.len > 0 ? http_metrics_streams_per_connection(result->metrics.hosts[0]) : 0;
+    printf("%-8s %8zu %6zu %10.0f %8llu %8llu %8llu %8llu %10.2f %9.1f\n",
+        mode,
+        (size_t)latency->count,
+        result->failed,
+        (double)latency->count / seconds,
+        (unsigned long long)http_histogram_percentile(latency, 50),
+        (unsigned long long)http_histogram_percentile(latency, 90),
+        (unsigned long long)http_histogram_percentile(latency, 99),
+        (unsigned long long)latency->max,
+        (double)result->body_bytes / seconds / (1024 * 1024),
+        per_connection);
+}
+
+int bench_mode(const char *mode, const char *url, const BenchOptions *options) {
+    static const char *modes[] = {"request", "client", "batch", "event", "pool"};
+    int found = 0;
+    for (size_t i = 0; i < sizeof(modes) / sizeof(*modes); i += 1) {
+        if (strcmp(mode, "all") != 0 && strcmp(mode, modes[i]) != 0) {
+            continue;
+        }
+        found = 1;
+        HttpClient client;
+        HttpClientOptions client_options = {.http2 = options->http2 ? HttpHttp2Upgrade : HttpHttp2Off};
+        BenchResult *result = calloc(1, sizeof(*result));
+        if (result == NULL || http_client_init(&client, &client_options) != CURLE_OK) {
+            free(result);
+            return 1;
+        }
+        int64_t start = bench_now_us();
+        switch (i) {
+            case 0: bench_run_request(url, options, result); break;
+            case 1: bench_run_client(&client, url, options, result); break;
+            case 2: bench_run_concurrent(&client, url, options, result, 0); break;
+            case 3: bench_run_concurrent(&client, url, options, result, 1); break;
+            case 4: bench_run_pool(url, options, &client_options, result); break;
+        }
+        double seconds = (double)(bench_now_us() - start) / 1e6;
+        bench_report(modes[i], result, seconds > 0 ? seconds : 1e-6);
+        http_client_release(&client);
+        http_metrics_release(&result->metrics);
+        free(result);
+    }
+    return !found;
+}
+
+int main(int argc, char **argv) {
+    BenchOptions options = {.mode = "all", .requests = 2000, .concurrency = 16, .body_size = 1024};
+    int option;
+    while ((option = getopt(argc, argv, "m:n:c:s:d:k2")) != -1) {
+        switch (option) {
+            case 'm': options.mode = optarg; break;
+            case 'n': options.requests = strtoull(optarg, NULL, 10); break;
+            case 'c': options.concurrency = strtoull(optarg, NULL, 10); break;
+            case 's': options.body_size = strtoull(optarg, NULL, 10); break;
+            case 'd': options.latency_ms = strtol(optarg, NULL, 10); break;
+            case 'k': options.chunked = 1; break;
+            case '2': options.http2 = 1; break;
+            default:
+                fprintf(stderr, "usage: %s [-m request|client|batch|event|pool|all] [-n requests] [-c concurrency] [-s body_size] [-d latency_ms] [-k] [-2]\n", argv[0]);
+                return 2;
+        }
+    }
+    if (options.concurrency == 0) {
+        options.concurrency = 1;
+    }
+
+    LoopbackServer server;
+    LoopbackServerOptions server_options = {.body_size = options.body_size, .latency_ms = options.latency_ms, .chunked = options.chunked};
+    if (loopback_server_start(&server, &server_options) != 0) {
+        fprintf(stderr, "could not start the loopback server\n");
+        return 1;
+    }
+    char url[128];
+    loopback_server_url(&server, "/", url, sizeof(url));
+
+    http_global_init();
+    printf("# %zu requests, %zu concurrent, %zu byte bodies%s, %ld ms latency%s\n",
+        options.requests, options.concurrency, options.body_size, options.chunked ? " (chunked)" : "", options.latency_ms, options.http2 ? ", h2c" : "");
+    printf("%-8s %8s %6s %10s %8s %8s %8s %8s %10s %9s\n", "mode", "ok", "failed", "req/s", "p50 us", "p90 us", "p99 us", "max us", "MB/s", "per conn");
+    int failed = bench_mode(options.mode, url, &options);
+    if (failed) {
+        fprintf(stderr, "unknown mode: %s\n", options.mode);
+    }
+    printf("# server: %zu connections, %zu requests\n", (size_t)server.connections, (size_t)server.requests);
+    http_global_cleanup();
+    loopback_server_stop(&server);
+    return failed;
+}
@@ -0,0 +1,285 @@
+#ifndef ALLOC_H
+#define ALLOC_H
+
+/**
+ * Allocation hooks of `Buffer.h` and `String.h`.
+ * Every allocation of those headers goes through `ALLOC_CALLOC`, `ALLOC_REALLOC` and `ALLOC_FREE`.
+ * Define the three macros before including any clib header to use another allocator:
+ *
+ *   #define ALLOC_CALLOC(Count, Size) my_calloc(Count, Size)
+ *   #define ALLOC_REALLOC(Ptr, Size) my_realloc(Ptr, Size)
+ *   #define ALLOC_FREE(Ptr) my_free(Ptr)
+ *
+ * Or define `ALLOC_STATS` to count allocations with the built-in implementation below,
+ * see `alloc_stats_get` and `alloc_stats_print`. A call site is the allocation in the header
+ * together with the code that called into the header, e.g. the `buffer_write_bytes` that grew a buffer,
+ * which shows where to pre-reserve. The allocating functions are not inlined then, so the caller is exact.
+ * NOTE: With `ALLOC_STATS` the memory of a `Buffer` or `String` must be released with
+ * `buffer_release`/`string_release`, never with `free`.
+ */
+
+#ifndef _INC_STDLIB
+#include <stdlib.h>
+#endif
+
+#include "Clib.h"
+
+#if defined(ALLOC_STATS) && !defined(ALLOC_CALLOC)
+
+#ifndef _STDINT_H
+#include <stdint.h>
+#endif
+
+#ifndef _INC_STDIO
+#include <stdio.h>
+#endif
+
+#include <stdatomic.h>
+
+#if defined(__GLIBC__) || defined(__APPLE__)
+#include <execinfo.h>
+#endif
+
+#ifdef _MSC_VER
+#include <intrin.h>
+#define ALLOC_STATS_CALLER _ReturnAddress()
+#define ALLOC_NOINLINE __declspec(noinline)
+#elif defined(__GNUC__)
+#define ALLOC_STATS_CALLER __builtin_return_address(0)
+#define ALLOC_NOINLINE __attribute__((noinline))
+#else
+#define ALLOC_STATS_CALLER NULL
+#define ALLOC_NOINLINE
+#endif
+
+#define ALLOC_CALLOC(Count, Size) alloc_stats_calloc(Count, Size, __FILE__, __LINE__, __func__, ALLOC_STATS_CALLER)
+#define ALLOC_REALLOC(Ptr, Size) alloc_stats_realloc(Ptr, Size, __FILE__, __LINE__, __func__, ALLOC_STATS_CALLER)
+#define ALLOC_FREE(Ptr) alloc_stats_free(Ptr)
+
+#define ALLOC_STATS_MAX_SITES 256
+
+/**
+ * Counters of a single allocation call site.
+ */
+typedef struct AllocSite {
+    _Atomic(const char*) file; // `NULL` while the slot is free
+    int line;
+    const char *function;
+    void *caller;              // Return address into the code that called `function`, `NULL` if unknown
+    atomic_uint_fast64_t allocations;   // New blocks
+    atomic_uint_fast64_t reallocations; // Resized blocks
+    atomic_uint_fast64_t growths;       // Resizes to a larger block
+    atomic_uint_fast64_t bytes;         // Bytes requested, new blocks and growths
+} AllocSite;
+
+/**
+ * Process-wide allocation counters, updated lock-free from any thread.
+ */
+typedef struct AllocStats {
+    atomic_uint_fast64_t allocations;
+    atomic_uint_fast64_t reallocations;
+    atomic_uint_fast64_t frees;
+    atomic_uint_fast64_t live_bytes; // Bytes currently allocated
+    atomic_uint_fast64_t peak_bytes; // Highest `live_bytes` so far
+    AllocSite sites[ALLOC_STATS_MAX_SITES];
+} AllocStats;
+
+#pragma region Internals
+
+/**
+ * Every block starts with its size, keeping the user data 16-byte aligned.
+ */
+#define ALLOC_STATS_HEADER_SIZE 16
+
+#ifdef CLIB_DEFINITIONS
+
+static AllocStats alloc_stats;
+
+/**
+ * Find or add the counters of a call site.
+ * @return Pointer to the site, or `NULL` if every slot is taken
+ */
+AllocSite *alloc_stats_internal_site(const char *file, int line, const char *function, void *caller) {
+    size_t start = ((uintptr_t)file >> 4 ^ (size_t)line * 31 ^ (uintptr_t)caller >> 2) % ALLOC_STATS_MAX_SITES;
+    for (size_t i = 0; i < ALLOC_STATS_MAX_SITES; i += 1) {
+        AllocSite *site = &alloc_stats.sites[(start + i) % ALLOC_STATS_MAX_SITES];
+        const char *site_file = atomic_load_explicit(&site->file, memory_order_acquire);
+        if (site_file == NULL) {
+            // Claim the slot, the line, function and caller are written before the file is published
+            static atomic_flag lock = ATOMIC_FLAG_INIT;
+            while (atomic_flag_test_and_set_explicit(&lock, memory_order_acquire)) {}
+            site_file = atomic_load_explicit(&site->file, memory_order_relaxed);
+            if (site_file == NULL) {
+                site->line = line;
+                site->function = function;
+                site->caller = caller;
+                atomic_store_explicit(&site->file, file, memory_order_release);
+                site_file = file;
+            }
+            atomic_flag_clear_explicit(&lock, memory_order_release);
+        }
+        if (site_file == file && site->line == line && site->caller == caller) {
+            return site;
+        }
+    }
+    return NULL;
+}
+
+void alloc_stats_internal_live(int64_t change) {
+    uint64_t live = (uint64_t)((int64_t)atomic_fetch_add_explicit(&alloc_stats.live_bytes, (uint64_t)change, memory_order_relaxed) + change);
+    uint64_t peak = atomic_load_explicit(&alloc_stats.peak_bytes, memory_order_relaxed);
+    while (live > peak && !atomic_compare_exchange_weak_explicit(&alloc_stats.peak_bytes, &peak, live, memory_order_relaxed, memory_order_relaxed)) {}
+}
+
+#else
+
+AllocSite *alloc_stats_internal_site(const char *file, int line, const char *function, void *caller);
+void alloc_stats_internal_live(int64_t change);
+
+#endif
+
+#pragma endregion
+
+#ifdef CLIB_DEFINITIONS
+
+/**
+ * Counting `calloc`, use through `ALLOC_CALLOC`.
+ */
+void *alloc_stats_calloc(size_t count, size_t size, const char *file, int line, const char *function, void *caller) {
+    if (size != 0 && count > (SIZE_MAX - ALLOC_STATS_HEADER_SIZE) / size) {
+        return NULL;
+    }
+    size_t bytes = count * size;
+    char *block = calloc(1, ALLOC_STATS_HEADER_SIZE + bytes);
+    if (block == NULL) {
+        return NULL;
+    }
+    *(size_t*)block = bytes;
+    atomic_fetch_add_explicit(&alloc_stats.allocations, 1, memory_order_relaxed);
+    alloc_stats_internal_live((int64_t)bytes);
+    AllocSite *site = alloc_stats_internal_site(file, line, function, caller);
+    if (site != NULL) {
+        atomic_fetch_add_explicit(&site->allocations, 1, memory_order_relaxed);
+        atomic_fetch_add_explicit(&site->bytes, bytes, memory_order_relaxed);
+    }
+    return block + ALLOC_STATS_HEADER_SIZE;
+}
+
+/**
+ * Counting `realloc`, use through `ALLOC_REALLOC`.
+ */
+void *alloc_stats_realloc(void *ptr, size_t size, const char *file, int line, const char *function, void *caller) {
+    if (ptr == NULL) {
+        return alloc_stats_calloc(1, size, file, line, function, caller);
+    }
+    if (size > SIZE_MAX - ALLOC_STATS_HEADER_SIZE) {
+        return NULL;
+    }
+    char *block = (char*)ptr - ALLOC_STATS_HEADER_SIZE;
+    size_t old_size = *(size_t*)block;
+    block = realloc(block, ALLOC_STATS_HEADER_SIZE + size);
+    if (block == NULL) {
+        return NULL;
+    }
+    *(size_t*)block = size;
+    atomic_fetch_add_explicit(&alloc_stats.reallocations, 1, memory_order_relaxed);
+    alloc_stats_internal_live((int64_t)size - (int64_t)old_size);
+    AllocSite *site = alloc_stats_internal_site(file, line, function, caller);
+    if (site != NULL) {
+        atomic_fetch_add_explicit(&site->reallocations, 1, memory_order_relaxed);
+        if (size > old_size) {
+            atomic_fetch_add_explicit(&site->growths, 1, memory_order_relaxed);
+            atomic_fetch_add_explicit(&site->bytes, size - old_size, memory_order_relaxed);
+        }
+    }
+    return block + ALLOC_STATS_HEADER_SIZE;
+}
+
+/**
+ * Counting `free`, use through `ALLOC_FREE`.
+ */
+void alloc_stats_free(void *ptr) {
+    if (ptr == NULL) {
+        return;
+    }
+    char *block = (char*)ptr - ALLOC_STATS_HEADER_SIZE;
+    atomic_fetch_add_explicit(&alloc_stats.frees, 1, memory_order_relaxed);
+    alloc_stats_internal_live(-(int64_t)*(size_t*)block);
+    free(block);
+}
+
+/**
+ * @return Pointer to the process-wide counters
+ */
+AllocStats *alloc_stats_get(void) {
+    return &alloc_stats;
+}
+
+/**
+ * Print the totals and every call site to a stream.
+ * The caller is a symbol and offset where the platform can resolve it (link with `-rdynamic` for the names
+ * of non-static functions), else a module offset, e.g. `addr2line -f -i -e build/core_bench_alloc 0x3c90`
+ * lists the inlined functions down to the line that made the buffer grow.
+ * @param stream Output, e.g. `stderr`
+ */
+void alloc_stats_print(FILE *stream) {
+    fprintf(stream, "allocations %llu, reallocations %llu, frees %llu, live %llu bytes, peak %llu bytes\n",
+        (unsigned long long)alloc_stats.allocations,
+        (unsigned long long)alloc_stats.reallocations,
+        (unsigned long long)alloc_stats.frees,
+        (unsigned long long)alloc_stats.live_bytes,
+        (unsigned long long)alloc_stats.peak_bytes);
+    for (size_t i = 0; i < ALLOC_STATS_MAX_SITES; i += 1) {
+        AllocSite *site = &alloc_stats.sites[i];
+        const char *file = atomic_load_explicit(&site->file, memory_order_acquire);
+        if (file == NULL) {
+            continue;
+        }
+#if defined(__GLIBC__) || defined(__APPLE__)
+        char **symbols = site->caller != NULL ? backtrace_symbols(&site->caller, 1) : NULL;
+        const char *caller = symbols != NULL ? symbols[0] : "?";
+#else
+        char caller[32];
+        snprintf(caller, sizeof(caller), "%p", site->caller);
+#endif
+        fprintf(stream, "  %s (%s:%d) from %s: %llu allocations, %llu reallocations, %llu growths, %llu bytes\n",
+            site->function, file, site->line, caller,
+            (unsigned long long)site->allocations,
+            (unsigned long long)site->reallocations,
+            (unsigned long long)site->growths,
+            (unsigned long long)site->bytes);
+#if defined(__GLIBC__) || defined(__APPLE__)
+        free(symbols);
+#endif
+    }
+}
+
+#else
+
+void *alloc_stats_calloc(size_t count, size_t size, const char *file, int line, const char *function, void *caller);
+void *alloc_stats_realloc(void *ptr, size_t size, const char *file, int line, const char *function, void *caller);
+void alloc_stats_free(void *ptr);
+AllocStats *alloc_stats_get(void);
+void alloc_stats_print(FILE *stream);
+
+#endif
+
+#endif
+
+#ifndef ALLOC_CALLOC
+#define ALLOC_CALLOC(Count, Size) calloc(Count, Size)
+#endif
+
+#ifndef ALLOC_REALLOC
+#define ALLOC_REALLOC(Ptr, Size) realloc(Ptr, Size)
+#endif
+
+#ifndef ALLOC_FREE
+#define ALLOC_FREE(Ptr) free(Ptr)
+#endif
+
+#ifndef ALLOC_NOINLINE
+#define ALLOC_NOINLINE
+#endif
+
+#endif
@@ -5,6 +5,10 @@
 #include <stdarg.h>
 #endif
 
+#ifndef _STDINT_H
+#include <stdint.h>
+#endif
+
 #ifndef _INC_STDLIB
 #include <stdlib.h>
 #endif
@@ -13,8 +17,13 @@
 #include <string.h>
 #endif
 
+#include "Clib.h"
+#include "Alloc.h"
+
 #pragma region Internals
 
+#ifdef CLIB_DEFINITIONS
+
 /**
  * Writes the provided int64 `value` as a string to `buffer`.
  * @param buffer Pointer to the output buffer.
@@ -86,6 +95,13 @@ int buffer_internal_u64_to_string(char *buffer, size_t buffer_size, uint64_t val
     return 1;
 }
 
+#else
+
+int buffer_internal_i64_to_string(char *buffer, size_t buffer_size, int64_t value, int32_t base);
+int buffer_internal_u64_to_string(char *buffer, size_t buffer_size, uint64_t value, int32_t base);
+
+#endif
+
 #pragma endregion
 
 /**
@@ -113,6 +129,8 @@ typedef enum BufferError {
     BUFFER_ERROR_INDEX_OUT_OF_BOUNDS,
 } BufferError;
 
+#ifdef CLIB_DEFINITIONS
+
 char *buffer_error_to_string(BufferError error) {
     switch (error) {
         case BUFFER_ERROR_NONE:
@@ -138,12 +156,12 @@ char *buffer_error_to_string(BufferError error) {
  * @param cap Initial capacity. If 0, will default to 2.
  * @return `Buffer` struct value.
  */
-Buffer buffer_make(size_t cap) {
+ALLOC_NOINLINE Buffer buffer_make(size_t cap) {
     if (cap == 0) {
         cap = 2;
     }
     return (Buffer) {
-        .ptr = calloc(cap, 1),
+        .ptr = ALLOC_CALLOC(cap, 1),
         .cap = cap,
         .len = 0,
     };
@@ -155,12 +173,12 @@ Buffer buffer_make(size_t cap) {
  * @param string The string to initialize the buffer with.
  * @return `Buffer` struct value.
  */
-Buffer buffer_from_string(const char *string) {
+ALLOC_NOINLINE Buffer buffer_from_string(const char *string) {
     Buffer buffer;
     size_t string_len = strlen(string);
     buffer.cap = string_len + 1;
     buffer.len = string_len;
-    buffer.ptr = calloc(buffer.cap, 1);
+    buffer.ptr = ALLOC_CALLOC(buffer.cap, 1);
     if (buffer.ptr != NULL) {
         memcpy(buffer.ptr, string, string_len);
     }
@@ -174,11 +192,15 @@ Buffer buffer_from_string(const char *string) {
  * @param cap Initial capacity. If 0, will default to 1.
  * @return `BufferError` (errors are non-zero).
  */
-BufferError buffer_init(Buffer *buf, size_t cap) {
+ALLOC_NOINLINE BufferError buffer_init(Buffer *buf, size_t cap) {
     if (buf == NULL) {
         return BUFFER_ERROR_NULL_POINTER;
     }
-    *buf = buffer_make(cap);
+    // Not through `buffer_make`, the allocation is counted for the caller of `buffer_init`
+    if (cap == 0) {
+        cap = 2;
+    }
+    *buf = (Buffer) {.ptr = ALLOC_CALLOC(cap, 1), .cap = cap, .len = 0};
     if (buf->ptr == NULL) {
         return BUFFER_ERROR_ALLOCATION_FAILURE;
     }
@@ -195,7 +217,7 @@ BufferError buffer_release(Buffer *buf) {
     if (buf == NULL) {
         return BUFFER_ERROR_NULL_POINTER;
     }
-    free(buf->ptr);
+    ALLOC_FREE(buf->ptr);
     buf->ptr = NULL;
     buf->cap = 0;
     buf->len = 0;
@@ -225,7 +247,7 @@ BufferError buffer_clear(Buffer *buf) {
  * @param required_cap The target capacity of the buffer.
  * @return `BufferError` (errors are non-zero).
  */
-BufferError buffer_grow(Buffer *buf, size_t required_cap) {
+ALLOC_NOINLINE BufferError buffer_grow(Buffer *buf, size_t required_cap) {
     if (buf == NULL) {
         return BUFFER_ERROR_NULL_POINTER;
     }
@@ -233,7 +255,7 @@ BufferError buffer_grow(Buffer *buf, size_t required_cap) {
         while (required_cap >= buf->cap) {
             buf->cap <<= 1;
         }
-        buf->ptr = realloc(buf->ptr, buf->cap);
+        buf->ptr = ALLOC_REALLOC(buf->ptr, buf->cap);
         if (buf->ptr == NULL) {
             return BUFFER_ERROR_ALLOCATION_FAILURE;
         }
@@ -242,6 +264,47 @@ BufferError buffer_grow(Buffer *buf, size_t required_cap) {
     return BUFFER_ERROR_NONE;
 }
 
+/**
+ * Reserves room for `n` more bytes in a single allocation,
+ * so that writing them afterwards does not reallocate.
+ * Unlike `buffer_grow`, the capacity is not rounded up to a power of two.
+ * Extra allocated memory is zeroed.
+ * NOTE: Allocates memory!
+ * @param buf Pointer to a `Buffer` struct.
+ * @param n The number of bytes to make room for.
+ * @return `BufferError` (errors are non-zero).
+ */
+ALLOC_NOINLINE BufferError buffer_reserve(Buffer *buf, size_t n) {
+    if (buf == NULL) {
+        return BUFFER_ERROR_NULL_POINTER;
+    }
+    size_t required_cap = buf->len + n + 1;
+    if (required_cap >= buf->cap) {
+        size_t cap = required_cap + 1;
+        char *ptr = ALLOC_REALLOC(buf->ptr, cap);
+        if (ptr == NULL) {
+            return BUFFER_ERROR_ALLOCATION_FAILURE;
+        }
+        memset(ptr + buf->len, 0, cap - buf->len);
+        buf->ptr = ptr;
+        buf->cap = cap;
+    }
+    return BUFFER_ERROR_NONE;
+}
+
+#else
+
+char *buffer_error_to_string(BufferError error);
+Buffer buffer_make(size_t cap);
+Buffer buffer_from_string(const char *string);
+BufferError buffer_init(Buffer *buf, size_t cap);
+BufferError buffer_release(Buffer *buf);
+BufferError buffer_clear(Buffer *buf);
+BufferError buffer_grow(Buffer *buf, size_t required_cap);
+BufferError buffer_reserve(Buffer *buf, size_t n);
+
+#endif
+
 /**
  * Writes a byte to the end of the buffer.
  * NOTE: Allocates memory!
@@ -249,20 +312,24 @@ BufferError buffer_grow(Buffer *buf, size_t required_cap) {
  * @param b Byte to be written.
  * @return `BufferError` (errors are non-zero).
  */
-BufferError buffer_write_byte(Buffer *buf, char b) {
+static inline BufferError buffer_write_byte(Buffer *buf, char b) {
     if (buf == NULL) {
         return BUFFER_ERROR_NULL_POINTER;
     }
     size_t required_cap = buf->len + 2;
-    BufferError error = buffer_grow(buf, required_cap);
-    if (error != BUFFER_ERROR_NONE) {
-        return error;
+    if (required_cap >= buf->cap) {
+        BufferError error = buffer_grow(buf, required_cap);
+        if (error != BUFFER_ERROR_NONE) {
+            return error;
+        }
     }
     buf->ptr[buf->len] = b;
     buf->len += 1;
     return BUFFER_ERROR_NONE;
 }
 
+#ifdef CLIB_DEFINITIONS
+
 /**
  * Write a byte in the specified index.
  * This can overwrite existing data.
@@ -291,6 +358,12 @@ BufferError buffer_write_byte_at(Buffer *buf, char b, size_t index) {
     return BUFFER_ERROR_NONE;
 }
 
+#else
+
+BufferError buffer_write_byte_at(Buffer *buf, char b, size_t index);
+
+#endif
+
 /**
  * Writes some bytes to the end of the buffer.
  * NOTE: Allocates memory! Prefer this function over `buffer_write_string` if the data is not a C-string (e.g. a file).
@@ -299,20 +372,24 @@ BufferError buffer_write_byte_at(Buffer *buf, char b, size_t index) {
  * @param n The number of bytes to be written.
  * @return `BufferError` (errors are non-zero).
  */
-BufferError buffer_write_bytes(Buffer *buf, const char *bytes, size_t n) {
+static inline BufferError buffer_write_bytes(Buffer *buf, const char *bytes, size_t n) {
     if (buf == NULL) {
         return BUFFER_ERROR_NULL_POINTER;
     }
     size_t required_cap = buf->len + n + 1;
-    BufferError error = buffer_grow(buf, required_cap);
-    if (error != BUFFER_ERROR_NONE) {
-        return error;
+    if (required_cap >= buf->cap) {
+        BufferError error = buffer_grow(buf, required_cap);
+        if (error != BUFFER_ERROR_NONE) {
+            return error;
+        }
     }
     memcpy(buf->ptr + buf->len, bytes, n);
     buf->len += n;
     return BUFFER_ERROR_NONE;
 }
 
+#ifdef CLIB_DEFINITIONS
+
 /**
  * Writes a string to the end of the buffer.
  * NOTE: Allocates memory!
@@ -426,12 +503,20 @@ BufferError buffer_copy_string(Buffer *buf, char **dst) {
     return BUFFER_ERROR_NONE;
 }
 
+#else
+
+BufferError buffer_write_string(Buffer *buf, const char *s);
+BufferError buffer_write_format(Buffer *buf, const char *format, ...);
+BufferError buffer_copy_string(Buffer *buf, char **dst);
+
+#endif
+
 /**
  * Pop a byte from the end of a buffer.
  * @param buf Buffer
  * @return Popped byte, 0 if length is 0
  */
-char buffer_pop_byte(Buffer *buf) {
+static inline char buffer_pop_byte(Buffer *buf) {
     if (buf->len == 0) {
         return 0;
     }
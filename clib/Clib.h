@@ -0,0 +1,36 @@
+#ifndef CLIB_H
+#define CLIB_H
+
+/**
+ * Build modes of the clib headers, included by every one of them.
+ *
+ * By default a header holds the whole implementation, include it in a single source file
+ * and compile that file, nothing else is needed.
+ *
+ * Programs with several source files use the library mode (STB-style):
+ *
+ *   Every source file:     #define CLIB_DECLARATIONS_ONLY (or -DCLIB_DECLARATIONS_ONLY)
+ *                          #include "Buffer.h"
+ *
+ *   Exactly one file:      #define CLIB_IMPLEMENTATION
+ *                          #include "Buffer.h"
+ *
+ * The HTTP headers have their own `CLIB_HTTP_IMPLEMENTATION`, so the HTTP part can live in
+ * another library than the core headers it uses.
+ * `clib.c` and `Http/http.c` are those files, `make lib lib_http` compiles them into static libraries,
+ * with `LTO=1` for link-time optimization.
+ * The small functions on hot paths (e.g. `buffer_write_byte`, `slice_equals`) are `static inline`
+ * in every mode, so they are inlined at the call sites without LTO.
+ * NOTE: Macros that change the implementation (e.g. `ALLOC_STATS`) must be the same for the
+ * library and the program.
+ */
+
+#if !defined(CLIB_DECLARATIONS_ONLY) || defined(CLIB_IMPLEMENTATION)
+#define CLIB_DEFINITIONS
+#endif
+
+#if !defined(CLIB_DECLARATIONS_ONLY) || defined(CLIB_HTTP_IMPLEMENTATION)
+#define CLIB_HTTP_DEFINITIONS
+#endif
+
+#endif
@@ -0,0 +1,195 @@
+#ifndef HTTP_BATCH_H
+#define HTTP_BATCH_H
+
+#include "Clib.h"
+#include "Client.h"
+
+/**
+ * Number of transfers kept in flight when no concurrency cap is given.
+ */
+#define HTTP_BATCH_DEFAULT_CONCURRENCY 16
+
+/**
+ * Applies extra options to the easy handle of a batch request before it starts.
+ * @param curl The curl easy handle
+ * @param user_data The `user_data` of the request
+ */
+typedef void (*HttpSetupFunction)(CURL *curl, void *user_data);
+
+/**
+ * A single request of a batch.
+ */
+typedef struct HttpBatchRequest {
+    const char *url;
+    HttpSink sink;                    // Receives the response
+    void *user_data;                  // Any user specified data for the completion callback
+    HttpSetupFunction setup_function; // Optional, called with `user_data`
+    size_t slot;                      // Set by `HttpEventLoop`, index in its list of requests in flight
+} HttpBatchRequest;
+
+/**
+ * Called once for every finished request of a batch.
+ * The response is only valid during the call, its handle goes back to the client afterwards.
+ * @param request The finished request
+ * @param response The response, `code` and `version` are 0 if the transfer failed, `error` is set like the argument
+ * @param error Result of the transfer, `CURLE_OK` on success
+ * @param batch_data The `batch_data` passed to `http_batch_run`
+ */
+typedef void (*HttpCompletionFunction)(HttpBatchRequest *request, HttpResponse *response, CURLcode error, void *batch_data);
+
+#pragma region Internals
+
+#ifdef CLIB_HTTP_DEFINITIONS
+
+/**
+ * Report a request that could not be started.
+ * @param request The request
+ * @param error Reason of the failure
+ * @param on_complete Completion callback
+ * @param batch_data User data of the batch
+ */
+void http_batch_internal_fail(HttpBatchRequest *request, CURLcode error, HttpCompletionFunction on_complete, void *batch_data) {
+    HttpResponse response = {0};
+    http_internal_take_headers(&request->sink, &response);
+    response.error = error;
+    on_complete(request, &response, error, batch_data);
+    http_response_release(&response);
+}
+
+/**
+ * Start a request of the batch on a multi handle.
+ * @param client Pointer to an `HttpClient` struct, the easy handle is taken from its pool
+ * @param multi The multi handle that drives the transfer
+ * @param request The request to start
+ * @param on_complete Completion callback, used if the request cannot be started
+ * @param batch_data User data of the batch
+ * @return 1 if the transfer was started, else 0
+ */
+int http_batch_internal_start(HttpClient *client, CURLM *multi, HttpBatchRequest *request, HttpCompletionFunction on_complete, void *batch_data) {
+    CURL *curl = http_client_acquire_handle(client);
+    if (curl == NULL) {
+        http_batch_internal_fail(request, CURLE_OUT_OF_MEMORY, on_complete, batch_data);
+        return 0;
+    }
+    http_internal_setup_handle(curl, request->url, &request->sink);
+    request->sink.multi = multi;
+    curl_easy_setopt(curl, CURLOPT_PRIVATE, request); // Find the request again when the transfer is done
+    if (request->setup_function != NULL) {
+        request->setup_function(curl, request->user_data);
+    }
+    if (curl_multi_add_handle(multi, curl) != CURLM_OK) {
+        http_client_return_handle(client, curl);
+        http_batch_internal_fail(request, CURLE_FAILED_INIT, on_complete, batch_data);
+        return 0;
+    }
+    return 1;
+}
+
+/**
+ * Deliver the completions of all finished transfers of a multi handle.
+ * @param client Pointer to an `HttpClient` struct, the easy handles go back to its pool
+ * @param multi The multi handle that drives the transfers
+ * @param on_complete Completion callback
+ * @param batch_data User data of the batch
+ * @return Number of transfers that finished
+ */
+size_t http_batch_internal_collect(HttpClient *client, CURLM *multi, HttpCompletionFunction on_complete, void *batch_data) {
+    size_t finished = 0;
+    int queued;
+    CURLMsg *msg;
+    while ((msg = curl_multi_info_read(multi, &queued)) != NULL) {
+        if (msg->msg != CURLMSG_DONE) {
+            continue;
+        }
+        // The message is freed by curl_multi_remove_handle, copy what we need first
+        CURL *curl = msg->easy_handle;
+        CURLcode error = msg->data.result;
+        HttpBatchRequest *request = NULL;
+        curl_easy_getinfo(curl, CURLINFO_PRIVATE, (char**)&request);
+        curl_multi_remove_handle(multi, curl);
+        request->sink.multi = NULL;
+
+        HttpResponse response = {0};
+        if (error == CURLE_OK) {
+            http_internal_load_response(curl, &request->sink, &response);
+        }
+        http_internal_take_headers(&request->sink, &response);
+        response.curl_handle = curl;
+        response.error = error;
+        on_complete(request, &response, error, batch_data);
+
+        http_client_response_release(client, &response);
+        finished += 1;
+    }
+    return finished;
+}
+
+#else
+
+void http_batch_internal_fail(HttpBatchRequest *request, CURLcode error, HttpCompletionFunction on_complete, void *batch_data);
+int http_batch_internal_start(HttpClient *client, CURLM *multi, HttpBatchRequest *request, HttpCompletionFunction on_complete, void *batch_data);
+size_t http_batch_internal_collect(HttpClient *client, CURLM *multi, HttpCompletionFunction on_complete, void *batch_data);
+
+#endif
+
+#pragma endregion
+
+#ifdef CLIB_HTTP_DEFINITIONS
+
+/**
+ * Perform a batch of HTTP GET requests concurrently on the calling thread.
+ * At most `max_concurrency` transfers are in flight at a time, the next request
+ * is started as soon as one finishes. Connections are reused through the client.
+ * @param client Pointer to an initialized `HttpClient` struct
+ * @param requests Array of requests
+ * @param count Number of requests
+ * @param max_concurrency Max transfers in flight, 0 = `HTTP_BATCH_DEFAULT_CONCURRENCY`
+ * @param on_complete Callback called once for every request
+ * @param batch_data Any user specified data to be passed into the callback function
+ * @return `CURLM_OK` when every request has completed, else the multi error that aborted the batch.
+ *         Release the client after an aborted batch, unfinished transfers stay attached to it.
+ */
+CURLMcode http_batch_run(HttpClient *client, HttpBatchRequest *requests, size_t count, size_t max_concurrency, HttpCompletionFunction on_complete, void *batch_data) {
+    CURLMcode code = CURLM_OK;
+    size_t next = 0, in_flight = 0;
+    int running;
+
+    if (max_concurrency == 0) {
+        max_concurrency = HTTP_BATCH_DEFAULT_CONCURRENCY;
+    }
+
+    while (next < count || in_flight > 0) {
+        while (next < count && in_flight < max_concurrency) {
+            in_flight += http_batch_internal_start(client, client->multi, &requests[next], on_complete, batch_data);
+            next += 1;
+        }
+        if (in_flight == 0) {
+            continue;
+        }
+
+        code = curl_multi_perform(client->multi, &running);
+        if (code != CURLM_OK) {
+            break;
+        }
+
+        size_t finished = http_batch_internal_collect(client, client->multi, on_complete, batch_data);
+        in_flight -= finished;
+
+        // Only wait for activity when no new transfer can be started right away
+        if (finished == 0 && running > 0) {
+            code = curl_multi_poll(client->multi, NULL, 0, 1000, NULL);
+            if (code != CURLM_OK) {
+                break;
+            }
+        }
+    }
+    return code;
+}
+
+#else
+
+CURLMcode http_batch_run(HttpClient *client, HttpBatchRequest *requests, size_t count, size_t max_concurrency, HttpCompletionFunction on_complete, void *batch_data);
+
+#endif
+
+#endif
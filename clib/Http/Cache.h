@@ -0,0 +1,958 @@
+#ifndef HTTP_CACHE_H
+#define HTTP_CACHE_H
+
+#ifndef _INC_STDIO
+#include <stdio.h>
+#endif
+
+#ifndef _INC_TIME
+#include <time.h>
+#endif
+
+#include "Clib.h"
+#include "Client.h"
+#include "Headers.h"
+
+/**
+ * Name of the file in the cache directory that holds the cache index.
+ */
+#define HTTP_CACHE_INDEX_FILE "index"
+
+/**
+ * Size of the chunks a cached body is read from disk with.
+ */
+#define HTTP_CACHE_READ_CHUNK_SIZE (64 << 10)
+
+/**
+ * Suffix of the file next to a cached body that holds the response headers, one `Name: value` line each.
+ */
+#define HTTP_CACHE_HEADERS_SUFFIX ".headers"
+
+/**
+ * Initial number of slots in the hash index of a cache.
+ */
+#define HTTP_CACHE_INITIAL_SLOTS 32
+
+/**
+ * A cached response.
+ * The body is stored in the cache directory in a file named after `key`,
+ * the headers in the same name with `HTTP_CACHE_HEADERS_SUFFIX`.
+ */
+typedef struct HttpCacheEntry {
+    char key[17];        // FNV-1a hash of the URL as hex
+    uint64_t hash;       // FNV-1a hash of the URL
+    char *url;
+    char *etag;          // Validator for `If-None-Match`, or `NULL`
+    char *last_modified; // Validator for `If-Modified-Since`, or `NULL`
+    time_t expires;      // The entry is served without revalidation until this time
+    size_t size;         // Size of the body on disk
+    uint64_t last_used;  // LRU clock value of the last use
+    size_t older, newer; // Index + 1 of the neighbours in the LRU list, 0 = none
+} HttpCacheEntry;
+
+/**
+ * An on-disk HTTP response cache with a size bound and LRU eviction.
+ * Entries are found through a hash index over the URL hashes and kept in a list from least to most recently used.
+ */
+typedef struct HttpCache {
+    char *directory;
+    HttpCacheEntry *entries;
+    size_t len, cap;
+    size_t *slots;         // Index + 1 of the entry of each URL hash, 0 = empty slot
+    size_t slot_count;
+    size_t oldest, newest; // Index + 1 of the ends of the LRU list, 0 = empty
+    size_t size, max_size; // Total size of the cached bodies and its upper bound
+    uint64_t clock;        // Incremented on every use of an entry
+    size_t hits;           // Fresh responses served from disk
+    size_t revalidations;  // Responses served from disk after a 304 Not Modified
+    size_t misses;         // Responses transferred in full
+    size_t evictions;      // Entries dropped to stay under `max_size`
+} HttpCache;
+
+#pragma region Internals
+
+#ifdef CLIB_HTTP_DEFINITIONS
+
+/**
+ * Hash the URL into the hex key of its cache entry.
+ * @param url The URL
+ * @param key Output for the 16 hex digits and the null terminator
+ * @return The hash
+ */
+uint64_t http_cache_internal_key(const char *url, char key[17]) {
+    uint64_t hash = 14695981039346656037ULL;
+    for (; *url != '\0'; url += 1) {
+        hash ^= (unsigned char)*url;
+        hash *= 1099511628211ULL;
+    }
+    for (int i = 15; i >= 0; i -= 1) {
+        key[i] = "0123456789abcdef"[(hash >> (60 - 4 * i)) & 0xf];
+    }
+    key[16] = '\0';
+    return hash;
+}
+
+/**
+ * Build the path of a file in the cache directory.
+ * @param cache Pointer to an `HttpCache` struct
+ * @param name File name
+ * @param suffix Suffix appended to the file name
+ * @param path Output buffer
+ * @param path_size Size of the output buffer
+ */
+void http_cache_internal_path(HttpCache *cache, const char *name, const char *suffix, char *path, size_t path_size) {
+    snprintf(path, path_size, "%s/%s%s", cache->directory, name, suffix);
+}
+
+/**
+ * Copy a string into newly allocated memory.
+ * @param string The string, may be `NULL`
+ * @return The copy or `NULL`
+ */
+char *http_cache_internal_strdup(const char *string) {
+    if (string == NULL) {
+        return NULL;
+    }
+    size_t length = strlen(string);
+    char *copy = malloc(length + 1);
+    if (copy != NULL) {
+        memcpy(copy, string, length + 1);
+    }
+    return copy;
+}
+
+/**
+ * Free the strings of an entry.
+ * @param entry Pointer to an `HttpCacheEntry` struct
+ */
+void http_cache_internal_entry_release(HttpCacheEntry *entry) {
+    free(entry->url);
+    free(entry->etag);
+    free(entry->last_modified);
+}
+
+/**
+ * Find the slot of a URL hash: either the slot holding its entry or the empty slot where it belongs.
+ */
+size_t *http_cache_internal_slot(HttpCache *cache, uint64_t hash) {
+    size_t mask = cache->slot_count - 1;
+    for (size_t i = (size_t)hash & mask;; i = (i + 1) & mask) {
+        size_t *slot = &cache->slots[i];
+        if (*slot == 0 || cache->entries[*slot - 1].hash == hash) {
+            return slot;
+        }
+    }
+}
+
+/**
+ * Double the hash index and reinsert every entry.
+ * @return 0 on success, 1 on allocation failure
+ */
+int http_cache_internal_grow_slots(HttpCache *cache) {
+    size_t slot_count = cache->slot_count == 0 ? HTTP_CACHE_INITIAL_SLOTS : cache->slot_count << 1;
+    size_t *slots = calloc(slot_count, sizeof(*slots));
+    if (slots == NULL) {
+        return 1;
+    }
+    free(cache->slots);
+    cache->slots = slots;
+    cache->slot_count = slot_count;
+    for (size_t i = 0; i < cache->len; i += 1) {
+        *http_cache_internal_slot(cache, cache->entries[i].hash) = i + 1;
+    }
+    return 0;
+}
+
+/**
+ * Clear the slot of an entry and move later entries of its probe sequence up, so that lookups still find them.
+ * @param cache Pointer to an `HttpCache` struct
+ * @param hash Hash of the entry
+ */
+void http_cache_internal_unindex(HttpCache *cache, uint64_t hash) {
+    size_t mask = cache->slot_count - 1;
+    size_t i = (size_t)(http_cache_internal_slot(cache, hash) - cache->slots);
+    for (size_t j = (i + 1) & mask; cache->slots[j] != 0; j = (j + 1) & mask) {
+        size_t home = (size_t)cache->entries[cache->slots[j] - 1].hash & mask;
+        // The entry in `j` may fill the gap unless its home slot lies after the gap
+        if (((j - home) & mask) >= ((j - i) & mask)) {
+            cache->slots[i] = cache->slots[j];
+            i = j;
+        }
+    }
+    cache->slots[i] = 0;
+}
+
+/**
+ * Take an entry out of the LRU list.
+ * @param cache Pointer to an `HttpCache` struct
+ * @param index Index of the entry
+ */
+void http_cache_internal_unlink(HttpCache *cache, size_t index) {
+    HttpCacheEntry *entry = &cache->entries[index];
+    *(entry->older != 0 ? &cache->entries[entry->older - 1].newer : &cache->oldest) = entry->newer;
+    *(entry->newer != 0 ? &cache->entries[entry->newer - 1].older : &cache->newest) = entry->older;
+    entry->older = 0;
+    entry->newer = 0;
+}
+
+/**
+ * Put an entry into the LRU list by its `last_used`.
+ * The search starts at the most recently used end, so it is immediate for entries that were just used.
+ * @param cache Pointer to an `HttpCache` struct
+ * @param index Index of the entry, not in the list
+ */
+void http_cache_internal_link(HttpCache *cache, size_t index) {
+    HttpCacheEntry *entry = &cache->entries[index];
+    size_t newer = 0, older = cache->newest;
+    while (older != 0 && cache->entries[older - 1].last_used > entry->last_used) {
+        newer = older;
+        older = cache->entries[older - 1].older;
+    }
+    entry->older = older;
+    entry->newer = newer;
+    *(older != 0 ? &cache->entries[older - 1].newer : &cache->oldest) = index + 1;
+    *(newer != 0 ? &cache->entries[newer - 1].older : &cache->newest) = index + 1;
+}
+
+/**
+ * Mark an entry as the most recently used one.
+ * @param cache Pointer to an `HttpCache` struct
+ * @param entry Pointer to the entry
+ */
+void http_cache_internal_touch(HttpCache *cache, HttpCacheEntry *entry) {
+    size_t index = (size_t)(entry - cache->entries);
+    http_cache_internal_unlink(cache, index);
+    cache->clock += 1;
+    entry->last_used = cache->clock;
+    http_cache_internal_link(cache, index);
+}
+
+/**
+ * Find the entry of a URL.
+ * @param cache Pointer to an `HttpCache` struct
+ * @param hash Hash of the URL
+ * @return Pointer to the entry or `NULL`
+ */
+HttpCacheEntry *http_cache_internal_find(HttpCache *cache, uint64_t hash) {
+    if (cache->slot_count == 0) {
+        return NULL;
+    }
+    size_t *slot = http_cache_internal_slot(cache, hash);
+    return *slot == 0 ? NULL : &cache->entries[*slot - 1];
+}
+
+/**
+ * Remove an entry and its files from the cache.
+ * The last entry takes its place in the table, so pointers to it are invalidated as well.
+ * @param cache Pointer to an `HttpCache` struct
+ * @param entry Pointer to the entry, invalidated by the call
+ */
+void http_cache_internal_remove(HttpCache *cache, HttpCacheEntry *entry) {
+    char path[4096];
+    size_t index = (size_t)(entry - cache->entries), last = cache->len - 1;
+    http_cache_internal_path(cache, entry->key, "", path, sizeof(path));
+    remove(path);
+    http_cache_internal_path(cache, entry->key, HTTP_CACHE_HEADERS_SUFFIX, path, sizeof(path));
+    remove(path);
+    cache->size -= entry->size;
+    http_cache_internal_unindex(cache, entry->hash);
+    http_cache_internal_unlink(cache, index);
+    http_cache_internal_entry_release(entry);
+    if (index != last) {
+        // Point the slot and the list neighbours of the last entry at its new index
+        HttpCacheEntry *moved = &cache->entries[last];
+        *http_cache_internal_slot(cache, moved->hash) = index + 1;
+        *(moved->older != 0 ? &cache->entries[moved->older - 1].newer : &cache->oldest) = index + 1;
+        *(moved->newer != 0 ? &cache->entries[moved->newer - 1].older : &cache->newest) = index + 1;
+        *entry = *moved;
+    }
+    cache->len -= 1;
+}
+
+/**
+ * Evict the least recently used entries until the cache fits in `max_size`.
+ * @param cache Pointer to an `HttpCache` struct
+ */
+void http_cache_internal_evict(HttpCache *cache) {
+    while (cache->size > cache->max_size && cache->oldest != 0) {
+        http_cache_internal_remove(cache, &cache->entries[cache->oldest - 1]);
+        cache->evictions += 1;
+    }
+}
+
+/**
+ * Add an empty entry for a key as the most recently used one.
+ * @param cache Pointer to an `HttpCache` struct
+ * @param key Key of the URL
+ * @param hash Hash of the URL, no entry may have it yet
+ * @return Pointer to the new entry or `NULL` on allocation failure
+ */
+HttpCacheEntry *http_cache_internal_add(HttpCache *cache, const char *key, uint64_t hash) {
+    if (cache->len == cache->cap) {
+        size_t cap = cache->cap == 0 ? 16 : cache->cap << 1;
+        HttpCacheEntry *entries = realloc(cache->entries, cap * sizeof(*entries));
+        if (entries == NULL) {
+            return NULL;
+        }
+        cache->entries = entries;
+        cache->cap = cap;
+    }
+    // Keep the index at most half full
+    if ((cache->len + 1) * 2 > cache->slot_count && http_cache_internal_grow_slots(cache) != 0) {
+        return NULL;
+    }
+    size_t index = cache->len;
+    HttpCacheEntry *entry = &cache->entries[index];
+    *entry = (HttpCacheEntry) {.hash = hash};
+    memcpy(entry->key, key, sizeof(entry->key));
+    cache->len += 1;
+    *http_cache_internal_slot(cache, hash) = index + 1;
+    cache->clock += 1;
+    entry->last_used = cache->clock;
+    http_cache_internal_link(cache, index);
+    return entry;
+}
+
+/**
+ * Check whether a response depends on request headers other than `Accept-Encoding`.
+ * Those variants can't be told apart by URL. `Accept-Encoding` is fine as bodies are stored decoded
+ * whenever the client negotiates an encoding.
+ * @param curl The curl easy handle of the finished transfer
+ * @return 1 if a `Vary` header names another request header or `*`, else 0
+ */
+int http_cache_internal_varies(CURL *curl) {
+    struct curl_header *header;
+    for (size_t i = 0; curl_easy_header(curl, "Vary", i, CURLH_HEADER, -1, &header) == CURLHE_OK; i += 1) {
+        const char *name = header->value;
+        while (*name != '\0') {
+            name += strspn(name, " \t,");
+            size_t length = strcspn(name, " \t,");
+            if (length > 0 && !(length == 15 && curl_strnequal(name, "Accept-Encoding", 15))) {
+                return 1;
+            }
+            name += length;
+        }
+    }
+    return 0;
+}
+
+/**
+ * Work out until when a response may be served without revalidation.
+ * Honours `Cache-Control: no-store, no-cache, max-age` and `Expires`, and never stores responses that vary.
+ * @param curl The curl easy handle of the finished transfer
+ * @param now Current time
+ * @param expires Output for the expiry time
+ * @return 0 if the response must not be stored, else 1
+ */
+int http_cache_internal_freshness(CURL *curl, time_t now, time_t *expires) {
+    struct curl_header *header;
+    *expires = now;
+    if (http_cache_internal_varies(curl)) {
+        return 0;
+    }
+    if (curl_easy_header(curl, "Cache-Control", 0, CURLH_HEADER, -1, &header) == CURLHE_OK) {
+        const char *value = header->value;
+        if (strstr(value, "no-store") != NULL) {
+            return 0;
+        }
+        if (strstr(value, "no-cache") != NULL) {
+            return 1;
+        }
+        const char *max_age = strstr(value, "max-age=");
+        if (max_age != NULL) {
+            *expires = now + (time_t)strtol(max_age + 8, NULL, 10);
+            return 1;
+        }
+    }
+    if (curl_easy_header(curl, "Expires", 0, CURLH_HEADER, -1, &header) == CURLHE_OK) {
+        time_t date = curl_getdate(header->value, NULL);
+        if (date > now) {
+            *expires = date;
+        }
+    }
+    return 1;
+}
+
+/**
+ * Update the validators of an entry from the response headers.
+ * @param entry Pointer to an `HttpCacheEntry` struct
+ * @param curl The curl easy handle of the finished transfer
+ */
+void http_cache_internal_load_validators(HttpCacheEntry *entry, CURL *curl) {
+    struct curl_header *header;
+    if (curl_easy_header(curl, "ETag", 0, CURLH_HEADER, -1, &header) == CURLHE_OK) {
+        free(entry->etag);
+        entry->etag = http_cache_internal_strdup(header->value);
+    }
+    if (curl_easy_header(curl, "Last-Modified", 0, CURLH_HEADER, -1, &header) == CURLHE_OK) {
+        free(entry->last_modified);
+        entry->last_modified = http_cache_internal_strdup(header->value);
+    }
+}
+
+/**
+ * @return 1 if the header only applies to a single connection and must not be stored
+ */
+int http_cache_internal_is_hop_header(const char *name) {
+    static const char *const hop_headers[] = {
+        "Connection", "Keep-Alive", "Proxy-Authenticate", "Proxy-Authorization", "TE", "Trailer", "Transfer-Encoding", "Upgrade",
+    };
+    for (size_t i = 0; i < sizeof(hop_headers) / sizeof(*hop_headers); i += 1) {
+        if (curl_strequal(name, hop_headers[i])) {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+/**
+ * Free a header store allocated by the cache.
+ * @param headers Pointer to an `HttpHeaders` struct, may be `NULL`
+ */
+void http_cache_internal_free_headers(HttpHeaders *headers) {
+    if (headers != NULL) {
+        http_headers_release(headers);
+        free(headers);
+    }
+}
+
+/**
+ * Allocate an empty header store.
+ * @return The store or `NULL` on allocation failure
+ */
+HttpHeaders *http_cache_internal_new_headers(void) {
+    HttpHeaders *headers = malloc(sizeof(*headers));
+    if (headers != NULL && http_headers_init(headers) != 0) {
+        http_cache_internal_free_headers(headers);
+        headers = NULL;
+    }
+    return headers;
+}
+
+/**
+ * @return 1 if the header describes the body as stored on disk rather than the response
+ */
+int http_cache_internal_is_body_header(const char *name) {
+    return curl_strequal(name, "Content-Length") || curl_strequal(name, "Content-Encoding");
+}
+
+/**
+ * Combine stored headers with the headers of the response the transfer just received.
+ * The response's headers replace the stored ones of the same name, except `Content-Length` and
+ * `Content-Encoding` which in a 304 do not describe the stored body. Hop-by-hop headers are left out.
+ * A response stored for the first time gets the `Content-Length` of the stored body, and loses
+ * `Content-Encoding` when curl decoded the body.
+ * @param curl The curl easy handle of the finished transfer
+ * @param stored The stored headers, or `NULL` when the response is stored for the first time
+ * @param decoded The client negotiates encodings, so curl decoded the body before it was stored
+ * @param size Size of the stored body
+ * @param merged Output for the new header store, free it with `http_cache_internal_free_headers`
+ * @return 0 on success, 1 on allocation failure
+ */
+int http_cache_internal_merge_headers(CURL *curl, HttpHeaders *stored, int decoded, size_t size, HttpHeaders **merged) {
+    struct curl_header *header = NULL, *replacement;
+    HttpHeaderField field;
+    size_t iterator = 0;
+    int error = 0;
+    *merged = http_cache_internal_new_headers();
+    if (*merged == NULL) {
+        return 1;
+    }
+    while (!error && stored != NULL && http_headers_next(stored, &iterator, &field)) {
+        if (http_cache_internal_is_body_header(field.name)
+            || curl_easy_header(curl, field.name, 0, CURLH_HEADER, -1, &replacement) != CURLHE_OK) {
+            error = http_headers_add(*merged, field.name, strlen(field.name), field.value, strlen(field.value));
+        }
+    }
+    while (!error && (header = curl_easy_nextheader(curl, CURLH_HEADER, -1, header)) != NULL) {
+        int keep = !http_cache_internal_is_body_header(header->name)
+            || (stored == NULL && !decoded && curl_strequal(header->name, "Content-Encoding"));
+        if (keep && !http_cache_internal_is_hop_header(header->name)) {
+            error = http_headers_add(*merged, header->name, strlen(header->name), header->value, strlen(header->value));
+        }
+    }
+    if (!error && stored == NULL) {
+        char length[32];
+        int length_length = snprintf(length, sizeof(length), "%zu", size);
+        error = http_headers_add(*merged, "Content-Length", 14, length, (size_t)length_length);
+    }
+    if (error) {
+        http_cache_internal_free_headers(*merged);
+        *merged = NULL;
+    }
+    return error;
+}
+
+/**
+ * Write the headers of an entry next to its body.
+ * @param cache Pointer to an `HttpCache` struct
+ * @param key Key of the entry
+ * @param headers The headers
+ * @return 0 on success, else 1
+ */
+int http_cache_internal_write_headers(HttpCache *cache, const char *key, HttpHeaders *headers) {
+    char path[4096], tmp_path[4096];
+    HttpHeaderField field;
+    size_t iterator = 0;
+    http_cache_internal_path(cache, key, HTTP_CACHE_HEADERS_SUFFIX, path, sizeof(path));
+    http_cache_internal_path(cache, key, HTTP_CACHE_HEADERS_SUFFIX ".tmp", tmp_path, sizeof(tmp_path));
+    FILE *file = fopen(tmp_path, "w");
+    if (file == NULL) {
+        return 1;
+    }
+    while (http_headers_next(headers, &iterator, &field)) {
+        fprintf(file, "%s: %s\n", field.name, field.value);
+    }
+    if (fclose(file) != 0) {
+        remove(tmp_path);
+        return 1;
+    }
+    remove(path);
+    return rename(tmp_path, path) != 0;
+}
+
+/**
+ * Read the headers of an entry from disk.
+ * @param cache Pointer to an `HttpCache` struct
+ * @param key Key of the entry
+ * @param headers Output for the new header store, free it with `http_cache_internal_free_headers`
+ * @return 0 on success, 1 if the file could not be read
+ */
+int http_cache_internal_read_headers(HttpCache *cache, const char *key, HttpHeaders **headers) {
+    char path[4096], line[8192];
+    int error = 0;
+    http_cache_internal_path(cache, key, HTTP_CACHE_HEADERS_SUFFIX, path, sizeof(path));
+    *headers = NULL;
+    FILE *file = fopen(path, "r");
+    if (file == NULL) {
+        return 1;
+    }
+    *headers = http_cache_internal_new_headers();
+    error = *headers == NULL;
+    while (!error && fgets(line, sizeof(line), file) != NULL) {
+        error = http_headers_add_line(*headers, line, strlen(line));
+    }
+    if (ferror(file)) {
+        error = 1;
+    }
+    fclose(file);
+    if (error) {
+        http_cache_internal_free_headers(*headers);
+        *headers = NULL;
+    }
+    return error;
+}
+
+/**
+ * Pass a cached body from disk to a sink.
+ * @param cache Pointer to an `HttpCache` struct
+ * @param entry Pointer to the entry
+ * @param sink The sink
+ * @return 1 on success, 0 if the body file could not be read or the sink aborted
+ */
+int http_cache_internal_serve(HttpCache *cache, HttpCacheEntry *entry, HttpSink *sink) {
+    char path[4096];
+    http_cache_internal_path(cache, entry->key, "", path, sizeof(path));
+    FILE *file = fopen(path, "rb");
+    if (file == NULL) {
+        return 0;
+    }
+    char *chunk = malloc(HTTP_CACHE_READ_CHUNK_SIZE);
+    int ok = chunk != NULL;
+    size_t n;
+    while (ok && (n = fread(chunk, 1, HTTP_CACHE_READ_CHUNK_SIZE, file)) > 0) {
+        ok = sink->body_write_function(chunk, 1, n, sink->user_data) == n;
+    }
+    free(chunk);
+    fclose(file);
+    return ok;
+}
+
+#else
+
+uint64_t http_cache_internal_key(const char *url, char key[17]);
+void http_cache_internal_path(HttpCache *cache, const char *name, const char *suffix, char *path, size_t path_size);
+char *http_cache_internal_strdup(const char *string);
+void http_cache_internal_entry_release(HttpCacheEntry *entry);
+size_t *http_cache_internal_slot(HttpCache *cache, uint64_t hash);
+int http_cache_internal_grow_slots(HttpCache *cache);
+void http_cache_internal_unindex(HttpCache *cache, uint64_t hash);
+void http_cache_internal_unlink(HttpCache *cache, size_t index);
+void http_cache_internal_link(HttpCache *cache, size_t index);
+void http_cache_internal_touch(HttpCache *cache, HttpCacheEntry *entry);
+HttpCacheEntry *http_cache_internal_find(HttpCache *cache, uint64_t hash);
+void http_cache_internal_remove(HttpCache *cache, HttpCacheEntry *entry);
+void http_cache_internal_evict(HttpCache *cache);
+HttpCacheEntry *http_cache_internal_add(HttpCache *cache, const char *key, uint64_t hash);
+int http_cache_internal_varies(CURL *curl);
+int http_cache_internal_freshness(CURL *curl, time_t now, time_t *expires);
+void http_cache_internal_load_validators(HttpCacheEntry *entry, CURL *curl);
+int http_cache_internal_is_hop_header(const char *name);
+void http_cache_internal_free_headers(HttpHeaders *headers);
+HttpHeaders *http_cache_internal_new_headers(void);
+int http_cache_internal_is_body_header(const char *name);
+int http_cache_internal_merge_headers(CURL *curl, HttpHeaders *stored, int decoded, size_t size, HttpHeaders **merged);
+int http_cache_internal_write_headers(HttpCache *cache, const char *key, HttpHeaders *headers);
+int http_cache_internal_read_headers(HttpCache *cache, const char *key, HttpHeaders **headers);
+int http_cache_internal_serve(HttpCache *cache, HttpCacheEntry *entry, HttpSink *sink);
+
+#endif
+
+/**
+ * Sink state of a request that goes through the cache.
+ * Writes the body to a temporary file while passing it to the caller's sink.
+ */
+typedef struct HttpCacheInternalTee {
+    HttpSink *sink;
+    FILE *file;
+    size_t size;
+} HttpCacheInternalTee;
+
+#ifdef CLIB_HTTP_DEFINITIONS
+
+size_t http_cache_internal_tee_write(char *chunk, size_t size, size_t count, void *user_data) {
+    HttpCacheInternalTee *tee = user_data;
+    size_t n = size * count;
+    if (tee->file != NULL && fwrite(chunk, 1, n, tee->file) != n) {
+        // Keep serving the caller, the response just won't be stored
+        fclose(tee->file);
+        tee->file = NULL;
+    }
+    tee->size += n;
+    return tee->sink->body_write_function(chunk, size, count, tee->sink->user_data);
+}
+
+size_t http_cache_internal_tee_header(char *header, size_t size, size_t count, void *user_data) {
+    HttpCacheInternalTee *tee = user_data;
+    if (tee->sink->header_write_function == NULL) {
+        return size * count;
+    }
+    return tee->sink->header_write_function(header, size, count, tee->sink->user_data);
+}
+
+int http_cache_internal_tee_poll(HttpSink *tee_sink) {
+    HttpCacheInternalTee *tee = tee_sink->user_data;
+    return tee->sink->poll_function(tee->sink);
+}
+
+#else
+
+size_t http_cache_internal_tee_write(char *chunk, size_t size, size_t count, void *user_data);
+size_t http_cache_internal_tee_header(char *header, size_t size, size_t count, void *user_data);
+int http_cache_internal_tee_poll(HttpSink *tee_sink);
+
+#endif
+
+#pragma endregion
+
+#ifdef CLIB_HTTP_DEFINITIONS
+
+/**
+ * Initialize a response cache and load its index from the cache directory.
+ * NOTE: Allocates memory! Release the cache with `http_cache_release`.
+ * @param cache Pointer to an `HttpCache` struct
+ * @param directory An existing directory for the cached bodies
+ * @param max_size Upper bound for the total size of the cached bodies in bytes
+ * @return 0 on success, else 1
+ */
+int http_cache_init(HttpCache *cache, const char *directory, size_t max_size) {
+    *cache = (HttpCache) {
+        .directory = http_cache_internal_strdup(directory),
+        .max_size = max_size,
+    };
+    if (cache->directory == NULL) {
+        return 1;
+    }
+
+    char path[4096];
+    http_cache_internal_path(cache, HTTP_CACHE_INDEX_FILE, "", path, sizeof(path));
+    FILE *file = fopen(path, "r");
+    if (file == NULL) {
+        return 0;
+    }
+
+    // One entry per line: key, expires, size, last used, etag, last modified and the URL, separated by tabs
+    char line[8192];
+    while (fgets(line, sizeof(line), file) != NULL) {
+        char *fields[7];
+        char *cursor = line;
+        line[strcspn(line, "\n")] = '\0';
+        for (int i = 0; i < 7; i += 1) {
+            fields[i] = cursor;
+            cursor = i < 6 ? strchr(cursor, '\t') : NULL;
+            if (i < 6 && cursor == NULL) {
+                goto ContinueOuterLoop;
+            }
+            if (cursor != NULL) {
+                *cursor++ = '\0';
+            }
+        }
+        if (strlen(fields[0]) != 16 || strspn(fields[0], "0123456789abcdef") != 16) {
+            goto ContinueOuterLoop;
+        }
+        uint64_t hash = strtoull(fields[0], NULL, 16);
+        if (http_cache_internal_find(cache, hash) != NULL) {
+            goto ContinueOuterLoop;
+        }
+        // Bodies stored without their headers can't be served as complete responses
+        char headers_path[4096];
+        http_cache_internal_path(cache, fields[0], HTTP_CACHE_HEADERS_SUFFIX, headers_path, sizeof(headers_path));
+        FILE *headers_file = fopen(headers_path, "r");
+        if (headers_file == NULL) {
+            http_cache_internal_path(cache, fields[0], "", headers_path, sizeof(headers_path));
+            remove(headers_path);
+            goto ContinueOuterLoop;
+        }
+        fclose(headers_file);
+        HttpCacheEntry *entry = http_cache_internal_add(cache, fields[0], hash);
+        if (entry == NULL) {
+            break;
+        }
+        entry->expires = (time_t)strtoll(fields[1], NULL, 10);
+        entry->size = (size_t)strtoull(fields[2], NULL, 10);
+        // Move it to its place in the LRU list, which is the end when the index was written by `http_cache_save`
+        http_cache_internal_unlink(cache, cache->len - 1);
+        entry->last_used = strtoull(fields[3], NULL, 10);
+        http_cache_internal_link(cache, cache->len - 1);
+        entry->etag = *fields[4] ? http_cache_internal_strdup(fields[4]) : NULL;
+        entry->last_modified = *fields[5] ? http_cache_internal_strdup(fields[5]) : NULL;
+        entry->url = http_cache_internal_strdup(fields[6]);
+        cache->size += entry->size;
+        if (entry->last_used > cache->clock) {
+            cache->clock = entry->last_used;
+        }
+ContinueOuterLoop:
+        ;
+    }
+    fclose(file);
+    http_cache_internal_evict(cache);
+    return 0;
+}
+
+/**
+ * Write the cache index to the cache directory.
+ * @param cache Pointer to an `HttpCache` struct
+ * @return 0 on success, else 1
+ */
+int http_cache_save(HttpCache *cache) {
+    char path[4096], tmp_path[4096];
+    http_cache_internal_path(cache, HTTP_CACHE_INDEX_FILE, "", path, sizeof(path));
+    http_cache_internal_path(cache, HTTP_CACHE_INDEX_FILE, ".tmp", tmp_path, sizeof(tmp_path));
+    FILE *file = fopen(tmp_path, "w");
+    if (file == NULL) {
+        return 1;
+    }
+    // From the least to the most recently used, so the next `http_cache_init` can append every entry to its LRU list
+    for (size_t i = cache->oldest; i != 0; i = cache->entries[i - 1].newer) {
+        HttpCacheEntry *entry = &cache->entries[i - 1];
+        fprintf(file, "%s\t%lld\t%llu\t%llu\t%s\t%s\t%s\n",
+            entry->key,
+            (long long)entry->expires,
+            (unsigned long long)entry->size,
+            (unsigned long long)entry->last_used,
+            entry->etag != NULL ? entry->etag : "",
+            entry->last_modified != NULL ? entry->last_modified : "",
+            entry->url != NULL ? entry->url : "");
+    }
+    if (fclose(file) != 0) {
+        remove(tmp_path);
+        return 1;
+    }
+    remove(path);
+    return rename(tmp_path, path) != 0;
+}
+
+/**
+ * Save the cache index and free all the associated memory of the cache.
+ * The cached responses stay on disk for the next `http_cache_init`.
+ * @param cache Pointer to an `HttpCache` struct
+ */
+void http_cache_release(HttpCache *cache) {
+    http_cache_save(cache);
+    for (size_t i = 0; i < cache->len; i += 1) {
+        http_cache_internal_entry_release(&cache->entries[i]);
+    }
+    free(cache->entries);
+    free(cache->slots);
+    free(cache->directory);
+    *cache = (HttpCache) {0};
+}
+
+/**
+ * Perform an HTTP GET request through the cache.
+ * Fresh entries are served from disk without a request. Stale entries are
+ * revalidated with `If-None-Match`/`If-Modified-Since`, and a 304 answer
+ * serves the body from disk. Full 200 responses are stored for later use,
+ * with their headers but without the hop-by-hop ones. Responses with a `Vary`
+ * on request headers other than `Accept-Encoding` are not stored.
+ * @param cache Pointer to an initialized `HttpCache` struct
+ * @param client Pointer to an initialized `HttpClient` struct
+ * @param url The request URL
+ * @param sink The sink for the response
+ * @return An `HttpResponse` struct, `code` is 200 when the body came from the cache.
+ *         When it did, `headers` holds the stored headers, updated by the 304 if there was one.
+ *         `curl_handle` is `NULL` for fresh hits. Release it with `http_client_response_release`.
+ */
+HttpResponse http_cache_get(HttpCache *cache, HttpClient *client, const char *url, HttpSink *sink) {
+    HttpResponse response = {0};
+    struct curl_slist *headers = NULL;
+    char key[17], path[4096], tmp_path[4096], header[1024];
+    time_t now = time(NULL);
+
+    uint64_t hash = http_cache_internal_key(url, key);
+    HttpCacheEntry *entry = http_cache_internal_find(cache, hash);
+    if (entry != NULL && (entry->url == NULL || strcmp(entry->url, url) != 0)) {
+        // Hash collision with another URL, the new one takes the slot
+        http_cache_internal_remove(cache, entry);
+        entry = NULL;
+    }
+
+    if (entry != NULL && now < entry->expires) {
+        http_cache_internal_touch(cache, entry);
+        if (http_cache_internal_read_headers(cache, key, &response.headers) == 0 && http_cache_internal_serve(cache, entry, sink)) {
+            cache->hits += 1;
+            response.code = HttpOk;
+            response.body_bytes = (curl_off_t)entry->size;
+            http_internal_curl_code = CURLE_OK;
+            return response;
+        }
+        http_cache_internal_free_headers(response.headers);
+        response.headers = NULL;
+        http_cache_internal_remove(cache, entry);
+        entry = NULL;
+    }
+
+    if (entry != NULL && entry->etag != NULL) {
+        snprintf(header, sizeof(header), "If-None-Match: %s", entry->etag);
+        headers = curl_slist_append(headers, header);
+    }
+    if (entry != NULL && entry->last_modified != NULL) {
+        snprintf(header, sizeof(header), "If-Modified-Since: %s", entry->last_modified);
+        headers = curl_slist_append(headers, header);
+    }
+
+    http_cache_internal_path(cache, key, "", path, sizeof(path));
+    http_cache_internal_path(cache, key, ".tmp", tmp_path, sizeof(tmp_path));
+    HttpCacheInternalTee tee = {.sink = sink, .file = fopen(tmp_path, "wb")};
+    HttpSink tee_sink = {
+        .body_write_function = http_cache_internal_tee_write,
+        .header_write_function = http_cache_internal_tee_header,
+        .user_data = &tee,
+        .index_headers = sink->index_headers,
+        .poll_function = sink->poll_function != NULL ? http_cache_internal_tee_poll : NULL,
+    };
+
+    CURL *curl = http_client_acquire_handle(client);
+    if (curl == NULL) {
+        http_internal_curl_code = CURLE_OUT_OF_MEMORY;
+        goto FunctionReturn;
+    }
+    http_internal_setup_handle(curl, url, &tee_sink);
+    sink->curl_handle = curl;
+    sink->multi = client->multi;
+    curl_easy_setopt(curl, CURLOPT_HTTPHEADER, headers);
+
+    http_internal_curl_code = http_client_perform(client, curl);
+    sink->multi = NULL;
+    curl_easy_setopt(curl, CURLOPT_HTTPHEADER, NULL);
+    if (http_internal_curl_code != CURLE_OK) {
+        goto FunctionReturn;
+    }
+    http_internal_load_response(curl, &tee_sink, &response);
+
+    time_t expires;
+    struct curl_header *validator;
+    int storable = http_cache_internal_freshness(curl, now, &expires);
+    if (expires <= now
+        && curl_easy_header(curl, "ETag", 0, CURLH_HEADER, -1, &validator) != CURLHE_OK
+        && curl_easy_header(curl, "Last-Modified", 0, CURLH_HEADER, -1, &validator) != CURLHE_OK) {
+        // Neither fresh nor revalidatable, storing it would never save a transfer
+        storable = 0;
+    }
+
+    if (response.code == 304 && entry != NULL) {
+        HttpHeaders *stored_headers, *merged_headers = NULL;
+        int revalidated = http_cache_internal_read_headers(cache, key, &stored_headers) == 0
+            && http_cache_internal_merge_headers(curl, stored_headers, client->options.accept_encoding, entry->size, &merged_headers) == 0
+            && http_cache_internal_write_headers(cache, key, merged_headers) == 0
+            && http_cache_internal_serve(cache, entry, sink);
+        http_cache_internal_free_headers(stored_headers);
+        if (!revalidated) {
+            http_cache_internal_free_headers(merged_headers);
+            http_internal_curl_code = CURLE_READ_ERROR;
+            http_cache_internal_remove(cache, entry);
+            goto FunctionReturn;
+        }
+        // The response carries the stored headers in place of the 304's
+        http_cache_internal_free_headers(tee_sink.headers);
+        tee_sink.headers = merged_headers;
+        cache->revalidations += 1;
+        http_cache_internal_touch(cache, entry);
+        entry->expires = expires;
+        http_cache_internal_load_validators(entry, curl);
+        response.code = HttpOk;
+        response.body_bytes = (curl_off_t)entry->size;
+        goto FunctionReturn;
+    }
+
+    cache->misses += 1;
+    if (response.code != HttpOk || !storable || tee.file == NULL) {
+        if (entry != NULL) {
+            http_cache_internal_remove(cache, entry);
+        }
+        goto FunctionReturn;
+    }
+
+    // Store the new body in place of the old one
+    int stored = fclose(tee.file) == 0;
+    tee.file = NULL;
+    if (entry != NULL) {
+        cache->size -= entry->size;
+        entry->size = 0;
+    }
+    else {
+        entry = http_cache_internal_add(cache, key, hash);
+        if (entry == NULL) {
+            goto FunctionReturn;
+        }
+        entry->url = http_cache_internal_strdup(url);
+    }
+    remove(path);
+    HttpHeaders *stored_headers = NULL;
+    if (!stored || rename(tmp_path, path) != 0
+        || http_cache_internal_merge_headers(curl, NULL, client->options.accept_encoding, tee.size, &stored_headers) != 0
+        || http_cache_internal_write_headers(cache, key, stored_headers) != 0) {
+        http_cache_internal_free_headers(stored_headers);
+        http_cache_internal_remove(cache, entry);
+        goto FunctionReturn;
+    }
+    http_cache_internal_free_headers(stored_headers);
+    http_cache_internal_touch(cache, entry);
+    entry->expires = expires;
+    entry->size = tee.size;
+    cache->size += tee.size;
+    http_cache_internal_load_validators(entry, curl);
+    http_cache_internal_evict(cache);
+
+FunctionReturn:
+    response.error = http_internal_curl_code;
+    http_internal_take_headers(&tee_sink, &response);
+    if (tee.file != NULL) {
+        fclose(tee.file);
+    }
+    remove(tmp_path);
+    curl_slist_free_all(headers);
+    response.curl_handle = curl;
+    return response;
+}
+
+#else
+
+int http_cache_init(HttpCache *cache, const char *directory, size_t max_size);
+int http_cache_save(HttpCache *cache);
+void http_cache_release(HttpCache *cache);
+HttpResponse http_cache_get(HttpCache *cache, HttpClient *client, const char *url, HttpSink *sink);
+
+#endif
+
+#endif
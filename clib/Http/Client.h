@@ -1,16 +1,191 @@
 #ifndef HTTP_CLIENT_H
 #define HTTP_CLIENT_H
 
+#ifdef _WIN32
+#include <io.h>
+#ifndef _INC_WINDOWS
+#include <windows.h>
+#endif
+#else
+#include <pthread.h>
+#endif
+
+#include <stdatomic.h>
+
+#include "Clib.h"
 #include "curl/include/curl/curl.h"
 #include "Buffer.h"
+#include "Headers.h"
+
+/**
+ * Storage class of the per-thread error state.
+ */
+#ifdef _MSC_VER
+#define HTTP_THREAD_LOCAL __declspec(thread)
+#else
+#define HTTP_THREAD_LOCAL _Thread_local
+#endif
+
+/**
+ * The CA bundle that verifies TLS peers, set once with `http_ca_bundle_file` or `http_ca_bundle_blob`.
+ */
+typedef struct HttpCaBundle {
+    char *path;            // Absolute path of the bundle file
+    struct curl_blob blob; // In-memory bundle, used instead of the file if set
+    int resolved;          // The default bundle was looked up
+} HttpCaBundle;
+
+#ifdef CLIB_HTTP_DEFINITIONS
+
+static HTTP_THREAD_LOCAL CURLcode http_internal_curl_code;
+static HttpCaBundle http_internal_ca_bundle;
+static CURLcode http_internal_global_code;
+
+#ifdef _WIN32
+static SRWLOCK http_internal_ca_bundle_lock = SRWLOCK_INIT;
+static INIT_ONCE http_internal_global_once = INIT_ONCE_STATIC_INIT;
+
+void http_internal_ca_bundle_acquire(void) {
+    AcquireSRWLockExclusive(&http_internal_ca_bundle_lock);
+}
 
-static CURLcode http_internal_curl_code;
-static CURLHcode http_internal_curlh_code;
+void http_internal_ca_bundle_return(void) {
+    ReleaseSRWLockExclusive(&http_internal_ca_bundle_lock);
+}
+
+BOOL CALLBACK http_internal_global_init(PINIT_ONCE once, PVOID parameter, PVOID *context) {
+    (void)once;
+    (void)parameter;
+    (void)context;
+    http_internal_global_code = curl_global_init(CURL_GLOBAL_DEFAULT);
+    return TRUE;
+}
+#else
+static pthread_mutex_t http_internal_ca_bundle_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_once_t http_internal_global_once = PTHREAD_ONCE_INIT;
+
+void http_internal_ca_bundle_acquire(void) {
+    pthread_mutex_lock(&http_internal_ca_bundle_lock);
+}
+
+void http_internal_ca_bundle_return(void) {
+    pthread_mutex_unlock(&http_internal_ca_bundle_lock);
+}
+
+void http_internal_global_init(void) {
+    http_internal_global_code = curl_global_init(CURL_GLOBAL_DEFAULT);
+}
+#endif
+
+/**
+ * Initialize libcurl once for the whole process, safe to call from any number of threads at once.
+ * Every function that creates curl handles calls this, calling it up front only moves the cost.
+ * @return The result of `curl_global_init`, the same on every call
+ */
+CURLcode http_global_init(void) {
+#ifdef _WIN32
+    InitOnceExecuteOnce(&http_internal_global_once, http_internal_global_init, NULL, NULL);
+#else
+    pthread_once(&http_internal_global_once, http_internal_global_init);
+#endif
+    return http_internal_global_code;
+}
 
+/**
+ * Release the global libcurl state.
+ * NOTE: Not thread-safe! Call it once at exit, after every other thread stopped using curl.
+ */
+void http_global_cleanup(void) {
+    if (http_internal_global_code == CURLE_OK) {
+        curl_global_cleanup();
+    }
+}
+
+/**
+ * Get the result of the last request made by the calling thread.
+ * Every thread has its own, see also `HttpResponse.error`.
+ * @return `CURLE_OK` if the last request succeeded
+ */
 CURLcode http_get_last_error(void) {
     return http_internal_curl_code;
 }
 
+/**
+ * @return The absolute path of an existing file, `NULL` if it does not exist
+ */
+char *http_internal_absolute_path(const char *path) {
+#ifdef _WIN32
+    char *absolute = _fullpath(NULL, path, 0);
+    if (absolute != NULL && _access(absolute, 0) != 0) {
+        free(absolute);
+        absolute = NULL;
+    }
+    return absolute;
+#else
+    return realpath(path, NULL);
+#endif
+}
+
+/**
+ * Use a CA bundle file for every following request.
+ * The path is resolved once, so later changes of the working directory don't matter.
+ * Handles of an `HttpClient` share its multi handle, which parses the bundle once
+ * and keeps the certificate store cached (see `CURLOPT_CA_CACHE_TIMEOUT`).
+ * Without a call to this or `http_ca_bundle_blob`, `cacert.pem` in the working directory is used.
+ * NOTE: Allocates memory! Release it with `http_ca_bundle_release`.
+ * @param path Path of the PEM bundle
+ * @return `CURLE_OK` on success, `CURLE_SSL_CACERT_BADFILE` if the file does not exist
+ */
+CURLcode http_ca_bundle_file(const char *path) {
+    char *absolute = http_internal_absolute_path(path);
+    if (absolute == NULL) {
+        return CURLE_SSL_CACERT_BADFILE;
+    }
+    http_internal_ca_bundle_acquire();
+    free(http_internal_ca_bundle.path);
+    http_internal_ca_bundle.path = absolute;
+    http_internal_ca_bundle.blob = (struct curl_blob) {0};
+    http_internal_ca_bundle.resolved = 1;
+    http_internal_ca_bundle_return();
+    return CURLE_OK;
+}
+
+/**
+ * Use an in-memory CA bundle for every following request, e.g. one embedded in the binary.
+ * The memory is not copied and must stay valid until `http_ca_bundle_release` or the last request.
+ * @param data The PEM bundle
+ * @param length Length of the bundle in bytes
+ */
+void http_ca_bundle_blob(const void *data, size_t length) {
+    http_internal_ca_bundle_acquire();
+    free(http_internal_ca_bundle.path);
+    http_internal_ca_bundle.path = NULL;
+    http_internal_ca_bundle.blob = (struct curl_blob) {.data = (void*)data, .len = length, .flags = CURL_BLOB_NOCOPY};
+    http_internal_ca_bundle.resolved = 1;
+    http_internal_ca_bundle_return();
+}
+
+/**
+ * Free the CA bundle setting, later requests fall back to `cacert.pem` again.
+ */
+void http_ca_bundle_release(void) {
+    http_internal_ca_bundle_acquire();
+    free(http_internal_ca_bundle.path);
+    http_internal_ca_bundle = (HttpCaBundle) {0};
+    http_internal_ca_bundle_return();
+}
+
+#else
+
+CURLcode http_global_init(void);
+void http_global_cleanup(void);
+CURLcode http_get_last_error(void);
+CURLcode http_ca_bundle_file(const char *path);
+void http_ca_bundle_blob(const void *data, size_t length);
+void http_ca_bundle_release(void);
+
+#endif
+
 /**
  * HTTP status codes enum.
  * @todo Add the missing codes
@@ -24,6 +199,8 @@ typedef enum HttpStatusCode {
     HttpNotFound = 404,
 } HttpStatusCode;
 
+#ifdef CLIB_HTTP_DEFINITIONS
+
 /**
  * A lookup table for HTTP response status messages.
  * The indeces are equivalent to the status codes.
@@ -46,11 +223,39 @@ const char *http_get_status_message(HttpStatusCode code) {
     return http_internal_status_message_lookup_table[code];
 }
 
+#else
+
+const char *http_get_status_message(HttpStatusCode code);
+
+#endif
+
+/**
+ * Timing breakdown of a transfer.
+ * Every value is in microseconds from the start of the transfer until the end of the phase.
+ */
+typedef struct HttpTimings {
+    curl_off_t name_lookup;    // DNS resolution done
+    curl_off_t connect;        // TCP connection established
+    curl_off_t app_connect;    // TLS handshake done, 0 for plain HTTP
+    curl_off_t pre_transfer;   // About to send the request
+    curl_off_t start_transfer; // First byte of the response received
+    curl_off_t total;          // Transfer done
+} HttpTimings;
+
 typedef struct HttpResponse {
     CURL *curl_handle;
     long code, version;
+    HttpTimings timings;
+    curl_off_t bytes_received, bytes_sent; // Body bytes on the wire, without headers
+    curl_off_t body_bytes;                 // Decoded body bytes passed to the sink, more than `bytes_received` for compressed responses
+    int connection_reused;                 // 1 if no new connection had to be opened
+    long local_port;                       // Local port of the connection, tells connections to the same host apart
+    HttpHeaders *headers;                  // Indexed response headers if the sink asked for them, else `NULL`
+    CURLcode error;                        // Result of the transfer, `CURLE_OK` on success
 } HttpResponse;
 
+#ifdef CLIB_HTTP_DEFINITIONS
+
 /**
  * Free all the associated memory of the HTTP response.
  * Call this for every response.
@@ -58,18 +263,26 @@ typedef struct HttpResponse {
  */
 void http_response_release(HttpResponse *r) {
     curl_easy_cleanup(r->curl_handle);
+    if (r->headers != NULL) {
+        http_headers_release(r->headers);
+        free(r->headers);
+        r->headers = NULL;
+    }
 }
 
 /**
  * Get a header value from an HTTP response.
+ * Responses with indexed headers are looked up in the index, else curl is asked.
  * @param r HttpResponse
  * @param header_name Name of the header
  * @return If found, the header value, else `NULL`
  */
 char *http_response_get_header(HttpResponse *r, const char *header_name) {
+    if (r->headers != NULL) {
+        return (char*)http_headers_get(r->headers, header_name);
+    }
     struct curl_header *header;
-    http_internal_curlh_code = curl_easy_header(r->curl_handle, header_name, 0, CURLH_HEADER, 0, &header);
-    if (http_internal_curlh_code != 0) {
+    if (curl_easy_header(r->curl_handle, header_name, 0, CURLH_HEADER, 0, &header) != CURLHE_OK) {
         return NULL;
     }
     return header->value;
@@ -83,20 +296,254 @@ char *http_response_get_header(HttpResponse *r, const char *header_name) {
  * @return If found, the header value, else the default value
  */
 char *http_response_get_header_default(HttpResponse *r, const char *header_name, const char *default_value) {
+    if (r->headers != NULL) {
+        const char *value = http_headers_get(r->headers, header_name);
+        return (char*)(value != NULL ? value : default_value);
+    }
     struct curl_header *header;
-    http_internal_curlh_code = curl_easy_header(r->curl_handle, header_name, 0, CURLH_HEADER, 0, &header);
-    if (http_internal_curlh_code != 0 || header->value == NULL) {
+    if (curl_easy_header(r->curl_handle, header_name, 0, CURLH_HEADER, 0, &header) != CURLHE_OK || header->value == NULL) {
         return (char*)default_value;
     }
     return header->value;
 }
 
+#else
+
+void http_response_release(HttpResponse *r);
+char *http_response_get_header(HttpResponse *r, const char *header_name);
+char *http_response_get_header_default(HttpResponse *r, const char *header_name, const char *default_value);
+
+#endif
+
 /**
  * The write function for curl.
  * https://curl.se/libcurl/c/CURLOPT_WRITEFUNCTION.html
  */
 typedef size_t (*BodyWriteFunction)(char *chunk, size_t size, size_t count, void *user_data);
 
+/**
+ * The header function for curl, called once for every received header line.
+ * https://curl.se/libcurl/c/CURLOPT_HEADERFUNCTION.html
+ */
+typedef size_t (*HeaderWriteFunction)(char *header, size_t size, size_t count, void *user_data);
+
+/**
+ * A sink that receives the response of a request.
+ * Built-in sinks are found in `Sink.h`.
+ */
+typedef struct HttpSink {
+    BodyWriteFunction body_write_function;     // Called with every chunk of the response body
+    HeaderWriteFunction header_write_function; // Optional, called with every response header line
+    void *user_data;                           // Passed into both functions
+    CURL *curl_handle;                         // Set by the request functions while the sink is in use
+    curl_off_t body_bytes;                     // Set by the request functions, bytes accepted by the body write function
+    int index_headers;                         // Collect the response headers into `HttpResponse.headers`
+    HttpHeaders *headers;                      // Set by the request functions while headers are collected
+    int (*poll_function)(struct HttpSink *sink); // Optional, called on the thread that drives the transfer while it runs, also while it is paused. Non-zero aborts it.
+    _Atomic(CURLM*) multi;                     // Set by the request functions that wait in `curl_multi_poll`, so other threads can wake them up
+} HttpSink;
+
+#pragma region Internals
+
+#ifdef CLIB_HTTP_DEFINITIONS
+
+/**
+ * Body write function installed for every sink.
+ * Counts the decoded body bytes before passing them on to the sink.
+ */
+size_t http_internal_sink_write(char *chunk, size_t size, size_t count, void *user_data) {
+    HttpSink *sink = user_data;
+    size_t n = sink->body_write_function(chunk, size, count, sink->user_data);
+    if (n == size * count) {
+        sink->body_bytes += n;
+    }
+    return n;
+}
+
+/**
+ * Header function installed for sinks that index their headers.
+ * Adds the line to the sink's header store before passing it on to the sink.
+ */
+size_t http_internal_sink_header(char *header, size_t size, size_t count, void *user_data) {
+    HttpSink *sink = user_data;
+    if (http_headers_add_line(sink->headers, header, size * count) != 0) {
+        return 0;
+    }
+    if (sink->header_write_function != NULL) {
+        return sink->header_write_function(header, size, count, sink->user_data);
+    }
+    return size * count;
+}
+
+/**
+ * Progress function installed for sinks with a poll function.
+ * curl calls it about once a second while a transfer is paused, and after every wake-up of the multi handle.
+ * https://curl.se/libcurl/c/CURLOPT_XFERINFOFUNCTION.html
+ */
+int http_internal_sink_progress(void *user_data, curl_off_t download_total, curl_off_t downloaded, curl_off_t upload_total, curl_off_t uploaded) {
+    HttpSink *sink = user_data;
+    (void)download_total;
+    (void)downloaded;
+    (void)upload_total;
+    (void)uploaded;
+    return sink->poll_function(sink) != 0;
+}
+
+/**
+ * Hand the sink's header store over to the response, it is freed with the response.
+ * @param sink The sink of the transfer
+ * @param response Pointer to the response
+ */
+void http_internal_take_headers(HttpSink *sink, HttpResponse *response) {
+    response->headers = sink->headers;
+    sink->headers = NULL;
+}
+
+/**
+ * Point a handle at the CA bundle, looking up the default bundle on first use.
+ * @param curl The curl easy handle
+ */
+void http_internal_setup_ca_bundle(CURL *curl) {
+    // curl copies the path and the blob struct, the lock only has to cover the setopt
+    http_internal_ca_bundle_acquire();
+    if (!http_internal_ca_bundle.resolved) {
+        http_internal_ca_bundle.path = http_internal_absolute_path("cacert.pem");
+        http_internal_ca_bundle.resolved = 1;
+    }
+    if (http_internal_ca_bundle.blob.data != NULL) {
+        curl_easy_setopt(curl, CURLOPT_CAINFO_BLOB, &http_internal_ca_bundle.blob); // SSL certificates, parsed from memory
+    }
+    else if (http_internal_ca_bundle.path != NULL) {
+        curl_easy_setopt(curl, CURLOPT_CAINFO, http_internal_ca_bundle.path);      // SSL certificates, absolute path
+    }
+    else {
+        curl_easy_setopt(curl, CURLOPT_CAINFO, "cacert.pem");                      // SSL certificates
+    }
+    http_internal_ca_bundle_return();
+}
+
+/**
+ * Apply the common request options to a curl easy handle.
+ * @param curl The curl easy handle
+ * @param url The request URL
+ * @param sink The sink for the response
+ */
+void http_internal_setup_handle(CURL *curl, const char *url, HttpSink *sink) {
+    curl_easy_setopt(curl, CURLOPT_URL, url);                           // Set the request URL
+    curl_easy_setopt(curl, CURLOPT_USERAGENT, "Mozilla/5.0 (Windows NT 10.0; Win64; x64) AppleWebKit/537.36 (KHTML, like Gecko) Chrome/117.0.0.0 Safari/537.36");
+    curl_easy_setopt(curl, CURLOPT_FOLLOWLOCATION, 1L);                 // Follow HTTP 3xx redirects
+    http_internal_setup_ca_bundle(curl);
+    curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION, http_internal_sink_write);      // Body write function
+    curl_easy_setopt(curl, CURLOPT_WRITEDATA, sink);                              // Body write function user data
+    if (sink->index_headers && sink->headers == NULL) {
+        HttpHeaders *headers = malloc(sizeof(*headers));
+        if (headers != NULL && http_headers_init(headers) != 0) {
+            http_headers_release(headers);
+            free(headers);
+            headers = NULL;
+        }
+        sink->headers = headers; // Without a store the response falls back to curl's header API
+    }
+    else if (sink->headers != NULL) {
+        http_headers_clear(sink->headers);
+    }
+    if (sink->headers != NULL) {
+        curl_easy_setopt(curl, CURLOPT_HEADERFUNCTION, http_internal_sink_header);  // Index the headers, then pass them on to the sink
+        curl_easy_setopt(curl, CURLOPT_HEADERDATA, sink);                          // Header write function user data
+    }
+    else if (sink->header_write_function != NULL) {
+        curl_easy_setopt(curl, CURLOPT_HEADERFUNCTION, sink->header_write_function);  // Header write function
+        curl_easy_setopt(curl, CURLOPT_HEADERDATA, sink->user_data);              // Header write function user data
+    }
+    else {
+        curl_easy_setopt(curl, CURLOPT_HEADERFUNCTION, NULL);                     // No header function
+        curl_easy_setopt(curl, CURLOPT_HEADERDATA, NULL);                         // Without a header function curl would pass headers to the body write function
+    }
+    if (sink->poll_function != NULL) {
+        curl_easy_setopt(curl, CURLOPT_XFERINFOFUNCTION, http_internal_sink_progress); // Poll the sink on the driving thread
+        curl_easy_setopt(curl, CURLOPT_XFERINFODATA, sink);                            // Progress function user data
+        curl_easy_setopt(curl, CURLOPT_NOPROGRESS, 0L);                                // Without this curl never calls the progress function
+    }
+    sink->curl_handle = curl;
+    sink->body_bytes = 0;
+    sink->multi = NULL;
+}
+
+/**
+ * Read the response info of a finished transfer into `response`.
+ * @param curl The curl easy handle
+ * @param sink The sink of the transfer
+ * @param response Pointer to the response to fill in
+ */
+void http_internal_load_response(CURL *curl, HttpSink *sink, HttpResponse *response) {
+    long connects = 0;
+    response->body_bytes = sink->body_bytes;
+    curl_easy_getinfo(curl, CURLINFO_RESPONSE_CODE, &response->code);
+    curl_easy_getinfo(curl, CURLINFO_HTTP_VERSION, &response->version);
+    curl_easy_getinfo(curl, CURLINFO_NAMELOOKUP_TIME_T, &response->timings.name_lookup);
+    curl_easy_getinfo(curl, CURLINFO_CONNECT_TIME_T, &response->timings.connect);
+    curl_easy_getinfo(curl, CURLINFO_APPCONNECT_TIME_T, &response->timings.app_connect);
+    curl_easy_getinfo(curl, CURLINFO_PRETRANSFER_TIME_T, &response->timings.pre_transfer);
+    curl_easy_getinfo(curl, CURLINFO_STARTTRANSFER_TIME_T, &response->timings.start_transfer);
+    curl_easy_getinfo(curl, CURLINFO_TOTAL_TIME_T, &response->timings.total);
+    curl_easy_getinfo(curl, CURLINFO_SIZE_DOWNLOAD_T, &response->bytes_received);
+    curl_easy_getinfo(curl, CURLINFO_SIZE_UPLOAD_T, &response->bytes_sent);
+    curl_easy_getinfo(curl, CURLINFO_NUM_CONNECTS, &connects);
+    curl_easy_getinfo(curl, CURLINFO_LOCAL_PORT, &response->local_port);
+    response->connection_reused = connects == 0;
+}
+
+#else
+
+size_t http_internal_sink_write(char *chunk, size_t size, size_t count, void *user_data);
+size_t http_internal_sink_header(char *header, size_t size, size_t count, void *user_data);
+int http_internal_sink_progress(void *user_data, curl_off_t download_total, curl_off_t downloaded, curl_off_t upload_total, curl_off_t uploaded);
+void http_internal_take_headers(HttpSink *sink, HttpResponse *response);
+void http_internal_setup_ca_bundle(CURL *curl);
+void http_internal_setup_handle(CURL *curl, const char *url, HttpSink *sink);
+void http_internal_load_response(CURL *curl, HttpSink *sink, HttpResponse *response);
+
+#endif
+
+#pragma endregion
+
+#ifdef CLIB_HTTP_DEFINITIONS
+
+/**
+ * Perform an HTTP GET request into a sink.
+ * @param url The request URL
+ * @param sink The sink for the response
+ * @return An `HttpResponse` struct.
+ */
+HttpResponse http_request_get_sink(const char *url, HttpSink *sink) {
+    HttpResponse response = {0};
+    CURL *curl = NULL;
+
+    http_internal_curl_code = http_global_init();
+    if (http_internal_curl_code != CURLE_OK) {
+        goto FunctionReturn;
+    }
+    curl = curl_easy_init();
+    if (curl == NULL) {
+        http_internal_curl_code = CURLE_OUT_OF_MEMORY;
+        goto FunctionReturn;
+    }
+
+    http_internal_setup_handle(curl, url, sink);
+
+    http_internal_curl_code = curl_easy_perform(curl);
+    if(http_internal_curl_code != CURLE_OK) {
+        goto FunctionReturn;
+    }
+
+    http_internal_load_response(curl, sink, &response);
+
+FunctionReturn:
+    response.error = http_internal_curl_code;
+    http_internal_take_headers(sink, &response);
+    response.curl_handle = curl;
+    return response;
+}
 
 /**
  * Perform an HTTP GET request.
@@ -106,34 +553,309 @@ typedef size_t (*BodyWriteFunction)(char *chunk, size_t size, size_t count, void
  * @return An `HttpResponse` struct.
  */
 HttpResponse http_request_get(const char *url, BodyWriteFunction body_write_function, void *user_data) {
+    HttpSink sink = {.body_write_function = body_write_function, .user_data = user_data};
+    return http_request_get_sink(url, &sink);
+}
+
+#else
+
+HttpResponse http_request_get_sink(const char *url, HttpSink *sink);
+HttpResponse http_request_get(const char *url, BodyWriteFunction body_write_function, void *user_data);
+
+#endif
+
+#pragma region Client
+
+/**
+ * HTTP/2 modes of a persistent `HttpClient`.
+ */
+typedef enum HttpHttp2Mode {
+    HttpHttp2Off,            // The version curl picks, HTTP/1.1 for http:// URLs
+    HttpHttp2,               // HTTP/2 over TLS through ALPN, falls back to HTTP/1.1
+    HttpHttp2Upgrade,        // Also HTTP/2 for http:// URLs (h2c) through an `Upgrade: h2c` on the first request
+    HttpHttp2PriorKnowledge, // HTTP/2 for http:// URLs without an upgrade, the server must speak it (libcurl 7.88 fails to reuse these connections)
+} HttpHttp2Mode;
+
+/**
+ * Options for a persistent `HttpClient`.
+ * Zero values keep the curl defaults.
+ */
+typedef struct HttpClientOptions {
+    long max_host_connections;   // Max simultaneous connections to a single host, 0 = unlimited
+    long max_total_connections;  // Max connections kept open in the pool
+    long idle_timeout;           // Seconds an idle connection may sit in the pool before it is closed
+    long dns_cache_timeout;      // Seconds a resolved host name is kept in the DNS cache
+    int accept_encoding;         // Negotiate compressed responses (gzip, deflate, and brotli/zstd when curl has them) and decode them as they stream in
+    HttpHttp2Mode http2;         // Multiplex concurrent requests to a host as HTTP/2 streams over one connection
+    long max_concurrent_streams; // Max streams per HTTP/2 connection, 0 = curl's default of 100
+} HttpClientOptions;
+
+/**
+ * A persistent HTTP client.
+ * Keeps a pool of reusable curl easy handles and shares connections,
+ * the DNS cache and TLS sessions between them, so repeated requests to
+ * the same host skip the DNS lookup, TCP connect and TLS handshake.
+ * A client belongs to one thread at a time, an `HttpPool` gives every worker thread its own.
+ */
+typedef struct HttpClient {
+    CURLSH *share;
+    CURLM *multi;
+    CURL **idle_handles;
+    size_t idle_len, idle_cap;
+    HttpClientOptions options;
+} HttpClient;
+
+#ifdef CLIB_HTTP_DEFINITIONS
+
+/**
+ * Apply the connection and HTTP/2 options of a client to a multi handle.
+ * Every multi handle that runs the client's handles gets them, see also `HttpEventLoop`.
+ * @param multi The curl multi handle
+ * @param options The client options
+ */
+void http_internal_setup_multi(CURLM *multi, const HttpClientOptions *options) {
+    if (options->max_host_connections > 0) {
+        curl_multi_setopt(multi, CURLMOPT_MAX_HOST_CONNECTIONS, options->max_host_connections);
+    }
+    if (options->max_total_connections > 0) {
+        curl_multi_setopt(multi, CURLMOPT_MAXCONNECTS, options->max_total_connections);
+    }
+    if (options->http2 != HttpHttp2Off) {
+        curl_multi_setopt(multi, CURLMOPT_PIPELINING, CURLPIPE_MULTIPLEX);
+        if (options->max_concurrent_streams > 0) {
+            curl_multi_setopt(multi, CURLMOPT_MAX_CONCURRENT_STREAMS, options->max_concurrent_streams);
+        }
+    }
+}
+
+/**
+ * Initialize a persistent HTTP client.
+ * NOTE: Allocates memory! Release the client with `http_client_release`.
+ * @param client Pointer to an `HttpClient` struct
+ * @param options Client options, or `NULL` for the defaults
+ * @return `CURLE_OK` on success, the error of `http_global_init`, or `CURLE_OUT_OF_MEMORY`
+ */
+CURLcode http_client_init(HttpClient *client, const HttpClientOptions *options) {
+    *client = (HttpClient) {0};
+    if (options != NULL) {
+        client->options = *options;
+    }
+    CURLcode code = http_global_init();
+    if (code != CURLE_OK) {
+        return code;
+    }
+
+    client->share = curl_share_init();
+    client->multi = curl_multi_init();
+    if (client->share == NULL || client->multi == NULL) {
+        curl_share_cleanup(client->share);
+        curl_multi_cleanup(client->multi);
+        *client = (HttpClient) {0};
+        return CURLE_OUT_OF_MEMORY;
+    }
+
+    curl_share_setopt(client->share, CURLSHOPT_SHARE, CURL_LOCK_DATA_DNS);         // Shared DNS cache
+    curl_share_setopt(client->share, CURLSHOPT_SHARE, CURL_LOCK_DATA_SSL_SESSION); // Shared TLS session ids
+    curl_share_setopt(client->share, CURLSHOPT_SHARE, CURL_LOCK_DATA_CONNECT);     // Shared connection pool
+
+    http_internal_setup_multi(client->multi, &client->options);
+    return CURLE_OK;
+}
+
+/**
+ * Free all the associated memory of the client and close its connections.
+ * Release every response of the client before calling this.
+ * @param client Pointer to an `HttpClient` struct
+ */
+void http_client_release(HttpClient *client) {
+    for (size_t i = 0; i < client->idle_len; i += 1) {
+        curl_easy_cleanup(client->idle_handles[i]);
+    }
+    free(client->idle_handles);
+    curl_multi_cleanup(client->multi);
+    curl_share_cleanup(client->share);
+    *client = (HttpClient) {0};
+}
+
+/**
+ * Take an easy handle from the client's pool, or create a new one if the pool is empty.
+ * The handle is reset and attached to the client's share.
+ * @param client Pointer to an `HttpClient` struct
+ * @return A curl easy handle or `NULL` on allocation failure
+ */
+CURL *http_client_acquire_handle(HttpClient *client) {
+    CURL *curl;
+    if (client->idle_len > 0) {
+        client->idle_len -= 1;
+        curl = client->idle_handles[client->idle_len];
+        curl_easy_reset(curl);
+    }
+    else {
+        curl = curl_easy_init();
+        if (curl == NULL) {
+            return NULL;
+        }
+    }
+    curl_easy_setopt(curl, CURLOPT_SHARE, client->share);                        // Shared connections, DNS and TLS sessions
+    if (client->options.idle_timeout > 0) {
+        curl_easy_setopt(curl, CURLOPT_MAXAGE_CONN, client->options.idle_timeout); // Idle connection timeout
+    }
+    if (client->options.dns_cache_timeout > 0) {
+        curl_easy_setopt(curl, CURLOPT_DNS_CACHE_TIMEOUT, client->options.dns_cache_timeout);
+    }
+    if (client->options.accept_encoding) {
+        curl_easy_setopt(curl, CURLOPT_ACCEPT_ENCODING, "");                     // Every encoding curl was built with
+    }
+    if (client->options.http2 == HttpHttp2) {
+        curl_easy_setopt(curl, CURLOPT_HTTP_VERSION, CURL_HTTP_VERSION_2TLS);
+    }
+    else if (client->options.http2 == HttpHttp2Upgrade) {
+        curl_easy_setopt(curl, CURLOPT_HTTP_VERSION, CURL_HTTP_VERSION_2_0);
+    }
+    else if (client->options.http2 == HttpHttp2PriorKnowledge) {
+        curl_easy_setopt(curl, CURLOPT_HTTP_VERSION, CURL_HTTP_VERSION_2_PRIOR_KNOWLEDGE);
+    }
+    if (client->options.http2 != HttpHttp2Off) {
+        curl_easy_setopt(curl, CURLOPT_PIPEWAIT, 1L);                            // Wait for a stream on an open connection instead of opening another one
+    }
+    return curl;
+}
+
+/**
+ * Return an easy handle to the client's pool for reuse.
+ * The handle is cleaned up if the pool cannot grow.
+ * @param client Pointer to an `HttpClient` struct
+ * @param curl The curl easy handle
+ */
+void http_client_return_handle(HttpClient *client, CURL *curl) {
+    if (curl == NULL) {
+        return;
+    }
+    if (client->idle_len == client->idle_cap) {
+        size_t cap = client->idle_cap == 0 ? 4 : client->idle_cap << 1;
+        CURL **handles = realloc(client->idle_handles, cap * sizeof(*handles));
+        if (handles == NULL) {
+            curl_easy_cleanup(curl);
+            return;
+        }
+        client->idle_handles = handles;
+        client->idle_cap = cap;
+    }
+    client->idle_handles[client->idle_len] = curl;
+    client->idle_len += 1;
+}
+
+/**
+ * Run a single easy handle to completion on the client's multi handle.
+ * Going through the multi handle enforces the per-host connection limits.
+ * @param client Pointer to an `HttpClient` struct
+ * @param curl The curl easy handle
+ * @return The result of the transfer
+ */
+CURLcode http_client_perform(HttpClient *client, CURL *curl) {
+    CURLcode code = CURLE_OK;
+    int running = 1, queued;
+    if (curl_multi_add_handle(client->multi, curl) != CURLM_OK) {
+        return CURLE_FAILED_INIT;
+    }
+    while (running) {
+        if (curl_multi_perform(client->multi, &running) != CURLM_OK) {
+            code = CURLE_RECV_ERROR;
+            break;
+        }
+        if (running) {
+            curl_multi_poll(client->multi, NULL, 0, 1000, NULL);
+        }
+    }
+    CURLMsg *msg;
+    while ((msg = curl_multi_info_read(client->multi, &queued)) != NULL) {
+        if (msg->msg == CURLMSG_DONE && msg->easy_handle == curl) {
+            code = msg->data.result;
+        }
+    }
+    curl_multi_remove_handle(client->multi, curl);
+    return code;
+}
+
+/**
+ * Perform an HTTP GET request into a sink with a persistent client.
+ * The connection stays open for later requests to the same host.
+ * @param client Pointer to an `HttpClient` struct
+ * @param url The request URL
+ * @param sink The sink for the response
+ * @return An `HttpResponse` struct. Release it with `http_client_response_release`.
+ */
+HttpResponse http_client_get_sink(HttpClient *client, const char *url, HttpSink *sink) {
     HttpResponse response = {0};
-    CURL *curl = curl_easy_init();
+    CURL *curl = http_client_acquire_handle(client);
 
     if (curl == NULL) {
+        http_internal_curl_code = CURLE_OUT_OF_MEMORY;
         goto FunctionReturn;
     }
 
-    curl_easy_setopt(curl, CURLOPT_URL, url);                           // Set the request URL
-    curl_easy_setopt(curl, CURLOPT_USERAGENT, "Mozilla/5.0 (Windows NT 10.0; Win64; x64) AppleWebKit/537.36 (KHTML, like Gecko) Chrome/117.0.0.0 Safari/537.36");
-    curl_easy_setopt(curl, CURLOPT_FOLLOWLOCATION, 1L);                 // Follow HTTP 3xx redirects
-    curl_easy_setopt(curl, CURLOPT_CAINFO, "cacert.pem");               // SSL certificate
-    curl_easy_setopt(curl, CURLOPT_CAPATH, "cacert.pem");               // SSL certificate
-    curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION, body_write_function); // Body write function
-    curl_easy_setopt(curl, CURLOPT_WRITEDATA, user_data);               // Body write function user data
-    curl_easy_setopt(curl, CURLOPT_HEADERFUNCTION, NULL);               // Header write function
-    curl_easy_setopt(curl, CURLOPT_HEADERDATA, NULL);                   // Header write function user data
+    http_internal_setup_handle(curl, url, sink);
+    sink->multi = client->multi;
 
-    http_internal_curl_code = curl_easy_perform(curl);
-    if(http_internal_curl_code != CURLE_OK) {
+    http_internal_curl_code = http_client_perform(client, curl);
+    sink->multi = NULL;
+    if (http_internal_curl_code != CURLE_OK) {
         goto FunctionReturn;
     }
 
-    curl_easy_getinfo(curl, CURLINFO_RESPONSE_CODE, &response.code);
-    curl_easy_getinfo(curl, CURLINFO_HTTP_VERSION, &response.version);
+    http_internal_load_response(curl, sink, &response);
 
 FunctionReturn:
+    response.error = http_internal_curl_code;
+    http_internal_take_headers(sink, &response);
     response.curl_handle = curl;
     return response;
 }
 
+/**
+ * Perform an HTTP GET request with a persistent client.
+ * The connection stays open for later requests to the same host.
+ * @param client Pointer to an `HttpClient` struct
+ * @param url The request URL
+ * @param body_write_function Callback function (curl write function) for the response body
+ * @param user_data Any user specified data to be passed into the callback function
+ * @return An `HttpResponse` struct. Release it with `http_client_response_release`.
+ */
+HttpResponse http_client_get(HttpClient *client, const char *url, BodyWriteFunction body_write_function, void *user_data) {
+    HttpSink sink = {.body_write_function = body_write_function, .user_data = user_data};
+    return http_client_get_sink(client, url, &sink);
+}
+
+/**
+ * Hand the response's easy handle back to the client for reuse.
+ * Call this instead of `http_response_release` for client responses.
+ * @param client Pointer to an `HttpClient` struct
+ * @param r HttpResponse
+ */
+void http_client_response_release(HttpClient *client, HttpResponse *r) {
+    http_client_return_handle(client, r->curl_handle);
+    r->curl_handle = NULL;
+    if (r->headers != NULL) {
+        http_headers_release(r->headers);
+        free(r->headers);
+        r->headers = NULL;
+    }
+}
+
+#else
+
+void http_internal_setup_multi(CURLM *multi, const HttpClientOptions *options);
+CURLcode http_client_init(HttpClient *client, const HttpClientOptions *options);
+void http_client_release(HttpClient *client);
+CURL *http_client_acquire_handle(HttpClient *client);
+void http_client_return_handle(HttpClient *client, CURL *curl);
+CURLcode http_client_perform(HttpClient *client, CURL *curl);
+HttpResponse http_client_get_sink(HttpClient *client, const char *url, HttpSink *sink);
+HttpResponse http_client_get(HttpClient *client, const char *url, BodyWriteFunction body_write_function, void *user_data);
+void http_client_response_release(HttpClient *client, HttpResponse *r);
+
+#endif
+
+#pragma endregion
+
 #endif
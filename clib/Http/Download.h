@@ -0,0 +1,332 @@
+#ifndef HTTP_DOWNLOAD_H
+#define HTTP_DOWNLOAD_H
+
+/**
+ * Segmented downloads of large files.
+ * The file is split into byte ranges that are fetched concurrently and written
+ * in place with `pwrite`, so this header requires a POSIX system.
+ */
+
+#ifndef _INC_STDIO
+#include <stdio.h>
+#endif
+
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "Clib.h"
+#include "Batch.h"
+#include "Sink.h"
+
+#define HTTP_DOWNLOAD_DEFAULT_SEGMENTS 4
+#define HTTP_DOWNLOAD_DEFAULT_MIN_SEGMENT_SIZE (1 << 20)
+#define HTTP_DOWNLOAD_DEFAULT_MAX_RETRIES 3
+
+/**
+ * Options for `http_download_file`.
+ * Zero values fall back to the `HTTP_DOWNLOAD_DEFAULT_*` values.
+ */
+typedef struct HttpDownloadOptions {
+    size_t segments;         // Number of byte ranges fetched concurrently
+    size_t min_segment_size; // Smaller files are split into fewer segments
+    int max_retries;         // How many times a failed segment is retried, negative = never
+} HttpDownloadOptions;
+
+/**
+ * A byte range of a segmented download.
+ */
+typedef struct HttpDownloadSegment {
+    int fd;
+    curl_off_t offset, length, written;
+    CURL *curl_handle;
+    int checked;        // The response status was checked to be 206
+    int ranges_ignored; // The server answered the range with the whole file
+    char range[64];
+} HttpDownloadSegment;
+
+#pragma region Internals
+
+#ifdef CLIB_HTTP_DEFINITIONS
+
+/**
+ * Body write function of a segment.
+ * Writes the chunk at the segment's position in the file.
+ */
+size_t http_download_internal_write(char *chunk, size_t size, size_t count, void *user_data) {
+    HttpDownloadSegment *segment = user_data;
+    size_t n = size * count;
+    if (!segment->checked) {
+        // A server that ignores the range would send the whole file, don't write it at this offset
+        long code = 0;
+        curl_easy_getinfo(segment->curl_handle, CURLINFO_RESPONSE_CODE, &code);
+        if (code != 206) {
+            segment->ranges_ignored = code == 200;
+            return 0;
+        }
+        segment->checked = 1;
+    }
+    if (segment->written + (curl_off_t)n > segment->length) {
+        return 0;
+    }
+    size_t done = 0;
+    while (done < n) {
+        ssize_t written = pwrite(segment->fd, chunk + done, n - done, (off_t)(segment->offset + segment->written));
+        if (written < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return 0;
+        }
+        done += (size_t)written;
+        segment->written += written;
+    }
+    return n;
+}
+
+/**
+ * Setup function of a segment, requests the part of the range that is still missing.
+ */
+void http_download_internal_setup(CURL *curl, void *user_data) {
+    HttpDownloadSegment *segment = user_data;
+    segment->curl_handle = curl;
+    segment->checked = 0;
+    snprintf(segment->range, sizeof(segment->range), "%" CURL_FORMAT_CURL_OFF_T "-%" CURL_FORMAT_CURL_OFF_T,
+        segment->offset + segment->written, segment->offset + segment->length - 1);
+    curl_easy_setopt(curl, CURLOPT_RANGE, segment->range);
+}
+
+/**
+ * Completion callback of the segment batch.
+ * Nothing to do, the segments keep track of how much of them was written.
+ */
+void http_download_internal_complete(HttpBatchRequest *request, HttpResponse *response, CURLcode error, void *batch_data) {
+    (void)request;
+    (void)response;
+    (void)error;
+    (void)batch_data;
+}
+
+/**
+ * Discards the body of the probe request.
+ */
+size_t http_download_internal_discard(char *chunk, size_t size, size_t count, void *user_data) {
+    (void)chunk;
+    (void)user_data;
+    return size * count;
+}
+
+/**
+ * Find out the size of the file and whether the server accepts byte ranges with a HEAD request.
+ * @param client Pointer to an `HttpClient` struct
+ * @param url The file URL
+ * @param length Output for the `Content-Length`, -1 if unknown
+ * @param accepts_ranges Output, 1 if the server sent `Accept-Ranges: bytes`
+ * @return Result of the transfer
+ */
+CURLcode http_download_internal_probe(HttpClient *client, const char *url, curl_off_t *length, int *accepts_ranges) {
+    HttpSink sink = {.body_write_function = http_download_internal_discard};
+    CURL *curl = http_client_acquire_handle(client);
+    *length = -1;
+    *accepts_ranges = 0;
+    if (curl == NULL) {
+        return CURLE_OUT_OF_MEMORY;
+    }
+    http_internal_setup_handle(curl, url, &sink);
+    curl_easy_setopt(curl, CURLOPT_NOBODY, 1L);
+    CURLcode code = http_client_perform(client, curl);
+    if (code == CURLE_OK) {
+        long status = 0;
+        struct curl_header *header;
+        curl_easy_getinfo(curl, CURLINFO_RESPONSE_CODE, &status);
+        curl_easy_getinfo(curl, CURLINFO_CONTENT_LENGTH_DOWNLOAD_T, length);
+        if (status == 200
+            && curl_easy_header(curl, "Accept-Ranges", 0, CURLH_HEADER, -1, &header) == CURLHE_OK
+            && strcmp(header->value, "bytes") == 0) {
+            *accepts_ranges = 1;
+        }
+    }
+    http_client_return_handle(client, curl);
+    return code;
+}
+
+/**
+ * Download the file in a single stream, used when the server does not support ranges.
+ */
+CURLcode http_download_internal_single(HttpClient *client, const char *url, int fd) {
+    HttpFileSink file;
+    if (http_file_sink_init(&file, fd, 0, 1) != 0) {
+        return CURLE_OUT_OF_MEMORY;
+    }
+    HttpSink sink = http_sink_file(&file);
+    HttpResponse response = http_client_get_sink(client, url, &sink);
+    CURLcode code = http_get_last_error();
+    if (http_file_sink_release(&file) != 0 && code == CURLE_OK) {
+        code = CURLE_WRITE_ERROR;
+    }
+    if (code == CURLE_OK && response.code >= 400) {
+        code = CURLE_HTTP_RETURNED_ERROR;
+    }
+    http_client_response_release(client, &response);
+    return code;
+}
+
+/**
+ * Fetch the file as concurrent byte ranges into the preallocated file.
+ * @return `CURLE_RANGE_ERROR` if the server ignored a range, the file has to be downloaded in a single stream
+ */
+CURLcode http_download_internal_segmented(HttpClient *client, const char *url, int fd, curl_off_t length, size_t segment_count, int max_retries) {
+    HttpDownloadSegment *segments = calloc(segment_count, sizeof(*segments));
+    HttpBatchRequest *requests = calloc(segment_count, sizeof(*requests));
+    CURLcode code = CURLE_OK;
+
+    if (segments == NULL || requests == NULL) {
+        code = CURLE_OUT_OF_MEMORY;
+        goto FunctionReturn;
+    }
+
+    // Reserve the blocks up front, fall back to just setting the size
+    if (posix_fallocate(fd, 0, (off_t)length) != 0 && ftruncate(fd, (off_t)length) != 0) {
+        code = CURLE_WRITE_ERROR;
+        goto FunctionReturn;
+    }
+
+    curl_off_t segment_length = length / (curl_off_t)segment_count;
+    for (size_t i = 0; i < segment_count; i += 1) {
+        segments[i].fd = fd;
+        segments[i].offset = (curl_off_t)i * segment_length;
+        segments[i].length = i + 1 == segment_count ? length - segments[i].offset : segment_length;
+    }
+
+    size_t count = segment_count;
+    for (int attempt = 0; attempt <= max_retries && count > 0; attempt += 1) {
+        // Only the segments that are still missing bytes go into the batch
+        count = 0;
+        for (size_t i = 0; i < segment_count; i += 1) {
+            if (segments[i].written < segments[i].length) {
+                requests[count] = (HttpBatchRequest) {
+                    .url = url,
+                    .sink = {.body_write_function = http_download_internal_write, .user_data = &segments[i]},
+                    .user_data = &segments[i],
+                    .setup_function = http_download_internal_setup,
+                };
+                count += 1;
+            }
+        }
+        if (count > 0 && http_batch_run(client, requests, count, count, http_download_internal_complete, NULL) != CURLM_OK) {
+            code = CURLE_RECV_ERROR;
+            goto FunctionReturn;
+        }
+        for (size_t i = 0; i < segment_count; i += 1) {
+            if (segments[i].ranges_ignored) {
+                code = CURLE_RANGE_ERROR;
+                goto FunctionReturn;
+            }
+        }
+    }
+    for (size_t i = 0; i < segment_count; i += 1) {
+        if (segments[i].written < segments[i].length) {
+            code = CURLE_PARTIAL_FILE;
+            break;
+        }
+    }
+
+FunctionReturn:
+    free(segments);
+    free(requests);
+    return code;
+}
+
+#else
+
+size_t http_download_internal_write(char *chunk, size_t size, size_t count, void *user_data);
+void http_download_internal_setup(CURL *curl, void *user_data);
+void http_download_internal_complete(HttpBatchRequest *request, HttpResponse *response, CURLcode error, void *batch_data);
+size_t http_download_internal_discard(char *chunk, size_t size, size_t count, void *user_data);
+CURLcode http_download_internal_probe(HttpClient *client, const char *url, curl_off_t *length, int *accepts_ranges);
+CURLcode http_download_internal_single(HttpClient *client, const char *url, int fd);
+CURLcode http_download_internal_segmented(HttpClient *client, const char *url, int fd, curl_off_t length, size_t segment_count, int max_retries);
+
+#endif
+
+#pragma endregion
+
+#ifdef CLIB_HTTP_DEFINITIONS
+
+/**
+ * Download a file, fetching byte ranges of it concurrently.
+ * The server is probed for the file size and range support first,
+ * if it does not support ranges the file is downloaded in a single stream.
+ * A server that advertises ranges but answers them with the whole file gets the single stream too.
+ * Failed segments are retried from where they left off.
+ * @param client Pointer to an initialized `HttpClient` struct
+ * @param url The file URL
+ * @param path Path of the output file, it is created or truncated
+ * @param options Download options, or `NULL` for the defaults
+ * @return `CURLE_OK` on success, `CURLE_PARTIAL_FILE` if segments still failed after the retries
+ */
+CURLcode http_download_file(HttpClient *client, const char *url, const char *path, const HttpDownloadOptions *options) {
+    HttpDownloadOptions o = {0};
+    if (options != NULL) {
+        o = *options;
+    }
+    if (o.segments == 0) {
+        o.segments = HTTP_DOWNLOAD_DEFAULT_SEGMENTS;
+    }
+    if (o.min_segment_size == 0) {
+        o.min_segment_size = HTTP_DOWNLOAD_DEFAULT_MIN_SEGMENT_SIZE;
+    }
+    if (o.max_retries == 0) {
+        o.max_retries = HTTP_DOWNLOAD_DEFAULT_MAX_RETRIES;
+    }
+    else if (o.max_retries < 0) {
+        o.max_retries = 0;
+    }
+
+    curl_off_t length;
+    int accepts_ranges;
+    CURLcode code = http_download_internal_probe(client, url, &length, &accepts_ranges);
+    if (code != CURLE_OK) {
+        goto FunctionReturn;
+    }
+
+    int fd = open(path, O_CREAT | O_TRUNC | O_WRONLY, 0644);
+    if (fd < 0) {
+        code = CURLE_WRITE_ERROR;
+        goto FunctionReturn;
+    }
+
+    size_t segment_count = 1;
+    if (accepts_ranges && length > 0) {
+        segment_count = (size_t)(length / (curl_off_t)o.min_segment_size);
+        if (segment_count > o.segments) {
+            segment_count = o.segments;
+        }
+    }
+
+    if (segment_count > 1) {
+        code = http_download_internal_segmented(client, url, fd, length, segment_count, o.max_retries);
+        if (code == CURLE_RANGE_ERROR) {
+            // Start over, the segments only use `pwrite` so the file position is still 0
+            code = ftruncate(fd, 0) == 0 ? http_download_internal_single(client, url, fd) : CURLE_WRITE_ERROR;
+        }
+    }
+    else {
+        code = http_download_internal_single(client, url, fd);
+    }
+
+    if (close(fd) != 0 && code == CURLE_OK) {
+        code = CURLE_WRITE_ERROR;
+    }
+
+FunctionReturn:
+    http_internal_curl_code = code;
+    return code;
+}
+
+#else
+
+CURLcode http_download_file(HttpClient *client, const char *url, const char *path, const HttpDownloadOptions *options);
+
+#endif
+
+#endif
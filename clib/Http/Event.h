@@ -0,0 +1,450 @@
+#ifndef HTTP_EVENT_H
+#define HTTP_EVENT_H
+
+/**
+ * Non-blocking requests driven by an event loop.
+ * The sockets and timeouts curl needs are handed to an external event loop
+ * through a socket function, or to the bundled epoll loop on Linux.
+ * Completions are delivered as callbacks from `http_event_loop_on_socket`
+ * and `http_event_loop_on_timeout`.
+ */
+
+#ifndef _INC_ERRNO
+#include <errno.h>
+#endif
+
+#include <time.h>
+#include <unistd.h>
+
+#ifdef __linux__
+#include <sys/epoll.h>
+#endif
+
+#include "Clib.h"
+#include "Batch.h"
+
+#define HTTP_EVENT_IN 1
+#define HTTP_EVENT_OUT 2
+
+/**
+ * Max number of epoll events handled by one `http_event_loop_poll`.
+ */
+#define HTTP_EVENT_LOOP_MAX_EVENTS 64
+
+/**
+ * Interval in milliseconds at which the poll functions of the sinks in flight are called.
+ * curl does not run a paused transfer's progress callback when it is driven by socket actions.
+ */
+#define HTTP_EVENT_LOOP_POLL_INTERVAL_MS 50
+
+/**
+ * Called when curl wants the event loop to watch a socket, or to stop watching it.
+ * @param socket The socket
+ * @param events `HTTP_EVENT_IN` and/or `HTTP_EVENT_OUT`, 0 = stop watching the socket
+ * @param socket_data The `socket_data` passed to `http_event_loop_init_external`
+ * @return 0 on success, -1 on failure
+ */
+typedef int (*HttpEventSocketFunction)(curl_socket_t socket, int events, void *socket_data);
+
+/**
+ * Runs requests on a multi handle that is driven by socket readiness.
+ */
+typedef struct HttpEventLoop {
+    HttpClient *client;
+    CURLM *multi;
+    HttpCompletionFunction on_complete;
+    void *completion_data;
+    HttpEventSocketFunction socket_function; // `NULL` when the bundled epoll loop is used
+    void *socket_data;
+    int epoll_fd;
+    int64_t deadline_ms; // Monotonic time when curl wants `http_event_loop_on_timeout`, -1 = none
+    int64_t poll_ms;     // Monotonic time of the next call to the sinks' poll functions
+    HttpBatchRequest **requests; // The requests in flight, their handles are taken back on release
+    size_t in_flight, requests_cap;
+    size_t polling;              // Requests in flight with a sink poll function
+} HttpEventLoop;
+
+#pragma region Internals
+
+#ifdef CLIB_HTTP_DEFINITIONS
+
+/**
+ * @return Monotonic clock in milliseconds
+ */
+int64_t http_event_internal_now_ms(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (int64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+/**
+ * Socket function of the bundled epoll loop.
+ */
+int http_event_internal_epoll(curl_socket_t socket, int events, void *socket_data) {
+#ifdef __linux__
+    HttpEventLoop *loop = socket_data;
+    if (events == 0) {
+        // The socket may already be closed, in which case epoll has dropped it
+        epoll_ctl(loop->epoll_fd, EPOLL_CTL_DEL, socket, NULL);
+        return 0;
+    }
+    struct epoll_event event = {
+        .events = (events & HTTP_EVENT_IN ? EPOLLIN : 0) | (events & HTTP_EVENT_OUT ? EPOLLOUT : 0),
+        .data.fd = socket,
+    };
+    if (epoll_ctl(loop->epoll_fd, EPOLL_CTL_MOD, socket, &event) != 0) {
+        if (errno != ENOENT || epoll_ctl(loop->epoll_fd, EPOLL_CTL_ADD, socket, &event) != 0) {
+            return -1;
+        }
+    }
+    return 0;
+#else
+    (void)socket;
+    (void)events;
+    (void)socket_data;
+    return -1;
+#endif
+}
+
+/**
+ * curl socket callback, translates curl's poll requests into event loop events.
+ * https://curl.se/libcurl/c/CURLMOPT_SOCKETFUNCTION.html
+ */
+int http_event_internal_socket_callback(CURL *curl, curl_socket_t socket, int what, void *user_data, void *socket_pointer) {
+    HttpEventLoop *loop = user_data;
+    int events = 0;
+    (void)curl;
+    (void)socket_pointer;
+    if (what == CURL_POLL_IN || what == CURL_POLL_INOUT) {
+        events |= HTTP_EVENT_IN;
+    }
+    if (what == CURL_POLL_OUT || what == CURL_POLL_INOUT) {
+        events |= HTTP_EVENT_OUT;
+    }
+    if (loop->socket_function != NULL) {
+        return loop->socket_function(socket, events, loop->socket_data);
+    }
+    return http_event_internal_epoll(socket, events, loop);
+}
+
+/**
+ * curl timer callback, remembers when curl wants to be called back.
+ * https://curl.se/libcurl/c/CURLMOPT_TIMERFUNCTION.html
+ */
+int http_event_internal_timer_callback(CURLM *multi, long timeout_ms, void *user_data) {
+    HttpEventLoop *loop = user_data;
+    (void)multi;
+    loop->deadline_ms = timeout_ms < 0 ? -1 : http_event_internal_now_ms() + timeout_ms;
+    return 0;
+}
+
+/**
+ * Initialize the loop state and the multi handle.
+ */
+CURLcode http_event_internal_init(HttpEventLoop *loop, HttpClient *client, HttpCompletionFunction on_complete, void *completion_data) {
+    *loop = (HttpEventLoop) {
+        .client = client,
+        .multi = curl_multi_init(),
+        .on_complete = on_complete,
+        .completion_data = completion_data,
+        .epoll_fd = -1,
+        .deadline_ms = -1,
+    };
+    if (loop->multi == NULL) {
+        return CURLE_OUT_OF_MEMORY;
+    }
+    curl_multi_setopt(loop->multi, CURLMOPT_SOCKETFUNCTION, http_event_internal_socket_callback);
+    curl_multi_setopt(loop->multi, CURLMOPT_SOCKETDATA, loop);
+    curl_multi_setopt(loop->multi, CURLMOPT_TIMERFUNCTION, http_event_internal_timer_callback);
+    curl_multi_setopt(loop->multi, CURLMOPT_TIMERDATA, loop);
+    http_internal_setup_multi(loop->multi, &client->options);
+    return CURLE_OK;
+}
+
+/**
+ * Completion function of the loop's transfers, drops the request from the in-flight list before the callback.
+ */
+void http_event_internal_complete(HttpBatchRequest *request, HttpResponse *response, CURLcode error, void *batch_data) {
+    HttpEventLoop *loop = batch_data;
+    // The last request takes the slot of the finished one
+    loop->in_flight -= 1;
+    HttpBatchRequest *last = loop->requests[loop->in_flight];
+    loop->requests[request->slot] = last;
+    last->slot = request->slot;
+    if (request->sink.poll_function != NULL) {
+        loop->polling -= 1;
+    }
+    loop->on_complete(request, response, error, loop->completion_data);
+}
+
+/**
+ * Call the poll functions of the sinks in flight once the poll interval ran out.
+ * Transfers only complete in `http_batch_internal_collect`, so the requests stay put while they run.
+ * A non-zero result is not acted on here, the transfer's progress callback aborts it.
+ */
+void http_event_internal_poll_sinks(HttpEventLoop *loop) {
+    int64_t now = http_event_internal_now_ms();
+    if (loop->polling == 0 || now < loop->poll_ms) {
+        return;
+    }
+    loop->poll_ms = now + HTTP_EVENT_LOOP_POLL_INTERVAL_MS;
+    for (size_t i = 0; i < loop->in_flight; i += 1) {
+        HttpSink *sink = &loop->requests[i]->sink;
+        if (sink->poll_function != NULL) {
+            sink->poll_function(sink);
+        }
+    }
+}
+
+/**
+ * Let curl act on a socket or the timeout and deliver the finished transfers.
+ */
+CURLMcode http_event_internal_action(HttpEventLoop *loop, curl_socket_t socket, int events) {
+    int running;
+    CURLMcode code = curl_multi_socket_action(loop->multi, socket, events, &running);
+    http_batch_internal_collect(loop->client, loop->multi, http_event_internal_complete, loop);
+    return code;
+}
+
+#else
+
+int64_t http_event_internal_now_ms(void);
+int http_event_internal_epoll(curl_socket_t socket, int events, void *socket_data);
+int http_event_internal_socket_callback(CURL *curl, curl_socket_t socket, int what, void *user_data, void *socket_pointer);
+int http_event_internal_timer_callback(CURLM *multi, long timeout_ms, void *user_data);
+void http_event_internal_complete(HttpBatchRequest *request, HttpResponse *response, CURLcode error, void *batch_data);
+void http_event_internal_poll_sinks(HttpEventLoop *loop);
+CURLcode http_event_internal_init(HttpEventLoop *loop, HttpClient *client, HttpCompletionFunction on_complete, void *completion_data);
+CURLMcode http_event_internal_action(HttpEventLoop *loop, curl_socket_t socket, int events);
+
+#endif
+
+#pragma endregion
+
+#ifdef CLIB_HTTP_DEFINITIONS
+
+/**
+ * Initialize an event loop that uses the bundled epoll loop (Linux only).
+ * Drive it with `http_event_loop_poll` or `http_event_loop_run`.
+ * NOTE: Allocates memory! Release the loop with `http_event_loop_release`.
+ * @param loop Pointer to an `HttpEventLoop` struct
+ * @param client Pointer to an initialized `HttpClient` struct, provides the easy handles and the connection share
+ * @param on_complete Callback called once for every request
+ * @param completion_data Any user specified data to be passed into the callback function
+ * @return `CURLE_OK` on success
+ */
+CURLcode http_event_loop_init(HttpEventLoop *loop, HttpClient *client, HttpCompletionFunction on_complete, void *completion_data) {
+    CURLcode code = http_event_internal_init(loop, client, on_complete, completion_data);
+    if (code != CURLE_OK) {
+        return code;
+    }
+#ifdef __linux__
+    loop->epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+#endif
+    if (loop->epoll_fd < 0) {
+        curl_multi_cleanup(loop->multi);
+        loop->multi = NULL;
+        return CURLE_FAILED_INIT;
+    }
+    return CURLE_OK;
+}
+
+/**
+ * Initialize an event loop that is driven by an external event loop.
+ * The external loop watches the sockets it is told about through `socket_function`,
+ * calls `http_event_loop_on_socket` when one is ready, and calls
+ * `http_event_loop_on_timeout` when `http_event_loop_timeout` runs out.
+ * NOTE: Allocates memory! Release the loop with `http_event_loop_release`.
+ * @param loop Pointer to an `HttpEventLoop` struct
+ * @param client Pointer to an initialized `HttpClient` struct, provides the easy handles and the connection share
+ * @param on_complete Callback called once for every request
+ * @param completion_data Any user specified data to be passed into the callback function
+ * @param socket_function Called when a socket needs to be watched or no longer needs to be
+ * @param socket_data Any user specified data to be passed into the socket function
+ * @return `CURLE_OK` on success
+ */
+CURLcode http_event_loop_init_external(HttpEventLoop *loop, HttpClient *client, HttpCompletionFunction on_complete, void *completion_data, HttpEventSocketFunction socket_function, void *socket_data) {
+    CURLcode code = http_event_internal_init(loop, client, on_complete, completion_data);
+    loop->socket_function = socket_function;
+    loop->socket_data = socket_data;
+    return code;
+}
+
+/**
+ * Free all the associated memory of the loop.
+ * Requests still in flight are aborted without completions, their handles go back to the client.
+ * @param loop Pointer to an `HttpEventLoop` struct
+ */
+void http_event_loop_release(HttpEventLoop *loop) {
+    for (size_t i = 0; i < loop->in_flight; i += 1) {
+        HttpSink *sink = &loop->requests[i]->sink;
+        curl_multi_remove_handle(loop->multi, sink->curl_handle);
+        http_client_return_handle(loop->client, sink->curl_handle);
+        sink->curl_handle = NULL;
+        if (sink->headers != NULL) {
+            http_headers_release(sink->headers);
+            free(sink->headers);
+            sink->headers = NULL;
+        }
+    }
+    free(loop->requests);
+    curl_multi_cleanup(loop->multi);
+    if (loop->epoll_fd >= 0) {
+        close(loop->epoll_fd);
+    }
+    *loop = (HttpEventLoop) {0};
+}
+
+/**
+ * Start a request. Returns right away, the completion callback is called once the request finishes.
+ * @param loop Pointer to an `HttpEventLoop` struct
+ * @param request The request, it must stay valid until its completion
+ * @return 1 if the request was started, else 0 (the completion callback has already been called)
+ */
+int http_event_loop_add(HttpEventLoop *loop, HttpBatchRequest *request) {
+    if (loop->in_flight == loop->requests_cap) {
+        size_t cap = loop->requests_cap == 0 ? 16 : loop->requests_cap << 1;
+        HttpBatchRequest **requests = realloc(loop->requests, cap * sizeof(*requests));
+        if (requests == NULL) {
+            http_batch_internal_fail(request, CURLE_OUT_OF_MEMORY, loop->on_complete, loop->completion_data);
+            return 0;
+        }
+        loop->requests = requests;
+        loop->requests_cap = cap;
+    }
+    if (!http_batch_internal_start(loop->client, loop->multi, request, loop->on_complete, loop->completion_data)) {
+        return 0;
+    }
+    // Nobody waits in `curl_multi_poll` on the loop's multi handle, the sink is polled on the poll interval instead
+    request->sink.multi = NULL;
+    request->slot = loop->in_flight;
+    loop->requests[loop->in_flight] = request;
+    loop->in_flight += 1;
+    if (request->sink.poll_function != NULL) {
+        if (loop->polling == 0) {
+            loop->poll_ms = http_event_internal_now_ms() + HTTP_EVENT_LOOP_POLL_INTERVAL_MS;
+        }
+        loop->polling += 1;
+    }
+    return 1;
+}
+
+/**
+ * Milliseconds until `http_event_loop_on_timeout` should be called.
+ * While a sink in flight has a poll function, this is at most `HTTP_EVENT_LOOP_POLL_INTERVAL_MS`.
+ * @param loop Pointer to an `HttpEventLoop` struct
+ * @return Milliseconds to wait, 0 = call it now, -1 = no timeout pending
+ */
+long http_event_loop_timeout(HttpEventLoop *loop) {
+    int64_t deadline = loop->deadline_ms;
+    if (loop->polling > 0 && (deadline < 0 || loop->poll_ms < deadline)) {
+        deadline = loop->poll_ms;
+    }
+    if (deadline < 0) {
+        return -1;
+    }
+    int64_t remaining = deadline - http_event_internal_now_ms();
+    return remaining > 0 ? (long)remaining : 0;
+}
+
+/**
+ * Tell curl that a socket is ready.
+ * @param loop Pointer to an `HttpEventLoop` struct
+ * @param socket The ready socket
+ * @param events `HTTP_EVENT_IN` and/or `HTTP_EVENT_OUT`
+ * @return Result of `curl_multi_socket_action`
+ */
+CURLMcode http_event_loop_on_socket(HttpEventLoop *loop, curl_socket_t socket, int events) {
+    int action = 0;
+    if (events & HTTP_EVENT_IN) {
+        action |= CURL_CSELECT_IN;
+    }
+    if (events & HTTP_EVENT_OUT) {
+        action |= CURL_CSELECT_OUT;
+    }
+    return http_event_internal_action(loop, socket, action);
+}
+
+/**
+ * Tell curl that its timeout ran out, and call the sinks' poll functions when they are due.
+ * @param loop Pointer to an `HttpEventLoop` struct
+ * @return Result of `curl_multi_socket_action`
+ */
+CURLMcode http_event_loop_on_timeout(HttpEventLoop *loop) {
+    loop->deadline_ms = -1;
+    // A resumed transfer sets a timer, the socket action below picks it up
+    http_event_internal_poll_sinks(loop);
+    return http_event_internal_action(loop, CURL_SOCKET_TIMEOUT, 0);
+}
+
+/**
+ * Wait for socket activity or the timeout once with the bundled epoll loop and handle it.
+ * @param loop Pointer to an `HttpEventLoop` struct initialized with `http_event_loop_init`
+ * @param max_wait_ms Max time to wait in milliseconds, -1 = until something happens
+ * @return `CURLM_OK` on success
+ */
+CURLMcode http_event_loop_poll(HttpEventLoop *loop, int max_wait_ms) {
+#ifdef __linux__
+    struct epoll_event events[HTTP_EVENT_LOOP_MAX_EVENTS];
+    long timeout = http_event_loop_timeout(loop);
+    if (timeout < 0 || (max_wait_ms >= 0 && timeout > max_wait_ms)) {
+        timeout = max_wait_ms;
+    }
+    int count = epoll_wait(loop->epoll_fd, events, HTTP_EVENT_LOOP_MAX_EVENTS, (int)timeout);
+    if (count < 0) {
+        return errno == EINTR ? CURLM_OK : CURLM_INTERNAL_ERROR;
+    }
+    for (int i = 0; i < count; i += 1) {
+        int ready = 0;
+        if (events[i].events & (EPOLLIN | EPOLLHUP | EPOLLERR)) {
+            ready |= HTTP_EVENT_IN;
+        }
+        if (events[i].events & EPOLLOUT) {
+            ready |= HTTP_EVENT_OUT;
+        }
+        CURLMcode code = http_event_loop_on_socket(loop, events[i].data.fd, ready);
+        if (code != CURLM_OK) {
+            return code;
+        }
+    }
+    if (http_event_loop_timeout(loop) == 0) {
+        return http_event_loop_on_timeout(loop);
+    }
+    return CURLM_OK;
+#else
+    (void)loop;
+    (void)max_wait_ms;
+    return CURLM_INTERNAL_ERROR;
+#endif
+}
+
+/**
+ * Run the bundled epoll loop until every request has completed.
+ * @param loop Pointer to an `HttpEventLoop` struct initialized with `http_event_loop_init`
+ * @return `CURLM_OK` on success
+ */
+CURLMcode http_event_loop_run(HttpEventLoop *loop) {
+    while (loop->in_flight > 0) {
+        CURLMcode code = http_event_loop_poll(loop, -1);
+        if (code != CURLM_OK) {
+            return code;
+        }
+    }
+    return CURLM_OK;
+}
+
+#else
+
+CURLcode http_event_loop_init(HttpEventLoop *loop, HttpClient *client, HttpCompletionFunction on_complete, void *completion_data);
+CURLcode http_event_loop_init_external(HttpEventLoop *loop, HttpClient *client, HttpCompletionFunction on_complete, void *completion_data, HttpEventSocketFunction socket_function, void *socket_data);
+void http_event_loop_release(HttpEventLoop *loop);
+int http_event_loop_add(HttpEventLoop *loop, HttpBatchRequest *request);
+long http_event_loop_timeout(HttpEventLoop *loop);
+CURLMcode http_event_loop_on_socket(HttpEventLoop *loop, curl_socket_t socket, int events);
+CURLMcode http_event_loop_on_timeout(HttpEventLoop *loop);
+CURLMcode http_event_loop_poll(HttpEventLoop *loop, int max_wait_ms);
+CURLMcode http_event_loop_run(HttpEventLoop *loop);
+
+#endif
+
+#endif
@@ -0,0 +1,352 @@
+#ifndef HTTP_HEADERS_H
+#define HTTP_HEADERS_H
+
+#ifndef _STDINT_H
+#include <stdint.h>
+#endif
+
+#include "Clib.h"
+#include "Buffer.h"
+
+/**
+ * Initial number of slots in the hash index of a header store.
+ */
+#define HTTP_HEADERS_INITIAL_SLOTS 32
+
+/**
+ * A header as returned by `http_headers_next`.
+ */
+typedef struct HttpHeaderField {
+    const char *name;
+    const char *value;
+} HttpHeaderField;
+
+/**
+ * A header line in the store.
+ * Offsets point into the arena, entries with the same name are chained in arrival order.
+ */
+typedef struct HttpHeadersInternalEntry {
+    uint32_t name, value; // Offsets of the null terminated name and value in the arena
+    uint32_t hash;        // Case-insensitive hash of the name
+    uint32_t next;        // Index + 1 of the next entry with the same name, 0 = none
+    uint32_t last;        // First entry of a name only: index + 1 of the last entry with the name
+    uint32_t count;       // First entry of a name only: number of entries with the name
+} HttpHeadersInternalEntry;
+
+/**
+ * The headers of a response, collected once into a single arena
+ * with a case-insensitive hash index over the names.
+ */
+typedef struct HttpHeaders {
+    Buffer arena;
+    HttpHeadersInternalEntry *entries;
+    uint32_t len, cap;
+    uint32_t *slots; // Index + 1 of the first entry of each name, 0 = empty slot
+    uint32_t slot_count;
+} HttpHeaders;
+
+#pragma region Internals
+
+/**
+ * @return `c` in lower case if it is an ASCII letter
+ */
+static inline char http_headers_internal_lower(char c) {
+    return c >= 'A' && c <= 'Z' ? c + ('a' - 'A') : c;
+}
+
+/**
+ * Case-insensitive FNV-1a hash of a header name.
+ */
+static inline uint32_t http_headers_internal_hash(const char *name, size_t length) {
+    uint32_t hash = 2166136261u;
+    for (size_t i = 0; i < length; i += 1) {
+        hash ^= (unsigned char)http_headers_internal_lower(name[i]);
+        hash *= 16777619u;
+    }
+    return hash;
+}
+
+/**
+ * Case-insensitive comparison of a stored name and a name of `length` bytes.
+ * @return 1 if equal, else 0
+ */
+static inline int http_headers_internal_equals(const char *stored, const char *name, size_t length) {
+    for (size_t i = 0; i < length; i += 1) {
+        if (http_headers_internal_lower(stored[i]) != http_headers_internal_lower(name[i])) {
+            return 0;
+        }
+    }
+    return stored[length] == '\0';
+}
+
+#ifdef CLIB_HTTP_DEFINITIONS
+
+/**
+ * Find the slot of a name: either the slot holding it or the empty slot where it belongs.
+ */
+uint32_t *http_headers_internal_slot(HttpHeaders *headers, const char *name, size_t length, uint32_t hash) {
+    uint32_t mask = headers->slot_count - 1;
+    for (uint32_t i = hash & mask;; i = (i + 1) & mask) {
+        uint32_t *slot = &headers->slots[i];
+        if (*slot == 0) {
+            return slot;
+        }
+        HttpHeadersInternalEntry *entry = &headers->entries[*slot - 1];
+        if (entry->hash == hash && http_headers_internal_equals(headers->arena.ptr + entry->name, name, length)) {
+            return slot;
+        }
+    }
+}
+
+/**
+ * Double the hash index and reinsert the first entry of every name.
+ * @return 0 on success, 1 on allocation failure
+ */
+int http_headers_internal_grow_slots(HttpHeaders *headers) {
+    uint32_t slot_count = headers->slot_count == 0 ? HTTP_HEADERS_INITIAL_SLOTS : headers->slot_count << 1;
+    uint32_t *slots = calloc(slot_count, sizeof(*slots));
+    if (slots == NULL) {
+        return 1;
+    }
+    free(headers->slots);
+    headers->slots = slots;
+    headers->slot_count = slot_count;
+    for (uint32_t i = 0; i < headers->len; i += 1) {
+        HttpHeadersInternalEntry *entry = &headers->entries[i];
+        if (entry->count == 0) {
+            continue;
+        }
+        uint32_t mask = slot_count - 1;
+        uint32_t j = entry->hash & mask;
+        while (slots[j] != 0) {
+            j = (j + 1) & mask;
+        }
+        slots[j] = i + 1;
+    }
+    return 0;
+}
+
+/**
+ * Find the first entry of a name.
+ * @return Pointer to the entry or `NULL`
+ */
+HttpHeadersInternalEntry *http_headers_internal_find(HttpHeaders *headers, const char *name) {
+    if (headers == NULL || headers->slot_count == 0) {
+        return NULL;
+    }
+    size_t length = strlen(name);
+    uint32_t *slot = http_headers_internal_slot(headers, name, length, http_headers_internal_hash(name, length));
+    return *slot == 0 ? NULL : &headers->entries[*slot - 1];
+}
+
+#else
+
+uint32_t *http_headers_internal_slot(HttpHeaders *headers, const char *name, size_t length, uint32_t hash);
+int http_headers_internal_grow_slots(HttpHeaders *headers);
+HttpHeadersInternalEntry *http_headers_internal_find(HttpHeaders *headers, const char *name);
+
+#endif
+
+#pragma endregion
+
+#ifdef CLIB_HTTP_DEFINITIONS
+
+/**
+ * Initialize a header store.
+ * NOTE: Allocates memory! Release the store with `http_headers_release`.
+ * @param headers Pointer to an `HttpHeaders` struct
+ * @return 0 on success, 1 on allocation failure
+ */
+int http_headers_init(HttpHeaders *headers) {
+    *headers = (HttpHeaders) {0};
+    if (buffer_init(&headers->arena, 1024) != BUFFER_ERROR_NONE) {
+        return 1;
+    }
+    return http_headers_internal_grow_slots(headers);
+}
+
+/**
+ * Free all the associated memory of the store.
+ * @param headers Pointer to an `HttpHeaders` struct
+ */
+void http_headers_release(HttpHeaders *headers) {
+    buffer_release(&headers->arena);
+    free(headers->entries);
+    free(headers->slots);
+    *headers = (HttpHeaders) {0};
+}
+
+/**
+ * Remove every header but keep the memory for reuse.
+ * @param headers Pointer to an `HttpHeaders` struct
+ */
+void http_headers_clear(HttpHeaders *headers) {
+    headers->arena.len = 0;
+    headers->len = 0;
+    memset(headers->slots, 0, headers->slot_count * sizeof(*headers->slots));
+}
+
+/**
+ * Add a header to the store.
+ * @param headers Pointer to an `HttpHeaders` struct
+ * @param name Header name, not null terminated
+ * @param name_length Length of the name
+ * @param value Header value, not null terminated
+ * @param value_length Length of the value
+ * @return 0 on success, 1 on allocation failure
+ */
+int http_headers_add(HttpHeaders *headers, const char *name, size_t name_length, const char *value, size_t value_length) {
+    if (headers->len == headers->cap) {
+        uint32_t cap = headers->cap == 0 ? 32 : headers->cap << 1;
+        HttpHeadersInternalEntry *entries = realloc(headers->entries, cap * sizeof(*entries));
+        if (entries == NULL) {
+            return 1;
+        }
+        headers->entries = entries;
+        headers->cap = cap;
+    }
+    // Keep the index at most half full
+    if ((headers->len + 1) * 2 > headers->slot_count && http_headers_internal_grow_slots(headers) != 0) {
+        return 1;
+    }
+
+    uint32_t name_offset = (uint32_t)headers->arena.len;
+    if (buffer_write_bytes(&headers->arena, name, name_length) != BUFFER_ERROR_NONE
+        || buffer_write_byte(&headers->arena, '\0') != BUFFER_ERROR_NONE) {
+        return 1;
+    }
+    uint32_t value_offset = (uint32_t)headers->arena.len;
+    if (buffer_write_bytes(&headers->arena, value, value_length) != BUFFER_ERROR_NONE
+        || buffer_write_byte(&headers->arena, '\0') != BUFFER_ERROR_NONE) {
+        return 1;
+    }
+
+    uint32_t hash = http_headers_internal_hash(name, name_length);
+    uint32_t index = headers->len;
+    headers->entries[index] = (HttpHeadersInternalEntry) {
+        .name = name_offset,
+        .value = value_offset,
+        .hash = hash,
+    };
+    headers->len += 1;
+
+    uint32_t *slot = http_headers_internal_slot(headers, name, name_length, hash);
+    if (*slot == 0) {
+        *slot = index + 1;
+        headers->entries[index].last = index + 1;
+        headers->entries[index].count = 1;
+    }
+    else {
+        HttpHeadersInternalEntry *first = &headers->entries[*slot - 1];
+        headers->entries[first->last - 1].next = index + 1;
+        first->last = index + 1;
+        first->count += 1;
+    }
+    return 0;
+}
+
+/**
+ * Add a raw header line as received from curl.
+ * A status line starts a new response (e.g. after a redirect) and clears the store,
+ * so only the headers of the final response are kept.
+ * @param headers Pointer to an `HttpHeaders` struct
+ * @param line The header line, not null terminated
+ * @param length Length of the line
+ * @return 0 on success, 1 on allocation failure
+ */
+int http_headers_add_line(HttpHeaders *headers, const char *line, size_t length) {
+    while (length > 0 && (line[length - 1] == '\n' || line[length - 1] == '\r')) {
+        length -= 1;
+    }
+    if (length >= 5 && memcmp(line, "HTTP/", 5) == 0) {
+        http_headers_clear(headers);
+        return 0;
+    }
+    const char *colon = memchr(line, ':', length);
+    if (colon == NULL || colon == line || line[0] == ' ' || line[0] == '\t') {
+        return 0;
+    }
+    const char *value = colon + 1;
+    const char *end = line + length;
+    while (value < end && (*value == ' ' || *value == '\t')) {
+        value += 1;
+    }
+    while (end > value && (end[-1] == ' ' || end[-1] == '\t')) {
+        end -= 1;
+    }
+    return http_headers_add(headers, line, (size_t)(colon - line), value, (size_t)(end - value));
+}
+
+/**
+ * Get the first value of a header.
+ * @param headers Pointer to an `HttpHeaders` struct
+ * @param name Header name, case-insensitive
+ * @return The value or `NULL`. Valid until the store is cleared or released.
+ */
+const char *http_headers_get(HttpHeaders *headers, const char *name) {
+    HttpHeadersInternalEntry *entry = http_headers_internal_find(headers, name);
+    return entry == NULL ? NULL : headers->arena.ptr + entry->value;
+}
+
+/**
+ * Get the number of values of a header.
+ * @param headers Pointer to an `HttpHeaders` struct
+ * @param name Header name, case-insensitive
+ * @return Number of values, 0 if the header is missing
+ */
+size_t http_headers_count(HttpHeaders *headers, const char *name) {
+    HttpHeadersInternalEntry *entry = http_headers_internal_find(headers, name);
+    return entry == NULL ? 0 : entry->count;
+}
+
+/**
+ * Get the nth value of a header that was sent multiple times.
+ * @param headers Pointer to an `HttpHeaders` struct
+ * @param name Header name, case-insensitive
+ * @param n Index of the value in arrival order
+ * @return The value or `NULL`. Valid until the store is cleared or released.
+ */
+const char *http_headers_get_nth(HttpHeaders *headers, const char *name, size_t n) {
+    HttpHeadersInternalEntry *entry = http_headers_internal_find(headers, name);
+    if (entry == NULL || n >= entry->count) {
+        return NULL;
+    }
+    for (; n > 0; n -= 1) {
+        entry = &headers->entries[entry->next - 1];
+    }
+    return headers->arena.ptr + entry->value;
+}
+
+/**
+ * Iterate over all headers in arrival order.
+ * @param headers Pointer to an `HttpHeaders` struct
+ * @param iterator Iterator state, set to 0 before the first call
+ * @param field Output for the next header
+ * @return 1 if a header was returned, 0 at the end
+ */
+int http_headers_next(HttpHeaders *headers, size_t *iterator, HttpHeaderField *field) {
+    if (headers == NULL || *iterator >= headers->len) {
+        return 0;
+    }
+    HttpHeadersInternalEntry *entry = &headers->entries[*iterator];
+    field->name = headers->arena.ptr + entry->name;
+    field->value = headers->arena.ptr + entry->value;
+    *iterator += 1;
+    return 1;
+}
+
+#else
+
+int http_headers_init(HttpHeaders *headers);
+void http_headers_release(HttpHeaders *headers);
+void http_headers_clear(HttpHeaders *headers);
+int http_headers_add(HttpHeaders *headers, const char *name, size_t name_length, const char *value, size_t value_length);
+int http_headers_add_line(HttpHeaders *headers, const char *line, size_t length);
+const char *http_headers_get(HttpHeaders *headers, const char *name);
+size_t http_headers_count(HttpHeaders *headers, const char *name);
+const char *http_headers_get_nth(HttpHeaders *headers, const char *name, size_t n);
+int http_headers_next(HttpHeaders *headers, size_t *iterator, HttpHeaderField *field);
+
+#endif
+
+#endif
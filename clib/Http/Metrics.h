@@ -0,0 +1,348 @@
+#ifndef HTTP_METRICS_H
+#define HTTP_METRICS_H
+
+#ifndef _STDINT_H
+#include <stdint.h>
+#endif
+
+#include "Clib.h"
+#include "Client.h"
+
+/**
+ * Every power of two range of a histogram is split into 2^`HTTP_HISTOGRAM_SUB_BITS`
+ * buckets, which bounds the relative error of a recorded value to about 3%.
+ */
+#define HTTP_HISTOGRAM_SUB_BITS 5
+
+/**
+ * Values are clamped below 2^`HTTP_HISTOGRAM_MAX_BITS` microseconds (about 19 hours).
+ */
+#define HTTP_HISTOGRAM_MAX_BITS 36
+
+#define HTTP_HISTOGRAM_BUCKETS ((HTTP_HISTOGRAM_MAX_BITS - HTTP_HISTOGRAM_SUB_BITS + 1) << HTTP_HISTOGRAM_SUB_BITS)
+
+/**
+ * Max length of a host name in `HttpHostMetrics`.
+ */
+#define HTTP_METRICS_HOST_SIZE 256
+
+/**
+ * Connections kept per host in `HttpHostMetrics`, the most recently opened ones.
+ * Older connections only remain in the totals.
+ */
+#define HTTP_METRICS_CONNECTIONS 64
+
+/**
+ * A log-linear latency histogram in the style of HdrHistogram.
+ * Recording is a constant time bucket increment, percentiles are read by walking the buckets.
+ */
+typedef struct HttpHistogram {
+    uint64_t buckets[HTTP_HISTOGRAM_BUCKETS];
+    uint64_t count, sum, min, max;
+} HttpHistogram;
+
+/**
+ * Transfers of a single connection, more than one at a time with HTTP/2 multiplexing.
+ */
+typedef struct HttpConnectionMetrics {
+    long local_port;  // Tells the connections to a host apart
+    uint64_t streams; // Number of transfers that ran on the connection
+    long version;     // HTTP version of the connection, e.g. `CURL_HTTP_VERSION_2_0`
+} HttpConnectionMetrics;
+
+/**
+ * Latency histograms of a single host.
+ */
+typedef struct HttpHostMetrics {
+    char host[HTTP_METRICS_HOST_SIZE];
+    HttpHistogram total;                                         // Whole transfer
+    HttpHistogram first_byte;                                    // Until the first byte of the response
+    HttpHistogram connect;                                       // Until the connection is ready, TLS included, only for new connections
+    uint64_t reused;                                             // Number of transfers that reused a connection
+    uint64_t opened;                                             // Number of connections opened to the host
+    uint64_t streams;                                            // Number of transfers on all of them
+    HttpConnectionMetrics connections[HTTP_METRICS_CONNECTIONS]; // Ring of the most recently opened connections
+    size_t connections_len;                                      // Entries of `connections` in use
+    size_t connections_next;                                     // Entry the next new connection replaces
+} HttpHostMetrics;
+
+/**
+ * Aggregates response timings per host.
+ */
+typedef struct HttpMetrics {
+    HttpHostMetrics **hosts;
+    size_t len, cap;
+} HttpMetrics;
+
+#pragma region Internals
+
+/**
+ * @return Index of the bucket for `value`
+ */
+static inline size_t http_histogram_internal_index(uint64_t value) {
+    if (value >= (1ULL << HTTP_HISTOGRAM_MAX_BITS)) {
+        value = (1ULL << HTTP_HISTOGRAM_MAX_BITS) - 1;
+    }
+    if (value < (1ULL << HTTP_HISTOGRAM_SUB_BITS)) {
+        return (size_t)value;
+    }
+    int msb = 63;
+    while (!(value >> msb)) {
+        msb -= 1;
+    }
+    int shift = msb - HTTP_HISTOGRAM_SUB_BITS;
+    return ((size_t)(shift + 1) << HTTP_HISTOGRAM_SUB_BITS) + (size_t)((value >> shift) - (1ULL << HTTP_HISTOGRAM_SUB_BITS));
+}
+
+#ifdef CLIB_HTTP_DEFINITIONS
+
+/**
+ * @return The highest value that falls into the bucket at `index`
+ */
+uint64_t http_histogram_internal_highest(size_t index) {
+    if (index < (1 << HTTP_HISTOGRAM_SUB_BITS)) {
+        return index;
+    }
+    int shift = (int)(index >> HTTP_HISTOGRAM_SUB_BITS) - 1;
+    uint64_t sub = (index & ((1 << HTTP_HISTOGRAM_SUB_BITS) - 1)) + (1ULL << HTTP_HISTOGRAM_SUB_BITS);
+    return ((sub + 1) << shift) - 1;
+}
+
+/**
+ * Extract the host name from a URL.
+ * @param url The URL
+ * @param host Output buffer for the host
+ * @param host_size Size of the output buffer
+ */
+void http_metrics_internal_host(const char *url, char *host, size_t host_size) {
+    const char *start = strstr(url, "://");
+    start = start != NULL ? start + 3 : url;
+    const char *at = start;
+    // Skip user info
+    for (const char *c = start; *c != '\0' && *c != '/' && *c != '?' && *c != '#'; c += 1) {
+        if (*c == '@') {
+            at = c + 1;
+        }
+    }
+    start = at;
+    size_t length = 0;
+    if (*start == '[') {
+        while (start[length] != '\0' && start[length] != ']') {
+            length += 1;
+        }
+        length += start[length] == ']';
+    }
+    else {
+        while (start[length] != '\0' && start[length] != ':' && start[length] != '/' && start[length] != '?' && start[length] != '#') {
+            length += 1;
+        }
+    }
+    if (length >= host_size) {
+        length = host_size - 1;
+    }
+    memcpy(host, start, length);
+    host[length] = '\0';
+}
+
+/**
+ * Count a transfer on its connection.
+ * A new connection replaces the oldest entry once the ring is full, even if its local port was used before.
+ * A reused connection is looked up from the newest entry, so a port that was reused by a newer connection
+ * finds that one.
+ */
+void http_metrics_internal_connection(HttpHostMetrics *host_metrics, HttpResponse *response) {
+    host_metrics->streams += 1;
+    if (response->connection_reused) {
+        for (size_t i = 1; i <= host_metrics->connections_len; i += 1) {
+            size_t index = (host_metrics->connections_next + HTTP_METRICS_CONNECTIONS - i) % HTTP_METRICS_CONNECTIONS;
+            if (host_metrics->connections[index].local_port == response->local_port) {
+                host_metrics->connections[index].streams += 1;
+                return;
+            }
+        }
+        // Opened before the oldest entry, only the totals count it
+        return;
+    }
+    host_metrics->opened += 1;
+    host_metrics->connections[host_metrics->connections_next] = (HttpConnectionMetrics) {
+        .local_port = response->local_port,
+        .streams = 1,
+        .version = response->version,
+    };
+    host_metrics->connections_next = (host_metrics->connections_next + 1) % HTTP_METRICS_CONNECTIONS;
+    if (host_metrics->connections_len < HTTP_METRICS_CONNECTIONS) {
+        host_metrics->connections_len += 1;
+    }
+}
+
+#else
+
+uint64_t http_histogram_internal_highest(size_t index);
+void http_metrics_internal_host(const char *url, char *host, size_t host_size);
+void http_metrics_internal_connection(HttpHostMetrics *host_metrics, HttpResponse *response);
+
+#endif
+
+#pragma endregion
+
+/**
+ * Record a value into a histogram.
+ * @param histogram Pointer to an `HttpHistogram` struct
+ * @param value The value, e.g. microseconds
+ */
+static inline void http_histogram_record(HttpHistogram *histogram, uint64_t value) {
+    histogram->buckets[http_histogram_internal_index(value)] += 1;
+    if (histogram->count == 0 || value < histogram->min) {
+        histogram->min = value;
+    }
+    if (value > histogram->max) {
+        histogram->max = value;
+    }
+    histogram->count += 1;
+    histogram->sum += value;
+}
+
+#ifdef CLIB_HTTP_DEFINITIONS
+
+/**
+ * Get a percentile of the recorded values.
+ * The result is the highest value of the bucket the percentile falls into, capped to the max.
+ * @param histogram Pointer to an `HttpHistogram` struct
+ * @param percentile Percentile between 0 and 100, e.g. 99.9
+ * @return The value at the percentile, 0 if the histogram is empty
+ */
+uint64_t http_histogram_percentile(HttpHistogram *histogram, double percentile) {
+    if (histogram->count == 0) {
+        return 0;
+    }
+    if (percentile > 100) {
+        percentile = 100;
+    }
+    uint64_t target = (uint64_t)(percentile / 100 * (double)histogram->count + 0.5);
+    if (target == 0) {
+        target = 1;
+    }
+    uint64_t seen = 0;
+    for (size_t i = 0; i < HTTP_HISTOGRAM_BUCKETS; i += 1) {
+        seen += histogram->buckets[i];
+        if (seen >= target) {
+            uint64_t value = http_histogram_internal_highest(i);
+            return value < histogram->max ? value : histogram->max;
+        }
+    }
+    return histogram->max;
+}
+
+/**
+ * Get the mean of the recorded values.
+ * @param histogram Pointer to an `HttpHistogram` struct
+ * @return The mean, 0 if the histogram is empty
+ */
+double http_histogram_mean(HttpHistogram *histogram) {
+    if (histogram->count == 0) {
+        return 0;
+    }
+    return (double)histogram->sum / (double)histogram->count;
+}
+
+/**
+ * Get the average number of transfers per connection of a host.
+ * Well above 1 for HTTP/2 multiplexing and HTTP/1.1 keep-alive.
+ * @param host_metrics Pointer to an `HttpHostMetrics` struct
+ * @return Transfers per connection, 0 if nothing was recorded
+ */
+double http_metrics_streams_per_connection(HttpHostMetrics *host_metrics) {
+    if (host_metrics->opened == 0) {
+        return 0;
+    }
+    return (double)host_metrics->streams / (double)host_metrics->opened;
+}
+
+/**
+ * Free all the associated memory of the metrics.
+ * @param metrics Pointer to an `HttpMetrics` struct
+ */
+void http_metrics_release(HttpMetrics *metrics) {
+    for (size_t i = 0; i < metrics->len; i += 1) {
+        free(metrics->hosts[i]);
+    }
+    free(metrics->hosts);
+    *metrics = (HttpMetrics) {0};
+}
+
+/**
+ * Find the metrics of a host, adding them if the host is new.
+ * NOTE: Allocates memory!
+ * @param metrics Pointer to an `HttpMetrics` struct, zero initialized before first use
+ * @param host The host name
+ * @return Pointer to the host metrics, or `NULL` on allocation failure
+ */
+HttpHostMetrics *http_metrics_host(HttpMetrics *metrics, const char *host) {
+    for (size_t i = 0; i < metrics->len; i += 1) {
+        if (strcmp(metrics->hosts[i]->host, host) == 0) {
+            return metrics->hosts[i];
+        }
+    }
+    if (metrics->len == metrics->cap) {
+        size_t cap = metrics->cap == 0 ? 8 : metrics->cap << 1;
+        HttpHostMetrics **hosts = realloc(metrics->hosts, cap * sizeof(*hosts));
+        if (hosts == NULL) {
+            return NULL;
+        }
+        metrics->hosts = hosts;
+        metrics->cap = cap;
+    }
+    HttpHostMetrics *host_metrics = calloc(1, sizeof(*host_metrics));
+    if (host_metrics == NULL) {
+        return NULL;
+    }
+    strncpy(host_metrics->host, host, HTTP_METRICS_HOST_SIZE - 1);
+    metrics->hosts[metrics->len] = host_metrics;
+    metrics->len += 1;
+    return host_metrics;
+}
+
+/**
+ * Record the timings of a response under the host of its URL.
+ * Responses without a curl handle (e.g. cache hits) are skipped.
+ * @param metrics Pointer to an `HttpMetrics` struct
+ * @param response The response of a finished transfer
+ */
+void http_metrics_record(HttpMetrics *metrics, HttpResponse *response) {
+    char *url = NULL;
+    char host[HTTP_METRICS_HOST_SIZE];
+    if (response->curl_handle == NULL || response->timings.total == 0) {
+        return;
+    }
+    if (curl_easy_getinfo(response->curl_handle, CURLINFO_EFFECTIVE_URL, &url) != CURLE_OK || url == NULL) {
+        return;
+    }
+    http_metrics_internal_host(url, host, sizeof(host));
+    HttpHostMetrics *host_metrics = http_metrics_host(metrics, host);
+    if (host_metrics == NULL) {
+        return;
+    }
+    http_histogram_record(&host_metrics->total, (uint64_t)response->timings.total);
+    http_histogram_record(&host_metrics->first_byte, (uint64_t)response->timings.start_transfer);
+    http_metrics_internal_connection(host_metrics, response);
+    if (response->connection_reused) {
+        host_metrics->reused += 1;
+    }
+    else {
+        curl_off_t connect = response->timings.app_connect > 0 ? response->timings.app_connect : response->timings.connect;
+        http_histogram_record(&host_metrics->connect, (uint64_t)connect);
+    }
+}
+
+#else
+
+uint64_t http_histogram_percentile(HttpHistogram *histogram, double percentile);
+double http_histogram_mean(HttpHistogram *histogram);
+double http_metrics_streams_per_connection(HttpHostMetrics *host_metrics);
+void http_metrics_release(HttpMetrics *metrics);
+HttpHostMetrics *http_metrics_host(HttpMetrics *metrics, const char *host);
+void http_metrics_record(HttpMetrics *metrics, HttpResponse *response);
+
+#endif
+
+#endif
@@ -0,0 +1,383 @@
+#ifndef HTTP_POOL_H
+#define HTTP_POOL_H
+
+/**
+ * A fixed number of worker threads that run requests, every worker with its own `HttpClient`.
+ * Every worker has its own queue of jobs: it takes its newest job first, and once its queue is empty
+ * it steals the oldest job of another worker. Slow hosts or heavy body processing on one worker
+ * don't leave the other cores idle.
+ * Results come back through a callback that runs on the worker, so bodies are processed in parallel,
+ * or by waiting for a job like for a future.
+ * NOTE: POSIX threads only.
+ */
+
+#ifndef _INC_STDLIB
+#include <stdlib.h>
+#endif
+
+#include <pthread.h>
+#include <stdatomic.h>
+#include <unistd.h>
+
+#include "Clib.h"
+#include "Client.h"
+
+/**
+ * Initial capacity of every worker's queue, it grows as needed.
+ */
+#define HTTP_POOL_QUEUE_SIZE 64
+
+typedef struct HttpJob HttpJob;
+
+/**
+ * Called on the worker thread once the transfer of a job finished.
+ * The response is only valid during the call, its handle goes back to the worker's client afterwards.
+ * @param job The finished job
+ * @param response The response, `error` has the result of the transfer
+ * @param user_data The `user_data` of the job
+ */
+typedef void (*HttpJobFunction)(HttpJob *job, HttpResponse *response, void *user_data);
+
+/**
+ * A GET request for the pool.
+ * The job must stay valid until it is done, see `http_job_wait` and `http_pool_wait`.
+ */
+struct HttpJob {
+    const char *url;
+    HttpSink sink;               // Receives the response, called on the worker thread
+    HttpJobFunction on_complete; // Optional, called on the worker thread
+    void *user_data;             // Any user specified data for the callback
+    HttpResponse response;       // Set by the pool, the result without its curl handle
+    int done;                    // Set by the pool, 1 once the response is set and the callback returned
+};
+
+typedef struct HttpPool HttpPool;
+
+/**
+ * Jobs of a single worker, a ring buffer with the oldest job at `head`.
+ */
+typedef struct HttpPoolInternalQueue {
+    pthread_mutex_t lock;
+    HttpJob **jobs;
+    size_t head, len, cap;
+} HttpPoolInternalQueue;
+
+typedef struct HttpPoolInternalWorker {
+    HttpPool *pool;
+    size_t index;
+    HttpPoolInternalQueue queue;
+    HttpClient client;
+    pthread_t thread;
+    int started;
+} HttpPoolInternalWorker;
+
+struct HttpPool {
+    HttpPoolInternalWorker *workers;
+    size_t worker_count;
+    atomic_size_t next;      // Worker that gets the next job submitted from outside the pool
+    atomic_size_t queued;    // Jobs in a queue or being pushed, not yet taken by a worker
+    pthread_mutex_t lock;    // Guards the sleeping workers, `pending`, `stopping` and `HttpJob.done`
+    pthread_cond_t work;     // Signaled when a job is queued
+    pthread_cond_t finished; // Broadcast when a job is done
+    size_t pending;          // Jobs submitted and not done yet
+    int stopping;
+};
+
+#pragma region Internals
+
+#ifdef CLIB_HTTP_DEFINITIONS
+
+/**
+ * The worker running on the calling thread, `NULL` outside of the pool.
+ */
+static HTTP_THREAD_LOCAL HttpPoolInternalWorker *http_pool_internal_current;
+
+/**
+ * Append a job as the newest of a queue.
+ * @return 0 on success, 1 on allocation failure
+ */
+int http_pool_internal_push(HttpPoolInternalQueue *queue, HttpJob *job) {
+    pthread_mutex_lock(&queue->lock);
+    if (queue->len == queue->cap) {
+        size_t cap = queue->cap * 2;
+        HttpJob **jobs = malloc(cap * sizeof(*jobs));
+        if (jobs == NULL) {
+            pthread_mutex_unlock(&queue->lock);
+            return 1;
+        }
+        for (size_t i = 0; i < queue->len; i += 1) {
+            jobs[i] = queue->jobs[(queue->head + i) % queue->cap];
+        }
+        free(queue->jobs);
+        queue->jobs = jobs;
+        queue->head = 0;
+        queue->cap = cap;
+    }
+    queue->jobs[(queue->head + queue->len) % queue->cap] = job;
+    queue->len += 1;
+    pthread_mutex_unlock(&queue->lock);
+    return 0;
+}
+
+/**
+ * Take the newest (owner) or the oldest (thief) job of a queue.
+ * @return The job, `NULL` if the queue is empty
+ */
+HttpJob *http_pool_internal_take(HttpPoolInternalQueue *queue, int oldest) {
+    HttpJob *job = NULL;
+    pthread_mutex_lock(&queue->lock);
+    if (queue->len > 0) {
+        if (oldest) {
+            job = queue->jobs[queue->head];
+            queue->head = (queue->head + 1) % queue->cap;
+        }
+        else {
+            job = queue->jobs[(queue->head + queue->len - 1) % queue->cap];
+        }
+        queue->len -= 1;
+    }
+    pthread_mutex_unlock(&queue->lock);
+    return job;
+}
+
+/**
+ * Take a job from the worker's own queue, else steal one from the next workers in turn.
+ * @return The job, `NULL` if every queue is empty
+ */
+HttpJob *http_pool_internal_find(HttpPoolInternalWorker *worker) {
+    HttpPool *pool = worker->pool;
+    HttpJob *job = http_pool_internal_take(&worker->queue, 0);
+    for (size_t i = 1; job == NULL && i < pool->worker_count; i += 1) {
+        job = http_pool_internal_take(&pool->workers[(worker->index + i) % pool->worker_count].queue, 1);
+    }
+    if (job != NULL) {
+        atomic_fetch_sub_explicit(&pool->queued, 1, memory_order_relaxed);
+    }
+    return job;
+}
+
+/**
+ * Perform a job on the worker's client and report it.
+ */
+void http_pool_internal_run(HttpPoolInternalWorker *worker, HttpJob *job) {
+    HttpPool *pool = worker->pool;
+    HttpResponse response = http_client_get_sink(&worker->client, job->url, &job->sink);
+    if (job->on_complete != NULL) {
+        job->on_complete(job, &response, job->user_data);
+    }
+    http_client_return_handle(&worker->client, response.curl_handle);
+    response.curl_handle = NULL;
+    job->sink.curl_handle = NULL;
+
+    pthread_mutex_lock(&pool->lock);
+    job->response = response;
+    job->done = 1;
+    pool->pending -= 1;
+    pthread_cond_broadcast(&pool->finished);
+    pthread_mutex_unlock(&pool->lock);
+}
+
+void *http_pool_internal_thread(void *argument) {
+    HttpPoolInternalWorker *worker = argument;
+    HttpPool *pool = worker->pool;
+    http_pool_internal_current = worker;
+    while (1) {
+        HttpJob *job = http_pool_internal_find(worker);
+        if (job != NULL) {
+            http_pool_internal_run(worker, job);
+            continue;
+        }
+        // `queued` is raised before the signal, so checking it under the lock misses no job
+        pthread_mutex_lock(&pool->lock);
+        while (atomic_load_explicit(&pool->queued, memory_order_relaxed) == 0 && !pool->stopping) {
+            pthread_cond_wait(&pool->work, &pool->lock);
+        }
+        int stop = pool->stopping && atomic_load_explicit(&pool->queued, memory_order_relaxed) == 0;
+        pthread_mutex_unlock(&pool->lock);
+        if (stop) {
+            break;
+        }
+    }
+    http_pool_internal_current = NULL;
+    return NULL;
+}
+
+#else
+
+int http_pool_internal_push(HttpPoolInternalQueue *queue, HttpJob *job);
+HttpJob *http_pool_internal_take(HttpPoolInternalQueue *queue, int oldest);
+HttpJob *http_pool_internal_find(HttpPoolInternalWorker *worker);
+void http_pool_internal_run(HttpPoolInternalWorker *worker, HttpJob *job);
+void *http_pool_internal_thread(void *argument);
+
+#endif
+
+#pragma endregion
+
+#ifdef CLIB_HTTP_DEFINITIONS
+
+/**
+ * Stop the workers once every queued job is done and free the pool.
+ * Jobs still waiting in a queue are run first.
+ * @param pool Pointer to an `HttpPool` struct
+ */
+void http_pool_release(HttpPool *pool) {
+    pthread_mutex_lock(&pool->lock);
+    pool->stopping = 1;
+    pthread_cond_broadcast(&pool->work);
+    pthread_mutex_unlock(&pool->lock);
+    for (size_t i = 0; i < pool->worker_count; i += 1) {
+        HttpPoolInternalWorker *worker = &pool->workers[i];
+        if (worker->started) {
+            pthread_join(worker->thread, NULL);
+        }
+        http_client_release(&worker->client);
+        pthread_mutex_destroy(&worker->queue.lock);
+        free(worker->queue.jobs);
+    }
+    free(pool->workers);
+    pthread_cond_destroy(&pool->finished);
+    pthread_cond_destroy(&pool->work);
+    pthread_mutex_destroy(&pool->lock);
+    *pool = (HttpPool) {0};
+}
+
+/**
+ * Start the worker threads.
+ * NOTE: Allocates memory! Release the pool with `http_pool_release`.
+ * @param pool Pointer to an `HttpPool` struct
+ * @param worker_count Number of threads, 0 = one per online CPU
+ * @param options Options of every worker's `HttpClient`, or `NULL` for the defaults
+ * @return `CURLE_OK` on success, the error of `http_client_init`, or `CURLE_FAILED_INIT` if a thread could not be started
+ */
+CURLcode http_pool_init(HttpPool *pool, size_t worker_count, const HttpClientOptions *options) {
+    *pool = (HttpPool) {0};
+    if (worker_count == 0) {
+        long online = sysconf(_SC_NPROCESSORS_ONLN);
+        worker_count = online > 0 ? (size_t)online : 1;
+    }
+    pthread_mutex_init(&pool->lock, NULL);
+    pthread_cond_init(&pool->work, NULL);
+    pthread_cond_init(&pool->finished, NULL);
+    pool->workers = calloc(worker_count, sizeof(*pool->workers));
+    if (pool->workers == NULL) {
+        http_pool_release(pool);
+        return CURLE_OUT_OF_MEMORY;
+    }
+
+    CURLcode code = CURLE_OK;
+    for (size_t i = 0; i < worker_count && code == CURLE_OK; i += 1) {
+        HttpPoolInternalWorker *worker = &pool->workers[i];
+        worker->pool = pool;
+        worker->index = i;
+        pthread_mutex_init(&worker->queue.lock, NULL);
+        pool->worker_count += 1;
+        worker->queue.cap = HTTP_POOL_QUEUE_SIZE;
+        worker->queue.jobs = malloc(HTTP_POOL_QUEUE_SIZE * sizeof(*worker->queue.jobs));
+        if (worker->queue.jobs == NULL) {
+            code = CURLE_OUT_OF_MEMORY;
+        }
+        else {
+            code = http_client_init(&worker->client, options);
+        }
+    }
+    for (size_t i = 0; i < pool->worker_count && code == CURLE_OK; i += 1) {
+        HttpPoolInternalWorker *worker = &pool->workers[i];
+        if (pthread_create(&worker->thread, NULL, http_pool_internal_thread, worker) != 0) {
+            code = CURLE_FAILED_INIT;
+            break;
+        }
+        worker->started = 1;
+    }
+    if (code != CURLE_OK) {
+        http_pool_release(pool);
+    }
+    return code;
+}
+
+/**
+ * Queue a job, safe from any thread.
+ * Jobs submitted from a callback go to the queue of the worker running it.
+ * @param pool Pointer to an `HttpPool` struct
+ * @param job The job, its `response` and `done` are reset
+ * @return 0 on success, 1 on allocation failure
+ */
+int http_pool_submit(HttpPool *pool, HttpJob *job) {
+    job->response = (HttpResponse) {0};
+    job->done = 0;
+    HttpPoolInternalWorker *worker = http_pool_internal_current;
+    if (worker == NULL || worker->pool != pool) {
+        size_t next = atomic_fetch_add_explicit(&pool->next, 1, memory_order_relaxed);
+        worker = &pool->workers[next % pool->worker_count];
+    }
+
+    pthread_mutex_lock(&pool->lock);
+    pool->pending += 1;
+    pthread_mutex_unlock(&pool->lock);
+    // Raised before the push, a worker that takes the job right away must not bring it below 0
+    atomic_fetch_add_explicit(&pool->queued, 1, memory_order_relaxed);
+    if (http_pool_internal_push(&worker->queue, job) != 0) {
+        atomic_fetch_sub_explicit(&pool->queued, 1, memory_order_relaxed);
+        pthread_mutex_lock(&pool->lock);
+        pool->pending -= 1;
+        pthread_mutex_unlock(&pool->lock);
+        return 1;
+    }
+    pthread_mutex_lock(&pool->lock);
+    pthread_cond_signal(&pool->work);
+    pthread_mutex_unlock(&pool->lock);
+    return 0;
+}
+
+/**
+ * Block until a job is done, like waiting for a future.
+ * NOTE: Never call this from a callback of the same pool, the worker would wait for itself.
+ * @param pool Pointer to an `HttpPool` struct
+ * @param job A submitted job
+ * @return The response of the job
+ */
+HttpResponse *http_job_wait(HttpPool *pool, HttpJob *job) {
+    pthread_mutex_lock(&pool->lock);
+    while (!job->done) {
+        pthread_cond_wait(&pool->finished, &pool->lock);
+    }
+    pthread_mutex_unlock(&pool->lock);
+    return &job->response;
+}
+
+/**
+ * Block until every submitted job is done, including jobs submitted by callbacks meanwhile.
+ * @param pool Pointer to an `HttpPool` struct
+ */
+void http_pool_wait(HttpPool *pool) {
+    pthread_mutex_lock(&pool->lock);
+    while (pool->pending > 0) {
+        pthread_cond_wait(&pool->finished, &pool->lock);
+    }
+    pthread_mutex_unlock(&pool->lock);
+}
+
+/**
+ * Free the response of a done job.
+ * @param job Pointer to an `HttpJob` struct
+ */
+void http_job_release(HttpJob *job) {
+    if (job->response.headers != NULL) {
+        http_headers_release(job->response.headers);
+        free(job->response.headers);
+        job->response.headers = NULL;
+    }
+}
+
+#else
+
+void http_pool_release(HttpPool *pool);
+CURLcode http_pool_init(HttpPool *pool, size_t worker_count, const HttpClientOptions *options);
+int http_pool_submit(HttpPool *pool, HttpJob *job);
+HttpResponse *http_job_wait(HttpPool *pool, HttpJob *job);
+void http_pool_wait(HttpPool *pool);
+void http_job_release(HttpJob *job);
+
+#endif
+
+#endif
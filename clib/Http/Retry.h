@@ -0,0 +1,552 @@
+#ifndef HTTP_RETRY_H
+#define HTTP_RETRY_H
+
+/**
+ * Retries with exponential backoff and hedged requests.
+ * Reference:
+ *  - Backoff with full jitter: https://aws.amazon.com/blogs/architecture/exponential-backoff-and-jitter/
+ *  - Hedged requests: Dean & Barroso, "The Tail at Scale"
+ */
+
+#ifndef _STDINT_H
+#include <stdint.h>
+#endif
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <time.h>
+#endif
+
+#ifndef _INC_ERRNO
+#include <errno.h>
+#endif
+
+#include "Clib.h"
+#include "Metrics.h"
+#include "Sink.h"
+
+#define HTTP_RETRY_DEFAULT_MAX_ATTEMPTS 3
+#define HTTP_RETRY_DEFAULT_BASE_DELAY_MS 100
+#define HTTP_RETRY_DEFAULT_MAX_DELAY_MS 10000
+
+#define HTTP_HEDGE_DEFAULT_PERCENTILE 95
+#define HTTP_HEDGE_DEFAULT_DELAY_MS 50
+
+/**
+ * Samples needed in the latency histogram before the hedge delay is taken from it.
+ */
+#define HTTP_HEDGE_MIN_SAMPLES 20
+
+/**
+ * Called before a retry so the sink can drop what it received from the failed attempt.
+ * `sink->body_bytes` holds the number of bytes the attempt passed to it.
+ * @return 0 if the sink was reset, else the failed attempt is returned without retrying
+ */
+typedef int (*HttpRetryResetFunction)(HttpSink *sink);
+
+/**
+ * When and how often to retry a request.
+ * Zero values fall back to the `HTTP_RETRY_DEFAULT_*` values.
+ */
+typedef struct HttpRetryPolicy {
+    int max_attempts;                      // Attempts including the first one
+    long base_delay_ms;                    // Backoff before the first retry, doubled for every further one
+    long max_delay_ms;                     // Cap of the backoff and of `Retry-After`
+    const CURLcode *retry_errors;          // Transfer errors to retry, `NULL` = connection and timeout errors
+    size_t retry_errors_len;
+    const long *retry_statuses;            // Response codes to retry, `NULL` = 429, 502, 503 and 504
+    size_t retry_statuses_len;
+    int ignore_retry_after;                // Don't wait for the `Retry-After` of 429/503 responses
+    HttpRetryResetFunction reset_function; // Called before every retry, `NULL` = `http_sink_buffer_reset` or `http_sink_file_reset` for those sinks
+} HttpRetryPolicy;
+
+/**
+ * When to send a duplicate of a slow request.
+ */
+typedef struct HttpHedgePolicy {
+    HttpHistogram *latency; // Latencies of earlier requests in microseconds, the new one is recorded into it. `NULL` = always wait `delay_ms`
+    double percentile;      // Hedge once this percentile of `latency` has passed, 0 = `HTTP_HEDGE_DEFAULT_PERCENTILE`
+    long delay_ms;          // Delay until `latency` has `HTTP_HEDGE_MIN_SAMPLES` samples, 0 = `HTTP_HEDGE_DEFAULT_DELAY_MS`
+} HttpHedgePolicy;
+
+#pragma region Internals
+
+static const CURLcode http_retry_internal_default_errors[] = {
+    CURLE_COULDNT_RESOLVE_HOST,
+    CURLE_COULDNT_CONNECT,
+    CURLE_OPERATION_TIMEDOUT,
+    CURLE_SEND_ERROR,
+    CURLE_RECV_ERROR,
+    CURLE_GOT_NOTHING,
+    CURLE_PARTIAL_FILE,
+    CURLE_HTTP2_STREAM,
+};
+
+static const long http_retry_internal_default_statuses[] = {429, 502, 503, 504};
+
+#ifdef CLIB_HTTP_DEFINITIONS
+
+/**
+ * @return Monotonic clock in microseconds
+ */
+int64_t http_retry_internal_now_us(void) {
+#ifdef _WIN32
+    return (int64_t)GetTickCount64() * 1000;
+#else
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (int64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+#endif
+}
+
+void http_retry_internal_sleep_ms(long ms) {
+#ifdef _WIN32
+    Sleep((DWORD)ms);
+#else
+    struct timespec delay = {.tv_sec = ms / 1000, .tv_nsec = (ms % 1000) * 1000000L};
+    while (nanosleep(&delay, &delay) != 0 && errno == EINTR) {}
+#endif
+}
+
+/**
+ * xorshift64*, good enough to spread out the retries of many clients.
+ */
+uint64_t http_retry_internal_random(uint64_t *state) {
+    *state ^= *state >> 12;
+    *state ^= *state << 25;
+    *state ^= *state >> 27;
+    return *state * 2685821657736338717ULL;
+}
+
+/**
+ * Decide whether an attempt should be retried.
+ * @return 1 to retry, else 0
+ */
+int http_retry_internal_should_retry(const HttpRetryPolicy *policy, CURLcode error, long status) {
+    const CURLcode *errors = policy->retry_errors;
+    size_t errors_len = policy->retry_errors_len;
+    const long *statuses = policy->retry_statuses;
+    size_t statuses_len = policy->retry_statuses_len;
+    if (errors == NULL) {
+        errors = http_retry_internal_default_errors;
+        errors_len = sizeof(http_retry_internal_default_errors) / sizeof(*errors);
+    }
+    if (statuses == NULL) {
+        statuses = http_retry_internal_default_statuses;
+        statuses_len = sizeof(http_retry_internal_default_statuses) / sizeof(*statuses);
+    }
+    if (error != CURLE_OK) {
+        for (size_t i = 0; i < errors_len; i += 1) {
+            if (errors[i] == error) {
+                return 1;
+            }
+        }
+        return 0;
+    }
+    for (size_t i = 0; i < statuses_len; i += 1) {
+        if (statuses[i] == status) {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+/**
+ * Run a request with retries, on a client or with a new handle for every attempt.
+ */
+HttpResponse http_retry_internal_run(HttpClient *client, const char *url, HttpSink *sink, const HttpRetryPolicy *policy) {
+    HttpRetryPolicy p = {0};
+    if (policy != NULL) {
+        p = *policy;
+    }
+    if (p.max_attempts <= 0) {
+        p.max_attempts = HTTP_RETRY_DEFAULT_MAX_ATTEMPTS;
+    }
+    if (p.base_delay_ms <= 0) {
+        p.base_delay_ms = HTTP_RETRY_DEFAULT_BASE_DELAY_MS;
+    }
+    if (p.max_delay_ms <= 0) {
+        p.max_delay_ms = HTTP_RETRY_DEFAULT_MAX_DELAY_MS;
+    }
+    if (p.reset_function == NULL && sink->body_write_function == http_sink_buffer_write) {
+        p.reset_function = http_sink_buffer_reset;
+    }
+    else if (p.reset_function == NULL && sink->body_write_function == http_sink_file_write) {
+        p.reset_function = http_sink_file_reset;
+    }
+    uint64_t random = (uint64_t)http_retry_internal_now_us() ^ (uint64_t)(uintptr_t)sink ^ 0x9E3779B97F4A7C15ULL;
+
+    HttpResponse response;
+    for (int attempt = 1;; attempt += 1) {
+        response = client != NULL ? http_client_get_sink(client, url, sink) : http_request_get_sink(url, sink);
+        CURLcode error = response.error;
+        if (attempt >= p.max_attempts || !http_retry_internal_should_retry(&p, error, response.code)) {
+            break;
+        }
+
+        // Full jitter: anywhere between 0 and the exponential backoff
+        long backoff = p.base_delay_ms;
+        for (int i = 1; i < attempt && backoff < p.max_delay_ms; i += 1) {
+            backoff <<= 1;
+        }
+        if (backoff > p.max_delay_ms) {
+            backoff = p.max_delay_ms;
+        }
+        long delay = (long)(http_retry_internal_random(&random) % (uint64_t)(backoff + 1));
+
+        curl_off_t retry_after = 0;
+        if (!p.ignore_retry_after && error == CURLE_OK
+            && curl_easy_getinfo(response.curl_handle, CURLINFO_RETRY_AFTER, &retry_after) == CURLE_OK
+            && retry_after > 0) {
+            long retry_after_ms = retry_after * 1000 < p.max_delay_ms ? (long)retry_after * 1000 : p.max_delay_ms;
+            if (retry_after_ms > delay) {
+                delay = retry_after_ms;
+            }
+        }
+
+        if (p.reset_function != NULL && p.reset_function(sink) != 0) {
+            break;
+        }
+        if (client != NULL) {
+            http_client_response_release(client, &response);
+        }
+        else {
+            http_response_release(&response);
+        }
+        http_retry_internal_sleep_ms(delay);
+    }
+    return response;
+}
+
+#else
+
+int64_t http_retry_internal_now_us(void);
+void http_retry_internal_sleep_ms(long ms);
+uint64_t http_retry_internal_random(uint64_t *state);
+int http_retry_internal_should_retry(const HttpRetryPolicy *policy, CURLcode error, long status);
+HttpResponse http_retry_internal_run(HttpClient *client, const char *url, HttpSink *sink, const HttpRetryPolicy *policy);
+
+#endif
+
+/**
+ * One of the two transfers of a hedged request.
+ */
+typedef struct HttpHedgeInternalAttempt {
+    struct HttpHedgeInternal *hedge;
+    int index;
+    CURL *curl;
+    HttpSink sink;
+    int started;
+    int rejected; // Answered with a status worth retrying, the response is drained unless the other attempt is out too
+    int done;
+    CURLcode error;
+} HttpHedgeInternalAttempt;
+
+typedef struct HttpHedgeInternal {
+    HttpSink *sink;
+    int winner; // Index of the attempt that answered first, -1 = none yet
+    HttpHedgeInternalAttempt attempts[2];
+} HttpHedgeInternal;
+
+#ifdef CLIB_HTTP_DEFINITIONS
+
+/**
+ * Parse the status code of a status line.
+ * @param header The raw header line as received from curl (not null terminated)
+ * @param length Length of the header line
+ * @return The status code, 0 if the line is not a status line
+ */
+long http_hedge_internal_status(const char *header, size_t length) {
+    if (length < 5 || memcmp(header, "HTTP/", 5) != 0) {
+        return 0;
+    }
+    size_t i = 5;
+    while (i < length && header[i] != ' ') {
+        i += 1;
+    }
+    long status = 0;
+    for (i += 1; i < length && header[i] >= '0' && header[i] <= '9'; i += 1) {
+        status = status * 10 + (header[i] - '0');
+    }
+    return status;
+}
+
+/**
+ * Decide the race on the final status of an attempt.
+ * A status that is worth retrying only wins if the other attempt can't win anymore,
+ * else the attempt is rejected and its response is drained.
+ * @param attempt The attempt
+ * @param status The status code of its response
+ */
+void http_hedge_internal_claim(HttpHedgeInternalAttempt *attempt, long status) {
+    HttpHedgeInternal *hedge = attempt->hedge;
+    HttpHedgeInternalAttempt *other = &hedge->attempts[1 - attempt->index];
+    HttpRetryPolicy defaults = {0};
+    attempt->rejected = http_retry_internal_should_retry(&defaults, CURLE_OK, status);
+    if (hedge->winner < 0 && (!attempt->rejected || (other->started && (other->done || other->rejected)))) {
+        hedge->winner = attempt->index;
+    }
+}
+
+/**
+ * @return What the attempt's callback returns for `n` bytes it does not pass on:
+ *         a rejected response is read to its end so its connection can be reused, a lost one is aborted
+ */
+size_t http_hedge_internal_skip(HttpHedgeInternalAttempt *attempt, size_t n) {
+    return attempt->rejected && attempt->hedge->winner < 0 ? n : 0;
+}
+
+size_t http_hedge_internal_write(char *chunk, size_t size, size_t count, void *user_data) {
+    HttpHedgeInternalAttempt *attempt = user_data;
+    if (attempt->hedge->winner != attempt->index) {
+        return http_hedge_internal_skip(attempt, size * count);
+    }
+    HttpSink *sink = attempt->hedge->sink;
+    sink->curl_handle = attempt->curl;
+    return sink->body_write_function(chunk, size, count, sink->user_data);
+}
+
+size_t http_hedge_internal_header(char *header, size_t size, size_t count, void *user_data) {
+    HttpHedgeInternalAttempt *attempt = user_data;
+    long status = http_hedge_internal_status(header, size * count);
+    if (attempt->hedge->winner != attempt->index) {
+        if (status >= 100 && status < 200) {
+            return size * count; // Informational, the final status is still to come
+        }
+        if (status != 0 && attempt->hedge->winner < 0) {
+            http_hedge_internal_claim(attempt, status);
+        }
+        if (attempt->hedge->winner != attempt->index) {
+            return http_hedge_internal_skip(attempt, size * count);
+        }
+    }
+    HttpSink *sink = attempt->hedge->sink;
+    sink->curl_handle = attempt->curl;
+    if (sink->header_write_function != NULL) {
+        return sink->header_write_function(header, size, count, sink->user_data);
+    }
+    return size * count;
+}
+
+/**
+ * Poll function of an attempt, the user's sink is polled once its attempt has won.
+ */
+int http_hedge_internal_poll(HttpSink *attempt_sink) {
+    HttpHedgeInternalAttempt *attempt = attempt_sink->user_data;
+    if (attempt->hedge->winner != attempt->index) {
+        return 0;
+    }
+    return attempt->hedge->sink->poll_function(attempt->hedge->sink);
+}
+
+/**
+ * Start an attempt of a hedged request.
+ * @return 1 if it was started, else 0
+ */
+int http_hedge_internal_start(HttpClient *client, const char *url, HttpHedgeInternalAttempt *attempt) {
+    attempt->started = 1;
+    attempt->curl = http_client_acquire_handle(client);
+    if (attempt->curl == NULL) {
+        attempt->done = 1;
+        attempt->error = CURLE_OUT_OF_MEMORY;
+        return 0;
+    }
+    attempt->sink = (HttpSink) {
+        .body_write_function = http_hedge_internal_write,
+        .header_write_function = http_hedge_internal_header,
+        .user_data = attempt,
+        .index_headers = attempt->hedge->sink->index_headers,
+        .poll_function = attempt->hedge->sink->poll_function != NULL ? http_hedge_internal_poll : NULL,
+    };
+    http_internal_setup_handle(attempt->curl, url, &attempt->sink);
+    if (curl_multi_add_handle(client->multi, attempt->curl) != CURLM_OK) {
+        http_client_return_handle(client, attempt->curl);
+        attempt->curl = NULL;
+        attempt->done = 1;
+        attempt->error = CURLE_FAILED_INIT;
+        return 0;
+    }
+    return 1;
+}
+
+/**
+ * Stop an attempt that is still running and give its handle back.
+ */
+void http_hedge_internal_cancel(HttpClient *client, HttpHedgeInternalAttempt *attempt) {
+    if (attempt->curl == NULL) {
+        return;
+    }
+    curl_multi_remove_handle(client->multi, attempt->curl);
+    http_client_return_handle(client, attempt->curl);
+    attempt->curl = NULL;
+    if (attempt->sink.headers != NULL) {
+        http_headers_release(attempt->sink.headers);
+        free(attempt->sink.headers);
+        attempt->sink.headers = NULL;
+    }
+    attempt->done = 1;
+    attempt->error = CURLE_ABORTED_BY_CALLBACK;
+}
+
+#else
+
+long http_hedge_internal_status(const char *header, size_t length);
+void http_hedge_internal_claim(HttpHedgeInternalAttempt *attempt, long status);
+size_t http_hedge_internal_skip(HttpHedgeInternalAttempt *attempt, size_t n);
+size_t http_hedge_internal_write(char *chunk, size_t size, size_t count, void *user_data);
+size_t http_hedge_internal_header(char *header, size_t size, size_t count, void *user_data);
+int http_hedge_internal_poll(HttpSink *attempt_sink);
+int http_hedge_internal_start(HttpClient *client, const char *url, HttpHedgeInternalAttempt *attempt);
+void http_hedge_internal_cancel(HttpClient *client, HttpHedgeInternalAttempt *attempt);
+
+#endif
+
+#pragma endregion
+
+#ifdef CLIB_HTTP_DEFINITIONS
+
+/**
+ * Perform an HTTP GET request, retrying failed attempts with exponential backoff and jitter.
+ * A `Retry-After` header on the response extends the wait.
+ * @param url The request URL
+ * @param sink The sink for the response. Buffer and file sinks only keep the body of the last attempt,
+ *             other sinks receive the body of every attempt unless the policy resets them
+ * @param policy Retry policy, or `NULL` for the defaults
+ * @return The `HttpResponse` of the last attempt, `http_get_last_error` has its result
+ */
+HttpResponse http_request_get_retry(const char *url, HttpSink *sink, const HttpRetryPolicy *policy) {
+    return http_retry_internal_run(NULL, url, sink, policy);
+}
+
+/**
+ * Perform an HTTP GET request with a persistent client, retrying failed attempts with exponential backoff and jitter.
+ * A `Retry-After` header on the response extends the wait.
+ * @param client Pointer to an `HttpClient` struct
+ * @param url The request URL
+ * @param sink The sink for the response. Buffer and file sinks only keep the body of the last attempt,
+ *             other sinks receive the body of every attempt unless the policy resets them
+ * @param policy Retry policy, or `NULL` for the defaults
+ * @return The `HttpResponse` of the last attempt, `http_get_last_error` has its result.
+ *         Release it with `http_client_response_release`.
+ */
+HttpResponse http_client_get_retry(HttpClient *client, const char *url, HttpSink *sink, const HttpRetryPolicy *policy) {
+    return http_retry_internal_run(client, url, sink, policy);
+}
+
+/**
+ * Get the hedge delay of a policy in milliseconds.
+ * @param policy The hedge policy
+ * @return The `percentile` of the recorded latencies rounded up, at least 1 so a fast host is not
+ *         always asked twice, or `delay_ms` while there are too few of them
+ */
+long http_hedge_delay_ms(const HttpHedgePolicy *policy) {
+    if (policy->latency != NULL && policy->latency->count >= HTTP_HEDGE_MIN_SAMPLES) {
+        double percentile = policy->percentile > 0 ? policy->percentile : HTTP_HEDGE_DEFAULT_PERCENTILE;
+        long delay_ms = (long)((http_histogram_percentile(policy->latency, percentile) + 999) / 1000);
+        return delay_ms > 0 ? delay_ms : 1;
+    }
+    return policy->delay_ms > 0 ? policy->delay_ms : HTTP_HEDGE_DEFAULT_DELAY_MS;
+}
+
+/**
+ * Perform a hedged HTTP GET request with a persistent client.
+ * If no response has arrived after the hedge delay, a duplicate request is sent.
+ * Whichever answers first with a status that is not worth retrying (see `HttpRetryPolicy`)
+ * is passed to the sink and the other one is cancelled. If the first request fails,
+ * or answers with a status worth retrying, the duplicate is sent right away.
+ * A status worth retrying is only passed on when the other attempt has failed or got one too.
+ * @param client Pointer to an `HttpClient` struct
+ * @param url The request URL, the request must be safe to send twice
+ * @param sink The sink for the response
+ * @param policy Hedge policy, its latency histogram is updated
+ * @return An `HttpResponse` struct. Release it with `http_client_response_release`.
+ */
+HttpResponse http_client_get_hedged(HttpClient *client, const char *url, HttpSink *sink, HttpHedgePolicy *policy) {
+    HttpResponse response = {0};
+    HttpHedgeInternal hedge = {.sink = sink, .winner = -1};
+    int64_t start = http_retry_internal_now_us();
+    int64_t hedge_at = start + (int64_t)http_hedge_delay_ms(policy) * 1000;
+    int hedged = 0, running, queued;
+    CURLMcode code = CURLM_OK;
+
+    for (int i = 0; i < 2; i += 1) {
+        hedge.attempts[i] = (HttpHedgeInternalAttempt) {.hedge = &hedge, .index = i};
+    }
+    sink->multi = client->multi;
+    http_hedge_internal_start(client, url, &hedge.attempts[0]);
+
+    for (;;) {
+        HttpHedgeInternalAttempt *first = &hedge.attempts[0];
+        HttpHedgeInternalAttempt *second = &hedge.attempts[1];
+        // Hedge once the delay has passed, or right away if the first attempt failed or answered with a status worth retrying
+        if (!hedged && hedge.winner < 0 && (first->done || first->rejected || http_retry_internal_now_us() >= hedge_at)) {
+            hedged = 1;
+            http_hedge_internal_start(client, url, second);
+        }
+        if (hedge.winner >= 0) {
+            http_hedge_internal_cancel(client, &hedge.attempts[1 - hedge.winner]);
+        }
+        if ((first->done && (!hedged || second->done)) || (hedge.winner >= 0 && hedge.attempts[hedge.winner].done)) {
+            break;
+        }
+
+        code = curl_multi_perform(client->multi, &running);
+        if (code != CURLM_OK) {
+            break;
+        }
+        CURLMsg *msg;
+        int finished = 0;
+        while ((msg = curl_multi_info_read(client->multi, &queued)) != NULL) {
+            for (int i = 0; i < 2 && msg->msg == CURLMSG_DONE; i += 1) {
+                if (hedge.attempts[i].curl == msg->easy_handle && !hedge.attempts[i].done) {
+                    hedge.attempts[i].done = 1;
+                    hedge.attempts[i].error = msg->data.result;
+                    finished = 1;
+                }
+            }
+        }
+        if (!finished && running > 0) {
+            int64_t timeout_ms = 1000;
+            if (!hedged) {
+                timeout_ms = (hedge_at - http_retry_internal_now_us()) / 1000 + 1;
+                timeout_ms = timeout_ms < 0 ? 0 : timeout_ms > 1000 ? 1000 : timeout_ms;
+            }
+            curl_multi_poll(client->multi, NULL, 0, (int)timeout_ms, NULL);
+        }
+    }
+
+    // The winner, or the last attempt that failed
+    int index = hedge.winner >= 0 ? hedge.winner : hedged ? 1 : 0;
+    HttpHedgeInternalAttempt *attempt = &hedge.attempts[index];
+    http_internal_curl_code = code != CURLM_OK ? CURLE_RECV_ERROR : attempt->error;
+    response.error = http_internal_curl_code;
+    if (attempt->curl != NULL) {
+        curl_multi_remove_handle(client->multi, attempt->curl);
+        if (http_internal_curl_code == CURLE_OK) {
+            http_internal_load_response(attempt->curl, &attempt->sink, &response);
+            if (policy->latency != NULL) {
+                http_histogram_record(policy->latency, (uint64_t)(http_retry_internal_now_us() - start));
+            }
+        }
+    }
+    http_internal_take_headers(&attempt->sink, &response);
+    response.curl_handle = attempt->curl;
+    sink->curl_handle = attempt->curl;
+    sink->body_bytes = attempt->sink.body_bytes;
+    sink->multi = NULL;
+    // A failed first attempt is still attached when the second one is returned
+    http_hedge_internal_cancel(client, &hedge.attempts[1 - index]);
+    return response;
+}
+
+#else
+
+HttpResponse http_request_get_retry(const char *url, HttpSink *sink, const HttpRetryPolicy *policy);
+HttpResponse http_client_get_retry(HttpClient *client, const char *url, HttpSink *sink, const HttpRetryPolicy *policy);
+long http_hedge_delay_ms(const HttpHedgePolicy *policy);
+HttpResponse http_client_get_hedged(HttpClient *client, const char *url, HttpSink *sink, HttpHedgePolicy *policy);
+
+#endif
+
+#endif
@@ -0,0 +1,539 @@
+#ifndef HTTP_SCHEDULER_H
+#define HTTP_SCHEDULER_H
+
+/**
+ * Rate limited requests to many hosts.
+ * Every host has a token bucket (requests per second with a burst) and a max number
+ * of transfers in flight. Hosts take turns round-robin, and within the turn order
+ * requests with a higher priority always start first.
+ * Hosts that may start a request are kept in a heap, hosts that wait for a token in a second
+ * one by the time it arrives, so starting a request costs O(log hosts) however many hosts there are.
+ */
+
+#ifndef _STDINT_H
+#include <stdint.h>
+#endif
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <time.h>
+#endif
+
+#include "Clib.h"
+#include "Batch.h"
+#include "Metrics.h"
+
+/**
+ * Limits of a single host. Zero values mean no limit.
+ */
+typedef struct HttpHostLimits {
+    double requests_per_second; // Refill rate of the token bucket
+    double burst;               // Capacity of the token bucket, at least 1
+    size_t max_in_flight;       // Max transfers to the host at a time
+} HttpHostLimits;
+
+typedef struct HttpSchedulerHost HttpSchedulerHost;
+
+/**
+ * Binary heap of hosts: the hosts that may start a request by the priority of their first request,
+ * then by least recent turn, or the hosts waiting for a token by the time it arrives.
+ */
+typedef struct HttpSchedulerInternalHeap {
+    HttpSchedulerHost **hosts; // Room for every host of the scheduler
+    size_t len;
+    int by_time;
+} HttpSchedulerInternalHeap;
+
+/**
+ * A request submitted to the scheduler.
+ * The completion callback receives a pointer to `request`, which is the first member,
+ * so it can be cast back to the `HttpScheduledRequest`.
+ */
+typedef struct HttpScheduledRequest {
+    HttpBatchRequest request;
+    int priority;            // Higher starts first, 0 = normal
+    HttpSchedulerHost *host; // Set by the scheduler
+    int64_t queued_us;       // Set by the scheduler, time of the submit
+    uint64_t sequence;       // Set by the scheduler, keeps equal priorities in submit order
+} HttpScheduledRequest;
+
+/**
+ * Queue and metrics of a single host.
+ */
+struct HttpSchedulerHost {
+    char host[HTTP_METRICS_HOST_SIZE];
+    HttpHostLimits limits;
+    double tokens;
+    int64_t refilled_us;
+    HttpScheduledRequest **queue;    // Binary heap by priority, then sequence
+    size_t queue_len, queue_cap;
+    size_t in_flight;
+    size_t max_queue_depth;          // Deepest the queue has been
+    uint64_t started, completed;
+    HttpHistogram wait;              // Microseconds from submit until the transfer started
+    HttpSchedulerInternalHeap *heap; // The heap the host is in, `NULL` if it has nothing to start or is at its in-flight limit
+    size_t heap_index;
+    int64_t ready_us;                // Time of the next token while the host waits for it
+    uint64_t turn;                   // Turn of the last request the host started
+};
+
+typedef struct HttpScheduler {
+    HttpClient *client;
+    HttpHostLimits default_limits;
+    HttpCompletionFunction on_complete;
+    void *completion_data;
+    HttpSchedulerHost **hosts;
+    size_t hosts_len, hosts_cap;
+    HttpSchedulerInternalHeap ready;   // Hosts that may start a request now
+    HttpSchedulerInternalHeap waiting; // Hosts that wait for a token
+    uint64_t turns;                    // Requests started, the round-robin clock
+    size_t queued, in_flight;
+    uint64_t sequence;
+} HttpScheduler;
+
+#pragma region Internals
+
+#ifdef CLIB_HTTP_DEFINITIONS
+
+/**
+ * @return Monotonic clock in microseconds
+ */
+int64_t http_scheduler_internal_now_us(void) {
+#ifdef _WIN32
+    return (int64_t)GetTickCount64() * 1000;
+#else
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (int64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+#endif
+}
+
+#else
+
+int64_t http_scheduler_internal_now_us(void);
+
+#endif
+
+/**
+ * @return 1 if `a` should start before `b`
+ */
+static inline int http_scheduler_internal_before(HttpScheduledRequest *a, HttpScheduledRequest *b) {
+    return a->priority != b->priority ? a->priority > b->priority : a->sequence < b->sequence;
+}
+
+/**
+ * @return 1 if host `a` comes before host `b` in the heap
+ */
+static inline int http_scheduler_internal_host_before(HttpSchedulerInternalHeap *heap, HttpSchedulerHost *a, HttpSchedulerHost *b) {
+    if (heap->by_time) {
+        return a->ready_us < b->ready_us;
+    }
+    int a_priority = a->queue[0]->priority, b_priority = b->queue[0]->priority;
+    return a_priority != b_priority ? a_priority > b_priority : a->turn < b->turn;
+}
+
+#ifdef CLIB_HTTP_DEFINITIONS
+
+/**
+ * Push a request onto the host's heap.
+ * @return 0 on success, 1 on allocation failure
+ */
+int http_scheduler_internal_push(HttpSchedulerHost *host, HttpScheduledRequest *request) {
+    if (host->queue_len == host->queue_cap) {
+        size_t cap = host->queue_cap == 0 ? 16 : host->queue_cap << 1;
+        HttpScheduledRequest **queue = realloc(host->queue, cap * sizeof(*queue));
+        if (queue == NULL) {
+            return 1;
+        }
+        host->queue = queue;
+        host->queue_cap = cap;
+    }
+    size_t i = host->queue_len;
+    host->queue_len += 1;
+    while (i > 0 && http_scheduler_internal_before(request, host->queue[(i - 1) / 2])) {
+        host->queue[i] = host->queue[(i - 1) / 2];
+        i = (i - 1) / 2;
+    }
+    host->queue[i] = request;
+    return 0;
+}
+
+/**
+ * Pop the first request off the host's heap, the heap must not be empty.
+ */
+HttpScheduledRequest *http_scheduler_internal_pop(HttpSchedulerHost *host) {
+    HttpScheduledRequest *first = host->queue[0];
+    host->queue_len -= 1;
+    HttpScheduledRequest *last = host->queue[host->queue_len];
+    size_t i = 0;
+    for (;;) {
+        size_t child = 2 * i + 1;
+        if (child >= host->queue_len) {
+            break;
+        }
+        if (child + 1 < host->queue_len && http_scheduler_internal_before(host->queue[child + 1], host->queue[child])) {
+            child += 1;
+        }
+        if (!http_scheduler_internal_before(host->queue[child], last)) {
+            break;
+        }
+        host->queue[i] = host->queue[child];
+        i = child;
+    }
+    if (host->queue_len > 0) {
+        host->queue[i] = last;
+    }
+    return first;
+}
+
+/**
+ * Add the tokens earned since the last refill.
+ */
+void http_scheduler_internal_refill(HttpSchedulerHost *host, int64_t now_us) {
+    if (host->limits.requests_per_second <= 0) {
+        return;
+    }
+    double burst = host->limits.burst >= 1 ? host->limits.burst : 1;
+    host->tokens += (double)(now_us - host->refilled_us) * host->limits.requests_per_second / 1e6;
+    if (host->tokens > burst) {
+        host->tokens = burst;
+    }
+    host->refilled_us = now_us;
+}
+
+/**
+ * Move the host at `index` up or down to its place in the heap.
+ */
+void http_scheduler_internal_heap_sift(HttpSchedulerInternalHeap *heap, size_t index) {
+    HttpSchedulerHost *host = heap->hosts[index];
+    while (index > 0 && http_scheduler_internal_host_before(heap, host, heap->hosts[(index - 1) / 2])) {
+        heap->hosts[index] = heap->hosts[(index - 1) / 2];
+        heap->hosts[index]->heap_index = index;
+        index = (index - 1) / 2;
+    }
+    for (;;) {
+        size_t child = 2 * index + 1;
+        if (child >= heap->len) {
+            break;
+        }
+        if (child + 1 < heap->len && http_scheduler_internal_host_before(heap, heap->hosts[child + 1], heap->hosts[child])) {
+            child += 1;
+        }
+        if (!http_scheduler_internal_host_before(heap, heap->hosts[child], host)) {
+            break;
+        }
+        heap->hosts[index] = heap->hosts[child];
+        heap->hosts[index]->heap_index = index;
+        index = child;
+    }
+    heap->hosts[index] = host;
+    host->heap_index = index;
+}
+
+/**
+ * Add a host to a heap, the heap has room for every host.
+ */
+void http_scheduler_internal_heap_insert(HttpSchedulerInternalHeap *heap, HttpSchedulerHost *host) {
+    heap->hosts[heap->len] = host;
+    heap->len += 1;
+    host->heap = heap;
+    http_scheduler_internal_heap_sift(heap, heap->len - 1);
+}
+
+/**
+ * Take a host out of the heap it is in.
+ */
+void http_scheduler_internal_heap_remove(HttpSchedulerHost *host) {
+    HttpSchedulerInternalHeap *heap = host->heap;
+    heap->len -= 1;
+    if (host->heap_index < heap->len) {
+        heap->hosts[host->heap_index] = heap->hosts[heap->len];
+        http_scheduler_internal_heap_sift(heap, host->heap_index);
+    }
+    host->heap = NULL;
+}
+
+/**
+ * Put a host into the heap for its state: ready if it may start a request now, waiting if it needs a token first,
+ * in neither if it has nothing to start or is at its in-flight limit.
+ * Called whenever the queue, the requests in flight or the limits of the host change.
+ */
+void http_scheduler_internal_update(HttpScheduler *scheduler, HttpSchedulerHost *host, int64_t now_us) {
+    if (host->heap != NULL) {
+        http_scheduler_internal_heap_remove(host);
+    }
+    if (host->queue_len == 0 || (host->limits.max_in_flight > 0 && host->in_flight >= host->limits.max_in_flight)) {
+        return;
+    }
+    http_scheduler_internal_refill(host, now_us);
+    if (host->limits.requests_per_second <= 0 || host->tokens >= 1) {
+        http_scheduler_internal_heap_insert(&scheduler->ready, host);
+        return;
+    }
+    host->ready_us = now_us + (int64_t)((1 - host->tokens) * 1e6 / host->limits.requests_per_second) + 1;
+    http_scheduler_internal_heap_insert(&scheduler->waiting, host);
+}
+
+/**
+ * Completion callback of every scheduled transfer, frees the host's slot
+ * before the user's callback runs.
+ */
+void http_scheduler_internal_complete(HttpBatchRequest *request, HttpResponse *response, CURLcode error, void *batch_data) {
+    HttpScheduler *scheduler = batch_data;
+    HttpScheduledRequest *scheduled = (HttpScheduledRequest*)request;
+    HttpSchedulerHost *host = scheduled->host;
+    host->in_flight -= 1;
+    host->completed += 1;
+    scheduler->in_flight -= 1;
+    // A host that was at its in-flight limit may start again
+    if (host->heap == NULL) {
+        http_scheduler_internal_update(scheduler, host, http_scheduler_internal_now_us());
+    }
+    scheduler->on_complete(request, response, error, scheduler->completion_data);
+}
+
+/**
+ * Start every request the limits allow.
+ * Each round picks the highest priority among the hosts that may start, and of
+ * those hosts the one whose last turn is longest ago.
+ * @return Microseconds until the next request may start, -1 if none is waiting on a token
+ */
+int64_t http_scheduler_internal_dispatch(HttpScheduler *scheduler) {
+    int64_t now = http_scheduler_internal_now_us();
+    // Hosts whose token has arrived move to the ready heap
+    while (scheduler->waiting.len > 0 && scheduler->waiting.hosts[0]->ready_us <= now) {
+        http_scheduler_internal_update(scheduler, scheduler->waiting.hosts[0], now);
+    }
+
+    while (scheduler->ready.len > 0) {
+        HttpSchedulerHost *host = scheduler->ready.hosts[0];
+        HttpScheduledRequest *request = http_scheduler_internal_pop(host);
+        scheduler->queued -= 1;
+        if (host->limits.requests_per_second > 0) {
+            host->tokens -= 1;
+        }
+        host->in_flight += 1;
+        host->started += 1;
+        host->turn = scheduler->turns;
+        scheduler->turns += 1;
+        scheduler->in_flight += 1;
+        http_scheduler_internal_update(scheduler, host, now);
+        http_histogram_record(&host->wait, (uint64_t)(now - request->queued_us));
+        // A request that cannot be started completes right away through the callback
+        http_batch_internal_start(scheduler->client, scheduler->client->multi, &request->request, http_scheduler_internal_complete, scheduler);
+    }
+
+    return scheduler->waiting.len > 0 ? scheduler->waiting.hosts[0]->ready_us - now : -1;
+}
+
+#else
+
+int http_scheduler_internal_push(HttpSchedulerHost *host, HttpScheduledRequest *request);
+HttpScheduledRequest *http_scheduler_internal_pop(HttpSchedulerHost *host);
+void http_scheduler_internal_refill(HttpSchedulerHost *host, int64_t now_us);
+void http_scheduler_internal_heap_sift(HttpSchedulerInternalHeap *heap, size_t index);
+void http_scheduler_internal_heap_insert(HttpSchedulerInternalHeap *heap, HttpSchedulerHost *host);
+void http_scheduler_internal_heap_remove(HttpSchedulerHost *host);
+void http_scheduler_internal_update(HttpScheduler *scheduler, HttpSchedulerHost *host, int64_t now_us);
+void http_scheduler_internal_complete(HttpBatchRequest *request, HttpResponse *response, CURLcode error, void *batch_data);
+int64_t http_scheduler_internal_dispatch(HttpScheduler *scheduler);
+
+#endif
+
+#pragma endregion
+
+#ifdef CLIB_HTTP_DEFINITIONS
+
+/**
+ * Initialize a scheduler.
+ * NOTE: Allocates memory! Release the scheduler with `http_scheduler_release`.
+ * @param scheduler Pointer to an `HttpScheduler` struct
+ * @param client Pointer to an initialized `HttpClient` struct, the transfers run on its multi handle
+ * @param default_limits Limits of hosts without their own, or `NULL` for no limits
+ * @param on_complete Callback called once for every request
+ * @param completion_data Any user specified data to be passed into the callback function
+ */
+void http_scheduler_init(HttpScheduler *scheduler, HttpClient *client, const HttpHostLimits *default_limits, HttpCompletionFunction on_complete, void *completion_data) {
+    *scheduler = (HttpScheduler) {
+        .client = client,
+        .on_complete = on_complete,
+        .completion_data = completion_data,
+        .waiting = {.by_time = 1},
+    };
+    if (default_limits != NULL) {
+        scheduler->default_limits = *default_limits;
+    }
+}
+
+/**
+ * Free all the associated memory of the scheduler.
+ * Requests that are still queued are dropped without a completion.
+ * @param scheduler Pointer to an `HttpScheduler` struct
+ */
+void http_scheduler_release(HttpScheduler *scheduler) {
+    for (size_t i = 0; i < scheduler->hosts_len; i += 1) {
+        free(scheduler->hosts[i]->queue);
+        free(scheduler->hosts[i]);
+    }
+    free(scheduler->hosts);
+    free(scheduler->ready.hosts);
+    free(scheduler->waiting.hosts);
+    *scheduler = (HttpScheduler) {0};
+}
+
+/**
+ * Find the queue and metrics of a host, adding them if the host is new.
+ * NOTE: Allocates memory!
+ * @param scheduler Pointer to an `HttpScheduler` struct
+ * @param host The host name
+ * @return Pointer to the host, or `NULL` on allocation failure
+ */
+HttpSchedulerHost *http_scheduler_host(HttpScheduler *scheduler, const char *host) {
+    for (size_t i = 0; i < scheduler->hosts_len; i += 1) {
+        if (strcmp(scheduler->hosts[i]->host, host) == 0) {
+            return scheduler->hosts[i];
+        }
+    }
+    if (scheduler->hosts_len == scheduler->hosts_cap) {
+        // The heaps grow with the hosts, so putting a host into one never fails
+        size_t cap = scheduler->hosts_cap == 0 ? 8 : scheduler->hosts_cap << 1;
+        HttpSchedulerHost **hosts = realloc(scheduler->hosts, cap * sizeof(*hosts));
+        if (hosts == NULL) {
+            return NULL;
+        }
+        scheduler->hosts = hosts;
+        hosts = realloc(scheduler->ready.hosts, cap * sizeof(*hosts));
+        if (hosts == NULL) {
+            return NULL;
+        }
+        scheduler->ready.hosts = hosts;
+        hosts = realloc(scheduler->waiting.hosts, cap * sizeof(*hosts));
+        if (hosts == NULL) {
+            return NULL;
+        }
+        scheduler->waiting.hosts = hosts;
+        scheduler->hosts_cap = cap;
+    }
+    HttpSchedulerHost *scheduler_host = calloc(1, sizeof(*scheduler_host));
+    if (scheduler_host == NULL) {
+        return NULL;
+    }
+    strncpy(scheduler_host->host, host, HTTP_METRICS_HOST_SIZE - 1);
+    scheduler_host->limits = scheduler->default_limits;
+    scheduler_host->tokens = scheduler_host->limits.burst >= 1 ? scheduler_host->limits.burst : 1;
+    scheduler_host->refilled_us = http_scheduler_internal_now_us();
+    scheduler->hosts[scheduler->hosts_len] = scheduler_host;
+    scheduler->hosts_len += 1;
+    return scheduler_host;
+}
+
+/**
+ * Set the limits of a host.
+ * @param scheduler Pointer to an `HttpScheduler` struct
+ * @param host The host name, as in the request URLs
+ * @param limits The limits
+ * @return 0 on success, 1 on allocation failure
+ */
+int http_scheduler_set_limits(HttpScheduler *scheduler, const char *host, const HttpHostLimits *limits) {
+    HttpSchedulerHost *scheduler_host = http_scheduler_host(scheduler, host);
+    if (scheduler_host == NULL) {
+        return 1;
+    }
+    scheduler_host->limits = *limits;
+    double burst = limits->burst >= 1 ? limits->burst : 1;
+    if (scheduler_host->tokens > burst) {
+        scheduler_host->tokens = burst;
+    }
+    http_scheduler_internal_update(scheduler, scheduler_host, http_scheduler_internal_now_us());
+    return 0;
+}
+
+/**
+ * Queue a request. It starts from `http_scheduler_poll` or `http_scheduler_run` once its host's limits allow.
+ * @param scheduler Pointer to an `HttpScheduler` struct
+ * @param request The request, it must stay valid until its completion
+ * @return 0 on success, 1 on allocation failure
+ */
+int http_scheduler_submit(HttpScheduler *scheduler, HttpScheduledRequest *request) {
+    char host[HTTP_METRICS_HOST_SIZE];
+    http_metrics_internal_host(request->request.url, host, sizeof(host));
+    request->host = http_scheduler_host(scheduler, host);
+    if (request->host == NULL) {
+        return 1;
+    }
+    request->queued_us = http_scheduler_internal_now_us();
+    request->sequence = scheduler->sequence;
+    if (http_scheduler_internal_push(request->host, request) != 0) {
+        return 1;
+    }
+    scheduler->sequence += 1;
+    scheduler->queued += 1;
+    if (request->host->queue_len > request->host->max_queue_depth) {
+        request->host->max_queue_depth = request->host->queue_len;
+    }
+    // The request may be the host's first, or come before its first
+    http_scheduler_internal_update(scheduler, request->host, request->queued_us);
+    return 0;
+}
+
+/**
+ * Start the requests the limits allow, drive the transfers and deliver the completions, waiting at most once.
+ * @param scheduler Pointer to an `HttpScheduler` struct
+ * @param max_wait_ms Max time to wait for activity in milliseconds
+ * @return `CURLM_OK` on success
+ */
+CURLMcode http_scheduler_poll(HttpScheduler *scheduler, int max_wait_ms) {
+    CURLM *multi = scheduler->client->multi;
+    int running;
+    int64_t next_us = http_scheduler_internal_dispatch(scheduler);
+
+    CURLMcode code = curl_multi_perform(multi, &running);
+    if (code != CURLM_OK) {
+        return code;
+    }
+    size_t before = scheduler->in_flight;
+    http_batch_internal_collect(scheduler->client, multi, http_scheduler_internal_complete, scheduler);
+    if (scheduler->in_flight < before) {
+        return CURLM_OK; // Freed slots can be used right away
+    }
+
+    // Wake up for the next token even if no transfer is running
+    int timeout = max_wait_ms;
+    if (next_us >= 0 && next_us / 1000 + 1 < timeout) {
+        timeout = (int)(next_us / 1000 + 1);
+    }
+    if (running > 0 || next_us >= 0) {
+        code = curl_multi_poll(multi, NULL, 0, timeout, NULL);
+    }
+    return code;
+}
+
+/**
+ * Run until every submitted request has completed.
+ * @param scheduler Pointer to an `HttpScheduler` struct
+ * @return `CURLM_OK` on success
+ */
+CURLMcode http_scheduler_run(HttpScheduler *scheduler) {
+    while (scheduler->queued > 0 || scheduler->in_flight > 0) {
+        CURLMcode code = http_scheduler_poll(scheduler, 1000);
+        if (code != CURLM_OK) {
+            return code;
+        }
+    }
+    return CURLM_OK;
+}
+
+#else
+
+void http_scheduler_init(HttpScheduler *scheduler, HttpClient *client, const HttpHostLimits *default_limits, HttpCompletionFunction on_complete, void *completion_data);
+void http_scheduler_release(HttpScheduler *scheduler);
+HttpSchedulerHost *http_scheduler_host(HttpScheduler *scheduler, const char *host);
+int http_scheduler_set_limits(HttpScheduler *scheduler, const char *host, const HttpHostLimits *limits);
+int http_scheduler_submit(HttpScheduler *scheduler, HttpScheduledRequest *request);
+CURLMcode http_scheduler_poll(HttpScheduler *scheduler, int max_wait_ms);
+CURLMcode http_scheduler_run(HttpScheduler *scheduler);
+
+#endif
+
+#endif
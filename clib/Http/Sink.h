@@ -0,0 +1,474 @@
+#ifndef HTTP_SINK_H
+#define HTTP_SINK_H
+
+#ifndef _INC_ERRNO
+#include <errno.h>
+#endif
+
+#ifdef _WIN32
+#include <io.h>
+#include <limits.h>
+#else
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+#include <stdatomic.h>
+
+#include "Clib.h"
+#include "Client.h"
+
+/**
+ * Size of the write batch of a file sink when none is given.
+ */
+#define HTTP_FILE_SINK_DEFAULT_BATCH_SIZE (1 << 20)
+
+/**
+ * The largest `Content-Length` a buffer sink reserves memory for up front.
+ * Larger bodies still work, the buffer just grows as data arrives.
+ */
+#define HTTP_BUFFER_SINK_MAX_RESERVE (256 << 20)
+
+#pragma region Internals
+
+/**
+ * Largest value of a signed integer type, e.g. `curl_off_t` or `off_t`.
+ */
+#define HTTP_SINK_INTERNAL_SIGNED_MAX(Type) ((Type)(((unsigned long long)1 << (sizeof(Type) * 8 - 1)) - 1))
+
+#ifdef CLIB_HTTP_DEFINITIONS
+
+/**
+ * Parse a `Content-Length` header line.
+ * @param header The raw header line as received from curl (not null terminated)
+ * @param length Length of the header line
+ * @param content_length Output for the parsed value
+ * @return 1 if the line is a valid `Content-Length` header, else 0, also if the value does not fit a `curl_off_t`
+ */
+int http_sink_internal_parse_content_length(const char *header, size_t length, curl_off_t *content_length) {
+    static const char name[] = "content-length:";
+    size_t name_length = sizeof(name) - 1;
+    if (length <= name_length) {
+        return 0;
+    }
+    for (size_t i = 0; i < name_length; i += 1) {
+        char c = header[i];
+        if (c >= 'A' && c <= 'Z') {
+            c += 'a' - 'A';
+        }
+        if (c != name[i]) {
+            return 0;
+        }
+    }
+    size_t i = name_length;
+    while (i < length && (header[i] == ' ' || header[i] == '\t')) {
+        i += 1;
+    }
+    if (i == length || header[i] < '0' || header[i] > '9') {
+        return 0;
+    }
+    curl_off_t value = 0;
+    for (; i < length && header[i] >= '0' && header[i] <= '9'; i += 1) {
+        int digit = header[i] - '0';
+        if (value > (HTTP_SINK_INTERNAL_SIGNED_MAX(curl_off_t) - digit) / 10) {
+            return 0;
+        }
+        value = value * 10 + digit;
+    }
+    *content_length = value;
+    return 1;
+}
+
+/**
+ * Write all `n` bytes to a file descriptor, retrying short and interrupted writes.
+ * @param fd File descriptor
+ * @param bytes The bytes to write
+ * @param n Number of bytes
+ * @return 0 on success, else the `errno` of the failed write
+ */
+int http_sink_internal_write_all(int fd, const char *bytes, size_t n) {
+    while (n > 0) {
+#ifdef _WIN32
+        int written = _write(fd, bytes, n > INT_MAX ? INT_MAX : (unsigned int)n);
+#else
+        ssize_t written = write(fd, bytes, n);
+#endif
+        if (written < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return errno;
+        }
+        bytes += written;
+        n -= (size_t)written;
+    }
+    return 0;
+}
+
+#else
+
+int http_sink_internal_parse_content_length(const char *header, size_t length, curl_off_t *content_length);
+int http_sink_internal_write_all(int fd, const char *bytes, size_t n);
+
+#endif
+
+#pragma endregion
+
+#pragma region Buffer sink
+
+#ifdef CLIB_HTTP_DEFINITIONS
+
+/**
+ * Header function of the buffer sink.
+ * Reserves the whole body in the buffer as soon as the `Content-Length` header arrives.
+ */
+size_t http_sink_buffer_header(char *header, size_t size, size_t count, void *user_data) {
+    Buffer *buffer = user_data;
+    size_t n = size * count;
+    curl_off_t content_length;
+    if (http_sink_internal_parse_content_length(header, n, &content_length)
+        && content_length > 0
+        && content_length <= HTTP_BUFFER_SINK_MAX_RESERVE) {
+        buffer_reserve(buffer, (size_t)content_length);
+    }
+    return n;
+}
+
+/**
+ * Body write function of the buffer sink.
+ * Appends the chunk to the buffer.
+ */
+size_t http_sink_buffer_write(char *chunk, size_t size, size_t count, void *user_data) {
+    size_t n = size * count;
+    if (buffer_write_bytes(user_data, chunk, n) != BUFFER_ERROR_NONE) {
+        return 0;
+    }
+    return n;
+}
+
+/**
+ * Create a sink that collects the response body into a buffer.
+ * The buffer is reserved to the size of the body once the headers arrive,
+ * so the body is received without repeated reallocations.
+ * @param buffer Pointer to an initialized `Buffer` struct
+ * @return An `HttpSink` struct
+ */
+HttpSink http_sink_buffer(Buffer *buffer) {
+    return (HttpSink) {
+        .body_write_function = http_sink_buffer_write,
+        .header_write_function = http_sink_buffer_header,
+        .user_data = buffer,
+    };
+}
+
+/**
+ * Drop the body of the last request from a buffer sink, what the buffer held before it stays.
+ * @param sink The sink returned by `http_sink_buffer`, after its request
+ * @return 0
+ */
+int http_sink_buffer_reset(HttpSink *sink) {
+    Buffer *buffer = sink->user_data;
+    size_t dropped = (curl_off_t)buffer->len < sink->body_bytes ? buffer->len : (size_t)sink->body_bytes;
+    buffer->len -= dropped;
+    memset(buffer->ptr + buffer->len, 0, dropped);
+    sink->body_bytes = 0;
+    return 0;
+}
+
+#else
+
+size_t http_sink_buffer_header(char *header, size_t size, size_t count, void *user_data);
+size_t http_sink_buffer_write(char *chunk, size_t size, size_t count, void *user_data);
+HttpSink http_sink_buffer(Buffer *buffer);
+int http_sink_buffer_reset(HttpSink *sink);
+
+#endif
+
+#pragma endregion
+
+#pragma region File sink
+
+/**
+ * Streams a response body into a file descriptor with large batched writes.
+ */
+typedef struct HttpFileSink {
+    int fd;
+    char *batch;
+    size_t batch_len, batch_cap;
+    int preallocate; // Preallocate the file from `Content-Length`
+    int error;       // `errno` of the first failed write, 0 if none
+} HttpFileSink;
+
+#ifdef CLIB_HTTP_DEFINITIONS
+
+/**
+ * Initialize a file sink.
+ * NOTE: Allocates memory! Release the sink with `http_file_sink_release`.
+ * @param sink Pointer to an `HttpFileSink` struct
+ * @param fd File descriptor opened for writing, it is not closed by the sink
+ * @param batch_size Size of the write batch, 0 = `HTTP_FILE_SINK_DEFAULT_BATCH_SIZE`
+ * @param preallocate If non-zero, allocate the file blocks up front from `Content-Length`
+ * @return 0 on success, else `ENOMEM`
+ */
+int http_file_sink_init(HttpFileSink *sink, int fd, size_t batch_size, int preallocate) {
+    if (batch_size == 0) {
+        batch_size = HTTP_FILE_SINK_DEFAULT_BATCH_SIZE;
+    }
+    *sink = (HttpFileSink) {
+        .fd = fd,
+        .batch = malloc(batch_size),
+        .batch_cap = batch_size,
+        .preallocate = preallocate,
+    };
+    if (sink->batch == NULL) {
+        return ENOMEM;
+    }
+    return 0;
+}
+
+/**
+ * Write the batched bytes of the sink to its file.
+ * @param sink Pointer to an `HttpFileSink` struct
+ * @return 0 on success, else the `errno` of the first failed write
+ */
+int http_file_sink_flush(HttpFileSink *sink) {
+    if (sink->error == 0 && sink->batch_len > 0) {
+        sink->error = http_sink_internal_write_all(sink->fd, sink->batch, sink->batch_len);
+    }
+    sink->batch_len = 0;
+    return sink->error;
+}
+
+/**
+ * Flush the sink and free its batch memory.
+ * @param sink Pointer to an `HttpFileSink` struct
+ * @return 0 on success, else the `errno` of the first failed write
+ */
+int http_file_sink_release(HttpFileSink *sink) {
+    int error = http_file_sink_flush(sink);
+    free(sink->batch);
+    sink->batch = NULL;
+    sink->batch_cap = 0;
+    return error;
+}
+
+/**
+ * Header function of the file sink.
+ * Preallocates the file blocks for the body when enabled.
+ */
+size_t http_sink_file_header(char *header, size_t size, size_t count, void *user_data) {
+    size_t n = size * count;
+#ifndef _WIN32
+    HttpFileSink *sink = user_data;
+    curl_off_t content_length;
+    if (sink->preallocate && http_sink_internal_parse_content_length(header, n, &content_length) && content_length > 0) {
+        off_t offset = lseek(sink->fd, 0, SEEK_CUR);
+        if (offset >= 0 && (off_t)sink->batch_len <= HTTP_SINK_INTERNAL_SIGNED_MAX(off_t) - offset) {
+            offset += (off_t)sink->batch_len;
+            // Best effort, the writes still work on file systems without fallocate support
+            if (content_length <= (curl_off_t)(HTTP_SINK_INTERNAL_SIGNED_MAX(off_t) - offset)) {
+                posix_fallocate(sink->fd, offset, (off_t)content_length);
+            }
+        }
+    }
+#else
+    (void)header;
+    (void)user_data;
+#endif
+    return n;
+}
+
+/**
+ * Body write function of the file sink.
+ * Small chunks are collected into the batch, chunks larger than the batch are written directly.
+ */
+size_t http_sink_file_write(char *chunk, size_t size, size_t count, void *user_data) {
+    HttpFileSink *sink = user_data;
+    size_t n = size * count;
+    if (sink->batch_len + n > sink->batch_cap && http_file_sink_flush(sink) != 0) {
+        return 0;
+    }
+    if (n >= sink->batch_cap) {
+        sink->error = http_sink_internal_write_all(sink->fd, chunk, n);
+        return sink->error == 0 ? n : 0;
+    }
+    memcpy(sink->batch + sink->batch_len, chunk, n);
+    sink->batch_len += n;
+    return n;
+}
+
+/**
+ * Create a sink that streams the response body into a file.
+ * Call `http_file_sink_release` after the request to write the last batch.
+ * @param file Pointer to an initialized `HttpFileSink` struct
+ * @return An `HttpSink` struct
+ */
+HttpSink http_sink_file(HttpFileSink *file) {
+    return (HttpSink) {
+        .body_write_function = http_sink_file_write,
+        .header_write_function = http_sink_file_header,
+        .user_data = file,
+    };
+}
+
+/**
+ * Drop the body of the last request from a file sink.
+ * The batched part is discarded, the written part is cut off the end of the file.
+ * @param sink The sink returned by `http_sink_file`, after its request
+ * @return 0 on success, else the `errno` of the failed seek or truncate (e.g. `ESPIPE` for a pipe)
+ */
+int http_sink_file_reset(HttpSink *sink) {
+    HttpFileSink *file = sink->user_data;
+    curl_off_t dropped = sink->body_bytes;
+    size_t batched = (curl_off_t)file->batch_len < dropped ? file->batch_len : (size_t)dropped;
+    file->batch_len -= batched;
+    dropped -= (curl_off_t)batched;
+    sink->body_bytes = 0;
+    if (dropped == 0 || file->error != 0) {
+        return file->error;
+    }
+#ifdef _WIN32
+    __int64 end = _lseeki64(file->fd, 0, SEEK_CUR);
+    if (end < dropped || _lseeki64(file->fd, end - dropped, SEEK_SET) < 0 || _chsize_s(file->fd, end - dropped) != 0) {
+        file->error = errno != 0 ? errno : EIO;
+    }
+#else
+    off_t end = lseek(file->fd, 0, SEEK_CUR);
+    if (end < (off_t)dropped || lseek(file->fd, end - (off_t)dropped, SEEK_SET) < 0 || ftruncate(file->fd, end - (off_t)dropped) != 0) {
+        file->error = errno != 0 ? errno : EIO;
+    }
+#endif
+    return file->error;
+}
+
+#else
+
+int http_file_sink_init(HttpFileSink *sink, int fd, size_t batch_size, int preallocate);
+int http_file_sink_flush(HttpFileSink *sink);
+int http_file_sink_release(HttpFileSink *sink);
+size_t http_sink_file_header(char *header, size_t size, size_t count, void *user_data);
+size_t http_sink_file_write(char *chunk, size_t size, size_t count, void *user_data);
+HttpSink http_sink_file(HttpFileSink *file);
+int http_sink_file_reset(HttpSink *sink);
+
+#endif
+
+#pragma endregion
+
+#pragma region Stream sink
+
+/**
+ * Result of a stream function.
+ */
+typedef enum HttpStreamResult {
+    HTTP_STREAM_CONTINUE, // The chunk was consumed
+    HTTP_STREAM_PAUSE,    // Not ready, pause the transfer and deliver the same chunk again after `http_stream_sink_resume`
+    HTTP_STREAM_ABORT,    // Abort the transfer
+} HttpStreamResult;
+
+/**
+ * Called with every chunk of the response body.
+ * @param chunk The chunk, only valid during the call
+ * @param length Length of the chunk
+ * @param user_data Any user specified data
+ * @return `HttpStreamResult`
+ */
+typedef HttpStreamResult (*HttpStreamFunction)(const char *chunk, size_t length, void *user_data);
+
+/**
+ * Passes the response body through to a stream function.
+ * Zero-initialize it before setting the stream function.
+ */
+typedef struct HttpStreamSink {
+    HttpStreamFunction stream_function;
+    void *user_data;
+    int paused;        // The transfer is paused, only touched by the thread that drives it
+    atomic_int resume; // Set by `http_stream_sink_resume` from any thread
+} HttpStreamSink;
+
+#ifdef CLIB_HTTP_DEFINITIONS
+
+/**
+ * Body write function of the stream sink.
+ */
+size_t http_sink_stream_write(char *chunk, size_t size, size_t count, void *user_data) {
+    HttpStreamSink *stream = user_data;
+    size_t n = size * count;
+    switch (stream->stream_function(chunk, n, stream->user_data)) {
+        case HTTP_STREAM_CONTINUE:
+            return n;
+        case HTTP_STREAM_PAUSE:
+            // A resume that came in while the chunk was offered is for this pause
+            if (atomic_exchange(&stream->resume, 0)) {
+                return http_sink_stream_write(chunk, size, count, user_data);
+            }
+            stream->paused = 1;
+            return CURL_WRITEFUNC_PAUSE;
+        default:
+            return 0;
+    }
+}
+
+/**
+ * Poll function of the stream sink, resumes the transfer on the driving thread once it was asked to.
+ */
+int http_sink_stream_poll(HttpSink *sink) {
+    HttpStreamSink *stream = sink->user_data;
+    if (stream->paused && atomic_exchange(&stream->resume, 0)) {
+        stream->paused = 0;
+        // The paused chunk is delivered again from inside this call
+        if (curl_easy_pause(sink->curl_handle, CURLPAUSE_CONT) != CURLE_OK) {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+/**
+ * Create a sink that passes the response body through to a stream function.
+ * The stream function applies backpressure by returning `HTTP_STREAM_PAUSE`.
+ * @param stream Pointer to an `HttpStreamSink` struct
+ * @return An `HttpSink` struct
+ */
+HttpSink http_sink_stream(HttpStreamSink *stream) {
+    return (HttpSink) {
+        .body_write_function = http_sink_stream_write,
+        .user_data = stream,
+        .poll_function = http_sink_stream_poll,
+    };
+}
+
+/**
+ * Resume a transfer that was paused by the stream function, from any thread.
+ * The thread that drives the transfer resumes it from the sink's poll function:
+ * the client, batch, cache, retry and upload functions are woken up right away,
+ * `http_request_get_sink` resumes it within curl's next progress tick (a few hundred ms at most),
+ * an `HttpEventLoop` within `HTTP_EVENT_LOOP_POLL_INTERVAL_MS`.
+ * Call it only while the transfer runs, a resume without a pause applies to the next pause.
+ * A resume that comes after the transfer completed only sets the flag, but the client or event loop
+ * that ran the transfer must not be released while another thread may still call this.
+ * @param sink The sink returned by `http_sink_stream`
+ * @return `CURLE_OK`, or the error of waking up the driving thread
+ */
+CURLcode http_stream_sink_resume(HttpSink *sink) {
+    HttpStreamSink *stream = sink->user_data;
+    atomic_store(&stream->resume, 1);
+    CURLM *multi = atomic_load(&sink->multi);
+    if (multi != NULL && curl_multi_wakeup(multi) != CURLM_OK) {
+        return CURLE_RECV_ERROR;
+    }
+    return CURLE_OK;
+}
+
+#else
+
+size_t http_sink_stream_write(char *chunk, size_t size, size_t count, void *user_data);
+int http_sink_stream_poll(HttpSink *sink);
+HttpSink http_sink_stream(HttpStreamSink *stream);
+CURLcode http_stream_sink_resume(HttpSink *sink);
+
+#endif
+
+#pragma endregion
+
+#endif
@@ -0,0 +1,418 @@
+#ifndef HTTP_UPLOAD_H
+#define HTTP_UPLOAD_H
+
+/**
+ * Request bodies for POST, PUT and PATCH requests.
+ * Memory bodies are sent straight from the caller's memory, file and stream bodies
+ * are read into curl's upload buffer as the request goes out, so the memory
+ * used by an upload does not grow with the size of the payload.
+ */
+
+#ifndef _INC_ERRNO
+#include <errno.h>
+#endif
+
+#ifndef _INC_STDIO
+#include <stdio.h>
+#endif
+
+#ifdef _WIN32
+#include <io.h>
+#include <limits.h>
+#else
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#include "Clib.h"
+#include "Client.h"
+#include "Slice.h"
+
+/**
+ * The read function for curl, fills `buffer` with up to `size * count` bytes of the body.
+ * Return 0 at the end of the body or `CURL_READFUNC_ABORT` to abort the request.
+ * https://curl.se/libcurl/c/CURLOPT_READFUNCTION.html
+ */
+typedef size_t (*HttpBodyReadFunction)(char *buffer, size_t size, size_t count, void *user_data);
+
+typedef enum HttpBodyType {
+    HttpBodyNone,
+    HttpBodyMemory,
+    HttpBodyFile,
+    HttpBodyStream,
+} HttpBodyType;
+
+/**
+ * The body of a request. Create it with one of the `http_body_*` functions.
+ */
+typedef struct HttpBody {
+    HttpBodyType type;
+    const char *data;                   // Memory bodies
+    curl_off_t length;                  // Length in bytes, -1 = unknown, sent with chunked encoding
+    int fd;                             // File bodies
+    curl_off_t start, offset;           // File bodies, first byte and read position
+    int seekable;                       // File bodies, read at `offset` if set, else from the current position (e.g. a pipe)
+    HttpBodyReadFunction read_function; // Stream bodies
+    void *user_data;                    // Stream bodies, passed into the read function
+    const char *content_type;           // Optional `Content-Type` of the body
+    struct curl_slist *headers;         // Set by `http_body_setup`
+    void *map;                          // Mapped file bodies
+    size_t map_length;
+} HttpBody;
+
+#pragma region Internals
+
+#ifdef CLIB_HTTP_DEFINITIONS
+
+/**
+ * Read function of file bodies.
+ * Seekable files are read at the body's offset, so a rewind is just a new offset.
+ */
+size_t http_body_internal_read_file(char *buffer, size_t size, size_t count, void *user_data) {
+    HttpBody *body = user_data;
+    size_t n = size * count;
+    if (body->length >= 0 && (curl_off_t)n > body->start + body->length - body->offset) {
+        n = (size_t)(body->start + body->length - body->offset);
+    }
+    for (;;) {
+#ifdef _WIN32
+        unsigned int wanted = n > INT_MAX ? INT_MAX : (unsigned int)n;
+        int read_count = body->seekable && _lseeki64(body->fd, body->offset, SEEK_SET) < 0 ? -1 : _read(body->fd, buffer, wanted);
+#else
+        ssize_t read_count = body->seekable ? pread(body->fd, buffer, n, (off_t)body->offset) : read(body->fd, buffer, n);
+#endif
+        if (read_count < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return CURL_READFUNC_ABORT;
+        }
+        body->offset += read_count;
+        return (size_t)read_count;
+    }
+}
+
+/**
+ * Seek function of file bodies, curl rewinds the body to send it again (e.g. after a redirect or an auth challenge).
+ * A body that is not seekable can only be "rewound" before anything was read from it.
+ */
+int http_body_internal_seek_file(void *user_data, curl_off_t offset, int origin) {
+    HttpBody *body = user_data;
+    if (origin != SEEK_SET || offset < 0 || (body->length >= 0 && offset > body->length)) {
+        return CURL_SEEKFUNC_CANTSEEK;
+    }
+    if (!body->seekable && body->start + offset != body->offset) {
+        return CURL_SEEKFUNC_CANTSEEK;
+    }
+    body->offset = body->start + offset;
+    return CURL_SEEKFUNC_OK;
+}
+
+#else
+
+size_t http_body_internal_read_file(char *buffer, size_t size, size_t count, void *user_data);
+int http_body_internal_seek_file(void *user_data, curl_off_t offset, int origin);
+
+#endif
+
+#pragma endregion
+
+#ifdef CLIB_HTTP_DEFINITIONS
+
+/**
+ * A body sent straight from a buffer, without a copy.
+ * The buffer must not change until the request is done.
+ * @param buffer Pointer to a `Buffer` struct
+ * @return A new body
+ */
+HttpBody http_body_buffer(Buffer *buffer) {
+    return (HttpBody) {.type = HttpBodyMemory, .data = buffer->ptr, .length = (curl_off_t)buffer->len, .fd = -1};
+}
+
+/**
+ * A body sent straight from a slice of bytes, without a copy.
+ * The memory must stay valid until the request is done.
+ * @param slice Slice of bytes
+ * @return A new body
+ */
+HttpBody http_body_slice(Slice slice) {
+    return (HttpBody) {.type = HttpBodyMemory, .data = slice.ptr, .length = (curl_off_t)slice.len, .fd = -1};
+}
+
+/**
+ * A body read from a file as the request goes out.
+ * Regular files are sent with their size, anything else (e.g. a pipe) with chunked encoding.
+ * A body that is not seekable, like a pipe, is read as it comes and can be sent only once.
+ * @param fd Open file descriptor, the body starts at its current position. It is not closed.
+ * @return A new body
+ */
+HttpBody http_body_file(int fd) {
+    HttpBody body = {.type = HttpBodyFile, .fd = fd, .length = -1};
+#ifdef _WIN32
+    body.start = _lseeki64(fd, 0, SEEK_CUR);
+    body.seekable = body.start >= 0;
+    if (!body.seekable) {
+        body.start = 0; // Read from where it is
+    }
+    else {
+        curl_off_t end = _lseeki64(fd, 0, SEEK_END);
+        if (end >= body.start) {
+            body.length = end - body.start;
+        }
+        _lseeki64(fd, body.start, SEEK_SET);
+    }
+#else
+    struct stat info;
+    body.start = lseek(fd, 0, SEEK_CUR);
+    body.seekable = body.start >= 0;
+    if (!body.seekable) {
+        body.start = 0; // Read from where it is
+    }
+    else if (fstat(fd, &info) == 0 && S_ISREG(info.st_mode) && info.st_size >= body.start) {
+        body.length = info.st_size - body.start;
+    }
+#endif
+    body.offset = body.start;
+    return body;
+}
+
+/**
+ * A body streamed from a read function.
+ * @param read_function Called whenever curl needs more of the body
+ * @param user_data Any user specified data to be passed into the read function
+ * @param length Length of the body, -1 if unknown (sent with chunked encoding)
+ * @return A new body
+ */
+HttpBody http_body_stream(HttpBodyReadFunction read_function, void *user_data, curl_off_t length) {
+    return (HttpBody) {.type = HttpBodyStream, .read_function = read_function, .user_data = user_data, .length = length, .fd = -1};
+}
+
+#else
+
+HttpBody http_body_buffer(Buffer *buffer);
+HttpBody http_body_slice(Slice slice);
+HttpBody http_body_file(int fd);
+HttpBody http_body_stream(HttpBodyReadFunction read_function, void *user_data, curl_off_t length);
+
+#endif
+
+#ifndef _WIN32
+#ifdef CLIB_HTTP_DEFINITIONS
+
+/**
+ * A body mapped from a file, sent straight from the page cache without a read into a buffer.
+ * NOTE: Maps memory! Release the body with `http_body_release`.
+ * @param body Pointer to an `HttpBody` struct
+ * @param fd Open file descriptor of a regular file, the whole file is sent. It can be closed right after.
+ * @return 0 on success, else the `errno` of the failure
+ */
+int http_body_map_file(HttpBody *body, int fd) {
+    struct stat info;
+    *body = (HttpBody) {.type = HttpBodyMemory, .fd = -1};
+    if (fstat(fd, &info) != 0) {
+        return errno;
+    }
+    if (!S_ISREG(info.st_mode)) {
+        return EINVAL;
+    }
+    if (info.st_size > 0) {
+        void *map = mmap(NULL, (size_t)info.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (map == MAP_FAILED) {
+            return errno;
+        }
+        madvise(map, (size_t)info.st_size, MADV_SEQUENTIAL);
+        body->map = map;
+        body->map_length = (size_t)info.st_size;
+    }
+    body->data = body->map;
+    body->length = (curl_off_t)info.st_size;
+    return 0;
+}
+
+#else
+
+int http_body_map_file(HttpBody *body, int fd);
+
+#endif
+#endif
+
+#ifdef CLIB_HTTP_DEFINITIONS
+
+/**
+ * Free all the associated resources of the body.
+ * The memory, file or stream the body was created from is left alone.
+ * @param body Pointer to an `HttpBody` struct
+ */
+void http_body_release(HttpBody *body) {
+    curl_slist_free_all(body->headers);
+    body->headers = NULL;
+#ifndef _WIN32
+    if (body->map != NULL) {
+        munmap(body->map, body->map_length);
+    }
+#endif
+    body->map = NULL;
+    body->map_length = 0;
+}
+
+/**
+ * Set the method and body of a request on a curl easy handle, e.g. from an `HttpSetupFunction` of a batch.
+ * The body is rewound, so one body can be sent more than once, except a file body that is not seekable.
+ * @param curl The curl easy handle, already set up for the request
+ * @param method The request method, e.g. "POST"
+ * @param body The request body, it must stay valid until the request is done
+ */
+void http_body_setup(CURL *curl, const char *method, HttpBody *body) {
+    curl_easy_setopt(curl, CURLOPT_POST, 1L);
+    if (strcmp(method, "POST") != 0) {
+        curl_easy_setopt(curl, CURLOPT_CUSTOMREQUEST, method);        // Keep the POST body handling with another method
+    }
+
+    switch (body->type) {
+        case HttpBodyMemory:
+            curl_easy_setopt(curl, CURLOPT_POSTFIELDSIZE_LARGE, body->length);
+            curl_easy_setopt(curl, CURLOPT_POSTFIELDS, body->data != NULL ? body->data : ""); // Sent from the caller's memory, not copied. `NULL` would read stdin
+            break;
+        case HttpBodyFile:
+            body->offset = body->start;
+            curl_easy_setopt(curl, CURLOPT_READFUNCTION, http_body_internal_read_file);
+            curl_easy_setopt(curl, CURLOPT_READDATA, body);
+            curl_easy_setopt(curl, CURLOPT_SEEKFUNCTION, http_body_internal_seek_file);
+            curl_easy_setopt(curl, CURLOPT_SEEKDATA, body);
+            curl_easy_setopt(curl, CURLOPT_POSTFIELDSIZE_LARGE, body->length); // -1 = chunked
+            break;
+        case HttpBodyStream:
+            curl_easy_setopt(curl, CURLOPT_READFUNCTION, body->read_function);
+            curl_easy_setopt(curl, CURLOPT_READDATA, body->user_data);
+            curl_easy_setopt(curl, CURLOPT_POSTFIELDSIZE_LARGE, body->length); // -1 = chunked
+            break;
+        case HttpBodyNone:
+            curl_easy_setopt(curl, CURLOPT_POSTFIELDSIZE_LARGE, (curl_off_t)0);
+            curl_easy_setopt(curl, CURLOPT_POSTFIELDS, "");
+            break;
+    }
+
+    curl_slist_free_all(body->headers);
+    body->headers = NULL;
+    if (body->content_type != NULL) {
+        char header[256];
+        snprintf(header, sizeof(header), "Content-Type: %s", body->content_type);
+        body->headers = curl_slist_append(NULL, header);
+    }
+    curl_easy_setopt(curl, CURLOPT_HTTPHEADER, body->headers);
+}
+
+/**
+ * Send an HTTP request with a body.
+ * @param method The request method, e.g. "POST", "PUT" or "PATCH"
+ * @param url The request URL
+ * @param body The request body
+ * @param sink The sink for the response
+ * @return An `HttpResponse` struct.
+ */
+HttpResponse http_request_send(const char *method, const char *url, HttpBody *body, HttpSink *sink) {
+    HttpResponse response = {0};
+    CURL *curl = NULL;
+
+    http_internal_curl_code = http_global_init();
+    if (http_internal_curl_code != CURLE_OK) {
+        goto FunctionReturn;
+    }
+    curl = curl_easy_init();
+    if (curl == NULL) {
+        http_internal_curl_code = CURLE_OUT_OF_MEMORY;
+        goto FunctionReturn;
+    }
+
+    http_internal_setup_handle(curl, url, sink);
+    http_body_setup(curl, method, body);
+
+    http_internal_curl_code = curl_easy_perform(curl);
+    if (http_internal_curl_code != CURLE_OK) {
+        goto FunctionReturn;
+    }
+
+    http_internal_load_response(curl, sink, &response);
+
+FunctionReturn:
+    response.error = http_internal_curl_code;
+    http_internal_take_headers(sink, &response);
+    response.curl_handle = curl;
+    return response;
+}
+
+/**
+ * Send an HTTP request with a body with a persistent client.
+ * @param client Pointer to an `HttpClient` struct
+ * @param method The request method, e.g. "POST", "PUT" or "PATCH"
+ * @param url The request URL
+ * @param body The request body
+ * @param sink The sink for the response
+ * @return An `HttpResponse` struct. Release it with `http_client_response_release`.
+ */
+HttpResponse http_client_send(HttpClient *client, const char *method, const char *url, HttpBody *body, HttpSink *sink) {
+    HttpResponse response = {0};
+    CURL *curl = http_client_acquire_handle(client);
+
+    if (curl == NULL) {
+        http_internal_curl_code = CURLE_OUT_OF_MEMORY;
+        goto FunctionReturn;
+    }
+
+    http_internal_setup_handle(curl, url, sink);
+    http_body_setup(curl, method, body);
+    sink->multi = client->multi;
+
+    http_internal_curl_code = http_client_perform(client, curl);
+    sink->multi = NULL;
+    if (http_internal_curl_code != CURLE_OK) {
+        goto FunctionReturn;
+    }
+
+    http_internal_load_response(curl, sink, &response);
+
+FunctionReturn:
+    response.error = http_internal_curl_code;
+    http_internal_take_headers(sink, &response);
+    response.curl_handle = curl;
+    return response;
+}
+
+/**
+ * Perform an HTTP POST request with a persistent client.
+ * @see http_client_send
+ */
+HttpResponse http_client_post(HttpClient *client, const char *url, HttpBody *body, HttpSink *sink) {
+    return http_client_send(client, "POST", url, body, sink);
+}
+
+/**
+ * Perform an HTTP PUT request with a persistent client.
+ * @see http_client_send
+ */
+HttpResponse http_client_put(HttpClient *client, const char *url, HttpBody *body, HttpSink *sink) {
+    return http_client_send(client, "PUT", url, body, sink);
+}
+
+/**
+ * Perform an HTTP PATCH request with a persistent client.
+ * @see http_client_send
+ */
+HttpResponse http_client_patch(HttpClient *client, const char *url, HttpBody *body, HttpSink *sink) {
+    return http_client_send(client, "PATCH", url, body, sink);
+}
+
+#else
+
+void http_body_release(HttpBody *body);
+void http_body_setup(CURL *curl, const char *method, HttpBody *body);
+HttpResponse http_request_send(const char *method, const char *url, HttpBody *body, HttpSink *sink);
+HttpResponse http_client_send(HttpClient *client, const char *method, const char *url, HttpBody *body, HttpSink *sink);
+HttpResponse http_client_post(HttpClient *client, const char *url, HttpBody *body, HttpSink *sink);
+HttpResponse http_client_put(HttpClient *client, const char *url, HttpBody *body, HttpSink *sink);
+HttpResponse http_client_patch(HttpClient *client, const char *url, HttpBody *body, HttpSink *sink);
+
+#endif
+
+#endif
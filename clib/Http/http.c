@@ -0,0 +1,27 @@
+/**
+ * Implementation of the HTTP headers for the library mode, see `Clib.h`.
+ * Build it with `make lib_http`, link it before `libclib.a` and libcurl.
+ * `Download.h`, `Event.h` and `Pool.h` need POSIX (pthreads, epoll, pwrite) and are left out on Windows.
+ */
+
+// The core headers come from `libclib.a`
+#ifndef CLIB_DECLARATIONS_ONLY
+#define CLIB_DECLARATIONS_ONLY
+#endif
+#define CLIB_HTTP_IMPLEMENTATION
+
+#include "Batch.h"
+#include "Cache.h"
+#include "Client.h"
+#include "Headers.h"
+#include "Metrics.h"
+#include "Retry.h"
+#include "Scheduler.h"
+#include "Sink.h"
+#include "Upload.h"
+
+#ifndef _WIN32
+#include "Download.h"
+#include "Event.h"
+#include "Pool.h"
+#endif
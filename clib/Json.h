@@ -0,0 +1,600 @@
+#ifndef JSON_H
+#define JSON_H
+
+/**
+ * Streaming JSON writer over a `Buffer`, for JSON documents and structured log lines.
+ * Commas and colons are inserted by the writer. Every top-level value ends with a newline,
+ * so a series of objects is newline-delimited JSON.
+ * String escaping scans 32 bytes (AVX2) or 16 bytes (SSE2) at a time for the characters
+ * that need escaping and copies clean blocks as they are. Numbers are formatted directly
+ * into the buffer.
+ *
+ *   Buffer buf = buffer_make(256);
+ *   JsonWriter json = json_writer_make(&buf);
+ *   json_object_begin(&json);
+ *   json_write_key(&json, "status");
+ *   json_write_int(&json, 200);
+ *   json_write_key(&json, "msg");
+ *   json_write_string(&json, "said \"hi\"");
+ *   json_object_end(&json);   // {"status":200,"msg":"said \"hi\""}\n
+ *
+ * Reference:
+ *  - https://www.rfc-editor.org/rfc/rfc8259
+ */
+
+#ifndef _INC_MATH
+#include <math.h>
+#endif
+
+#ifndef _STDINT_H
+#include <stdint.h>
+#endif
+
+#ifndef _INC_STDIO
+#include <stdio.h>
+#endif
+
+#ifndef _INC_STDLIB
+#include <stdlib.h>
+#endif
+
+#ifndef _INC_STRING
+#include <string.h>
+#endif
+
+#if defined(__AVX2__)
+#include <immintrin.h>
+#elif defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#endif
+
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+
+#include "Clib.h"
+#include "Buffer.h"
+
+/**
+ * Deepest nesting of objects and arrays.
+ */
+#define JSON_MAX_DEPTH 64
+
+typedef struct JsonWriter {
+    Buffer *buf;
+    int depth;          // Open objects and arrays
+    int after_key;      // A key was written, its value comes next
+    uint64_t elements;  // Bit `depth - 1` is set once the innermost container has an element
+    uint64_t objects;   // Bit `depth - 1` is set if the innermost container is an object
+} JsonWriter;
+
+#pragma region Internals
+
+/**
+ * Two digits of every number from 0 to 99.
+ */
+static const char json_internal_digits[] =
+    "00010203040506070809101112131415161718192021222324252627282930313233343536373839"
+    "40414243444546474849505152535455565758596061626364656667686970717273747576777879"
+    "8081828384858687888990919293949596979899";
+
+/**
+ * Make room for `n` more bytes and the null terminator.
+ */
+static inline BufferError json_internal_reserve(Buffer *buf, size_t n) {
+    size_t required_cap = buf->len + n + 1;
+    if (required_cap >= buf->cap) {
+        return buffer_grow(buf, required_cap);
+    }
+    return BUFFER_ERROR_NONE;
+}
+
+/**
+ * Write the separator that goes before a value, a value in an object needs its key first.
+ */
+static inline BufferError json_internal_separator(JsonWriter *writer) {
+    if (writer->after_key) {
+        writer->after_key = 0;
+        return BUFFER_ERROR_NONE;
+    }
+    if (writer->depth > 0) {
+        uint64_t bit = 1ULL << (writer->depth - 1);
+        if (writer->objects & bit) {
+            return BUFFER_ERROR_INVALID_FORMAT;
+        }
+        if (writer->elements & bit) {
+            return buffer_write_byte(writer->buf, ',');
+        }
+    }
+    return BUFFER_ERROR_NONE;
+}
+
+/**
+ * Count the value that was written, a complete top-level value gets its newline.
+ */
+static inline BufferError json_internal_value_done(JsonWriter *writer) {
+    if (writer->depth == 0) {
+        return buffer_write_byte(writer->buf, '\n');
+    }
+    writer->elements |= 1ULL << (writer->depth - 1);
+    return BUFFER_ERROR_NONE;
+}
+
+/**
+ * Index of the lowest set bit, `mask` is not 0.
+ */
+static inline size_t json_internal_lowest_bit(uint32_t mask) {
+#ifdef _MSC_VER
+    unsigned long index;
+    _BitScanForward(&index, mask);
+    return index;
+#else
+    return (size_t)__builtin_ctz(mask);
+#endif
+}
+
+#ifdef CLIB_DEFINITIONS
+
+/**
+ * Write the digits of `value` at `out`, which has room for 20 bytes.
+ * @return Number of digits
+ */
+size_t json_internal_u64(char *out, uint64_t value) {
+    size_t length = 1;
+    for (uint64_t rest = value; rest >= 10; rest /= 10) {
+        length += 1;
+    }
+    char *p = out + length;
+    while (value >= 100) {
+        unsigned pair = (unsigned)(value % 100) * 2;
+        value /= 100;
+        *--p = json_internal_digits[pair + 1];
+        *--p = json_internal_digits[pair];
+    }
+    if (value >= 10) {
+        *--p = json_internal_digits[value * 2 + 1];
+        *--p = json_internal_digits[value * 2];
+    }
+    else {
+        *--p = (char)('0' + value);
+    }
+    return length;
+}
+
+/**
+ * Append the escape sequence of a byte that may not appear in a JSON string.
+ * There is room for 6 bytes at `out`.
+ * @return Length of the sequence
+ */
+size_t json_internal_escape_byte(char *out, unsigned char c) {
+    static const char hex[] = "0123456789abcdef";
+    out[0] = '\\';
+    switch (c) {
+        case '"':  out[1] = '"';  return 2;
+        case '\\': out[1] = '\\'; return 2;
+        case '\b': out[1] = 'b';  return 2;
+        case '\f': out[1] = 'f';  return 2;
+        case '\n': out[1] = 'n';  return 2;
+        case '\r': out[1] = 'r';  return 2;
+        case '\t': out[1] = 't';  return 2;
+        default:
+            memcpy(out + 1, "u00", 3);
+            out[4] = hex[c >> 4];
+            out[5] = hex[c & 0xF];
+            return 6;
+    }
+}
+
+/**
+ * Length of the prefix of `s` without characters that need escaping, up to `n`.
+ * The SIMD loops test a whole block at once, the rest is checked byte by byte.
+ */
+size_t json_internal_clean_prefix(const char *s, size_t n) {
+    size_t i = 0;
+#if defined(__AVX2__)
+    const __m256i quote32 = _mm256_set1_epi8('"'), backslash32 = _mm256_set1_epi8('\\'), control32 = _mm256_set1_epi8(0x1F);
+    for (; i + 32 <= n; i += 32) {
+        __m256i block = _mm256_loadu_si256((const __m256i*)(s + i));
+        // Unsigned `block <= 0x1F` is `min(block, 0x1F) == block`
+        __m256i special = _mm256_or_si256(
+            _mm256_or_si256(_mm256_cmpeq_epi8(block, quote32), _mm256_cmpeq_epi8(block, backslash32)),
+            _mm256_cmpeq_epi8(_mm256_min_epu8(block, control32), block));
+        uint32_t mask = (uint32_t)_mm256_movemask_epi8(special);
+        if (mask != 0) {
+            return i + json_internal_lowest_bit(mask);
+        }
+    }
+#endif
+#if defined(__AVX2__) || defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+    const __m128i quote = _mm_set1_epi8('"'), backslash = _mm_set1_epi8('\\'), control = _mm_set1_epi8(0x1F);
+    for (; i + 16 <= n; i += 16) {
+        __m128i block = _mm_loadu_si128((const __m128i*)(s + i));
+        __m128i special = _mm_or_si128(
+            _mm_or_si128(_mm_cmpeq_epi8(block, quote), _mm_cmpeq_epi8(block, backslash)),
+            _mm_cmpeq_epi8(_mm_min_epu8(block, control), block));
+        uint32_t mask = (uint32_t)_mm_movemask_epi8(special);
+        if (mask != 0) {
+            return i + json_internal_lowest_bit(mask);
+        }
+    }
+#endif
+    for (; i < n; i += 1) {
+        unsigned char c = (unsigned char)s[i];
+        if (c == '"' || c == '\\' || c < 0x20) {
+            break;
+        }
+    }
+    return i;
+}
+
+#else
+
+size_t json_internal_u64(char *out, uint64_t value);
+size_t json_internal_escape_byte(char *out, unsigned char c);
+size_t json_internal_clean_prefix(const char *s, size_t n);
+
+#endif
+
+#pragma endregion
+
+/**
+ * Create a writer that appends to a buffer.
+ * @param buf Pointer to a `Buffer` struct
+ * @return `JsonWriter` struct value
+ */
+static inline JsonWriter json_writer_make(Buffer *buf) {
+    return (JsonWriter) {.buf = buf};
+}
+
+#ifdef CLIB_DEFINITIONS
+
+/**
+ * Append the escaped form of `n` bytes, without quotes.
+ * UTF-8 is copied as is, only `"`, `\` and control characters are escaped.
+ * NOTE: Allocates memory!
+ * @param buf Pointer to a `Buffer` struct
+ * @param s The bytes
+ * @param n Number of bytes
+ * @return `BufferError` (errors are non-zero).
+ */
+BufferError json_escape(Buffer *buf, const char *s, size_t n) {
+    if (buf == NULL) {
+        return BUFFER_ERROR_NULL_POINTER;
+    }
+    // Enough for a string without escapes, more is reserved once one shows up
+    BufferError error = json_internal_reserve(buf, n + 2);
+    if (error != BUFFER_ERROR_NONE) {
+        return error;
+    }
+    while (n > 0) {
+        size_t clean = json_internal_clean_prefix(s, n);
+        memcpy(buf->ptr + buf->len, s, clean);
+        buf->len += clean;
+        s += clean;
+        n -= clean;
+        if (n == 0) {
+            break;
+        }
+        if ((error = json_internal_reserve(buf, n + 6 + 2))) {
+            return error;
+        }
+        buf->len += json_internal_escape_byte(buf->ptr + buf->len, (unsigned char)*s);
+        s += 1;
+        n -= 1;
+    }
+    buf->ptr[buf->len] = '\0';
+    return BUFFER_ERROR_NONE;
+}
+
+/**
+ * Open an object, as a value or after a key.
+ * @param writer Pointer to a `JsonWriter` struct
+ * @return `BufferError` (errors are non-zero), `BUFFER_ERROR_INDEX_OUT_OF_BOUNDS` beyond `JSON_MAX_DEPTH`.
+ */
+BufferError json_object_begin(JsonWriter *writer) {
+    if (writer->depth >= JSON_MAX_DEPTH) {
+        return BUFFER_ERROR_INDEX_OUT_OF_BOUNDS;
+    }
+    BufferError error = json_internal_separator(writer);
+    if (error != BUFFER_ERROR_NONE || (error = buffer_write_byte(writer->buf, '{'))) {
+        return error;
+    }
+    writer->elements &= ~(1ULL << writer->depth);
+    writer->objects |= 1ULL << writer->depth;
+    writer->depth += 1;
+    return BUFFER_ERROR_NONE;
+}
+
+/**
+ * Close the innermost object.
+ * @param writer Pointer to a `JsonWriter` struct
+ * @return `BufferError` (errors are non-zero), `BUFFER_ERROR_INVALID_FORMAT` if no object is open.
+ */
+BufferError json_object_end(JsonWriter *writer) {
+    if (writer->depth == 0 || !(writer->objects >> (writer->depth - 1) & 1) || writer->after_key) {
+        return BUFFER_ERROR_INVALID_FORMAT;
+    }
+    writer->depth -= 1;
+    BufferError error = buffer_write_byte(writer->buf, '}');
+    if (error != BUFFER_ERROR_NONE) {
+        return error;
+    }
+    return json_internal_value_done(writer);
+}
+
+/**
+ * Open an array, as a value or after a key.
+ * @param writer Pointer to a `JsonWriter` struct
+ * @return `BufferError` (errors are non-zero), `BUFFER_ERROR_INDEX_OUT_OF_BOUNDS` beyond `JSON_MAX_DEPTH`.
+ */
+BufferError json_array_begin(JsonWriter *writer) {
+    if (writer->depth >= JSON_MAX_DEPTH) {
+        return BUFFER_ERROR_INDEX_OUT_OF_BOUNDS;
+    }
+    BufferError error = json_internal_separator(writer);
+    if (error != BUFFER_ERROR_NONE || (error = buffer_write_byte(writer->buf, '['))) {
+        return error;
+    }
+    writer->elements &= ~(1ULL << writer->depth);
+    writer->objects &= ~(1ULL << writer->depth);
+    writer->depth += 1;
+    return BUFFER_ERROR_NONE;
+}
+
+/**
+ * Close the innermost array.
+ * @param writer Pointer to a `JsonWriter` struct
+ * @return `BufferError` (errors are non-zero), `BUFFER_ERROR_INVALID_FORMAT` if no array is open.
+ */
+BufferError json_array_end(JsonWriter *writer) {
+    if (writer->depth == 0 || writer->objects >> (writer->depth - 1) & 1) {
+        return BUFFER_ERROR_INVALID_FORMAT;
+    }
+    writer->depth -= 1;
+    BufferError error = buffer_write_byte(writer->buf, ']');
+    if (error != BUFFER_ERROR_NONE) {
+        return error;
+    }
+    return json_internal_value_done(writer);
+}
+
+/**
+ * Write the key of the next member of the innermost object.
+ * @param writer Pointer to a `JsonWriter` struct
+ * @param key The key, escaped as needed
+ * @return `BufferError` (errors are non-zero), `BUFFER_ERROR_INVALID_FORMAT` outside of an object.
+ */
+BufferError json_write_key(JsonWriter *writer, const char *key) {
+    if (writer->depth == 0 || !(writer->objects >> (writer->depth - 1) & 1) || writer->after_key) {
+        return BUFFER_ERROR_INVALID_FORMAT;
+    }
+    BufferError error = BUFFER_ERROR_NONE;
+    if (writer->elements >> (writer->depth - 1) & 1) {
+        error = buffer_write_byte(writer->buf, ',');
+    }
+    if (error != BUFFER_ERROR_NONE
+        || (error = buffer_write_byte(writer->buf, '"'))
+        || (error = json_escape(writer->buf, key, strlen(key)))
+        || (error = buffer_write_bytes(writer->buf, "\":", 2))) {
+        return error;
+    }
+    writer->elements |= 1ULL << (writer->depth - 1);
+    writer->after_key = 1;
+    return BUFFER_ERROR_NONE;
+}
+
+/**
+ * Write `true` or `false`.
+ * NOTE: Allocates memory!
+ * @param writer Pointer to a `JsonWriter` struct
+ * @param value The value
+ * @return `BufferError` (errors are non-zero).
+ */
+BufferError json_write_bool(JsonWriter *writer, int value) {
+    BufferError error = json_internal_separator(writer);
+    if (error != BUFFER_ERROR_NONE
+        || (error = value ? buffer_write_bytes(writer->buf, "true", 4) : buffer_write_bytes(writer->buf, "false", 5))) {
+        return error;
+    }
+    return json_internal_value_done(writer);
+}
+
+/**
+ * Write `null`.
+ * NOTE: Allocates memory!
+ * @param writer Pointer to a `JsonWriter` struct
+ * @return `BufferError` (errors are non-zero).
+ */
+BufferError json_write_null(JsonWriter *writer) {
+    BufferError error = json_internal_separator(writer);
+    if (error != BUFFER_ERROR_NONE || (error = buffer_write_bytes(writer->buf, "null", 4))) {
+        return error;
+    }
+    return json_internal_value_done(writer);
+}
+
+/**
+ * Write a string value of `n` bytes, it may contain null bytes.
+ * NOTE: Allocates memory!
+ * @param writer Pointer to a `JsonWriter` struct
+ * @param s The bytes
+ * @param n Number of bytes
+ * @return `BufferError` (errors are non-zero).
+ */
+BufferError json_write_string_bytes(JsonWriter *writer, const char *s, size_t n) {
+    BufferError error = json_internal_separator(writer);
+    if (error != BUFFER_ERROR_NONE
+        || (error = buffer_write_byte(writer->buf, '"'))
+        || (error = json_escape(writer->buf, s, n))
+        || (error = buffer_write_byte(writer->buf, '"'))) {
+        return error;
+    }
+    return json_internal_value_done(writer);
+}
+
+/**
+ * Write a string value.
+ * NOTE: Allocates memory!
+ * @param writer Pointer to a `JsonWriter` struct
+ * @param s The string, `NULL` is written as `null`
+ * @return `BufferError` (errors are non-zero).
+ */
+BufferError json_write_string(JsonWriter *writer, const char *s) {
+    if (s == NULL) {
+        return json_write_null(writer);
+    }
+    return json_write_string_bytes(writer, s, strlen(s));
+}
+
+/**
+ * Write an unsigned integer value.
+ * NOTE: Allocates memory!
+ * @param writer Pointer to a `JsonWriter` struct
+ * @param value The value
+ * @return `BufferError` (errors are non-zero).
+ */
+BufferError json_write_uint(JsonWriter *writer, uint64_t value) {
+    BufferError error = json_internal_separator(writer);
+    if (error != BUFFER_ERROR_NONE || (error = json_internal_reserve(writer->buf, 20))) {
+        return error;
+    }
+    Buffer *buf = writer->buf;
+    buf->len += json_internal_u64(buf->ptr + buf->len, value);
+    buf->ptr[buf->len] = '\0';
+    return json_internal_value_done(writer);
+}
+
+/**
+ * Write a signed integer value.
+ * NOTE: Allocates memory!
+ * @param writer Pointer to a `JsonWriter` struct
+ * @param value The value
+ * @return `BufferError` (errors are non-zero).
+ */
+BufferError json_write_int(JsonWriter *writer, int64_t value) {
+    BufferError error = json_internal_separator(writer);
+    if (error != BUFFER_ERROR_NONE || (error = json_internal_reserve(writer->buf, 21))) {
+        return error;
+    }
+    Buffer *buf = writer->buf;
+    uint64_t magnitude = (uint64_t)value;
+    if (value < 0) {
+        buf->ptr[buf->len++] = '-';
+        magnitude = 0 - magnitude;
+    }
+    buf->len += json_internal_u64(buf->ptr + buf->len, magnitude);
+    buf->ptr[buf->len] = '\0';
+    return json_internal_value_done(writer);
+}
+
+/**
+ * Write a floating point value with a fixed number of decimals, e.g. a duration in milliseconds.
+ * Much faster than `json_write_double`, the value is rounded to the decimals.
+ * NaN and infinities are written as `null`, like values too large for 64-bit fixed point.
+ * NOTE: Allocates memory!
+ * @param writer Pointer to a `JsonWriter` struct
+ * @param value The value
+ * @param decimals Digits after the decimal point, 0 to 9
+ * @return `BufferError` (errors are non-zero).
+ */
+BufferError json_write_fixed(JsonWriter *writer, double value, int decimals) {
+    static const double scales[] = {1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9};
+    decimals = decimals < 0 ? 0 : decimals > 9 ? 9 : decimals;
+    double scaled = fabs(value) * scales[decimals] + 0.5;
+    if (!(scaled < 18446744073709551616.0)) {
+        return json_write_null(writer);
+    }
+    BufferError error = json_internal_separator(writer);
+    if (error != BUFFER_ERROR_NONE || (error = json_internal_reserve(writer->buf, 32))) {
+        return error;
+    }
+    Buffer *buf = writer->buf;
+    uint64_t units = (uint64_t)scaled;
+    uint64_t scale = (uint64_t)scales[decimals];
+    if (value < 0 && units != 0) {
+        buf->ptr[buf->len++] = '-';
+    }
+    buf->len += json_internal_u64(buf->ptr + buf->len, units / scale);
+    if (decimals > 0) {
+        // The fraction with its leading zeros, e.g. 5 with 3 decimals is "005"
+        char *fraction = buf->ptr + buf->len;
+        *fraction = '.';
+        uint64_t rest = units % scale;
+        for (int i = decimals; i > 0; i -= 1) {
+            fraction[i] = (char)('0' + rest % 10);
+            rest /= 10;
+        }
+        buf->len += (size_t)decimals + 1;
+    }
+    buf->ptr[buf->len] = '\0';
+    return json_internal_value_done(writer);
+}
+
+/**
+ * Write a floating point value with the fewest digits (up to 17) that read back as the same double.
+ * NaN and infinities are written as `null`. The decimal separator is always ".", whatever the locale.
+ * NOTE: Allocates memory!
+ * @param writer Pointer to a `JsonWriter` struct
+ * @param value The value
+ * @return `BufferError` (errors are non-zero).
+ */
+BufferError json_write_double(JsonWriter *writer, double value) {
+    if (!isfinite(value)) {
+        return json_write_null(writer);
+    }
+    // Integral values take the integer path, e.g. 3.0 becomes "3"
+    if (value >= -9007199254740992.0 && value <= 9007199254740992.0 && value == (double)(int64_t)value && (value != 0 || !signbit(value))) {
+        return json_write_int(writer, (int64_t)value);
+    }
+    BufferError error = json_internal_separator(writer);
+    if (error != BUFFER_ERROR_NONE || (error = json_internal_reserve(writer->buf, 32))) {
+        return error;
+    }
+    Buffer *buf = writer->buf;
+    char *out = buf->ptr + buf->len;
+    // 15 significant digits are exact for most values, 17 always are
+    int length = snprintf(out, 32, "%.15g", value);
+    for (int precision = 16; precision <= 17 && strtod(out, NULL) != value; precision += 1) {
+        length = snprintf(out, 32, "%.*g", precision, value);
+    }
+    // snprintf and strtod follow LC_NUMERIC, turn the decimal separator of the locale (e.g. "," for de_DE) into "."
+    int end = 0;
+    for (int i = 0; i < length;) {
+        char c = out[i];
+        if ((c >= '0' && c <= '9') || c == '-' || c == '+' || c == 'e') {
+            out[end] = c;
+            i += 1;
+        }
+        else {
+            out[end] = '.';
+            while (i < length && !((out[i] >= '0' && out[i] <= '9') || out[i] == 'e')) {
+                i += 1;
+            }
+        }
+        end += 1;
+    }
+    memset(out + end, 0, (size_t)(length - end));
+    buf->len += (size_t)end;
+    return json_internal_value_done(writer);
+}
+
+#else
+
+BufferError json_escape(Buffer *buf, const char *s, size_t n);
+BufferError json_object_begin(JsonWriter *writer);
+BufferError json_object_end(JsonWriter *writer);
+BufferError json_array_begin(JsonWriter *writer);
+BufferError json_array_end(JsonWriter *writer);
+BufferError json_write_key(JsonWriter *writer, const char *key);
+BufferError json_write_bool(JsonWriter *writer, int value);
+BufferError json_write_null(JsonWriter *writer);
+BufferError json_write_string_bytes(JsonWriter *writer, const char *s, size_t n);
+BufferError json_write_string(JsonWriter *writer, const char *s);
+BufferError json_write_uint(JsonWriter *writer, uint64_t value);
+BufferError json_write_int(JsonWriter *writer, int64_t value);
+BufferError json_write_fixed(JsonWriter *writer, double value, int decimals);
+BufferError json_write_double(JsonWriter *writer, double value);
+
+#endif
+
+#endif
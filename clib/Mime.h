@@ -1,10 +1,16 @@
 #ifndef MIME_H
 #define MIME_H
 
+#ifndef _INC_STDDEF
+#include <stddef.h>
+#endif
+
 #ifndef _STDINT_H
 #include <stdint.h>
 #endif
 
+#include "Clib.h"
+
 #define MIME_INTERNAL_LENGTH (sizeof(MIMES) / sizeof(*MIMES))
 
 /**
@@ -15,7 +21,7 @@ typedef struct Mime {
     char *type;
 } Mime;
 
-const Mime MIMES[] = {
+static const Mime MIMES[] = {
     //Text MIME types
     {".css",   "text/css"},
     {".csv",   "text/csv"},
@@ -74,6 +80,8 @@ const Mime MIMES[] = {
     {".zip",   "application/zip"}
 };
 
+#ifdef CLIB_DEFINITIONS
+
 /**
  * Resolve the file extension for the given mime/content type.
  * Returns `NULL` if there's no match.
@@ -135,4 +143,12 @@ ContinueOuterLoop:
     return NULL;
 }
 
+#else
+
+char *mime_resolve_ext(const char *type);
+char *mime_resolve_ext_default(const char *type, const char *default_value);
+char *mime_resolve_type(const char *ext);
+
+#endif
+
 #endif
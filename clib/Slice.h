@@ -1,10 +1,16 @@
 #ifndef SLICE_H
 #define SLICE_H
 
+#ifndef _INC_STDDEF
+#include <stddef.h>
+#endif
+
 #ifndef _STDINT_H
 #include <stdint.h>
 #endif
 
+#include "Clib.h"
+
 /**
  * A slice is a section of memory with a pointer to the beginning of memory and a length.
  * The struct doesn't contain any information of the size of each element.
@@ -69,7 +75,7 @@ typedef struct Slice {
  * @param s2 Pointer to the second slice
  * @return 1 if equal, else 0
  */
-int slice_equals(Slice *s1, Slice *s2) {
+static inline int slice_equals(Slice *s1, Slice *s2) {
     if (s1->len != s2->len) {
         return 0;
     }
@@ -87,7 +93,7 @@ int slice_equals(Slice *s1, Slice *s2) {
  * @param string String to compare against
  * @return 1 if equal, else 0
  */
-int slice_equals_string(Slice *slice, const char *string) {
+static inline int slice_equals_string(Slice *slice, const char *string) {
     size_t string_len = 0;
     for (size_t i = 0; string[i] != '\0'; i += 1) {
         string_len += 1;
@@ -109,7 +115,7 @@ int slice_equals_string(Slice *slice, const char *string) {
  * @param prefix Prefix string
  * @return 1 if true, 0 if false
  */
-int slice_has_prefix(Slice *slice, const char *prefix) {
+static inline int slice_has_prefix(Slice *slice, const char *prefix) {
     size_t prefix_length = 0, i;
     for (i = 0; prefix[i] != '\0'; i += 1) {
         prefix_length += 1;
@@ -131,7 +137,7 @@ int slice_has_prefix(Slice *slice, const char *prefix) {
  * @param suffix Suffix string
  * @return 1 if true, 0 if false
  */
-int slice_has_suffix(Slice *slice, const char *suffix) {
+static inline int slice_has_suffix(Slice *slice, const char *suffix) {
     size_t suffix_length = 0, i;
     for (i = 0; suffix[i] != '\0'; i += 1) {
         suffix_length += 1;
@@ -140,13 +146,15 @@ int slice_has_suffix(Slice *slice, const char *suffix) {
         return 0;
     }
     for (i = slice->len - suffix_length; i < slice->len; i += 1) {
-        if (((char*)slice->ptr)[i] != suffix[i]) {
+        if (((char*)slice->ptr)[i] != suffix[i - (slice->len - suffix_length)]) {
             return 0;
         }
     }
     return 1;
 }
 
+#ifdef CLIB_DEFINITIONS
+
 /**
  * Check if the slice contains the specified string.
  * @param slice Slice pointer
@@ -161,15 +169,23 @@ int slice_has_string(Slice *slice, const char *string) {
     if (string_length > slice->len) {
         return 0;
     }
-    for (i = 0; i < slice->len; i += 1) {
-        for (j = 0; j < string_length && i + j < slice->len; j += 1) {
+    for (i = 0; i + string_length <= slice->len; i += 1) {
+        for (j = 0; j < string_length; j += 1) {
             if (((char*)slice->ptr)[i + j] != string[j]) {
-                return 0;
+                break;
             }
         }
-        return 1;
+        if (j == string_length) {
+            return 1;
+        }
     }
     return 0;
 }
 
+#else
+
+int slice_has_string(Slice *slice, const char *string);
+
+#endif
+
 #endif
@@ -1,6 +1,10 @@
 #ifndef STRING_H
 #define STRING_H
 
+#ifndef _INC_STDIO
+#include <stdio.h>
+#endif
+
 #ifndef _INC_STDLIB
 #include <stdlib.h>
 #endif
@@ -9,6 +13,9 @@
 #include <string.h>
 #endif
 
+#include "Clib.h"
+#include "Alloc.h"
+
 #define string_last_index(String) ((String).len - 1)
 
 typedef struct String {
@@ -16,33 +23,38 @@ typedef struct String {
     size_t cap, len;
 } String;
 
+#ifdef CLIB_DEFINITIONS
+
 void string_print(String *string) {
-    printf("String{\"%s\", cap = %llu, len = %llu}\n", string->ptr, string->cap, string->len);
+    printf("String{\"%s\", cap = %llu, len = %llu}\n", string->ptr, (unsigned long long)string->cap, (unsigned long long)string->len);
 }
 
-String string_make(size_t capacity) {
+ALLOC_NOINLINE String string_make(size_t capacity) {
     if (capacity == 0) {
         capacity = 2;
     }
     return (String) {
-        .ptr = calloc(capacity, 1),
+        .ptr = ALLOC_CALLOC(capacity, 1),
         .cap = capacity,
         .len = 0,
     };
 }
 
-void string_init(String *string, size_t capacity) {
+ALLOC_NOINLINE void string_init(String *string, size_t capacity) {
     if (string == NULL) {
         return;
     }
-    *string = string_make(capacity);
+    if (capacity == 0) {
+        capacity = 2;
+    }
+    *string = (String) {.ptr = ALLOC_CALLOC(capacity, 1), .cap = capacity, .len = 0};
 }
 
 void string_release(String *string) {
     if (string == NULL) {
         return;
     }
-    free(string->ptr);
+    ALLOC_FREE(string->ptr);
     string->cap = 0;
     string->len = 0;
 }
@@ -55,7 +67,7 @@ void string_clear(String *string) {
     string->len = 0;
 }
 
-void string_grow(String *string, size_t required_capacity) {
+ALLOC_NOINLINE void string_grow(String *string, size_t required_capacity) {
     if (string == NULL) {
         return;
     }
@@ -63,7 +75,7 @@ void string_grow(String *string, size_t required_capacity) {
         while (required_capacity >= string->cap) {
             string->cap <<= 1;
         }
-        string->ptr = realloc(string->ptr, string->cap);
+        string->ptr = ALLOC_REALLOC(string->ptr, string->cap);
         if (string->ptr == NULL) {
             return;
         }
@@ -71,16 +83,31 @@ void string_grow(String *string, size_t required_capacity) {
     }
 }
 
-void string_append_byte(String *string, char byte) {
+#else
+
+void string_print(String *string);
+String string_make(size_t capacity);
+void string_init(String *string, size_t capacity);
+void string_release(String *string);
+void string_clear(String *string);
+void string_grow(String *string, size_t required_capacity);
+
+#endif
+
+static inline void string_append_byte(String *string, char byte) {
     if (string == NULL) {
         return;
     }
     size_t required_capacity = string->len + 2;
-    string_grow(string, required_capacity);
+    if (required_capacity >= string->cap) {
+        string_grow(string, required_capacity);
+    }
     string->ptr[string->len] = byte;
     string->len += 1;
 }
 
+#ifdef CLIB_DEFINITIONS
+
 void string_append_string(String *string, const char *append_string) {
     if (string == NULL) {
         return;
@@ -116,9 +143,12 @@ void string_insert_string(String *string, size_t index, const char *insert_strin
         return;
     }
     size_t insert_string_length = strlen(insert_string);
+    if (insert_string_length == 0) {
+        return;
+    }
     size_t required_capacity = string->len + insert_string_length + 1;
     string_grow(string, required_capacity);
-    for (size_t i = string->len - 1 + insert_string_length; i > index; i -= 1) {
+    for (size_t i = string->len - 1 + insert_string_length; i >= index + insert_string_length; i -= 1) {
         string->ptr[i] = string->ptr[i - insert_string_length];
     }
     for (size_t i = 0; i < insert_string_length; i += 1) {
@@ -181,4 +211,15 @@ void string_copy(String *dst, String *src) {
     dst->len = src->len;
 }
 
+#else
+
+void string_append_string(String *string, const char *append_string);
+void string_insert_byte(String *string, size_t index, char byte);
+void string_insert_string(String *string, size_t index, const char *insert_string);
+void string_remove_byte(String *string, size_t index);
+void string_remove_string(String *string, size_t index, size_t length);
+void string_copy(String *dst, String *src);
+
+#endif
+
 #endif
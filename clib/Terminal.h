@@ -12,9 +12,20 @@
 #include <stdio.h>
 #endif
 
+#ifdef _WIN32
 #ifndef _INC_WINDOWS
 #include <windows.h>
 #endif
+#else
+#include <errno.h>
+#include <pthread.h>
+#include <signal.h>
+#include <sys/ioctl.h>
+#include <termios.h>
+#include <unistd.h>
+#endif
+
+#include "Clib.h"
 
 #define term_run(Cmd, ...) printf("\033[" Cmd, ##__VA_ARGS__)
 
@@ -143,20 +154,206 @@ typedef struct TerminalDimensions {
     short rows, cols;
 } TerminalDimensions;
 
-TerminalDimensions term_get_dimensions(void) {
-    TerminalDimensions td;
-    CONSOLE_SCREEN_BUFFER_INFO csbi;
-    GetConsoleScreenBufferInfo(GetStdHandle(STD_OUTPUT_HANDLE), &csbi);
-    td.cols = csbi.srWindow.Right - csbi.srWindow.Left + 1;
-    td.rows = csbi.srWindow.Bottom - csbi.srWindow.Top + 1;
-    return td;
-}
+#pragma region Internals
 
-void term_load_dimensions(TerminalDimensions *td) {
+#ifdef _WIN32
+
+#ifdef CLIB_DEFINITIONS
+
+static DWORD term_internal_input_mode;
+static int term_internal_raw;
+
+void term_internal_query_dimensions(TerminalDimensions *td) {
     CONSOLE_SCREEN_BUFFER_INFO csbi;
     GetConsoleScreenBufferInfo(GetStdHandle(STD_OUTPUT_HANDLE), &csbi);
     td->cols = csbi.srWindow.Right - csbi.srWindow.Left + 1;
     td->rows = csbi.srWindow.Bottom - csbi.srWindow.Top + 1;
 }
 
+#else
+
+void term_internal_query_dimensions(TerminalDimensions *td);
+
+#endif
+
+#else
+
+#define TERM_DEFAULT_ROWS 24
+#define TERM_DEFAULT_COLS 80
+
+#ifdef CLIB_DEFINITIONS
+
+/**
+ * The cached size, rows in the high and columns in the low 16 bits.
+ * A single word so the SIGWINCH handler can replace it without tearing.
+ */
+static volatile sig_atomic_t term_internal_dimensions;
+static volatile sig_atomic_t term_internal_watching;
+static pthread_once_t term_internal_watch_once = PTHREAD_ONCE_INIT;
+static struct sigaction term_internal_previous_sigwinch;  // Installed before ours, called after every refresh
+static struct termios term_internal_termios;
+static int term_internal_raw;
+
+/**
+ * Query the size of the terminal, async-signal-safe.
+ * @return Rows in the high and columns in the low 16 bits, 24x80 if the output is not a terminal
+ */
+sig_atomic_t term_internal_query_dimensions(void) {
+    struct winsize ws;
+    int fd = isatty(STDOUT_FILENO) ? STDOUT_FILENO : STDIN_FILENO;
+    if (ioctl(fd, TIOCGWINSZ, &ws) != 0 || ws.ws_row == 0 || ws.ws_col == 0) {
+        ws.ws_row = TERM_DEFAULT_ROWS;
+        ws.ws_col = TERM_DEFAULT_COLS;
+    }
+    return (sig_atomic_t)((ws.ws_row & 0x7FFF) << 16 | (ws.ws_col & 0xFFFF));
+}
+
+void term_internal_refresh_dimensions(void) {
+    term_internal_dimensions = term_internal_query_dimensions();
+}
+
+/**
+ * Refresh the cached size, then pass the signal on to the handler the application had installed.
+ */
+void term_internal_sigwinch(int signal, siginfo_t *info, void *context) {
+    int saved = errno;
+    term_internal_refresh_dimensions();
+    errno = saved;
+    struct sigaction *previous = &term_internal_previous_sigwinch;
+    if (previous->sa_flags & SA_SIGINFO) {
+        if (previous->sa_sigaction != NULL) {
+            previous->sa_sigaction(signal, info, context);
+        }
+    }
+    else if (previous->sa_handler != SIG_DFL && previous->sa_handler != SIG_IGN && previous->sa_handler != NULL) {
+        previous->sa_handler(signal);
+    }
+}
+
+void term_internal_watch_dimensions(void) {
+    struct sigaction action = {0};
+    action.sa_sigaction = term_internal_sigwinch;
+    action.sa_flags = SA_RESTART | SA_SIGINFO;
+    sigemptyset(&action.sa_mask);
+    term_internal_refresh_dimensions();
+    if (sigaction(SIGWINCH, &action, &term_internal_previous_sigwinch) == 0) {
+        term_internal_watching = 1;
+    }
+}
+
+#else
+
+sig_atomic_t term_internal_query_dimensions(void);
+void term_internal_refresh_dimensions(void);
+void term_internal_sigwinch(int signal, siginfo_t *info, void *context);
+void term_internal_watch_dimensions(void);
+
+#endif
+
+#endif
+
+#pragma endregion
+
+#ifdef CLIB_DEFINITIONS
+
+/**
+ * Cache the size of the terminal and refresh it on every SIGWINCH from now on,
+ * so `term_load_dimensions` becomes a single memory load instead of a system call.
+ * A SIGWINCH handler installed before is kept and still called after each refresh,
+ * install yours before this or chain to the one you replace. Safe to call from several threads, only the first call installs.
+ * Does nothing on Windows.
+ */
+void term_watch_dimensions(void) {
+#ifndef _WIN32
+    pthread_once(&term_internal_watch_once, term_internal_watch_dimensions);
+#endif
+}
+
+/**
+ * Load the size of the terminal window into `td`.
+ * Queries the terminal on every call unless `term_watch_dimensions` was called, then it reads the cached size.
+ * @param td Pointer to a `TerminalDimensions` struct, 24x80 if the output is not a terminal
+ */
+void term_load_dimensions(TerminalDimensions *td) {
+#ifdef _WIN32
+    term_internal_query_dimensions(td);
+#else
+    sig_atomic_t dimensions = term_internal_watching ? term_internal_dimensions : term_internal_query_dimensions();
+    td->rows = (short)(dimensions >> 16);
+    td->cols = (short)(dimensions & 0xFFFF);
+#endif
+}
+
+/**
+ * Get the size of the terminal window, see `term_load_dimensions`.
+ * @return The rows and columns
+ */
+TerminalDimensions term_get_dimensions(void) {
+    TerminalDimensions td;
+    term_load_dimensions(&td);
+    return td;
+}
+
+/**
+ * Switch the input to raw mode: no echo, no line buffering, no signals from Ctrl-C/Ctrl-Z,
+ * every key press can be read as it comes. Output processing stays on, so "\n" still starts a new line.
+ * Restore the terminal with `term_raw_mode_disable` before exiting.
+ * @return 0 on success, -1 if the input is not a terminal
+ */
+int term_raw_mode_enable(void) {
+    if (term_internal_raw) {
+        return 0;
+    }
+#ifdef _WIN32
+    HANDLE input = GetStdHandle(STD_INPUT_HANDLE);
+    if (!GetConsoleMode(input, &term_internal_input_mode)) {
+        return -1;
+    }
+    DWORD mode = term_internal_input_mode & ~(ENABLE_ECHO_INPUT | ENABLE_LINE_INPUT | ENABLE_PROCESSED_INPUT);
+    if (!SetConsoleMode(input, mode | ENABLE_VIRTUAL_TERMINAL_INPUT)) {
+        return -1;
+    }
+#else
+    if (tcgetattr(STDIN_FILENO, &term_internal_termios) != 0) {
+        return -1;
+    }
+    struct termios raw = term_internal_termios;
+    raw.c_iflag &= ~(tcflag_t)(BRKINT | ICRNL | INPCK | ISTRIP | IXON);
+    raw.c_lflag &= ~(tcflag_t)(ECHO | ICANON | IEXTEN | ISIG);
+    raw.c_cflag |= CS8;
+    raw.c_cc[VMIN] = 1;  // Block until a byte is there
+    raw.c_cc[VTIME] = 0;
+    if (tcsetattr(STDIN_FILENO, TCSAFLUSH, &raw) != 0) {
+        return -1;
+    }
+#endif
+    term_internal_raw = 1;
+    return 0;
+}
+
+/**
+ * Restore the input mode from before `term_raw_mode_enable`.
+ */
+void term_raw_mode_disable(void) {
+    if (!term_internal_raw) {
+        return;
+    }
+#ifdef _WIN32
+    SetConsoleMode(GetStdHandle(STD_INPUT_HANDLE), term_internal_input_mode);
+#else
+    tcsetattr(STDIN_FILENO, TCSAFLUSH, &term_internal_termios);
+#endif
+    term_internal_raw = 0;
+}
+
+#else
+
+void term_watch_dimensions(void);
+void term_load_dimensions(TerminalDimensions *td);
+TerminalDimensions term_get_dimensions(void);
+int term_raw_mode_enable(void);
+void term_raw_mode_disable(void);
+
+#endif
+
 #endif
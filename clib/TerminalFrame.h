@@ -0,0 +1,423 @@
+#ifndef TERMINAL_FRAME_H
+#define TERMINAL_FRAME_H
+
+/**
+ * Double-buffered screen renderer.
+ * Drawing goes into the back grid of cells, `term_frame_present` compares it with the front grid
+ * (what the terminal shows) and sends only the changed cells, with as few cursor moves as possible,
+ * in a single write. Every cell is one column wide, wide characters are not supported.
+ */
+
+#ifndef _STDINT_H
+#include <stdint.h>
+#endif
+
+#ifndef _INC_STRING
+#include <string.h>
+#endif
+
+#ifdef _WIN32
+#include <io.h>
+#else
+#include <errno.h>
+#include <unistd.h>
+#endif
+
+#include "Clib.h"
+#include "Buffer.h"
+#include "Terminal.h"
+#include "TerminalStyle.h"
+
+/**
+ * A single character on the screen.
+ */
+typedef struct TerminalCell {
+    uint32_t codepoint; // Unicode code point, ' ' for an empty cell
+    TerminalStyle style;
+} TerminalCell;
+
+typedef struct TerminalFrame {
+    TerminalCell *front;         // What the terminal shows
+    TerminalCell *back;          // The frame being drawn
+    short rows, cols;
+    Buffer out;                  // Output of the last present, reused between frames
+    int cursor_row, cursor_col;  // Where the terminal cursor is, -1 = unknown
+    TerminalStyle pen;           // Style the terminal currently draws with
+    int full_redraw;             // Clear the screen on the next present
+} TerminalFrame;
+
+#define TERM_FRAME_BLANK ((TerminalCell) {.codepoint = ' '})
+
+#pragma region Internals
+
+static inline int term_frame_internal_same_style(const TerminalStyle *a, const TerminalStyle *b) {
+    return a->fg == b->fg && a->bg == b->bg && a->attrs == b->attrs;
+}
+
+static inline int term_frame_internal_same(const TerminalCell *a, const TerminalCell *b) {
+    return a->codepoint == b->codepoint && term_frame_internal_same_style(&a->style, &b->style);
+}
+
+#ifdef CLIB_DEFINITIONS
+
+/**
+ * Write a small non-negative number in decimal.
+ */
+void term_frame_internal_number(Buffer *out, int value) {
+    char digits[12];
+    int n = 0;
+    do {
+        digits[sizeof(digits) - 1 - n] = (char)('0' + value % 10);
+        value /= 10;
+        n += 1;
+    } while (value > 0);
+    buffer_write_bytes(out, digits + sizeof(digits) - n, (size_t)n);
+}
+
+/**
+ * Write a code point as UTF-8.
+ */
+void term_frame_internal_utf8(Buffer *out, uint32_t codepoint) {
+    char bytes[4];
+    size_t n;
+    if (codepoint < 0x80) {
+        bytes[0] = (char)codepoint;
+        n = 1;
+    }
+    else if (codepoint < 0x800) {
+        bytes[0] = (char)(0xC0 | codepoint >> 6);
+        bytes[1] = (char)(0x80 | (codepoint & 0x3F));
+        n = 2;
+    }
+    else if (codepoint < 0x10000) {
+        bytes[0] = (char)(0xE0 | codepoint >> 12);
+        bytes[1] = (char)(0x80 | (codepoint >> 6 & 0x3F));
+        bytes[2] = (char)(0x80 | (codepoint & 0x3F));
+        n = 3;
+    }
+    else {
+        bytes[0] = (char)(0xF0 | (codepoint >> 18 & 0x07));
+        bytes[1] = (char)(0x80 | (codepoint >> 12 & 0x3F));
+        bytes[2] = (char)(0x80 | (codepoint >> 6 & 0x3F));
+        bytes[3] = (char)(0x80 | (codepoint & 0x3F));
+        n = 4;
+    }
+    buffer_write_bytes(out, bytes, n);
+}
+
+/**
+ * Decode the next code point of a UTF-8 string, invalid bytes become U+FFFD.
+ * @return Number of bytes consumed
+ */
+size_t term_frame_internal_decode(const char *s, uint32_t *codepoint) {
+    const unsigned char *u = (const unsigned char*)s;
+    size_t n;
+    if (u[0] < 0x80) {
+        *codepoint = u[0];
+        return 1;
+    }
+    else if ((u[0] & 0xE0) == 0xC0) {
+        *codepoint = u[0] & 0x1F;
+        n = 2;
+    }
+    else if ((u[0] & 0xF0) == 0xE0) {
+        *codepoint = u[0] & 0x0F;
+        n = 3;
+    }
+    else if ((u[0] & 0xF8) == 0xF0) {
+        *codepoint = u[0] & 0x07;
+        n = 4;
+    }
+    else {
+        *codepoint = 0xFFFD;
+        return 1;
+    }
+    for (size_t i = 1; i < n; i += 1) {
+        if ((u[i] & 0xC0) != 0x80) {
+            *codepoint = 0xFFFD;
+            return i;
+        }
+        *codepoint = *codepoint << 6 | (u[i] & 0x3F);
+    }
+    return n;
+}
+
+/**
+ * Move the cursor to `row`, `col` with the shortest sequence.
+ * Short gaps on the same row are written over with the unchanged cells if they have the pen's style.
+ */
+void term_frame_internal_move(TerminalFrame *frame, int row, int col) {
+    Buffer *out = &frame->out;
+    if (frame->cursor_row == row && frame->cursor_col == col) {
+        return;
+    }
+    if (frame->cursor_row == row && frame->cursor_col >= 0 && col > frame->cursor_col) {
+        int gap = col - frame->cursor_col;
+        const TerminalCell *cells = &frame->front[row * frame->cols + frame->cursor_col];
+        int rewrite = gap <= 4;
+        for (int i = 0; i < gap && rewrite; i += 1) {
+            rewrite = cells[i].codepoint < 0x80 && term_frame_internal_same_style(&cells[i].style, &frame->pen);
+        }
+        if (rewrite) {
+            for (int i = 0; i < gap; i += 1) {
+                buffer_write_byte(out, (char)cells[i].codepoint);
+            }
+        }
+        else {
+            buffer_write_bytes(out, "\033[", 2);
+            term_frame_internal_number(out, gap);
+            buffer_write_byte(out, 'C');
+        }
+    }
+    else if (col == 0 && frame->cursor_row >= 0 && row == frame->cursor_row + 1) {
+        buffer_write_bytes(out, "\r\n", 2);
+    }
+    else if (col == 0 && frame->cursor_row == row) {
+        buffer_write_byte(out, '\r');
+    }
+    else if (row == 0 && col == 0) {
+        buffer_write_bytes(out, "\033[H", 3);
+    }
+    else {
+        buffer_write_bytes(out, "\033[", 2);
+        term_frame_internal_number(out, row + 1);
+        buffer_write_byte(out, ';');
+        term_frame_internal_number(out, col + 1);
+        buffer_write_byte(out, 'H');
+    }
+    frame->cursor_row = row;
+    frame->cursor_col = col;
+}
+
+/**
+ * Write all of the output, retrying on partial writes.
+ * @return 0 on success, -1 on error
+ */
+int term_frame_internal_write(int fd, const char *data, size_t length) {
+    while (length > 0) {
+#ifdef _WIN32
+        int written = _write(fd, data, (unsigned int)length);
+#else
+        ssize_t written = write(fd, data, length);
+        if (written < 0 && errno == EINTR) {
+            continue;
+        }
+#endif
+        if (written <= 0) {
+            return -1;
+        }
+        data += written;
+        length -= (size_t)written;
+    }
+    return 0;
+}
+
+#else
+
+void term_frame_internal_number(Buffer *out, int value);
+void term_frame_internal_utf8(Buffer *out, uint32_t codepoint);
+size_t term_frame_internal_decode(const char *s, uint32_t *codepoint);
+void term_frame_internal_move(TerminalFrame *frame, int row, int col);
+int term_frame_internal_write(int fd, const char *data, size_t length);
+
+#endif
+
+#pragma endregion
+
+#ifdef CLIB_DEFINITIONS
+
+/**
+ * Clear the back grid to blank cells.
+ * @param frame Pointer to a `TerminalFrame` struct
+ */
+void term_frame_clear(TerminalFrame *frame) {
+    size_t count = (size_t)frame->rows * (size_t)frame->cols;
+    for (size_t i = 0; i < count; i += 1) {
+        frame->back[i] = TERM_FRAME_BLANK;
+    }
+}
+
+/**
+ * Resize the frame, e.g. after the terminal was resized.
+ * The back grid is cleared and the next present redraws the whole screen.
+ * NOTE: Allocates memory!
+ * @param frame Pointer to a `TerminalFrame` struct
+ * @param rows Number of rows, 0 = the size of the terminal
+ * @param cols Number of columns, 0 = the size of the terminal
+ * @return 0 on success, -1 on allocation failure
+ */
+int term_frame_resize(TerminalFrame *frame, short rows, short cols) {
+    if (rows <= 0 || cols <= 0) {
+        TerminalDimensions td = term_get_dimensions();
+        rows = rows > 0 ? rows : td.rows;
+        cols = cols > 0 ? cols : td.cols;
+    }
+    size_t count = (size_t)rows * (size_t)cols;
+    TerminalCell *front = malloc(count * sizeof(TerminalCell));
+    TerminalCell *back = malloc(count * sizeof(TerminalCell));
+    if (front == NULL || back == NULL) {
+        free(front);
+        free(back);
+        return -1;
+    }
+    free(frame->front);
+    free(frame->back);
+    frame->front = front;
+    frame->back = back;
+    frame->rows = rows;
+    frame->cols = cols;
+    frame->full_redraw = 1;
+    term_frame_clear(frame);
+    return 0;
+}
+
+/**
+ * Initialize a frame, the first present clears the screen.
+ * NOTE: Allocates memory! Release the frame with `term_frame_release`.
+ * @param frame Pointer to a `TerminalFrame` struct
+ * @param rows Number of rows, 0 = the size of the terminal
+ * @param cols Number of columns, 0 = the size of the terminal
+ * @return 0 on success, -1 on allocation failure
+ */
+int term_frame_init(TerminalFrame *frame, short rows, short cols) {
+    *frame = (TerminalFrame) {0};
+    if (buffer_init(&frame->out, 4096) != BUFFER_ERROR_NONE) {
+        return -1;
+    }
+    if (term_frame_resize(frame, rows, cols) != 0) {
+        buffer_release(&frame->out);
+        return -1;
+    }
+    return 0;
+}
+
+/**
+ * Free all the associated memory of the frame.
+ * @param frame Pointer to a `TerminalFrame` struct
+ */
+void term_frame_release(TerminalFrame *frame) {
+    free(frame->front);
+    free(frame->back);
+    buffer_release(&frame->out);
+    *frame = (TerminalFrame) {0};
+}
+
+#else
+
+void term_frame_clear(TerminalFrame *frame);
+int term_frame_resize(TerminalFrame *frame, short rows, short cols);
+int term_frame_init(TerminalFrame *frame, short rows, short cols);
+void term_frame_release(TerminalFrame *frame);
+
+#endif
+
+/**
+ * Set a cell of the back grid, cells outside of the frame are ignored.
+ * @param frame Pointer to a `TerminalFrame` struct
+ * @param row Row, starting at 0
+ * @param col Column, starting at 0
+ * @param cell The character and its style
+ */
+static inline void term_frame_set(TerminalFrame *frame, int row, int col, TerminalCell cell) {
+    if (row < 0 || col < 0 || row >= frame->rows || col >= frame->cols) {
+        return;
+    }
+    frame->back[row * frame->cols + col] = cell;
+}
+
+#ifdef CLIB_DEFINITIONS
+
+/**
+ * Write a UTF-8 string into the back grid, clipped at the end of the row.
+ * @param frame Pointer to a `TerminalFrame` struct
+ * @param row Row, starting at 0
+ * @param col Column of the first character, starting at 0
+ * @param text The string
+ * @param style Style of every character
+ * @return The column after the last character
+ */
+int term_frame_print(TerminalFrame *frame, int row, int col, const char *text, TerminalStyle style) {
+    TerminalCell cell = {.style = style};
+    while (*text != '\0' && col < frame->cols) {
+        text += term_frame_internal_decode(text, &cell.codepoint);
+        term_frame_set(frame, row, col, cell);
+        col += 1;
+    }
+    return col;
+}
+
+/**
+ * Send the changes of the back grid to the terminal in a single write.
+ * Unchanged cells are skipped, blank row ends are erased with one sequence.
+ * The back grid keeps its content, so the next frame can redraw only what changed.
+ * @param frame Pointer to a `TerminalFrame` struct
+ * @param fd File descriptor of the terminal, e.g. 1 for stdout
+ * @return 0 on success, -1 if the output could not be written
+ */
+int term_frame_present(TerminalFrame *frame, int fd) {
+    Buffer *out = &frame->out;
+    buffer_clear(out);
+    if (frame->full_redraw) {
+        // The screen is cleared with the default style, so only non-blank cells are drawn
+        buffer_write_bytes(out, "\033[0m\033[H\033[2J", 11);
+        size_t count = (size_t)frame->rows * (size_t)frame->cols;
+        for (size_t i = 0; i < count; i += 1) {
+            frame->front[i] = TERM_FRAME_BLANK;
+        }
+        frame->pen = (TerminalStyle) {0};
+        frame->cursor_row = 0;
+        frame->cursor_col = 0;
+        frame->full_redraw = 0;
+    }
+
+    for (int row = 0; row < frame->rows; row += 1) {
+        TerminalCell *front = &frame->front[row * frame->cols];
+        TerminalCell *back = &frame->back[row * frame->cols];
+        // Cells after `blank_from` are blank in the new frame
+        int blank_from = frame->cols;
+        while (blank_from > 0 && term_frame_internal_same(&back[blank_from - 1], &TERM_FRAME_BLANK)) {
+            blank_from -= 1;
+        }
+        for (int col = 0; col < frame->cols; col += 1) {
+            if (term_frame_internal_same(&front[col], &back[col])) {
+                continue;
+            }
+            if (col >= blank_from) {
+                // Erase the rest of the row at once
+                term_frame_internal_move(frame, row, col);
+                term_style_write(out, &frame->pen, &TERM_FRAME_BLANK.style);
+                buffer_write_bytes(out, "\033[K", 3);
+                for (; col < frame->cols; col += 1) {
+                    front[col] = back[col];
+                }
+                break;
+            }
+            term_frame_internal_move(frame, row, col);
+            term_style_write(out, &frame->pen, &back[col].style);
+            term_frame_internal_utf8(out, back[col].codepoint);
+            front[col] = back[col];
+            // The cursor stays on the last column until the next character
+            frame->cursor_col = col + 1 < frame->cols ? col + 1 : -1;
+            if (frame->cursor_col < 0) {
+                frame->cursor_row = -1;
+            }
+        }
+    }
+
+    if (out->len == 0) {
+        return 0;
+    }
+    if (out->ptr == NULL) {
+        return -1;
+    }
+    return term_frame_internal_write(fd, out->ptr, out->len);
+}
+
+#else
+
+int term_frame_print(TerminalFrame *frame, int row, int col, const char *text, TerminalStyle style);
+int term_frame_present(TerminalFrame *frame, int fd);
+
+#endif
+
+#endif
@@ -0,0 +1,424 @@
+#ifndef TERMINAL_PROGRESS_H
+#define TERMINAL_PROGRESS_H
+
+/**
+ * Live progress bars for concurrent transfers.
+ * Transfers report their bytes with `term_progress_add` from any thread, which is a single relaxed
+ * atomic add. A single renderer redraws every bar at a fixed rate, in one write per tick, with the
+ * throughput and the remaining time of every line. Lines that did not change are skipped.
+ *
+ * Usage with the HTTP client, from the body write function of every transfer:
+ *   term_progress_add(bar, size * count);
+ */
+
+#ifndef _STDINT_H
+#include <stdint.h>
+#endif
+
+#ifndef _INC_STDIO
+#include <stdio.h>
+#endif
+
+#include <stdatomic.h>
+#include <time.h>
+
+#ifndef _WIN32
+#include <pthread.h>
+#endif
+
+#include "Clib.h"
+#include "Buffer.h"
+#include "Terminal.h"
+#include "TerminalFrame.h"
+#include "TerminalStyle.h"
+
+#define TERM_PROGRESS_LABEL_SIZE 64
+#define TERM_PROGRESS_LINE_SIZE 512
+#define TERM_PROGRESS_DEFAULT_INTERVAL_MS 100
+
+/**
+ * A single progress bar.
+ * The counters may be updated from any thread, everything else belongs to the renderer.
+ */
+typedef struct TerminalProgressBar {
+    char label[TERM_PROGRESS_LABEL_SIZE];
+    atomic_uint_fast64_t current; // Bytes done
+    atomic_uint_fast64_t total;   // Expected bytes, 0 = unknown
+    atomic_int finished;
+    uint64_t rate_bytes;          // `current` at the last rate sample
+    int64_t rate_us;              // Time of the last rate sample
+    double rate;                  // Smoothed bytes per second
+    char line[TERM_PROGRESS_LINE_SIZE];
+    size_t line_len;              // Last drawn line, to skip unchanged lines
+} TerminalProgressBar;
+
+typedef struct TerminalProgress {
+    TerminalProgressBar *bars;
+    size_t cap;
+    atomic_size_t len;   // Bars added so far, they are never removed
+    int fd;              // Output, e.g. 1 for stdout
+    long interval_ms;    // Time between two redraws
+    int64_t last_render_us;
+    size_t lines_drawn;  // Lines below the cursor's starting row that belong to the bars
+    Buffer out;
+#ifndef _WIN32
+    pthread_t thread;
+    atomic_int running;
+#endif
+} TerminalProgress;
+
+#pragma region Internals
+
+#ifdef CLIB_DEFINITIONS
+
+/**
+ * @return Monotonic clock in microseconds
+ */
+int64_t term_progress_internal_now_us(void) {
+    struct timespec ts;
+#ifdef _WIN32
+    timespec_get(&ts, TIME_UTC);
+#else
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+#endif
+    return (int64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+/**
+ * Format a byte count with a binary unit, e.g. "12.3 MiB".
+ */
+void term_progress_internal_bytes(char *out, size_t size, double bytes) {
+    static const char *units[] = {"B", "KiB", "MiB", "GiB", "TiB"};
+    size_t unit = 0;
+    while (bytes >= 1024 && unit < sizeof(units) / sizeof(*units) - 1) {
+        bytes /= 1024;
+        unit += 1;
+    }
+    snprintf(out, size, unit == 0 ? "%.0f %s" : "%.1f %s", bytes, units[unit]);
+}
+
+/**
+ * Update the smoothed throughput of a bar from its counter.
+ */
+void term_progress_internal_sample(TerminalProgressBar *bar, uint64_t current, int64_t now) {
+    if (bar->rate_us == 0) {
+        bar->rate_us = now;
+        bar->rate_bytes = current;
+        return;
+    }
+    int64_t elapsed = now - bar->rate_us;
+    if (elapsed <= 0) {
+        return;
+    }
+    double instant = (double)(current - bar->rate_bytes) * 1e6 / (double)elapsed;
+    // Exponential moving average, steady enough for the ETA and quick to follow changes
+    bar->rate = bar->rate == 0 ? instant : 0.3 * instant + 0.7 * bar->rate;
+    bar->rate_bytes = current;
+    bar->rate_us = now;
+}
+
+/**
+ * Write a label cut or padded to `width` columns, a column per code point like `TerminalFrame`.
+ * Multi-byte sequences are never split, invalid bytes become U+FFFD.
+ * @param out Output, up to 3 bytes per byte of the label plus the padding
+ * @return Number of bytes written
+ */
+size_t term_progress_internal_label(char *out, const char *label, int width) {
+    size_t len = 0;
+    int col = 0;
+    for (; *label != '\0' && col < width; col += 1) {
+        uint32_t codepoint;
+        size_t n = term_frame_internal_decode(label, &codepoint);
+        if (codepoint == 0xFFFD) {
+            memcpy(out + len, "\xEF\xBF\xBD", 3);
+            len += 3;
+        }
+        else {
+            memcpy(out + len, label, n);
+            len += n;
+        }
+        label += n;
+    }
+    memset(out + len, ' ', (size_t)(width - col));
+    return len + (size_t)(width - col);
+}
+
+/**
+ * Format the line of a bar: label, bar, percentage, throughput and ETA, at most `width` columns.
+ * Without room for the bar the line is the label and as much of the rest as fits, so the terminal never wraps it.
+ * @param line Output of `TERM_PROGRESS_LINE_SIZE` bytes
+ * @return Length of the line in bytes
+ */
+size_t term_progress_internal_line(TerminalProgressBar *bar, char *line, int width) {
+    static const TerminalStyle done_style = {.fg = term_color_basic(2)};
+    static const TerminalStyle todo_style = {.fg = term_color_basic(8)};
+    uint64_t current = atomic_load_explicit(&bar->current, memory_order_relaxed);
+    uint64_t total = atomic_load_explicit(&bar->total, memory_order_relaxed);
+    int finished = atomic_load_explicit(&bar->finished, memory_order_relaxed);
+
+    char done[16], rate[16], eta[32] = "";
+    term_progress_internal_bytes(done, sizeof(done), (double)current);
+    term_progress_internal_bytes(rate, sizeof(rate), finished ? 0 : bar->rate);
+    if (finished) {
+        snprintf(eta, sizeof(eta), "done");
+    }
+    else if (total > current && bar->rate > 0) {
+        uint64_t seconds = (uint64_t)((double)(total - current) / bar->rate);
+        snprintf(eta, sizeof(eta), "%llu:%02llu", (unsigned long long)(seconds / 60), (unsigned long long)(seconds % 60));
+    }
+
+    char tail[64];
+    int tail_len = total > 0
+        ? snprintf(tail, sizeof(tail), " %3d%% %10s %10s/s %6s", (int)(current >= total ? 100 : current * 100 / total), done, rate, eta)
+        : snprintf(tail, sizeof(tail), " %14s %10s/s %6s", done, rate, eta);
+    // Room for the escape sequences and multi-byte labels
+    if (width > TERM_PROGRESS_LINE_SIZE / 2) {
+        width = TERM_PROGRESS_LINE_SIZE / 2;
+    }
+    if (width < 0) {
+        width = 0;
+    }
+    int label_width = width / 4;
+    int bar_width = width - label_width - tail_len - 3;
+    char *p = line + term_progress_internal_label(line, bar->label, label_width);
+    if (bar_width < 0) {
+        int rest = width - label_width < tail_len ? width - label_width : tail_len;
+        memcpy(p, tail, (size_t)rest);
+        return (size_t)(p + rest - line);
+    }
+    int filled = total > 0 ? (int)((double)bar_width * (double)(current < total ? current : total) / (double)total) : 0;
+    if (finished && total == 0) {
+        filled = bar_width;
+    }
+
+    *p++ = ' ';
+    *p++ = '[';
+    const TerminalStyle *pen = &(TerminalStyle) {0};
+    if (filled > 0) {
+        p += term_style_transition(p, pen, &done_style);
+        memset(p, '=', (size_t)filled);
+        p += filled;
+        pen = &done_style;
+    }
+    if (filled < bar_width) {
+        p += term_style_transition(p, pen, &todo_style);
+        memset(p, '-', (size_t)(bar_width - filled));
+        p += bar_width - filled;
+        pen = &todo_style;
+    }
+    p += term_style_transition(p, pen, &(TerminalStyle) {0});
+    *p++ = ']';
+    memcpy(p, tail, (size_t)tail_len);
+    return (size_t)(p + tail_len - line);
+}
+
+#else
+
+int64_t term_progress_internal_now_us(void);
+void term_progress_internal_bytes(char *out, size_t size, double bytes);
+void term_progress_internal_sample(TerminalProgressBar *bar, uint64_t current, int64_t now);
+size_t term_progress_internal_label(char *out, const char *label, int width);
+size_t term_progress_internal_line(TerminalProgressBar *bar, char *line, int width);
+
+#endif
+
+#pragma endregion
+
+#ifdef CLIB_DEFINITIONS
+
+/**
+ * Initialize a progress renderer.
+ * NOTE: Allocates memory! Release it with `term_progress_release`.
+ * @param progress Pointer to a `TerminalProgress` struct
+ * @param max_bars Number of bars that can be added
+ * @param fd Output, e.g. 1 for stdout
+ * @param interval_ms Time between two redraws, 0 = `TERM_PROGRESS_DEFAULT_INTERVAL_MS`
+ * @return 0 on success, -1 on allocation failure
+ */
+int term_progress_init(TerminalProgress *progress, size_t max_bars, int fd, long interval_ms) {
+    *progress = (TerminalProgress) {0};
+    progress->bars = calloc(max_bars, sizeof(TerminalProgressBar));
+    if (progress->bars == NULL || buffer_init(&progress->out, 4096) != BUFFER_ERROR_NONE) {
+        free(progress->bars);
+        *progress = (TerminalProgress) {0};
+        return -1;
+    }
+    progress->cap = max_bars;
+    progress->fd = fd;
+    progress->interval_ms = interval_ms > 0 ? interval_ms : TERM_PROGRESS_DEFAULT_INTERVAL_MS;
+    return 0;
+}
+
+/**
+ * Free all the associated memory of the renderer, stop it first if it was started.
+ * @param progress Pointer to a `TerminalProgress` struct
+ */
+void term_progress_release(TerminalProgress *progress) {
+    free(progress->bars);
+    buffer_release(&progress->out);
+    *progress = (TerminalProgress) {0};
+}
+
+/**
+ * Add a bar, it is drawn below the previous ones.
+ * Only one thread may add bars, the renderer may be running.
+ * @param progress Pointer to a `TerminalProgress` struct
+ * @param label Name of the transfer, e.g. the file name
+ * @param total Expected bytes, 0 if unknown
+ * @return Pointer to the bar, or `NULL` if `max_bars` bars were added
+ */
+TerminalProgressBar *term_progress_add_bar(TerminalProgress *progress, const char *label, uint64_t total) {
+    size_t index = atomic_load_explicit(&progress->len, memory_order_relaxed);
+    if (index == progress->cap) {
+        return NULL;
+    }
+    TerminalProgressBar *bar = &progress->bars[index];
+    snprintf(bar->label, sizeof(bar->label), "%s", label);
+    atomic_store_explicit(&bar->total, total, memory_order_relaxed);
+    // Publish the bar to the renderer
+    atomic_store_explicit(&progress->len, index + 1, memory_order_release);
+    return bar;
+}
+
+#else
+
+int term_progress_init(TerminalProgress *progress, size_t max_bars, int fd, long interval_ms);
+void term_progress_release(TerminalProgress *progress);
+TerminalProgressBar *term_progress_add_bar(TerminalProgress *progress, const char *label, uint64_t total);
+
+#endif
+
+/**
+ * Count bytes of a bar, safe from any thread.
+ * @param bar Pointer to a `TerminalProgressBar`
+ * @param bytes Bytes done since the last call
+ */
+static inline void term_progress_add(TerminalProgressBar *bar, uint64_t bytes) {
+    atomic_fetch_add_explicit(&bar->current, bytes, memory_order_relaxed);
+}
+
+/**
+ * Set the expected bytes of a bar once they are known, e.g. from `Content-Length`.
+ * @param bar Pointer to a `TerminalProgressBar`
+ * @param total Expected bytes
+ */
+static inline void term_progress_set_total(TerminalProgressBar *bar, uint64_t total) {
+    atomic_store_explicit(&bar->total, total, memory_order_relaxed);
+}
+
+/**
+ * Mark a bar as finished, safe from any thread.
+ * @param bar Pointer to a `TerminalProgressBar`
+ */
+static inline void term_progress_finish(TerminalProgressBar *bar) {
+    atomic_store_explicit(&bar->finished, 1, memory_order_relaxed);
+}
+
+#ifdef CLIB_DEFINITIONS
+
+/**
+ * Redraw the bars in a single write.
+ * The cursor is left below the last bar, anything else printed meanwhile would be overwritten.
+ * Call this from a single thread only, or use `term_progress_start`.
+ * @param progress Pointer to a `TerminalProgress` struct
+ * @param force Redraw even if the interval has not passed since the last redraw
+ * @return 0 on success, -1 if the output could not be written
+ */
+int term_progress_render(TerminalProgress *progress, int force) {
+    int64_t now = term_progress_internal_now_us();
+    if (!force && now - progress->last_render_us < progress->interval_ms * 1000) {
+        return 0;
+    }
+    progress->last_render_us = now;
+    size_t len = atomic_load_explicit(&progress->len, memory_order_acquire);
+    int width = term_get_dimensions().cols - 1;
+
+    Buffer *out = &progress->out;
+    int changed = len != progress->lines_drawn;
+    buffer_clear(out);
+    if (progress->lines_drawn > 0) {
+        // Back to the first bar
+        buffer_write_bytes(out, "\033[", 2);
+        term_frame_internal_number(out, (int)progress->lines_drawn);
+        buffer_write_byte(out, 'A');
+    }
+    for (size_t i = 0; i < len; i += 1) {
+        TerminalProgressBar *bar = &progress->bars[i];
+        term_progress_internal_sample(bar, atomic_load_explicit(&bar->current, memory_order_relaxed), now);
+        char line[TERM_PROGRESS_LINE_SIZE];
+        size_t line_len = term_progress_internal_line(bar, line, width);
+        if (i < progress->lines_drawn && line_len == bar->line_len && memcmp(line, bar->line, line_len) == 0) {
+            buffer_write_byte(out, '\n');
+            continue;
+        }
+        memcpy(bar->line, line, line_len);
+        bar->line_len = line_len;
+        changed = 1;
+        buffer_write_byte(out, '\r');
+        buffer_write_bytes(out, line, line_len);
+        buffer_write_bytes(out, "\033[K\n", 4);
+    }
+    progress->lines_drawn = len;
+    if (!changed) {
+        return 0;
+    }
+    if (out->ptr == NULL) {
+        return -1;
+    }
+    return term_frame_internal_write(progress->fd, out->ptr, out->len);
+}
+
+#else
+
+int term_progress_render(TerminalProgress *progress, int force);
+
+#endif
+
+#ifndef _WIN32
+#ifdef CLIB_DEFINITIONS
+
+void *term_progress_internal_thread(void *argument) {
+    TerminalProgress *progress = argument;
+    struct timespec interval = {.tv_sec = progress->interval_ms / 1000, .tv_nsec = progress->interval_ms % 1000 * 1000000L};
+    while (atomic_load(&progress->running)) {
+        nanosleep(&interval, NULL);
+        term_progress_render(progress, 1);
+    }
+    return NULL;
+}
+
+/**
+ * Start a thread that redraws the bars every `interval_ms`.
+ * @param progress Pointer to a `TerminalProgress` struct
+ * @return 0 on success, -1 if the thread could not be started
+ */
+int term_progress_start(TerminalProgress *progress) {
+    atomic_store(&progress->running, 1);
+    if (pthread_create(&progress->thread, NULL, term_progress_internal_thread, progress) != 0) {
+        atomic_store(&progress->running, 0);
+        return -1;
+    }
+    return 0;
+}
+
+/**
+ * Stop the redraw thread and draw the final state of the bars.
+ * @param progress Pointer to a `TerminalProgress` struct
+ */
+void term_progress_stop(TerminalProgress *progress) {
+    if (atomic_exchange(&progress->running, 0)) {
+        pthread_join(progress->thread, NULL);
+    }
+    term_progress_render(progress, 1);
+}
+
+#else
+
+void *term_progress_internal_thread(void *argument);
+int term_progress_start(TerminalProgress *progress);
+void term_progress_stop(TerminalProgress *progress);
+
+#endif
+#endif
+
+#endif
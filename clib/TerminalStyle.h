@@ -0,0 +1,271 @@
+#ifndef TERMINAL_STYLE_H
+#define TERMINAL_STYLE_H
+
+/**
+ * Text style with SGR state tracking.
+ * The terminal keeps the active style between sequences, so going from one style to the next
+ * only needs the attributes and colors that differ, packed into a single `ESC[...m`.
+ * Sequences are assembled from precomputed byte strings, no format parsing.
+ *
+ * Reference:
+ *  - SGR parameters: https://en.wikipedia.org/wiki/ANSI_escape_code#SGR_(Select_Graphic_Rendition)_parameters
+ */
+
+#ifndef _STDINT_H
+#include <stdint.h>
+#endif
+
+#ifndef _INC_STDIO
+#include <stdio.h>
+#endif
+
+#ifndef _INC_STRING
+#include <string.h>
+#endif
+
+#include "Clib.h"
+#include "Buffer.h"
+
+#define TERM_ATTR_BOLD          0x01
+#define TERM_ATTR_DIM           0x02
+#define TERM_ATTR_ITALIC        0x04
+#define TERM_ATTR_UNDERLINE     0x08
+#define TERM_ATTR_BLINKING      0x10
+#define TERM_ATTR_INVERSE       0x20
+#define TERM_ATTR_HIDDEN        0x40
+#define TERM_ATTR_STRIKETHROUGH 0x80
+
+/**
+ * A color, the kind is in the high byte.
+ * Build colors with the macros below, 0 is the terminal's default color.
+ */
+typedef uint32_t TerminalColor;
+
+#define TERM_COLOR_DEFAULT 0
+
+/**
+ * One of the 16 basic colors: 0 black, 1 red, 2 green, 3 yellow, 4 blue, 5 magenta, 6 cyan, 7 white,
+ * 8-15 are their bright versions.
+ */
+#define term_color_basic(N) ((TerminalColor)(0x01000000u | ((N) & 0x0F)))
+
+/**
+ * One of the 256 indexed colors.
+ */
+#define term_color_256(N) ((TerminalColor)(0x02000000u | ((N) & 0xFF)))
+
+/**
+ * A 24-bit truecolor.
+ */
+#define term_color_rgb(R, G, B) ((TerminalColor)(0x03000000u | ((R) & 0xFF) << 16 | ((G) & 0xFF) << 8 | ((B) & 0xFF)))
+
+typedef struct TerminalStyle {
+    TerminalColor fg, bg;
+    uint8_t attrs; // `TERM_ATTR_*` flags
+} TerminalStyle;
+
+/**
+ * Longest sequence a transition can produce, including `ESC[` and `m`.
+ */
+#define TERM_STYLE_SEQUENCE_SIZE 96
+
+#pragma region Internals
+
+/**
+ * "000" to "255", the digits of `n` start at `3 * n + 3 - term_style_internal_digits(n)`.
+ */
+static const char term_style_internal_decimal[] =
+    "000001002003004005006007008009010011012013014015016017018019020021022023024025026027028029030031"
+    "032033034035036037038039040041042043044045046047048049050051052053054055056057058059060061062063"
+    "064065066067068069070071072073074075076077078079080081082083084085086087088089090091092093094095"
+    "096097098099100101102103104105106107108109110111112113114115116117118119120121122123124125126127"
+    "128129130131132133134135136137138139140141142143144145146147148149150151152153154155156157158159"
+    "160161162163164165166167168169170171172173174175176177178179180181182183184185186187188189190191"
+    "192193194195196197198199200201202203204205206207208209210211212213214215216217218219220221222223"
+    "224225226227228229230231232233234235236237238239240241242243244245246247248249250251252253254255";
+
+static const char term_style_internal_set_codes[8] = {'1', '2', '3', '4', '5', '7', '8', '9'};
+static const char term_style_internal_reset_codes[8][2] = {
+    {'2', '2'}, {'2', '2'}, {'2', '3'}, {'2', '4'}, {'2', '5'}, {'2', '7'}, {'2', '8'}, {'2', '9'},
+};
+
+static inline int term_style_internal_digits(unsigned n) {
+    return n < 10 ? 1 : n < 100 ? 2 : 3;
+}
+
+/**
+ * Append `;` (unless `p` is at `start`) and a number from 0 to 255.
+ * @return The end of the output
+ */
+static inline char *term_style_internal_number(char *p, const char *start, unsigned n) {
+    int digits = term_style_internal_digits(n);
+    if (p != start) {
+        *p++ = ';';
+    }
+    memcpy(p, term_style_internal_decimal + 3 * n + 3 - digits, (size_t)digits);
+    return p + digits;
+}
+
+#ifdef CLIB_DEFINITIONS
+
+/**
+ * Append the parameters of a foreground or background color.
+ * @return The end of the output
+ */
+char *term_style_internal_color(char *p, const char *start, TerminalColor color, int background) {
+    unsigned value = color & 0xFFFFFF;
+    switch (color >> 24) {
+        case 1: // 30-37, 90-97 and 40-47, 100-107
+            return term_style_internal_number(p, start, (value < 8 ? 30 : 82) + value + (background ? 10 : 0));
+        case 2:
+            p = term_style_internal_number(p, start, background ? 48 : 38);
+            p = term_style_internal_number(p, start, 5);
+            return term_style_internal_number(p, start, value);
+        case 3:
+            p = term_style_internal_number(p, start, background ? 48 : 38);
+            p = term_style_internal_number(p, start, 2);
+            p = term_style_internal_number(p, start, value >> 16);
+            p = term_style_internal_number(p, start, value >> 8 & 0xFF);
+            return term_style_internal_number(p, start, value & 0xFF);
+        default:
+            return term_style_internal_number(p, start, background ? 49 : 39);
+    }
+}
+
+char *term_style_internal_set(char *p, const char *start, uint8_t attrs) {
+    for (int i = 0; i < 8; i += 1) {
+        if (attrs & 1 << i) {
+            if (p != start) {
+                *p++ = ';';
+            }
+            *p++ = term_style_internal_set_codes[i];
+        }
+    }
+    return p;
+}
+
+#else
+
+char *term_style_internal_color(char *p, const char *start, TerminalColor color, int background);
+char *term_style_internal_set(char *p, const char *start, uint8_t attrs);
+
+#endif
+
+#pragma endregion
+
+#ifdef CLIB_DEFINITIONS
+
+/**
+ * Build the shortest SGR sequence that switches the terminal from `current` to `next`.
+ * Either only the differences are sent, or a reset followed by the whole new style, whichever is shorter.
+ * @param sequence Output of at least `TERM_STYLE_SEQUENCE_SIZE` bytes, not null terminated
+ * @param current The active style
+ * @param next The wanted style
+ * @return Length of the sequence, 0 if the styles are the same
+ */
+size_t term_style_transition(char *sequence, const TerminalStyle *current, const TerminalStyle *next) {
+    if (current->fg == next->fg && current->bg == next->bg && current->attrs == next->attrs) {
+        return 0;
+    }
+    // Parameters of both candidates, without `ESC[` and `m`
+    char changes[TERM_STYLE_SEQUENCE_SIZE] = {0}, reset[TERM_STYLE_SEQUENCE_SIZE] = {0};
+    char *p = changes;
+    uint8_t removed = current->attrs & ~next->attrs;
+    uint8_t added = next->attrs & ~current->attrs;
+    if (removed & (TERM_ATTR_BOLD | TERM_ATTR_DIM)) {
+        // 22 turns off both bold and dim
+        p = term_style_internal_number(p, changes, 22);
+        removed &= ~(TERM_ATTR_BOLD | TERM_ATTR_DIM);
+        added |= next->attrs & (TERM_ATTR_BOLD | TERM_ATTR_DIM);
+    }
+    for (int i = 2; i < 8; i += 1) {
+        if (removed & 1 << i) {
+            if (p != changes) {
+                *p++ = ';';
+            }
+            memcpy(p, term_style_internal_reset_codes[i], 2);
+            p += 2;
+        }
+    }
+    p = term_style_internal_set(p, changes, added);
+    if (current->fg != next->fg) {
+        p = term_style_internal_color(p, changes, next->fg, 0);
+    }
+    if (current->bg != next->bg) {
+        p = term_style_internal_color(p, changes, next->bg, 1);
+    }
+    size_t changes_len = (size_t)(p - changes);
+
+    // An empty parameter list is a reset
+    p = reset;
+    p = term_style_internal_set(p, reset, next->attrs);
+    if (next->fg != TERM_COLOR_DEFAULT) {
+        p = term_style_internal_color(p, reset, next->fg, 0);
+    }
+    if (next->bg != TERM_COLOR_DEFAULT) {
+        p = term_style_internal_color(p, reset, next->bg, 1);
+    }
+    size_t reset_len = (size_t)(p - reset);
+    size_t length;
+    sequence[0] = '\033';
+    sequence[1] = '[';
+    if (reset_len == 0) {
+        length = 0;
+    }
+    else if (reset_len + 2 <= changes_len) {
+        // "0;" first
+        sequence[2] = '0';
+        sequence[3] = ';';
+        memcpy(sequence + 4, reset, reset_len);
+        length = reset_len + 2;
+    }
+    else {
+        memcpy(sequence + 2, changes, changes_len);
+        length = changes_len;
+    }
+    sequence[2 + length] = 'm';
+    return length + 3;
+}
+
+/**
+ * Append the transition from `current` to `next` to a buffer and track the new style.
+ * NOTE: Allocates memory!
+ * @param buf Pointer to a `Buffer` struct
+ * @param current The style the terminal shows, updated to `next`
+ * @param next The wanted style
+ * @return `BufferError` (errors are non-zero).
+ */
+BufferError term_style_write(Buffer *buf, TerminalStyle *current, const TerminalStyle *next) {
+    char sequence[TERM_STYLE_SEQUENCE_SIZE];
+    size_t length = term_style_transition(sequence, current, next);
+    if (length == 0) {
+        return BUFFER_ERROR_NONE;
+    }
+    *current = *next;
+    return buffer_write_bytes(buf, sequence, length);
+}
+
+/**
+ * Print the transition from `current` to `next` to stdout and track the new style.
+ * Replaces a row of `term_color_set`/`term_graphics_*_set` calls with at most one sequence.
+ * @param current The style the terminal shows, updated to `next`
+ * @param next The wanted style
+ */
+void term_style_set(TerminalStyle *current, const TerminalStyle *next) {
+    char sequence[TERM_STYLE_SEQUENCE_SIZE];
+    size_t length = term_style_transition(sequence, current, next);
+    if (length > 0) {
+        fwrite(sequence, 1, length, stdout);
+        *current = *next;
+    }
+}
+
+#else
+
+size_t term_style_transition(char *sequence, const TerminalStyle *current, const TerminalStyle *next);
+BufferError term_style_write(Buffer *buf, TerminalStyle *current, const TerminalStyle *next);
+void term_style_set(TerminalStyle *current, const TerminalStyle *next);
+
+#endif
+
+#endif
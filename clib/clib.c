@@ -0,0 +1,17 @@
+/**
+ * Implementation of the core headers for the library mode, see `Clib.h`.
+ * Build it with `make lib`, programs define `CLIB_DECLARATIONS_ONLY` and link `libclib.a`.
+ */
+
+#define CLIB_IMPLEMENTATION
+
+#include "Alloc.h"
+#include "Buffer.h"
+#include "Json.h"
+#include "Mime.h"
+#include "Slice.h"
+#include "String.h"
+#include "Terminal.h"
+#include "TerminalFrame.h"
+#include "TerminalProgress.h"
+#include "TerminalStyle.h"
@@ -0,0 +1,79 @@
+#ifndef TEST_H
+#define TEST_H
+
+/**
+ * Minimal test harness of the test programs in this directory.
+ * A failed check prints its location and the test goes on, the program exits with 1 if any check failed.
+ *
+ *   void test_insert(void) {
+ *       TEST_CHECK(string.len == 3);
+ *   }
+ *
+ *   int main(void) {
+ *       TEST_RUN(test_insert);
+ *       return test_report();
+ *   }
+ */
+
+#ifndef _INC_STDIO
+#include <stdio.h>
+#endif
+
+#ifndef _INC_STRING
+#include <string.h>
+#endif
+
+static int test_internal_failed_checks;
+static int test_internal_failed_tests;
+static int test_internal_tests;
+
+/**
+ * Check a condition, print it with its location if it does not hold.
+ */
+#define TEST_CHECK(Condition) \
+    do { \
+        if (!(Condition)) { \
+            fprintf(stderr, "    %s:%d: check failed: %s\n", __FILE__, __LINE__, #Condition); \
+            test_internal_failed_checks += 1; \
+        } \
+    } while (0)
+
+/**
+ * Check that two null terminated strings are equal, print both if not.
+ */
+#define TEST_CHECK_STRING(Actual, Expected) \
+    do { \
+        const char *test_actual = (Actual), *test_expected = (Expected); \
+        if (test_actual == NULL || strcmp(test_actual, test_expected) != 0) { \
+            fprintf(stderr, "    %s:%d: %s is \"%s\", expected \"%s\"\n", __FILE__, __LINE__, #Actual, \
+                test_actual != NULL ? test_actual : "(null)", test_expected); \
+            test_internal_failed_checks += 1; \
+        } \
+    } while (0)
+
+/**
+ * Run a `void (void)` test function and report it.
+ */
+#define TEST_RUN(Function) test_internal_run(#Function, Function)
+
+static inline void test_internal_run(const char *name, void (*function)(void)) {
+    int failed = test_internal_failed_checks;
+    fprintf(stderr, "%s\n", name);
+    function();
+    test_internal_tests += 1;
+    if (test_internal_failed_checks != failed) {
+        test_internal_failed_tests += 1;
+        fprintf(stderr, "  FAILED\n");
+    }
+}
+
+/**
+ * Print the summary.
+ * @return The exit code of the test program, 1 if a check failed
+ */
+static inline int test_report(void) {
+    fprintf(stderr, "%d of %d tests passed\n", test_internal_tests - test_internal_failed_tests, test_internal_tests);
+    return test_internal_failed_tests == 0 ? 0 : 1;
+}
+
+#endif
@@ -0,0 +1,572 @@
+/**
+ * Tests of the core and terminal headers, no network or terminal is needed.
+ *
+ * Build and run with `make test`, or:
+ *   gcc -O2 -I clib -I tests tests/core_test.c -o core_test -lpthread -lm && ./core_test
+ */
+
+#ifndef _STDINT_H
+#include <stdint.h>
+#endif
+
+#ifndef _INC_STDLIB
+#include <stdlib.h>
+#endif
+
+#include <fcntl.h>
+#include <locale.h>
+#include <signal.h>
+#include <unistd.h>
+
+#include "Test.h"
+#include "Json.h"
+#include "Slice.h"
+#include "String.h"
+#include "TerminalFrame.h"
+#include "TerminalProgress.h"
+#include "TerminalStyle.h"
+
+/**
+ * Deterministic pseudo-random numbers, the same sequence on every platform.
+ */
+static uint64_t test_random_state = 0x9E3779B97F4A7C15u;
+
+uint32_t test_random(void) {
+    test_random_state ^= test_random_state << 13;
+    test_random_state ^= test_random_state >> 7;
+    test_random_state ^= test_random_state << 17;
+    return (uint32_t)(test_random_state >> 16);
+}
+
+#pragma region String
+
+void test_string_insert(void) {
+    String string = string_make(4);
+    string_append_string(&string, "abc");
+    string_insert_string(&string, 1, "XY");
+    TEST_CHECK_STRING(string.ptr, "aXYbc");
+    TEST_CHECK(string.len == 5);
+
+    // An empty insert used to loop forever at index 0
+    string_insert_string(&string, 0, "");
+    string_insert_string(&string, 4, "");
+    TEST_CHECK_STRING(string.ptr, "aXYbc");
+    TEST_CHECK(string.len == 5);
+
+    string_insert_string(&string, 0, "--");
+    TEST_CHECK_STRING(string.ptr, "--aXYbc");
+    string_release(&string);
+}
+
+#pragma endregion
+
+#pragma region Slice
+
+void test_slice_search(void) {
+    char text[] = "hello world!";
+    Slice slice = slice_from(text, 2, 11);
+
+    // The suffix used to be indexed with the slice's offset
+    TEST_CHECK(slice_has_suffix(&slice, "world"));
+    TEST_CHECK(slice_has_suffix(&slice, "d"));
+    TEST_CHECK(slice_has_suffix(&slice, "llo world"));
+    TEST_CHECK(!slice_has_suffix(&slice, "world!"));
+    TEST_CHECK(!slice_has_suffix(&slice, "worle"));
+    TEST_CHECK(!slice_has_suffix(&slice, "hello world"));
+
+    // Matches used to be found at offset 0 only
+    TEST_CHECK(slice_has_string(&slice, "llo"));
+    TEST_CHECK(slice_has_string(&slice, "o w"));
+    TEST_CHECK(slice_has_string(&slice, "world"));
+    TEST_CHECK(!slice_has_string(&slice, "hello"));
+    TEST_CHECK(!slice_has_string(&slice, "world!"));
+    TEST_CHECK(!slice_has_string(&slice, "ldx"));
+}
+
+#pragma endregion
+
+#pragma region Json
+
+/**
+ * Byte by byte escaping, what the SIMD scan of `json_escape` must match.
+ */
+void test_json_reference_escape(Buffer *buf, const char *s, size_t n) {
+    static const char hex[] = "0123456789abcdef";
+    for (size_t i = 0; i < n; i += 1) {
+        unsigned char c = (unsigned char)s[i];
+        const char *short_escape = NULL;
+        switch (c) {
+            case '"':  short_escape = "\\\""; break;
+            case '\\': short_escape = "\\\\"; break;
+            case '\b': short_escape = "\\b";  break;
+            case '\f': short_escape = "\\f";  break;
+            case '\n': short_escape = "\\n";  break;
+            case '\r': short_escape = "\\r";  break;
+            case '\t': short_escape = "\\t";  break;
+        }
+        if (short_escape != NULL) {
+            buffer_write_bytes(buf, short_escape, 2);
+        }
+        else if (c < 0x20) {
+            char escape[6] = {'\\', 'u', '0', '0', hex[c >> 4], hex[c & 0xF]};
+            buffer_write_bytes(buf, escape, sizeof(escape));
+        }
+        else {
+            buffer_write_byte(buf, (char)c);
+        }
+    }
+}
+
+/**
+ * Escape `s` both ways and compare.
+ * @return 1 if the outputs are equal
+ */
+int test_json_escape_matches(const char *s, size_t n) {
+    Buffer actual = buffer_make(16), expected = buffer_make(16);
+    json_escape(&actual, s, n);
+    test_json_reference_escape(&expected, s, n);
+    int same = actual.len == expected.len && memcmp(actual.ptr, expected.ptr, actual.len) == 0;
+    buffer_release(&actual);
+    buffer_release(&expected);
+    return same;
+}
+
+void test_json_escape(void) {
+    // A single special byte at every position of strings that span several 16 and 32 byte blocks,
+    // next to bytes the unsigned control check must let through (0x7F, 0x80, 0xFF)
+    static const unsigned char specials[] = {'"', '\\', 0x00, 0x01, '\n', 0x1F};
+    static const unsigned char clean[] = {'a', ' ', 0x7F, 0x80, 0xC3, 0xFF};
+    char s[100];
+    int failures = 0;
+    for (size_t n = 0; n <= sizeof(s); n += 1) {
+        for (size_t c = 0; c < sizeof(clean); c += 1) {
+            memset(s, clean[c], n);
+            failures += !test_json_escape_matches(s, n);
+            for (size_t at = 0; at < n; at += 1) {
+                for (size_t k = 0; k < sizeof(specials); k += 1) {
+                    s[at] = (char)specials[k];
+                    failures += !test_json_escape_matches(s, n);
+                }
+                s[at] = (char)clean[c];
+            }
+        }
+    }
+    TEST_CHECK(failures == 0);
+
+    // Random bytes, mostly clean, with long runs between the escapes
+    char random[4096];
+    for (int round = 0; round < 200; round += 1) {
+        size_t n = test_random() % sizeof(random);
+        for (size_t i = 0; i < n; i += 1) {
+            uint32_t r = test_random();
+            random[i] = r % 64 == 0 ? (char)(r >> 8 & 0x1F) : r % 64 == 1 ? '"' : (char)(0x20 + (r >> 8) % 0xE0);
+        }
+        failures += !test_json_escape_matches(random, n);
+    }
+    TEST_CHECK(failures == 0);
+}
+
+void test_json_writer(void) {
+    Buffer buf = buffer_make(16);
+    JsonWriter json = json_writer_make(&buf);
+    json_object_begin(&json);
+    json_write_key(&json, "id");
+    json_write_int(&json, -42);
+    json_write_key(&json, "tags");
+    json_array_begin(&json);
+    json_write_string(&json, "a\"b");
+    json_write_bool(&json, 1);
+    json_write_null(&json);
+    json_write_fixed(&json, 2.5, 2);
+    json_write_double(&json, 0.1);
+    json_array_end(&json);
+    json_write_key(&json, "empty");
+    json_object_begin(&json);
+    json_object_end(&json);
+    json_object_end(&json);
+    TEST_CHECK_STRING(buf.ptr, "{\"id\":-42,\"tags\":[\"a\\\"b\",true,null,2.50,0.1],\"empty\":{}}\n");
+
+    // A value where a key is expected
+    buffer_clear(&buf);
+    json_object_begin(&json);
+    TEST_CHECK(json_write_int(&json, 1) == BUFFER_ERROR_INVALID_FORMAT);
+    buffer_release(&buf);
+}
+
+void test_json_double_locale(void) {
+    static const char *locales[] = {"de_DE.UTF-8", "de_DE.utf8", "de_DE", "fr_FR.UTF-8", "fr_FR.utf8", "fr_FR"};
+    const char *locale = NULL;
+    for (size_t i = 0; i < sizeof(locales) / sizeof(*locales) && locale == NULL; i += 1) {
+        if (setlocale(LC_NUMERIC, locales[i]) != NULL && strcmp(localeconv()->decimal_point, ",") == 0) {
+            locale = locales[i];
+        }
+    }
+    if (locale == NULL) {
+        setlocale(LC_NUMERIC, "C");
+        fprintf(stderr, "    skipped, no locale with a decimal comma is installed\n");
+        return;
+    }
+
+    // The locale writes "0,1", JSON needs "0.1"
+    Buffer buf = buffer_make(16);
+    JsonWriter json = json_writer_make(&buf);
+    json_array_begin(&json);
+    json_write_double(&json, 0.1);
+    json_write_double(&json, -2.5e-7);
+    json_write_double(&json, 1234.5678);
+    json_array_end(&json);
+    TEST_CHECK_STRING(buf.ptr, "[0.1,-2.5e-07,1234.5678]\n");
+    TEST_CHECK(strlen(buf.ptr) == buf.len);
+    buffer_release(&buf);
+    setlocale(LC_NUMERIC, "C");
+}
+
+#pragma endregion
+
+#pragma region Terminal
+
+/**
+ * Apply the parameters of an SGR sequence to a style, the way a terminal does.
+ * @return 0 on success, -1 for parameters the transitions never produce
+ */
+int test_sgr_apply(TerminalStyle *style, const char *params, size_t length) {
+    int values[TERM_STYLE_SEQUENCE_SIZE];
+    int count = 0, value = 0;
+    for (size_t i = 0; i <= length; i += 1) {
+        if (i == length || params[i] == ';') {
+            values[count++] = value;
+            value = 0;
+        }
+        else {
+            value = value * 10 + params[i] - '0';
+        }
+    }
+    if (length == 0) {
+        *style = (TerminalStyle) {0};
+        return 0;
+    }
+    static const uint8_t set[10] = {0, TERM_ATTR_BOLD, TERM_ATTR_DIM, TERM_ATTR_ITALIC, TERM_ATTR_UNDERLINE,
+        TERM_ATTR_BLINKING, 0, TERM_ATTR_INVERSE, TERM_ATTR_HIDDEN, TERM_ATTR_STRIKETHROUGH};
+    for (int i = 0; i < count; i += 1) {
+        int v = values[i];
+        if (v == 0) {
+            *style = (TerminalStyle) {0};
+        }
+        else if (v >= 1 && v <= 9 && set[v] != 0) {
+            style->attrs |= set[v];
+        }
+        else if (v == 22) {
+            style->attrs &= (uint8_t)~(TERM_ATTR_BOLD | TERM_ATTR_DIM);
+        }
+        else if (v >= 23 && v <= 29 && set[v - 20] != 0) {
+            style->attrs &= (uint8_t)~set[v - 20];
+        }
+        else if ((v >= 30 && v <= 37) || (v >= 90 && v <= 97)) {
+            style->fg = term_color_basic(v < 90 ? v - 30 : v - 82);
+        }
+        else if ((v >= 40 && v <= 47) || (v >= 100 && v <= 107)) {
+            style->bg = term_color_basic(v < 100 ? v - 40 : v - 92);
+        }
+        else if (v == 39 || v == 49) {
+            *(v == 39 ? &style->fg : &style->bg) = TERM_COLOR_DEFAULT;
+        }
+        else if ((v == 38 || v == 48) && i + 2 < count && values[i + 1] == 5) {
+            *(v == 38 ? &style->fg : &style->bg) = term_color_256(values[i + 2]);
+            i += 2;
+        }
+        else if ((v == 38 || v == 48) && i + 4 < count && values[i + 1] == 2) {
+            *(v == 38 ? &style->fg : &style->bg) = term_color_rgb(values[i + 2], values[i + 3], values[i + 4]);
+            i += 4;
+        }
+        else {
+            return -1;
+        }
+    }
+    return 0;
+}
+
+TerminalColor test_random_color(void) {
+    switch (test_random() % 4) {
+        case 0: return TERM_COLOR_DEFAULT;
+        case 1: return term_color_basic(test_random() % 16);
+        case 2: return term_color_256(test_random() % 256);
+        default: return term_color_rgb(test_random() % 256, test_random() % 256, test_random() % 256);
+    }
+}
+
+TerminalStyle test_random_style(void) {
+    return (TerminalStyle) {
+        .fg = test_random_color(),
+        .bg = test_random_color(),
+        .attrs = (uint8_t)test_random(),
+    };
+}
+
+static inline int test_same_style(const TerminalStyle *a, const TerminalStyle *b) {
+    return a->fg == b->fg && a->bg == b->bg && a->attrs == b->attrs;
+}
+
+void test_style_transition(void) {
+    char sequence[TERM_STYLE_SEQUENCE_SIZE];
+    TerminalStyle plain = {0}, bold_red = {.fg = term_color_basic(1), .attrs = TERM_ATTR_BOLD};
+    size_t length = term_style_transition(sequence, &plain, &bold_red);
+    TEST_CHECK(length == 7 && memcmp(sequence, "\033[1;31m", 7) == 0);
+    length = term_style_transition(sequence, &bold_red, &plain);
+    TEST_CHECK(length == 3 && memcmp(sequence, "\033[m", 3) == 0);
+    TEST_CHECK(term_style_transition(sequence, &bold_red, &bold_red) == 0);
+
+    // Every transition must leave a terminal in the wanted style
+    int wrong = 0, unknown = 0;
+    for (int i = 0; i < 20000; i += 1) {
+        TerminalStyle current = test_random_style(), next = test_random_style();
+        if (i % 4 == 0) {
+            next = current;
+            next.attrs ^= (uint8_t)(1 << test_random() % 8);
+        }
+        length = term_style_transition(sequence, &current, &next);
+        if (length == 0) {
+            wrong += !test_same_style(&current, &next);
+            continue;
+        }
+        if (length > TERM_STYLE_SEQUENCE_SIZE || memcmp(sequence, "\033[", 2) != 0 || sequence[length - 1] != 'm') {
+            wrong += 1;
+            continue;
+        }
+        TerminalStyle terminal = current;
+        unknown += test_sgr_apply(&terminal, sequence + 2, length - 3) != 0;
+        wrong += !test_same_style(&terminal, &next);
+    }
+    TEST_CHECK(unknown == 0);
+    TEST_CHECK(wrong == 0);
+}
+
+#define TEST_SCREEN_ROWS 6
+#define TEST_SCREEN_COLS 20
+
+/**
+ * A terminal emulator that understands the output of `term_frame_present`.
+ */
+typedef struct TestScreen {
+    TerminalCell cells[TEST_SCREEN_ROWS][TEST_SCREEN_COLS];
+    int row, col;
+    TerminalStyle pen;
+    int errors; // Sequences the frame should not produce, or writes outside of the screen
+} TestScreen;
+
+void test_screen_put(TestScreen *screen, uint32_t codepoint) {
+    if (screen->col >= TEST_SCREEN_COLS) {
+        screen->col = 0;
+        screen->row += 1;
+    }
+    if (screen->row < 0 || screen->row >= TEST_SCREEN_ROWS || screen->col < 0) {
+        screen->errors += 1;
+        return;
+    }
+    screen->cells[screen->row][screen->col] = (TerminalCell) {.codepoint = codepoint, .style = screen->pen};
+    screen->col += 1;
+}
+
+void test_screen_feed(TestScreen *screen, const char *data, size_t length) {
+    size_t i = 0;
+    while (i < length) {
+        char c = data[i];
+        if (c == '\r') {
+            screen->col = 0;
+            i += 1;
+        }
+        else if (c == '\n') {
+            screen->row += 1;
+            i += 1;
+        }
+        else if (c == '\033' && i + 1 < length && data[i + 1] == '[') {
+            size_t start = i + 2, end = start;
+            while (end < length && ((data[end] >= '0' && data[end] <= '9') || data[end] == ';')) {
+                end += 1;
+            }
+            if (end == length) {
+                screen->errors += 1;
+                return;
+            }
+            int first = atoi(data + start), second = 1;
+            const char *semicolon = memchr(data + start, ';', end - start);
+            if (semicolon != NULL) {
+                second = atoi(semicolon + 1);
+            }
+            switch (data[end]) {
+                case 'm':
+                    screen->errors += test_sgr_apply(&screen->pen, data + start, end - start) != 0;
+                    break;
+                case 'H':
+                    screen->row = end == start ? 0 : first - 1;
+                    screen->col = end == start ? 0 : second - 1;
+                    break;
+                case 'C':
+                    screen->col += end == start ? 1 : first;
+                    break;
+                case 'J':
+                    for (int r = 0; r < TEST_SCREEN_ROWS; r += 1) {
+                        for (int col = 0; col < TEST_SCREEN_COLS; col += 1) {
+                            screen->cells[r][col] = (TerminalCell) {.codepoint = ' ', .style = {.bg = screen->pen.bg}};
+                        }
+                    }
+                    break;
+                case 'K':
+                    for (int col = screen->col; col < TEST_SCREEN_COLS; col += 1) {
+                        screen->cells[screen->row][col] = (TerminalCell) {.codepoint = ' ', .style = {.bg = screen->pen.bg}};
+                    }
+                    break;
+                default:
+                    screen->errors += 1;
+            }
+            i = end + 1;
+        }
+        else {
+            uint32_t codepoint;
+            i += term_frame_internal_decode(data + i, &codepoint);
+            test_screen_put(screen, codepoint);
+        }
+    }
+}
+
+/**
+ * @return Number of cells where the emulated screen differs from the frame's back grid
+ */
+int test_screen_compare(TestScreen *screen, TerminalFrame *frame) {
+    int different = 0;
+    for (int row = 0; row < TEST_SCREEN_ROWS; row += 1) {
+        for (int col = 0; col < TEST_SCREEN_COLS; col += 1) {
+            const TerminalCell *a = &screen->cells[row][col], *b = &frame->back[row * frame->cols + col];
+            different += a->codepoint != b->codepoint || !test_same_style(&a->style, &b->style);
+        }
+    }
+    return different;
+}
+
+void test_frame_diff(void) {
+    static const char *words[] = {"a", "hello", "  ", "\xC3\xA9t\xC3\xA9", "\xE2\x96\x88\xE2\x96\x88", "xyz", "0123456789"};
+    TerminalFrame frame;
+    TestScreen screen = {0};
+    int null_fd = open("/dev/null", O_WRONLY);
+    TEST_CHECK(null_fd >= 0);
+    TEST_CHECK(term_frame_init(&frame, TEST_SCREEN_ROWS, TEST_SCREEN_COLS) == 0);
+
+    term_frame_print(&frame, 1, 2, "status", (TerminalStyle) {.attrs = TERM_ATTR_BOLD});
+    TEST_CHECK(term_frame_present(&frame, null_fd) == 0);
+    TEST_CHECK(frame.out.len >= 11 && memcmp(frame.out.ptr, "\033[0m\033[H\033[2J", 11) == 0);
+    test_screen_feed(&screen, frame.out.ptr, frame.out.len);
+    TEST_CHECK(test_screen_compare(&screen, &frame) == 0);
+
+    // Nothing changed, nothing is written
+    TEST_CHECK(term_frame_present(&frame, null_fd) == 0);
+    TEST_CHECK(frame.out.len == 0);
+
+    // A single changed cell is a cursor move and the character
+    term_frame_print(&frame, 1, 4, "A", (TerminalStyle) {.attrs = TERM_ATTR_BOLD});
+    TEST_CHECK(term_frame_present(&frame, null_fd) == 0);
+    TEST_CHECK(frame.out.len > 0 && frame.out.len <= 8);
+    test_screen_feed(&screen, frame.out.ptr, frame.out.len);
+    TEST_CHECK(test_screen_compare(&screen, &frame) == 0);
+
+    // Random edits on top of the previous frame
+    int different = 0;
+    for (int round = 0; round < 2000; round += 1) {
+        if (round % 50 == 0) {
+            term_frame_clear(&frame);
+        }
+        int edits = 1 + test_random() % 6;
+        for (int e = 0; e < edits; e += 1) {
+            TerminalStyle style = test_random() % 2 ? (TerminalStyle) {0} : test_random_style();
+            int row = test_random() % TEST_SCREEN_ROWS, col = test_random() % TEST_SCREEN_COLS;
+            term_frame_print(&frame, row, col, words[test_random() % (sizeof(words) / sizeof(*words))], style);
+        }
+        if (term_frame_present(&frame, null_fd) != 0) {
+            different += 1;
+            break;
+        }
+        test_screen_feed(&screen, frame.out.ptr, frame.out.len);
+        different += test_screen_compare(&screen, &frame);
+    }
+    TEST_CHECK(different == 0);
+    TEST_CHECK(screen.errors == 0);
+
+    term_frame_release(&frame);
+    close(null_fd);
+}
+
+void test_progress_line(void) {
+    TerminalProgressBar bar = {.current = 300, .total = 1000};
+    char line[TERM_PROGRESS_LINE_SIZE];
+    snprintf(bar.label, sizeof(bar.label), "\xC3\xA9t\xC3\xA9-\xE2\x96\x88\xE2\x96\x88-transfer.bin");
+
+    // Every width is filled up to the 2 columns of the brackets, the bar goes first when there's no room
+    int wrong = 0;
+    for (int width = 0; width <= 120; width += 1) {
+        int columns = 0;
+        size_t length = term_progress_internal_line(&bar, line, width);
+        for (size_t i = 0; i < length; i += 1) {
+            if (line[i] == '\033') {
+                i += strcspn(line + i, "m");
+            }
+            else {
+                uint32_t codepoint;
+                i += term_frame_internal_decode(line + i, &codepoint) - 1;
+                wrong += codepoint == 0xFFFD;
+                columns += 1;
+            }
+        }
+        wrong += columns > width || columns + 2 < width;
+    }
+    TEST_CHECK(wrong == 0);
+
+    // Narrower than the tail: no wrap on the screen and the label is cut between code points
+    TestScreen screen = {0};
+    size_t length = term_progress_internal_line(&bar, line, TEST_SCREEN_COLS - 1);
+    test_screen_feed(&screen, line, length);
+    TEST_CHECK(screen.row == 0 && screen.col == TEST_SCREEN_COLS - 1 && screen.errors == 0);
+    TEST_CHECK(screen.cells[0][0].codepoint == 0xE9 && screen.cells[0][1].codepoint == 't');
+    TEST_CHECK(screen.cells[0][2].codepoint == 0xE9 && screen.cells[0][3].codepoint == '-');
+    TEST_CHECK(screen.cells[0][4].codepoint == ' ');
+}
+
+static volatile sig_atomic_t test_sigwinch_count;
+
+void test_sigwinch(int signal) {
+    (void)signal;
+    test_sigwinch_count += 1;
+}
+
+void test_dimensions_watch(void) {
+    struct sigaction action = {0}, current;
+    action.sa_handler = test_sigwinch;
+    sigemptyset(&action.sa_mask);
+    TEST_CHECK(sigaction(SIGWINCH, &action, NULL) == 0);
+
+    // Loading the size does not replace the application's handler
+    TerminalDimensions td = term_get_dimensions();
+    TEST_CHECK(td.rows > 0 && td.cols > 0);
+    TEST_CHECK(sigaction(SIGWINCH, NULL, &current) == 0);
+    TEST_CHECK(current.sa_handler == test_sigwinch);
+
+    // Watching installs once and still calls the previous handler
+    term_watch_dimensions();
+    term_watch_dimensions();
+    raise(SIGWINCH);
+    TEST_CHECK(test_sigwinch_count == 1);
+    TerminalDimensions cached = term_get_dimensions();
+    TEST_CHECK(cached.rows == td.rows && cached.cols == td.cols);
+}
+
+#pragma endregion
+
+int main(void) {
+    TEST_RUN(test_string_insert);
+    TEST_RUN(test_slice_search);
+    TEST_RUN(test_json_escape);
+    TEST_RUN(test_json_writer);
+    TEST_RUN(test_json_double_locale);
+    TEST_RUN(test_style_transition);
+    TEST_RUN(test_frame_diff);
+    TEST_RUN(test_progress_line);
+    TEST_RUN(test_dimensions_watch);
+    return test_report();
+}
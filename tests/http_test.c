@@ -0,0 +1,1072 @@
+/**
+ * Tests of the HTTP headers against the loopback server, everything runs on 127.0.0.1.
+ *
+ * Build and run with `make test`, or (POSIX, curl headers from the submodule, linked against the system libcurl):
+ *   gcc -O2 -I clib -I clib/Http -I bench -I tests tests/http_test.c -o http_test -lcurl -lpthread && ./http_test
+ */
+
+#ifndef _STDINT_H
+#include <stdint.h>
+#endif
+
+#include <dirent.h>
+#include <signal.h>
+
+#include "Test.h"
+#include "LoopbackServer.h"
+#include "Batch.h"
+#include "Cache.h"
+#include "Client.h"
+#include "Download.h"
+#include "Event.h"
+#include "Headers.h"
+#include "Metrics.h"
+#include "Pool.h"
+#include "Retry.h"
+#include "Scheduler.h"
+#include "Sink.h"
+#include "Upload.h"
+
+static LoopbackServer test_server;
+
+/**
+ * URL of a path on the loopback server, valid until the next call.
+ */
+const char *test_url(const char *path) {
+    static char url[256];
+    loopback_server_url(&test_server, path, url, sizeof(url));
+    return url;
+}
+
+/**
+ * @return 1 if `data` is the body pattern of the loopback server from body offset `offset`
+ */
+int test_is_pattern(const char *data, size_t length, size_t offset) {
+    for (size_t i = 0; i < length; i += 1) {
+        if (data[i] != (char)('a' + (offset + i) % LOOPBACK_SERVER_PATTERN_PERIOD)) {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+#pragma region Headers
+
+void test_headers_index(void) {
+    HttpHeaders headers;
+    TEST_CHECK(http_headers_init(&headers) == 0);
+    const char *lines[] = {
+        "HTTP/1.1 200 OK\r\n", "Set-Cookie: a=1\r\n", "content-type: text/plain\r\n",
+        "SET-COOKIE: b=2\r\n", "X-Empty:\r\n", "Set-Cookie:   c=3  \r\n", "\r\n",
+    };
+    for (size_t i = 0; i < sizeof(lines) / sizeof(*lines); i += 1) {
+        TEST_CHECK(http_headers_add_line(&headers, lines[i], strlen(lines[i])) == 0);
+    }
+    TEST_CHECK_STRING(http_headers_get(&headers, "Content-Type"), "text/plain");
+    TEST_CHECK(http_headers_count(&headers, "set-cookie") == 3);
+    TEST_CHECK_STRING(http_headers_get_nth(&headers, "Set-Cookie", 0), "a=1");
+    TEST_CHECK_STRING(http_headers_get_nth(&headers, "Set-Cookie", 2), "c=3");
+    TEST_CHECK(http_headers_get_nth(&headers, "Set-Cookie", 3) == NULL);
+    TEST_CHECK_STRING(http_headers_get(&headers, "x-empty"), "");
+    TEST_CHECK(http_headers_get(&headers, "Missing") == NULL);
+
+    size_t iterator = 0, count = 0;
+    HttpHeaderField field;
+    while (http_headers_next(&headers, &iterator, &field)) {
+        count += 1;
+    }
+    TEST_CHECK(count == 5);
+
+    // Enough names to grow the index several times
+    char name[32], value[32];
+    for (int i = 0; i < 1000; i += 1) {
+        int name_length = snprintf(name, sizeof(name), "X-Header-%d", i);
+        int value_length = snprintf(value, sizeof(value), "%d", i * 7);
+        TEST_CHECK(http_headers_add(&headers, name, (size_t)name_length, value, (size_t)value_length) == 0);
+    }
+    TEST_CHECK_STRING(http_headers_get(&headers, "x-header-999"), "6993");
+    TEST_CHECK_STRING(http_headers_get(&headers, "X-HEADER-0"), "0");
+    TEST_CHECK(http_headers_count(&headers, "set-cookie") == 3);
+
+    // A new status line, e.g. after a redirect, starts over
+    http_headers_add_line(&headers, "HTTP/1.1 301 Moved\r\n", 20);
+    TEST_CHECK(http_headers_get(&headers, "Content-Type") == NULL);
+    http_headers_release(&headers);
+}
+
+void test_headers_response(void) {
+    HttpClient client;
+    Buffer body = buffer_make(64);
+    TEST_CHECK(http_client_init(&client, NULL) == CURLE_OK);
+    HttpSink sink = http_sink_buffer(&body);
+    sink.index_headers = 1;
+
+    HttpResponse response = http_client_get_sink(&client, test_url("/?size=100"), &sink);
+    TEST_CHECK(response.error == CURLE_OK && response.code == 200);
+    TEST_CHECK(response.headers != NULL);
+    TEST_CHECK_STRING(http_response_get_header(&response, "content-length"), "100");
+    TEST_CHECK_STRING(http_response_get_header(&response, "Accept-Ranges"), "bytes");
+    TEST_CHECK(http_response_get_header(&response, "Content-Range") == NULL);
+    TEST_CHECK(body.len == 100 && test_is_pattern(body.ptr, body.len, 0));
+    http_client_response_release(&client, &response);
+
+    // The next response of the same sink gets its own store
+    buffer_clear(&body);
+    response = http_client_get_sink(&client, test_url("/chunked?size=10"), &sink);
+    TEST_CHECK(response.error == CURLE_OK && response.headers != NULL);
+    TEST_CHECK_STRING(http_response_get_header(&response, "Transfer-Encoding"), "chunked");
+    TEST_CHECK(http_response_get_header(&response, "Content-Length") == NULL);
+    TEST_CHECK(body.len == 10);
+    http_client_response_release(&client, &response);
+
+    buffer_release(&body);
+    http_client_release(&client);
+}
+
+void test_headers_content_length(void) {
+    static const char max[] = "Content-Length: 9223372036854775807\r\n";
+    static const char overflow[] = "Content-Length: 9223372036854775808\r\n";
+    static const char huge[] = "content-length: 123456789012345678901234567890\r\n";
+    curl_off_t length = -1;
+    TEST_CHECK(http_sink_internal_parse_content_length(max, sizeof(max) - 1, &length) == 1);
+    TEST_CHECK(length == HTTP_SINK_INTERNAL_SIGNED_MAX(curl_off_t));
+
+    // Too large for a curl_off_t is no length at all
+    length = -1;
+    TEST_CHECK(http_sink_internal_parse_content_length(overflow, sizeof(overflow) - 1, &length) == 0);
+    TEST_CHECK(http_sink_internal_parse_content_length(huge, sizeof(huge) - 1, &length) == 0);
+    TEST_CHECK(length == -1);
+}
+
+#pragma endregion
+
+#pragma region Batch
+
+typedef struct TestBatchResults {
+    size_t completed, failed, mismatched;
+} TestBatchResults;
+
+void test_batch_complete(HttpBatchRequest *request, HttpResponse *response, CURLcode error, void *batch_data) {
+    TestBatchResults *results = batch_data;
+    (void)request;
+    results->completed += 1;
+    results->failed += error != CURLE_OK;
+    results->mismatched += response->error != error;
+}
+
+void test_batch_error(void) {
+    HttpClient client;
+    TestBatchResults results = {0};
+    Buffer bodies[2] = {buffer_make(64), buffer_make(64)};
+    HttpBatchRequest requests[2] = {
+        {.url = test_url("/?size=100"), .sink = http_sink_buffer(&bodies[0])},
+        {.url = "http://127.0.0.1:1/", .sink = http_sink_buffer(&bodies[1])}, // Nothing listens on port 1
+    };
+    TEST_CHECK(http_client_init(&client, NULL) == CURLE_OK);
+
+    // The failed transfer has its error in the response too
+    TEST_CHECK(http_batch_run(&client, requests, 2, 0, test_batch_complete, &results) == CURLM_OK);
+    TEST_CHECK(results.completed == 2 && results.failed == 1 && results.mismatched == 0);
+
+    buffer_release(&bodies[0]);
+    buffer_release(&bodies[1]);
+    http_client_release(&client);
+}
+
+#pragma endregion
+
+#pragma region Event
+
+#define TEST_EVENT_REQUESTS 8
+
+typedef struct TestEventResults {
+    size_t completed, failed;
+    long version;
+    long ports[TEST_EVENT_REQUESTS];
+} TestEventResults;
+
+void test_event_complete(HttpBatchRequest *request, HttpResponse *response, CURLcode error, void *batch_data) {
+    TestEventResults *results = batch_data;
+    (void)request;
+    if (error != CURLE_OK || response->code != 200) {
+        results->failed += 1;
+        return;
+    }
+    results->version = response->version;
+    results->ports[results->completed] = response->local_port;
+    results->completed += 1;
+}
+
+/**
+ * @return Number of different local ports, i.e. connections, of the completed requests
+ */
+size_t test_event_connections(const TestEventResults *results) {
+    size_t connections = 0;
+    for (size_t i = 0; i < results->completed; i += 1) {
+        size_t j = 0;
+        while (j < i && results->ports[j] != results->ports[i]) {
+            j += 1;
+        }
+        connections += j == i;
+    }
+    return connections;
+}
+
+void test_event_http2(void) {
+    // Every h2c stream but the upgraded request gets the server's default body and latency,
+    // the latency keeps the streams open long enough to hit the limit
+    LoopbackServer server;
+    LoopbackServerOptions server_options = {.body_size = 1024, .latency_ms = 200};
+    char url[256];
+    TEST_CHECK(loopback_server_start(&server, &server_options) == 0);
+    loopback_server_url(&server, "/", url, sizeof(url));
+
+    // The loop has its own multi handle, it must get the stream limit of the client
+    HttpClientOptions options = {.http2 = HttpHttp2Upgrade, .max_concurrent_streams = 2};
+    HttpClient client;
+    HttpEventLoop loop;
+    TestEventResults results = {0};
+    Buffer bodies[TEST_EVENT_REQUESTS];
+    HttpBatchRequest requests[TEST_EVENT_REQUESTS];
+    TEST_CHECK(http_client_init(&client, &options) == CURLE_OK);
+    TEST_CHECK(http_event_loop_init(&loop, &client, test_event_complete, &results) == CURLE_OK);
+    for (size_t i = 0; i < TEST_EVENT_REQUESTS; i += 1) {
+        bodies[i] = buffer_make(64);
+        requests[i] = (HttpBatchRequest) {.url = url, .sink = http_sink_buffer(&bodies[i])};
+    }
+
+    // One request upgrades the connection, the rest are streams, at most 2 per connection
+    http_event_loop_add(&loop, &requests[0]);
+    TEST_CHECK(http_event_loop_run(&loop) == CURLM_OK);
+    for (size_t i = 1; i < TEST_EVENT_REQUESTS; i += 1) {
+        http_event_loop_add(&loop, &requests[i]);
+    }
+    TEST_CHECK(http_event_loop_run(&loop) == CURLM_OK);
+
+    TEST_CHECK(results.completed == TEST_EVENT_REQUESTS && results.failed == 0);
+    TEST_CHECK(results.version == CURL_HTTP_VERSION_2_0);
+    // Without the limit all 7 streams would share the upgraded connection
+    TEST_CHECK(test_event_connections(&results) > 1);
+    for (size_t i = 0; i < TEST_EVENT_REQUESTS; i += 1) {
+        TEST_CHECK(bodies[i].len == 1024);
+        buffer_release(&bodies[i]);
+    }
+    http_event_loop_release(&loop);
+    http_client_release(&client);
+    loopback_server_stop(&server);
+}
+
+void test_event_release(void) {
+    HttpClient client;
+    HttpEventLoop loop;
+    TestEventResults results = {0};
+    Buffer bodies[TEST_EVENT_REQUESTS];
+    HttpBatchRequest requests[TEST_EVENT_REQUESTS];
+    TEST_CHECK(http_client_init(&client, NULL) == CURLE_OK);
+    TEST_CHECK(http_event_loop_init(&loop, &client, test_event_complete, &results) == CURLE_OK);
+    for (size_t i = 0; i < TEST_EVENT_REQUESTS; i += 1) {
+        bodies[i] = buffer_make(64);
+        requests[i] = (HttpBatchRequest) {.url = test_url(i % 2 ? "/?size=100" : "/?delay=5000"), .sink = http_sink_buffer(&bodies[i])};
+        requests[i].sink.index_headers = 1;
+        TEST_CHECK(http_event_loop_add(&loop, &requests[i]) == 1);
+    }
+    while (results.completed < TEST_EVENT_REQUESTS / 2) {
+        TEST_CHECK(http_event_loop_poll(&loop, 100) == CURLM_OK);
+    }
+    TEST_CHECK(loop.in_flight == TEST_EVENT_REQUESTS / 2);
+
+    // The delayed requests are still running, their handles go back to the client
+    size_t idle = client.idle_len;
+    http_event_loop_release(&loop);
+    TEST_CHECK(client.idle_len == idle + TEST_EVENT_REQUESTS / 2);
+    TEST_CHECK(results.completed == TEST_EVENT_REQUESTS / 2 && results.failed == 0);
+    for (size_t i = 0; i < TEST_EVENT_REQUESTS; i += 1) {
+        TEST_CHECK(requests[i].sink.headers == NULL);
+        buffer_release(&bodies[i]);
+    }
+
+    // The handles are detached, a new request can use them
+    Buffer body = buffer_make(64);
+    HttpResponse response = http_client_get(&client, test_url("/?size=100"), http_sink_buffer_write, &body);
+    TEST_CHECK(response.error == CURLE_OK && body.len == 100);
+    http_client_response_release(&client, &response);
+    buffer_release(&body);
+
+    http_client_release(&client);
+}
+
+#pragma endregion
+
+#pragma region Scheduler
+
+#define TEST_SCHEDULER_REQUESTS 6
+
+typedef struct TestSchedulerResults {
+    size_t completed, failed;
+    int priorities[TEST_SCHEDULER_REQUESTS]; // In completion order
+} TestSchedulerResults;
+
+void test_scheduler_complete(HttpBatchRequest *request, HttpResponse *response, CURLcode error, void *batch_data) {
+    TestSchedulerResults *results = batch_data;
+    if (error != CURLE_OK || response->code != 200) {
+        results->failed += 1;
+    }
+    if (results->completed < TEST_SCHEDULER_REQUESTS) {
+        results->priorities[results->completed] = ((HttpScheduledRequest*)request)->priority;
+    }
+    results->completed += 1;
+}
+
+size_t test_discard(char *chunk, size_t size, size_t count, void *user_data) {
+    (void)chunk;
+    (void)user_data;
+    return size * count;
+}
+
+/**
+ * Submit `count` requests for `url` with the given priorities and run them.
+ * @return Microseconds until all of them completed
+ */
+int64_t test_scheduler_run(HttpScheduler *scheduler, HttpScheduledRequest *requests, const char *url, const int *priorities, size_t count) {
+    for (size_t i = 0; i < count; i += 1) {
+        requests[i] = (HttpScheduledRequest) {.request = {.url = url, .sink = {.body_write_function = test_discard}}, .priority = priorities[i]};
+        TEST_CHECK(http_scheduler_submit(scheduler, &requests[i]) == 0);
+    }
+    int64_t start = http_scheduler_internal_now_us();
+    TEST_CHECK(http_scheduler_run(scheduler) == CURLM_OK);
+    return http_scheduler_internal_now_us() - start;
+}
+
+void test_scheduler_limits(void) {
+    static const int priorities[TEST_SCHEDULER_REQUESTS] = {0, 5, 1, 5, 3, 0};
+    static const int zeros[TEST_SCHEDULER_REQUESTS] = {0};
+    HttpClient client;
+    HttpScheduler scheduler;
+    HttpScheduledRequest requests[TEST_SCHEDULER_REQUESTS];
+    TestSchedulerResults results = {0};
+    char url[256];
+    TEST_CHECK(http_client_init(&client, NULL) == CURLE_OK);
+    http_scheduler_init(&scheduler, &client, NULL, test_scheduler_complete, &results);
+
+    // One at a time, the queued requests start by priority, equal priorities in submit order
+    HttpHostLimits serial = {.max_in_flight = 1};
+    TEST_CHECK(http_scheduler_set_limits(&scheduler, "127.0.0.1", &serial) == 0);
+    loopback_server_url(&test_server, "/?size=10", url, sizeof(url));
+    test_scheduler_run(&scheduler, requests, url, priorities, TEST_SCHEDULER_REQUESTS);
+    TEST_CHECK(results.completed == TEST_SCHEDULER_REQUESTS && results.failed == 0);
+    static const int expected[TEST_SCHEDULER_REQUESTS] = {5, 5, 3, 1, 0, 0};
+    TEST_CHECK(memcmp(results.priorities, expected, sizeof(expected)) == 0);
+
+    // Two in flight at a time: 6 requests of 100 ms take 3 rounds
+    HttpHostLimits pair = {.max_in_flight = 2};
+    TEST_CHECK(http_scheduler_set_limits(&scheduler, "127.0.0.1", &pair) == 0);
+    loopback_server_url(&test_server, "/?size=10&delay=100", url, sizeof(url));
+    results = (TestSchedulerResults) {0};
+    int64_t elapsed = test_scheduler_run(&scheduler, requests, url, zeros, TEST_SCHEDULER_REQUESTS);
+    TEST_CHECK(results.completed == TEST_SCHEDULER_REQUESTS && results.failed == 0);
+    TEST_CHECK(elapsed >= 290000 && elapsed < 2000000);
+
+    // 20 requests per second with a burst of 1: the last of 6 starts after 250 ms
+    HttpHostLimits rate = {.requests_per_second = 20, .burst = 1};
+    TEST_CHECK(http_scheduler_set_limits(&scheduler, "127.0.0.1", &rate) == 0);
+    loopback_server_url(&test_server, "/?size=10", url, sizeof(url));
+    results = (TestSchedulerResults) {0};
+    elapsed = test_scheduler_run(&scheduler, requests, url, zeros, TEST_SCHEDULER_REQUESTS);
+    TEST_CHECK(results.completed == TEST_SCHEDULER_REQUESTS && results.failed == 0);
+    TEST_CHECK(elapsed >= 240000 && elapsed < 2000000);
+
+    HttpSchedulerHost *host = http_scheduler_host(&scheduler, "127.0.0.1");
+    TEST_CHECK(host->started == 3 * TEST_SCHEDULER_REQUESTS && host->completed == host->started);
+
+    // Hosts are limited on their own: one at a time on each of two hosts runs both at once
+    char other_url[256];
+    TEST_CHECK(http_scheduler_set_limits(&scheduler, "127.0.0.1", &serial) == 0);
+    TEST_CHECK(http_scheduler_set_limits(&scheduler, "localhost", &serial) == 0);
+    loopback_server_url(&test_server, "/?size=10&delay=100", url, sizeof(url));
+    snprintf(other_url, sizeof(other_url), "http://localhost:%u/?size=10&delay=100", test_server.port);
+    results = (TestSchedulerResults) {0};
+    for (size_t i = 0; i < TEST_SCHEDULER_REQUESTS; i += 1) {
+        requests[i] = (HttpScheduledRequest) {.request = {.url = i % 2 ? other_url : url, .sink = {.body_write_function = test_discard}}};
+        TEST_CHECK(http_scheduler_submit(&scheduler, &requests[i]) == 0);
+    }
+    int64_t start = http_scheduler_internal_now_us();
+    TEST_CHECK(http_scheduler_run(&scheduler) == CURLM_OK);
+    elapsed = http_scheduler_internal_now_us() - start;
+    TEST_CHECK(results.completed == TEST_SCHEDULER_REQUESTS && results.failed == 0);
+    TEST_CHECK(elapsed >= 290000 && elapsed < 550000);
+    TEST_CHECK(scheduler.hosts_len == 2 && scheduler.ready.len == 0 && scheduler.waiting.len == 0);
+
+    http_scheduler_release(&scheduler);
+    http_client_release(&client);
+}
+
+#pragma endregion
+
+#pragma region Stream
+
+/**
+ * A consumer that stops taking data every 256 KiB until another thread resumes the transfer.
+ */
+typedef struct TestStream {
+    HttpSink *sink;
+    size_t received;
+    size_t pauses;
+    size_t paused_at;         // `received` at the last pause, the same chunk comes again after the resume
+    int broken;               // The body did not match the pattern
+    atomic_int pause_pending; // Set by the stream function, cleared by the resuming thread
+    pthread_t thread;
+    atomic_int stop;
+} TestStream;
+
+HttpStreamResult test_stream_function(const char *chunk, size_t length, void *user_data) {
+    TestStream *test = user_data;
+    if (test->received / (256 << 10) != (test->received + length) / (256 << 10) && test->received != test->paused_at && test->pauses < 4) {
+        test->pauses += 1;
+        test->paused_at = test->received;
+        atomic_store(&test->pause_pending, 1);
+        return HTTP_STREAM_PAUSE;
+    }
+    test->broken |= !test_is_pattern(chunk, length, test->received);
+    test->received += length;
+    return HTTP_STREAM_CONTINUE;
+}
+
+void *test_stream_resumer(void *argument) {
+    TestStream *test = argument;
+    while (!atomic_load(&test->stop)) {
+        if (atomic_exchange(&test->pause_pending, 0)) {
+            usleep(20000);
+            http_stream_sink_resume(test->sink);
+        }
+        usleep(1000);
+    }
+    return NULL;
+}
+
+void test_stream_start(TestStream *test, HttpStreamSink *stream, HttpSink *sink) {
+    *test = (TestStream) {.sink = sink, .paused_at = SIZE_MAX};
+    *stream = (HttpStreamSink) {.stream_function = test_stream_function, .user_data = test};
+    *sink = http_sink_stream(stream);
+    pthread_create(&test->thread, NULL, test_stream_resumer, test);
+}
+
+void test_stream_stop(TestStream *test) {
+    atomic_store(&test->stop, 1);
+    pthread_join(test->thread, NULL);
+}
+
+void test_stream_batch_complete(HttpBatchRequest *request, HttpResponse *response, CURLcode error, void *batch_data) {
+    (void)request;
+    *(long*)batch_data = error == CURLE_OK ? response->code : -1;
+}
+
+void test_stream_pause(void) {
+    HttpClient client;
+    TestStream test;
+    HttpStreamSink stream;
+    HttpSink sink;
+    TEST_CHECK(http_client_init(&client, NULL) == CURLE_OK);
+
+    // Paused and resumed from another thread, the driving thread waits in `curl_multi_poll`
+    test_stream_start(&test, &stream, &sink);
+    HttpResponse response = http_client_get_sink(&client, test_url("/?size=2000000"), &sink);
+    test_stream_stop(&test);
+    TEST_CHECK(response.error == CURLE_OK && response.code == 200);
+    TEST_CHECK(test.received == 2000000 && test.pauses == 4 && !test.broken);
+    TEST_CHECK(response.body_bytes == 2000000);
+    http_client_response_release(&client, &response);
+
+    // The same in a batch, the paused transfer is the only one
+    HttpBatchRequest request = {.url = test_url("/?size=2000000")};
+    long code = 0;
+    test_stream_start(&test, &stream, &request.sink);
+    TEST_CHECK(http_batch_run(&client, &request, 1, 0, test_stream_batch_complete, &code) == CURLM_OK);
+    test_stream_stop(&test);
+    TEST_CHECK(code == 200);
+    TEST_CHECK(test.received == 2000000 && test.pauses == 4 && !test.broken);
+
+    // Without a multi handle to wake up, the next progress tick resumes it
+    test_stream_start(&test, &stream, &sink);
+    response = http_request_get_sink(test_url("/?size=1000000"), &sink);
+    test_stream_stop(&test);
+    TEST_CHECK(response.error == CURLE_OK && test.received == 1000000 && test.pauses == 3 && !test.broken);
+    http_response_release(&response);
+
+    // And in the event loop
+    HttpEventLoop loop;
+    request.url = test_url("/?size=2000000");
+    code = 0;
+    TEST_CHECK(http_event_loop_init(&loop, &client, test_stream_batch_complete, &code) == CURLE_OK);
+    test_stream_start(&test, &stream, &request.sink);
+    http_event_loop_add(&loop, &request);
+    TEST_CHECK(http_event_loop_run(&loop) == CURLM_OK);
+    test_stream_stop(&test);
+    TEST_CHECK(code == 200);
+    TEST_CHECK(test.received == 2000000 && test.pauses == 4 && !test.broken);
+    http_event_loop_release(&loop);
+
+    http_client_release(&client);
+}
+
+#pragma endregion
+
+#pragma region Cache
+
+/**
+ * Get a 1000 byte body through the cache and check it.
+ */
+HttpResponse test_cache_get(HttpCache *cache, HttpClient *client, const char *target, int index_headers) {
+    Buffer body = buffer_make(64);
+    HttpSink sink = http_sink_buffer(&body);
+    sink.index_headers = index_headers;
+    HttpResponse response = http_cache_get(cache, client, test_url(target), &sink);
+    TEST_CHECK(response.error == CURLE_OK && response.code == 200);
+    TEST_CHECK(body.len == 1000 && test_is_pattern(body.ptr, body.len, 0));
+    buffer_release(&body);
+    return response;
+}
+
+/**
+ * @return The `X-Request` header of a response as a number, 0 if it is missing
+ */
+unsigned long test_cache_request_number(HttpResponse *response) {
+    return strtoul(http_response_get_header_default(response, "X-Request", "0"), NULL, 10);
+}
+
+/**
+ * Remove a cache directory and the files in it.
+ */
+void test_cache_remove_directory(const char *directory) {
+    DIR *entries = opendir(directory);
+    struct dirent *entry;
+    char path[4096];
+    while (entries != NULL && (entry = readdir(entries)) != NULL) {
+        if (entry->d_name[0] != '.') {
+            snprintf(path, sizeof(path), "%s/%s", directory, entry->d_name);
+            unlink(path);
+        }
+    }
+    if (entries != NULL) {
+        closedir(entries);
+    }
+    TEST_CHECK(rmdir(directory) == 0);
+}
+
+void test_cache_headers(void) {
+    HttpClient client;
+    HttpCache cache;
+    char directory[] = "/tmp/http_test_XXXXXX";
+    TEST_CHECK(mkdtemp(directory) != NULL);
+    TEST_CHECK(http_client_init(&client, NULL) == CURLE_OK);
+    TEST_CHECK(http_cache_init(&cache, directory, 1 << 20) == 0);
+
+    // A fresh hit is served without a request and with the headers of the stored response
+    const char *fresh = "/?size=1000&etag=7&max_age=60";
+    HttpResponse response = test_cache_get(&cache, &client, fresh, 0);
+    unsigned long stored_number = test_cache_request_number(&response);
+    TEST_CHECK(cache.misses == 1 && stored_number > 0);
+    http_client_response_release(&client, &response);
+    size_t requests = atomic_load(&test_server.requests);
+    response = test_cache_get(&cache, &client, fresh, 0);
+    TEST_CHECK(cache.hits == 1 && atomic_load(&test_server.requests) == requests);
+    TEST_CHECK(response.curl_handle == NULL && response.headers != NULL);
+    TEST_CHECK_STRING(http_response_get_header(&response, "etag"), "\"7\"");
+    TEST_CHECK_STRING(http_response_get_header(&response, "Content-Type"), "application/octet-stream");
+    TEST_CHECK_STRING(http_response_get_header(&response, "Cache-Control"), "max-age=60");
+    TEST_CHECK_STRING(http_response_get_header(&response, "Content-Length"), "1000");
+    TEST_CHECK(test_cache_request_number(&response) == stored_number);
+    http_client_response_release(&client, &response);
+
+    // A 304 serves the stored headers, updated by the ones it carries
+    const char *stale = "/?size=1000&etag=8&max_age=0";
+    response = test_cache_get(&cache, &client, stale, 0);
+    stored_number = test_cache_request_number(&response);
+    http_client_response_release(&client, &response);
+    for (int index_headers = 1; index_headers >= 0; index_headers -= 1) {
+        response = test_cache_get(&cache, &client, stale, index_headers);
+        TEST_CHECK(cache.revalidations == (size_t)(2 - index_headers) && response.headers != NULL);
+        TEST_CHECK_STRING(http_response_get_header(&response, "Content-Type"), "application/octet-stream");
+        TEST_CHECK_STRING(http_response_get_header(&response, "Content-Length"), "1000");
+        TEST_CHECK_STRING(http_response_get_header(&response, "ETag"), "\"8\"");
+        TEST_CHECK(http_headers_count(response.headers, "X-Request") == 1);
+        TEST_CHECK(test_cache_request_number(&response) > stored_number);
+        stored_number = test_cache_request_number(&response);
+        http_client_response_release(&client, &response);
+    }
+
+    // The headers are kept on disk with the bodies
+    http_cache_release(&cache);
+    TEST_CHECK(http_cache_init(&cache, directory, 1 << 20) == 0);
+    response = test_cache_get(&cache, &client, fresh, 0);
+    TEST_CHECK(cache.hits == 1 && response.headers != NULL);
+    TEST_CHECK_STRING(http_response_get_header(&response, "ETag"), "\"7\"");
+    http_client_response_release(&client, &response);
+    http_cache_release(&cache);
+
+    test_cache_remove_directory(directory);
+    http_client_release(&client);
+}
+
+void test_cache_lru(void) {
+    HttpClient client;
+    HttpCache cache;
+    HttpResponse response;
+    char directory[] = "/tmp/http_test_XXXXXX", target[64];
+    TEST_CHECK(mkdtemp(directory) != NULL);
+    TEST_CHECK(http_client_init(&client, NULL) == CURLE_OK);
+    TEST_CHECK(http_cache_init(&cache, directory, 10 * 1000) == 0);
+
+    // Only the 10 most recently stored bodies fit, the index keeps finding them while others come and go
+    for (int i = 0; i < 100; i += 1) {
+        snprintf(target, sizeof(target), "/?size=1000&max_age=60&n=%d", i);
+        response = test_cache_get(&cache, &client, target, 0);
+        http_client_response_release(&client, &response);
+    }
+    TEST_CHECK(cache.len == 10 && cache.size == 10 * 1000 && cache.evictions == 90);
+    size_t requests = atomic_load(&test_server.requests);
+    for (int i = 90; i < 100; i += 1) {
+        snprintf(target, sizeof(target), "/?size=1000&max_age=60&n=%d", i);
+        response = test_cache_get(&cache, &client, target, 0);
+        http_client_response_release(&client, &response);
+    }
+    TEST_CHECK(cache.hits == 10 && atomic_load(&test_server.requests) == requests);
+
+    // A hit makes an entry the most recently used one, also across a reload of the index
+    response = test_cache_get(&cache, &client, "/?size=1000&max_age=60&n=90", 0);
+    http_client_response_release(&client, &response);
+    http_cache_release(&cache);
+    TEST_CHECK(http_cache_init(&cache, directory, 10 * 1000) == 0);
+    TEST_CHECK(cache.len == 10);
+    response = test_cache_get(&cache, &client, "/?size=1000&max_age=60&n=100", 0);
+    http_client_response_release(&client, &response);
+    TEST_CHECK(cache.evictions == 1);
+    response = test_cache_get(&cache, &client, "/?size=1000&max_age=60&n=90", 0);
+    http_client_response_release(&client, &response);
+    TEST_CHECK(cache.hits == 1);
+    response = test_cache_get(&cache, &client, "/?size=1000&max_age=60&n=91", 0);
+    http_client_response_release(&client, &response);
+    TEST_CHECK(cache.hits == 1 && cache.misses == 2);
+    http_cache_release(&cache);
+
+    test_cache_remove_directory(directory);
+    http_client_release(&client);
+}
+
+void test_cache_variants(void) {
+    HttpClient client;
+    HttpCache cache;
+    HttpClientOptions options = {.accept_encoding = 1};
+    char directory[] = "/tmp/http_test_XXXXXX";
+    TEST_CHECK(mkdtemp(directory) != NULL);
+    TEST_CHECK(http_client_init(&client, &options) == CURLE_OK);
+    TEST_CHECK(http_cache_init(&cache, directory, 1 << 20) == 0);
+
+    // A decoded body is stored with headers that describe it, not the encoded transfer
+    const char *encoded = "/?size=1000&max_age=60&deflate=1";
+    HttpResponse response = test_cache_get(&cache, &client, encoded, 0);
+    TEST_CHECK_STRING(http_response_get_header(&response, "Content-Encoding"), "deflate");
+    http_client_response_release(&client, &response);
+    response = test_cache_get(&cache, &client, encoded, 0);
+    TEST_CHECK(cache.hits == 1 && response.headers != NULL);
+    TEST_CHECK(http_response_get_header(&response, "Content-Encoding") == NULL);
+    TEST_CHECK_STRING(http_response_get_header(&response, "Content-Length"), "1000");
+    TEST_CHECK_STRING(http_response_get_header(&response, "Vary"), "Accept-Encoding");
+    http_client_response_release(&client, &response);
+
+    // A response that varies on other request headers is never served from the cache
+    const char *varying = "/?size=1000&max_age=60&vary=1";
+    for (int i = 0; i < 2; i += 1) {
+        response = test_cache_get(&cache, &client, varying, 0);
+        http_client_response_release(&client, &response);
+    }
+    TEST_CHECK(cache.hits == 1 && cache.misses == 3 && cache.len == 1);
+    http_cache_release(&cache);
+
+    test_cache_remove_directory(directory);
+    http_client_release(&client);
+}
+
+#pragma endregion
+
+#pragma region Download
+
+/**
+ * @return 1 if the file holds exactly `size` bytes of the body pattern
+ */
+int test_file_is_pattern(const char *path, size_t size) {
+    FILE *file = fopen(path, "rb");
+    char chunk[65536];
+    size_t offset = 0, n;
+    int matches = file != NULL;
+    while (matches && (n = fread(chunk, 1, sizeof(chunk), file)) > 0) {
+        matches = offset + n <= size && test_is_pattern(chunk, n, offset);
+        offset += n;
+    }
+    if (file != NULL) {
+        fclose(file);
+    }
+    return matches && offset == size;
+}
+
+/**
+ * Download a 3 MB file in 4 segments.
+ * @param requests Output, number of requests the server received for it
+ */
+CURLcode test_download(HttpClient *client, const char *path, const char *target, size_t *requests) {
+    HttpDownloadOptions options = {.segments = 4, .min_segment_size = 256 << 10};
+    size_t before = atomic_load(&test_server.requests);
+    CURLcode code = http_download_file(client, test_url(target), path, &options);
+    *requests = atomic_load(&test_server.requests) - before;
+    return code;
+}
+
+void test_download_file(void) {
+    HttpClient client;
+    char path[] = "/tmp/http_test_XXXXXX";
+    int fd = mkstemp(path);
+    size_t requests;
+    TEST_CHECK(fd >= 0 && close(fd) == 0);
+    TEST_CHECK(http_client_init(&client, NULL) == CURLE_OK);
+
+    // The probe, then one request per segment
+    TEST_CHECK(test_download(&client, path, "/?size=3000000", &requests) == CURLE_OK);
+    TEST_CHECK(requests == 5);
+    TEST_CHECK(test_file_is_pattern(path, 3000000));
+
+    // The second segment loses its connection at 1 MB and is resumed from there
+    TEST_CHECK(test_download(&client, path, "/?size=3000000&drop=1000000", &requests) == CURLE_OK);
+    TEST_CHECK(requests == 6);
+    TEST_CHECK(test_file_is_pattern(path, 3000000));
+
+    // Ranges are advertised but answered with 200, the segments give up and a single stream fetches the file
+    TEST_CHECK(test_download(&client, path, "/?size=3000000&norange=1", &requests) == CURLE_OK);
+    TEST_CHECK(requests == 6);
+    TEST_CHECK(test_file_is_pattern(path, 3000000));
+
+    http_client_release(&client);
+    unlink(path);
+}
+
+#pragma endregion
+
+#pragma region Metrics
+
+void test_metrics_connections(void) {
+    HttpHostMetrics *host_metrics = calloc(1, sizeof(*host_metrics));
+    TEST_CHECK(host_metrics != NULL);
+    if (host_metrics == NULL) {
+        return;
+    }
+    HttpResponse response = {.version = CURL_HTTP_VERSION_1_1};
+
+    // Far more connections than the ring holds, the table stays bounded
+    for (long port = 0; port < 10 * HTTP_METRICS_CONNECTIONS; port += 1) {
+        response.local_port = 40000 + port % 1000;
+        response.connection_reused = 0;
+        http_metrics_internal_connection(host_metrics, &response);
+        response.connection_reused = 1;
+        http_metrics_internal_connection(host_metrics, &response);
+    }
+    TEST_CHECK(host_metrics->connections_len == HTTP_METRICS_CONNECTIONS);
+    TEST_CHECK(host_metrics->opened == 10 * HTTP_METRICS_CONNECTIONS);
+    TEST_CHECK(http_metrics_streams_per_connection(host_metrics) == 2);
+
+    // A port used again by a new connection counts on the new one
+    response.local_port = 50000;
+    response.connection_reused = 0;
+    http_metrics_internal_connection(host_metrics, &response);
+    size_t older = (host_metrics->connections_next + HTTP_METRICS_CONNECTIONS - 1) % HTTP_METRICS_CONNECTIONS;
+    http_metrics_internal_connection(host_metrics, &response);
+    size_t newer = (host_metrics->connections_next + HTTP_METRICS_CONNECTIONS - 1) % HTTP_METRICS_CONNECTIONS;
+    response.connection_reused = 1;
+    http_metrics_internal_connection(host_metrics, &response);
+    TEST_CHECK(host_metrics->connections[older].streams == 1 && host_metrics->connections[newer].streams == 2);
+
+    free(host_metrics);
+}
+
+#pragma endregion
+
+#pragma region Retry
+
+void test_retry_reset(void) {
+    HttpClient client;
+    HttpRetryPolicy policy = {.base_delay_ms = 1, .max_delay_ms = 5};
+    Buffer body = buffer_make(64);
+    HttpSink sink = http_sink_buffer(&body);
+    TEST_CHECK(http_client_init(&client, NULL) == CURLE_OK);
+
+    // The bodies of the two 503s are dropped, what the buffer held before stays
+    buffer_write_byte(&body, '>');
+    HttpResponse response = http_client_get_retry(&client, test_url("/?size=1000&fail=2&id=1"), &sink, &policy);
+    TEST_CHECK(response.error == CURLE_OK && response.code == 200);
+    TEST_CHECK(body.len == 1001 && body.ptr[0] == '>' && test_is_pattern(body.ptr + 1, 1000, 0));
+    http_client_response_release(&client, &response);
+
+    // The same into a file, with a batch smaller than the body so it is written right away
+    char path[] = "/tmp/http_test_XXXXXX";
+    int fd = mkstemp(path);
+    HttpFileSink file;
+    TEST_CHECK(fd >= 0 && http_file_sink_init(&file, fd, 256, 0) == 0);
+    sink = http_sink_file(&file);
+    response = http_client_get_retry(&client, test_url("/?size=1000&fail=1&id=2"), &sink, &policy);
+    TEST_CHECK(response.error == CURLE_OK && response.code == 200);
+    http_client_response_release(&client, &response);
+    TEST_CHECK(http_file_sink_release(&file) == 0 && close(fd) == 0);
+    TEST_CHECK(test_file_is_pattern(path, 1000));
+    unlink(path);
+
+    // What went into a pipe can't be taken back, the 503 is returned without a retry
+    int pipe_fds[2];
+    TEST_CHECK(pipe(pipe_fds) == 0 && http_file_sink_init(&file, pipe_fds[1], 256, 0) == 0);
+    sink = http_sink_file(&file);
+    size_t requests = atomic_load(&test_server.requests);
+    response = http_client_get_retry(&client, test_url("/?size=1000&fail=1&id=3"), &sink, &policy);
+    TEST_CHECK(response.error == CURLE_OK && response.code == 503);
+    TEST_CHECK(atomic_load(&test_server.requests) == requests + 1);
+    http_client_response_release(&client, &response);
+    http_file_sink_release(&file);
+    close(pipe_fds[0]);
+    close(pipe_fds[1]);
+
+    buffer_release(&body);
+    http_client_release(&client);
+}
+
+void test_hedge_status(void) {
+    HttpClient client;
+    HttpHedgePolicy policy = {.delay_ms = 5000};
+    Buffer body = buffer_make(64);
+    HttpSink sink = http_sink_buffer(&body);
+    TEST_CHECK(http_client_init(&client, NULL) == CURLE_OK);
+
+    // A 503 does not win the race, the duplicate goes out right away instead of after the delay
+    size_t requests = atomic_load(&test_server.requests);
+    int64_t start = http_retry_internal_now_us();
+    HttpResponse response = http_client_get_hedged(&client, test_url("/?size=1000&fail=1&id=4"), &sink, &policy);
+    TEST_CHECK(response.error == CURLE_OK && response.code == 200);
+    TEST_CHECK(body.len == 1000 && test_is_pattern(body.ptr, body.len, 0));
+    TEST_CHECK(atomic_load(&test_server.requests) == requests + 2);
+    TEST_CHECK(http_retry_internal_now_us() - start < 2000000);
+    http_client_response_release(&client, &response);
+
+    // With both attempts answering 503, the second one is passed on
+    buffer_clear(&body);
+    response = http_client_get_hedged(&client, test_url("/?size=1000&fail=2&id=5"), &sink, &policy);
+    TEST_CHECK(response.error == CURLE_OK && response.code == 503);
+    TEST_CHECK(body.len == 1000 && test_is_pattern(body.ptr, body.len, 0));
+    http_client_response_release(&client, &response);
+
+    buffer_release(&body);
+    http_client_release(&client);
+}
+
+void test_hedge_fast_host(void) {
+    HttpClient client;
+    HttpHistogram latency = {0};
+    HttpHedgePolicy policy = {.latency = &latency};
+    Buffer body = buffer_make(64);
+    HttpSink sink = http_sink_buffer(&body);
+    TEST_CHECK(http_client_init(&client, NULL) == CURLE_OK);
+
+    // Sub-millisecond latencies still give a delay, the first attempt is not sent twice right away
+    for (int i = 0; i < HTTP_HEDGE_MIN_SAMPLES; i += 1) {
+        http_histogram_record(&latency, 200);
+    }
+    TEST_CHECK(http_hedge_delay_ms(&policy) == 1);
+
+    // The connection is warm after the first request, then a small response takes well under a millisecond
+    int single = 0;
+    for (int i = 0; i < 5; i += 1) {
+        buffer_clear(&body);
+        size_t requests = atomic_load(&test_server.requests);
+        HttpResponse response = http_client_get_hedged(&client, test_url("/?size=100"), &sink, &policy);
+        TEST_CHECK(response.error == CURLE_OK && response.code == 200 && body.len == 100);
+        single += atomic_load(&test_server.requests) == requests + 1;
+        http_client_response_release(&client, &response);
+    }
+    TEST_CHECK(single > 0);
+
+    buffer_release(&body);
+    http_client_release(&client);
+}
+
+#pragma endregion
+
+#pragma region Pool
+
+#define TEST_POOL_WORKERS 4
+#define TEST_POOL_JOBS 16
+#define TEST_POOL_CHILDREN 6
+
+typedef struct TestPoolJob {
+    HttpPool *pool;
+    HttpJob job;
+    Buffer body;
+    size_t worker;                // Index of the worker that ran the callback
+    struct TestPoolJob *children; // Submitted from the callback, `NULL` for none
+    int submit_failed;
+} TestPoolJob;
+
+void test_pool_complete(HttpJob *job, HttpResponse *response, void *user_data) {
+    TestPoolJob *test = user_data;
+    (void)job;
+    (void)response;
+    test->worker = http_pool_internal_current->index;
+    if (test->children != NULL) {
+        for (size_t i = 0; i < TEST_POOL_CHILDREN; i += 1) {
+            test->submit_failed |= http_pool_submit(test->pool, &test->children[i].job);
+        }
+        // The children are in this worker's queue, keep it busy so the other workers steal them
+        usleep(200000);
+    }
+}
+
+void test_pool_job_init(TestPoolJob *test, HttpPool *pool, const char *url) {
+    *test = (TestPoolJob) {.pool = pool, .body = buffer_make(64)};
+    test->job = (HttpJob) {.url = url, .sink = http_sink_buffer(&test->body), .on_complete = test_pool_complete, .user_data = test};
+}
+
+void test_pool_steal(void) {
+    HttpPool pool;
+    TestPoolJob jobs[TEST_POOL_JOBS], children[TEST_POOL_CHILDREN];
+    char url[256], delayed_url[256];
+    loopback_server_url(&test_server, "/?size=100", url, sizeof(url));
+    loopback_server_url(&test_server, "/?size=100&delay=20", delayed_url, sizeof(delayed_url));
+    TEST_CHECK(http_pool_init(&pool, TEST_POOL_WORKERS, NULL) == CURLE_OK);
+    for (size_t i = 0; i < TEST_POOL_CHILDREN; i += 1) {
+        test_pool_job_init(&children[i], &pool, url);
+    }
+    for (size_t i = 0; i < TEST_POOL_JOBS; i += 1) {
+        test_pool_job_init(&jobs[i], &pool, i % 2 ? delayed_url : url);
+    }
+    jobs[0].children = children;
+    for (size_t i = 0; i < TEST_POOL_JOBS; i += 1) {
+        TEST_CHECK(http_pool_submit(&pool, &jobs[i].job) == 0);
+    }
+
+    // Waiting for one job returns once its callback, including the submits, is done
+    HttpResponse *response = http_job_wait(&pool, &jobs[0].job);
+    TEST_CHECK(response->error == CURLE_OK && response->code == 200);
+    TEST_CHECK(jobs[0].submit_failed == 0);
+
+    // Waiting for the pool includes the jobs submitted by the callback
+    http_pool_wait(&pool);
+    int stolen = 0;
+    for (size_t i = 0; i < TEST_POOL_JOBS + TEST_POOL_CHILDREN; i += 1) {
+        TestPoolJob *test = i < TEST_POOL_JOBS ? &jobs[i] : &children[i - TEST_POOL_JOBS];
+        TEST_CHECK(test->job.done && test->job.response.error == CURLE_OK && test->job.response.code == 200);
+        TEST_CHECK(test->body.len == 100 && test_is_pattern(test->body.ptr, test->body.len, 0));
+        stolen += i >= TEST_POOL_JOBS && test->worker != jobs[0].worker;
+        http_job_release(&test->job);
+        buffer_release(&test->body);
+    }
+    TEST_CHECK(stolen > 0);
+
+    http_pool_release(&pool);
+}
+
+#pragma endregion
+
+#pragma region Upload
+
+/**
+ * Write `size` bytes of the body pattern to a file descriptor.
+ * @return 1 on success, else 0
+ */
+int test_write_pattern(int fd, size_t size) {
+    char chunk[26 * 1024];
+    for (size_t i = 0; i < sizeof(chunk); i += 1) {
+        chunk[i] = (char)('a' + i % LOOPBACK_SERVER_PATTERN_PERIOD);
+    }
+    for (size_t offset = 0; offset < size;) {
+        size_t n = size - offset < sizeof(chunk) ? size - offset : sizeof(chunk);
+        ssize_t written = write(fd, chunk, n);
+        if (written <= 0) {
+            return 0;
+        }
+        offset += (size_t)written;
+    }
+    return 1;
+}
+
+/**
+ * Feeds 300000 bytes of the pattern into the write end of a pipe, then closes it.
+ */
+void *test_upload_writer(void *argument) {
+    int fd = *(int*)argument;
+    test_write_pattern(fd, 300000);
+    close(fd);
+    return NULL;
+}
+
+void test_upload_file(void) {
+    HttpClient client;
+    Buffer body = buffer_make(64);
+    HttpSink sink = http_sink_buffer(&body);
+    TEST_CHECK(http_client_init(&client, NULL) == CURLE_OK);
+
+    // A regular file is sent with its size, from its current position
+    char path[] = "/tmp/http_test_XXXXXX";
+    int fd = mkstemp(path);
+    TEST_CHECK(fd >= 0 && test_write_pattern(fd, 200000) && lseek(fd, 1000, SEEK_SET) == 1000);
+    HttpBody upload = http_body_file(fd);
+    TEST_CHECK(upload.seekable && upload.length == 199000);
+    HttpResponse response = http_client_post(&client, test_url("/echo"), &upload, &sink);
+    TEST_CHECK(response.error == CURLE_OK && response.code == 200);
+    TEST_CHECK(body.len == 199000 && test_is_pattern(body.ptr, body.len, 1000));
+    http_client_response_release(&client, &response);
+    http_body_release(&upload);
+    close(fd);
+    unlink(path);
+
+    // A pipe is read as the data comes in and sent chunked
+    int pipe_fds[2];
+    pthread_t writer;
+    TEST_CHECK(pipe(pipe_fds) == 0 && pthread_create(&writer, NULL, test_upload_writer, &pipe_fds[1]) == 0);
+    upload = http_body_file(pipe_fds[0]);
+    TEST_CHECK(!upload.seekable && upload.length == -1);
+    buffer_clear(&body);
+    response = http_client_post(&client, test_url("/echo"), &upload, &sink);
+    close(pipe_fds[0]); // A writer left behind by a failed upload gets EPIPE
+    pthread_join(writer, NULL);
+    TEST_CHECK(response.error == CURLE_OK && response.code == 200);
+    TEST_CHECK(body.len == 300000 && test_is_pattern(body.ptr, body.len, 0));
+    http_client_response_release(&client, &response);
+    http_body_release(&upload);
+
+    buffer_release(&body);
+    http_client_release(&client);
+}
+
+#pragma endregion
+
+int main(void) {
+    LoopbackServerOptions options = {.body_size = 1024};
+    signal(SIGPIPE, SIG_IGN); // Failed writes to closed pipes and sockets are checked instead
+    if (loopback_server_start(&test_server, &options) != 0) {
+        fprintf(stderr, "could not start the loopback server\n");
+        return 1;
+    }
+    TEST_RUN(test_headers_index);
+    TEST_RUN(test_headers_response);
+    TEST_RUN(test_headers_content_length);
+    TEST_RUN(test_batch_error);
+    TEST_RUN(test_event_http2);
+    TEST_RUN(test_event_release);
+    TEST_RUN(test_scheduler_limits);
+    TEST_RUN(test_stream_pause);
+    TEST_RUN(test_cache_headers);
+    TEST_RUN(test_cache_lru);
+    TEST_RUN(test_cache_variants);
+    TEST_RUN(test_download_file);
+    TEST_RUN(test_metrics_connections);
+    TEST_RUN(test_retry_reset);
+    TEST_RUN(test_hedge_status);
+    TEST_RUN(test_hedge_fast_host);
+    TEST_RUN(test_pool_steal);
+    TEST_RUN(test_upload_file);
+    loopback_server_stop(&test_server);
+    http_global_cleanup();
+    return test_report();
+}